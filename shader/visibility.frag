@@ -0,0 +1,86 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Writes the primitive hit by the primary ray of the pixel, with its distance as depth,
+// see `src/app/visibility.h`.
+
+const int WIDTH = 800;
+const int HEIGHT = 600;
+
+layout(push_constant) uniform Constants {
+    vec4 camera_position;
+    vec4 camera_forward;
+    vec4 camera_right;
+    vec4 camera_down;
+    uint sphere_count;
+};
+
+layout(location = 0) flat in uint in_primitive;
+layout(location = 1) flat in vec4 in_bounds;
+layout(location = 2) flat in vec4 in_row0;
+layout(location = 3) flat in vec4 in_row1;
+layout(location = 4) flat in vec4 in_row2;
+
+layout(location = 0) out uint out_primitive;
+
+struct Ray {
+    vec3 start;
+    vec3 dir;
+};
+
+// The ray and the intersection tests are the same as in `shader/main.comp`,
+// so the tracer finds the same hit when it reconstructs it.
+
+Ray screen_ray(uvec2 pixel) {
+    float u = -1.0 + float(pixel.x) / float(WIDTH) * 2.0;
+    float v = -1.0 + float(pixel.y) / float(HEIGHT) * 2.0;
+
+    vec3 dir = normalize(camera_forward.xyz + u * camera_right.xyz + v * camera_down.xyz);
+
+    return Ray(camera_position.xyz, dir);
+}
+
+bool sphere_intersect(vec4 sphere, Ray ray, out float dist) {
+    vec3 to_start = ray.start - sphere.xyz;
+    float b = dot(to_start, ray.dir);
+    float c = dot(to_start, to_start) - sphere.w * sphere.w;
+    float disc = b * b - c;
+
+    if (disc < 0.0) { return false; }
+
+    float sqrt_disc = sqrt(disc);
+    dist = (-b - sqrt_disc >= 0.0) ? -b - sqrt_disc : -b + sqrt_disc;
+    return dist >= 0.0;
+}
+
+bool ellipsoid_intersect(vec4 row0, vec4 row1, vec4 row2, Ray ray, out float dist) {
+    vec3 start = vec3(dot(row0.xyz, ray.start), dot(row1.xyz, ray.start), dot(row2.xyz, ray.start))
+        + vec3(row0.w, row1.w, row2.w);
+    vec3 dir = vec3(dot(row0.xyz, ray.dir), dot(row1.xyz, ray.dir), dot(row2.xyz, ray.dir));
+
+    float a = dot(dir, dir);
+    float b = dot(start, dir);
+    float c = dot(start, start) - 1.0;
+    float disc = b * b - a * c;
+
+    if (disc < 0.0) { return false; }
+
+    float sqrt_disc = sqrt(disc);
+    dist = ((-b - sqrt_disc >= 0.0) ? -b - sqrt_disc : -b + sqrt_disc) / a;
+    return dist >= 0.0;
+}
+
+void main() {
+    Ray ray = screen_ray(uvec2(gl_FragCoord.xy));
+    float dist;
+
+    bool hit = in_primitive < sphere_count
+        ? sphere_intersect(in_bounds, ray, dist)
+        : ellipsoid_intersect(in_row0, in_row1, in_row2, ray, dist);
+
+    if (!hit) { discard; }
+
+    // Any increasing function of the distance will do for the depth test.
+    gl_FragDepth = dist / (dist + 1.0);
+    out_primitive = in_primitive;
+}
@@ -0,0 +1,75 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Draws a screen space quad around every primitive, see `src/app/visibility.h`.
+// The fragment shader intersects the primary ray of each pixel with the primitive.
+
+const int WIDTH = 800;
+const int HEIGHT = 600;
+
+/// The camera, laid out as `Camera` in `shader/main.comp`, and the number of spheres.
+layout(push_constant) uniform Constants {
+    vec4 camera_position;
+    vec4 camera_forward;
+    vec4 camera_right;
+    vec4 camera_down;
+    uint sphere_count;
+};
+
+/// Bounding sphere of the primitive, and the rows of its world to local transform if it's an ellipsoid.
+layout(location = 0) in vec4 in_bounds;
+layout(location = 1) in vec4 in_row0;
+layout(location = 2) in vec4 in_row1;
+layout(location = 3) in vec4 in_row2;
+
+layout(location = 0) flat out uint out_primitive;
+layout(location = 1) flat out vec4 out_bounds;
+layout(location = 2) flat out vec4 out_row0;
+layout(location = 3) flat out vec4 out_row1;
+layout(location = 4) flat out vec4 out_row2;
+
+/// Same as in `shader/main.comp`.
+vec2 projected_extent(float x, float z, float r) {
+    float tangent = r * sqrt(x * x + z * z - r * r);
+    return vec2(x * z - tangent, x * z + tangent) / (z * z - r * r);
+}
+
+void main() {
+    out_primitive = uint(gl_InstanceIndex);
+    out_bounds = in_bounds;
+    out_row0 = in_row0;
+    out_row1 = in_row1;
+    out_row2 = in_row2;
+
+    vec3 to_center = in_bounds.xyz - camera_position.xyz;
+    float x = dot(to_center, normalize(camera_right.xyz));
+    float y = dot(to_center, normalize(camera_down.xyz));
+    float z = dot(to_center, camera_forward.xyz);
+    float r = in_bounds.w;
+
+    // The corners of a triangle strip, in `[0, 1]`.
+    vec2 corner = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1);
+
+    // Behind the camera, the quad collapses to a point.
+    if (z + r <= 0.0) {
+        gl_Position = vec4(0.0, 0.0, 0.5, 1.0);
+        return;
+    }
+
+    // Reaching behind the camera, the primitive can cover any part of the screen.
+    if (z <= r) {
+        gl_Position = vec4(corner * 2.0 - 1.0, 0.5, 1.0);
+        return;
+    }
+
+    vec2 u = projected_extent(x, z, r) / length(camera_right.xyz);
+    vec2 v = projected_extent(y, z, r) / length(camera_down.xyz);
+
+    // The ray of a pixel goes through its corner (see `screen_ray`), the rasterizer samples its center,
+    // which is half a pixel further. The quad is widened by a pixel against rounding.
+    vec2 pixel = 2.0 / vec2(WIDTH, HEIGHT);
+    vec2 min_corner = vec2(u.x, v.x) + 0.5 * pixel - pixel;
+    vec2 max_corner = vec2(u.y, v.y) + 0.5 * pixel + pixel;
+
+    gl_Position = vec4(mix(min_corner, max_corner, corner), 0.5, 1.0);
+}
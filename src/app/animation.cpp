@@ -0,0 +1,426 @@
+#include "animation.h"
+#include "bvh.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cstring>
+#include <experimental/array>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+using std::experimental::make_array;
+
+namespace app {
+
+namespace {
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// Find the keys around `frame` and the weight of the second one. Both are the same key outside of their range.
+template<typename Key>
+void bracket(const std::vector<Key>& keys, double frame, const Key*& a, const Key*& b, float& t) {
+    auto next = std::upper_bound(keys.begin(), keys.end(), frame,
+        [](double f, const Key& key) { return f < key.frame; });
+
+    if (next == keys.begin()) {
+        a = b = &*next;
+        t = 0.0f;
+    } else if (next == keys.end()) {
+        a = b = &keys.back();
+        t = 0.0f;
+    } else {
+        a = &*(next - 1);
+        b = &*next;
+        t = float((frame - a->frame) / (b->frame - a->frame));
+    }
+}
+
+float lerp(float a, float b, float t) {
+    return a + (b - a) * t;
+}
+
+/// The animated part of the scene in one frame.
+struct Frame {
+    Primitives primitives;
+    Bvh bvh;
+    std::vector<CompressedBvhNode> compressedBvh;
+    Camera camera;
+
+    /// Data copied to the scene buffers, in the order of `sceneTargets`.
+    std::vector<std::pair<const void*, size_t>> sections(bool compressed) const {
+        auto section = [](const auto& data) {
+            return std::make_pair(static_cast<const void*>(data.data()), data.size() * sizeof(data[0]));
+        };
+
+        return std::vector<std::pair<const void*, size_t>> {
+            section(this->primitives.spheres),
+            section(this->primitives.ellipsoids),
+            compressed ? section(this->compressedBvh) : section(this->bvh.nodes),
+            section(this->bvh.primitives),
+            std::make_pair(static_cast<const void*>(&this->camera), sizeof(this->camera)),
+        };
+    }
+};
+
+Frame buildFrame(const Animation& animation, const Primitives& base, size_t frame, float aspect,
+    bool compressedBvh)
+{
+    auto result = Frame();
+    result.primitives = animation.primitivesAt(base, frame);
+    result.bvh = buildBvh(result.primitives.bounds());
+    result.camera = animation.cameraAt(frame, aspect);
+
+    if (compressedBvh) {
+        result.compressedBvh = compressBvh(result.bvh.nodes);
+    }
+
+    return result;
+}
+
+/// Buffers of the animated part of the scene, in the order of `Frame::sections`.
+std::vector<vk::Buffer> sceneTargets(const SceneBuffers& buffers, bool compressedBvh) {
+    return std::vector<vk::Buffer> {
+        *buffers.spheres, *buffers.ellipsoids, compressedBvh ? *buffers.compressedBvh : *buffers.bvh,
+        *buffers.bvhPrimitives, *buffers.camera
+    };
+}
+
+/// Record the upload of the staging buffer into `targets`, clearing the work image for the new frame.
+vk::UniqueCommandBuffer recordUpload(vk::Device device, vk::CommandPool pool, const Queues& queues,
+    vk::Buffer staging, const std::vector<vk::Buffer>& targets, const std::vector<size_t>& sizes,
+    vk::Image workImage)
+{
+    auto allocInfo = vk::CommandBufferAllocateInfo(
+        pool,                                   // commandPool,
+        vk::CommandBufferLevel::ePrimary,       // level
+        1                                       // commandBufferCount
+    );
+
+    auto cmds = device.allocateCommandBuffersUnique(allocInfo);
+    auto cmd = std::move(cmds[0]);
+
+    cmd->begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlags(), nullptr));
+
+    const auto range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+
+    // The buffers were last read by the frame two frames back, the work image by the blit
+    // and readback of the previous frame.
+    const auto readsToTransfer = vk::MemoryBarrier(
+        vk::AccessFlagBits::eShaderRead,        // srcAccessMask
+        vk::AccessFlagBits::eTransferWrite      // dstAccessMask
+    );
+
+    const auto workImageToClear = vk::ImageMemoryBarrier(
+        vk::AccessFlagBits::eShaderWrite,       // srcAccessMask
+        vk::AccessFlagBits::eTransferWrite,     // dstAccessMask
+        vk::ImageLayout::eTransferSrcOptimal,   // oldLayout
+        vk::ImageLayout::eTransferDstOptimal,   // newLayout
+        queues.computeQueueFamily,              // srcQueueFamilyIndex
+        queues.computeQueueFamily,              // dstQueueFamilyIndex
+        workImage,                              // image
+        range                                   // subresourceRange
+    );
+
+    cmd->pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader |
+            vk::PipelineStageFlagBits::eTransfer,   // srcStageMask
+        vk::PipelineStageFlagBits::eTransfer,       // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &readsToTransfer,                           // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        1,                                          // imageMemoryBarrierCount
+        &workImageToClear                           // pImageMemoryBarriers
+    );
+
+    size_t offset = 0;
+    for (size_t i = 0; i < targets.size(); i++) {
+        // Copies can't be empty, a scene without ellipsoids has nothing to upload for them.
+        if (sizes[i] > 0) {
+            cmd->copyBuffer(staging, targets[i], vk::BufferCopy(offset, 0, sizes[i]));
+        }
+        offset += sizes[i];
+    }
+
+    const auto clearColor = vk::ClearColorValue(make_array(0.0f, 0.0f, 0.0f, 0.0f));
+    cmd->clearColorImage(workImage, vk::ImageLayout::eTransferDstOptimal, &clearColor, 1, &range);
+
+    const auto transferToCompute = vk::MemoryBarrier(
+        vk::AccessFlagBits::eTransferWrite,     // srcAccessMask
+        vk::AccessFlagBits::eShaderRead         // dstAccessMask
+    );
+
+    // Back to the layout the frame's command buffer expects.
+    const auto clearToWorkImage = vk::ImageMemoryBarrier(
+        vk::AccessFlagBits::eTransferWrite,     // srcAccessMask
+        vk::AccessFlagBits::eShaderRead |
+            vk::AccessFlagBits::eShaderWrite,   // dstAccessMask
+        vk::ImageLayout::eTransferDstOptimal,   // oldLayout
+        vk::ImageLayout::eTransferSrcOptimal,   // newLayout
+        queues.computeQueueFamily,              // srcQueueFamilyIndex
+        queues.computeQueueFamily,              // dstQueueFamilyIndex
+        workImage,                              // image
+        range                                   // subresourceRange
+    );
+
+    cmd->pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,       // srcStageMask
+        vk::PipelineStageFlagBits::eTransfer |
+            vk::PipelineStageFlagBits::eComputeShader,  // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &transferToCompute,                         // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        1,                                          // imageMemoryBarrierCount
+        &clearToWorkImage                           // pImageMemoryBarriers
+    );
+
+    cmd->end();
+
+    return cmd;
+}
+
+} // namespace
+
+Camera Animation::cameraAt(size_t frame, float aspect) const {
+    if (this->cameraKeys.empty()) {
+        return defaultCamera(aspect);
+    }
+
+    const CameraKey* a;
+    const CameraKey* b;
+    float t;
+    bracket(this->cameraKeys, double(frame), a, b, t);
+
+    float position[3];
+    float target[3];
+    for (int i = 0; i < 3; i++) {
+        position[i] = lerp(a->position[i], b->position[i], t);
+        target[i] = lerp(a->target[i], b->target[i], t);
+    }
+
+    return Camera::lookAt(position, target, lerp(a->fov, b->fov, t), aspect);
+}
+
+Primitives Animation::primitivesAt(const Primitives& base, size_t frame) const {
+    auto result = base;
+
+    for (const auto& [primitive, keys] : this->moveKeys) {
+        const MoveKey* a;
+        const MoveKey* b;
+        float t;
+        bracket(keys, double(frame), a, b, t);
+
+        float offset[3];
+        for (int i = 0; i < 3; i++) {
+            offset[i] = lerp(a->offset[i], b->offset[i], t);
+        }
+
+        if (primitive < result.spheres.size()) {
+            auto& sphere = result.spheres[primitive];
+            for (int i = 0; i < 3; i++) {
+                sphere.center[i] += offset[i];
+            }
+        } else {
+            // Moving the ellipsoid by `offset` moves the origin of its local space the other way.
+            auto& rows = result.ellipsoids[primitive - result.spheres.size()].worldToLocal;
+            for (int r = 0; r < 3; r++) {
+                rows[r][3] -= rows[r][0] * offset[0] + rows[r][1] * offset[1] + rows[r][2] * offset[2];
+            }
+        }
+    }
+
+    return result;
+}
+
+Animation loadAnimation(const std::string& path) {
+    auto file = std::ifstream(path);
+    if (!file) {
+        throw std::runtime_error("failed to open " + path);
+    }
+
+    auto animation = Animation();
+    auto line = std::string();
+    size_t lineNumber = 0;
+
+    while (std::getline(file, line)) {
+        lineNumber += 1;
+        line = line.substr(0, line.find('#'));
+
+        auto stream = std::istringstream(line);
+        auto keyword = std::string();
+        if (!(stream >> keyword)) { continue; }
+
+        bool valid;
+        if (keyword == "frames") {
+            valid = bool(stream >> animation.frameCount) && animation.frameCount > 0;
+        } else if (keyword == "samples") {
+            valid = bool(stream >> animation.samplesPerFrame) && animation.samplesPerFrame > 0;
+        } else if (keyword == "camera") {
+            auto key = Animation::CameraKey();
+            valid = bool(stream >> key.frame >> key.position[0] >> key.position[1] >> key.position[2]
+                >> key.target[0] >> key.target[1] >> key.target[2] >> key.fov);
+            animation.cameraKeys.push_back(key);
+        } else if (keyword == "move") {
+            uint32_t primitive;
+            auto key = Animation::MoveKey();
+            valid = bool(stream >> primitive >> key.frame >> key.offset[0] >> key.offset[1] >> key.offset[2]);
+            animation.moveKeys[primitive].push_back(key);
+        } else {
+            valid = false;
+        }
+
+        auto rest = std::string();
+        if (!valid || stream >> rest) {
+            throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": invalid keyframe line: " + line);
+        }
+    }
+
+    if (animation.frameCount == 0) {
+        throw std::runtime_error(path + ": missing frame count");
+    }
+
+    auto byFrame = [](const auto& a, const auto& b) { return a.frame < b.frame; };
+    std::stable_sort(animation.cameraKeys.begin(), animation.cameraKeys.end(), byFrame);
+    for (auto& [primitive, keys] : animation.moveKeys) {
+        std::stable_sort(keys.begin(), keys.end(), byFrame);
+    }
+
+    std::cout << "Animation of " << animation.frameCount << " frames with " << animation.samplesPerFrame
+        << " samples each, " << animation.cameraKeys.size() << " camera keyframes and "
+        << animation.moveKeys.size() << " moving primitives\n";
+
+    return animation;
+}
+
+Animator::Animator(vk::Device device, const Queues& queues, Animation&& animation, Primitives&& base, float aspect,
+    bool compressedBvh, std::vector<Slot>&& slots, std::vector<size_t>&& sectionSizes):
+    device(device),
+    queues(queues),
+    animation(std::move(animation)),
+    base(std::move(base)),
+    aspect(aspect),
+    compressedBvh(compressedBvh),
+    slots(std::move(slots)),
+    sectionSizes(std::move(sectionSizes)),
+    prepareSeconds(0.0),
+    waitSeconds(0.0),
+    started(Clock::now())
+{
+}
+
+Animator Animator::create(vk::Device device, vk::PhysicalDevice physical, vk::CommandPool pool,
+    const Queues& queues, Animation&& animation, Primitives&& base,
+    const std::vector<const SceneBuffers*>& sceneBuffers, vk::Image workImage, float aspect, bool compressedBvh)
+{
+    auto slots = std::vector<Slot>();
+    auto sectionSizes = std::vector<size_t>();
+
+    if (animation.enabled()) {
+        const size_t primitiveCount = base.spheres.size() + base.ellipsoids.size();
+        for (const auto& [primitive, keys] : animation.moveKeys) {
+            if (primitive >= primitiveCount) {
+                throw std::runtime_error("animated primitive " + std::to_string(primitive) + " doesn't exist, the "
+                    "scene has " + std::to_string(primitiveCount) + " primitives");
+            }
+        }
+
+        // The BVH builder splits by count, so every frame has the same number of nodes as the first.
+        auto first = buildFrame(animation, base, 0, aspect, compressedBvh);
+
+        size_t stagingSize = 0;
+        for (const auto& [data, size] : first.sections(compressedBvh)) {
+            sectionSizes.push_back(size);
+            stagingSize += size;
+        }
+
+        for (const auto* buffers : sceneBuffers) {
+            auto [stagingMemory, staging] = createHostBuffer(device, physical, stagingSize,
+                vk::BufferUsageFlagBits::eTransferSrc);
+            auto mapped = device.mapMemory(*stagingMemory, 0, stagingSize, vk::MemoryMapFlags());
+            auto upload = recordUpload(device, pool, queues, *staging, sceneTargets(*buffers, compressedBvh),
+                sectionSizes, workImage);
+
+            // Signalled, as nothing is using the staging buffer yet.
+            auto uploaded = device.createFenceUnique(vk::FenceCreateInfo(vk::FenceCreateFlagBits::eSignaled),
+                nullptr);
+
+            slots.push_back(Slot { std::move(stagingMemory), std::move(staging), mapped, std::move(upload),
+                std::move(uploaded) });
+        }
+
+        std::cout << "Uploading " << stagingSize / 1024 << " KiB of scene data per frame through "
+            << slots.size() << " sets of scene buffers\n";
+    }
+
+    return Animator(device, queues, std::move(animation), std::move(base), aspect, compressedBvh,
+        std::move(slots), std::move(sectionSizes));
+}
+
+void Animator::prepare(size_t frame) {
+    if (frame == 0) {
+        this->started = Clock::now();
+    }
+
+    auto& slot = this->slots[this->slot(frame)];
+
+    auto waitStart = Clock::now();
+    this->device.waitForFences(1, &*slot.uploaded, true, std::numeric_limits<uint64_t>::max());
+    this->waitSeconds += secondsSince(waitStart);
+
+    auto prepareStart = Clock::now();
+    auto data = buildFrame(this->animation, this->base, frame, this->aspect, this->compressedBvh);
+    auto sections = data.sections(this->compressedBvh);
+
+    auto out = static_cast<char*>(slot.mapped);
+    for (size_t i = 0; i < sections.size(); i++) {
+        if (sections[i].second != this->sectionSizes[i]) {
+            throw std::runtime_error("the scene of frame " + std::to_string(frame) + " doesn't fit the buffers");
+        }
+
+        std::memcpy(out, sections[i].first, sections[i].second);
+        out += sections[i].second;
+    }
+
+    this->prepareSeconds += secondsSince(prepareStart);
+}
+
+void Animator::submit(size_t frame) {
+    auto& slot = this->slots[this->slot(frame)];
+    this->device.resetFences(1, &*slot.uploaded);
+
+    auto submitInfo = vk::SubmitInfo(
+        0,                                  // waitSemaphoreCount
+        nullptr,                            // pWaitSemaphores
+        nullptr,                            // pWaitDstStageMask
+        1,                                  // commandBufferCount
+        &*slot.upload,                      // pCommandBuffers
+        0,                                  // signalSemaphoreCount
+        nullptr                             // pSignalSemaphores
+    );
+
+    this->queues.compute.submit(1, &submitInfo, *slot.uploaded);
+}
+
+void Animator::finish(size_t framesRendered) {
+    if (!this->enabled()) { return; }
+
+    auto seconds = secondsSince(this->started);
+    auto perFrame = [&](double total) { return framesRendered > 0 ? 1000.0 * total / double(framesRendered) : 0.0; };
+
+    std::cout << std::fixed << std::setprecision(2)
+        << "Animation: " << framesRendered << " of " << this->animation.frameCount << " frames in " << seconds
+        << " s, " << perFrame(seconds) << " ms per frame\n"
+        << "    scene updates on the host: " << perFrame(this->prepareSeconds) << " ms per frame\n"
+        << "    waiting for a free set of scene buffers: " << perFrame(this->waitSeconds) << " ms per frame\n";
+}
+
+} // namespace app
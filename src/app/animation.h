@@ -0,0 +1,129 @@
+#pragma once
+
+#include "camera.h"
+#include "deps.h"
+#include "device.h"
+#include "primitives.h"
+#include "scene.h"
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace app {
+
+/// Camera and primitive motion of an image sequence, interpolated linearly between keyframes.
+///
+/// Keyframes are placed at (possibly fractional) frame numbers. Before the first and after the
+/// last keyframe the values are held constant. Without camera keyframes the default camera is used,
+/// primitives without keyframes stand still.
+struct Animation {
+    struct CameraKey {
+        double frame;
+        float position[3];
+        float target[3];
+        float fov;
+    };
+
+    struct MoveKey {
+        double frame;
+        float offset[3];
+    };
+
+    /// Number of frames in the sequence, zero if nothing is animated.
+    size_t frameCount = 0;
+
+    /// Number of samples per pixel (dispatches) accumulated for each frame.
+    size_t samplesPerFrame = 1;
+
+    /// Camera keyframes, sorted by frame.
+    std::vector<CameraKey> cameraKeys;
+
+    /// Offsets from the position in the scene for each moving primitive, sorted by frame.
+    std::map<uint32_t, std::vector<MoveKey>> moveKeys;
+
+    bool enabled() const { return this->frameCount > 0; }
+
+    Camera cameraAt(size_t frame, float aspect) const;
+
+    /// `base` with the moving primitives at their position in `frame`.
+    Primitives primitivesAt(const Primitives& base, size_t frame) const;
+};
+
+/// Load keyframes from a text file. Each line holds one of
+///
+///     frames <count>
+///     samples <count per frame>
+///     camera <frame> <x> <y> <z> <target x> <target y> <target z> <horizontal fov in degrees>
+///     move <primitive> <frame> <offset x> <offset y> <offset z>
+///
+/// Primitives are numbered as in the shader, spheres first and ellipsoids after them.
+/// Anything after a `#` is a comment. Throws if the file can't be read or parsed.
+Animation loadAnimation(const std::string& path);
+
+/// Renders an `Animation` frame by frame, alternating between two sets of scene buffers.
+///
+/// While the GPU traces a frame from one set, the host interpolates the next frame, rebuilds the
+/// BVH and writes the result into the staging buffer of the other set. A prerecorded command buffer
+/// then copies it into the scene buffers and clears the work image, ordered after the previous frame
+/// by barriers alone. The only wait is on the fence of the upload two frames back, before its staging
+/// buffer is overwritten.
+class Animator {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Slot {
+        vk::UniqueDeviceMemory stagingMemory;
+        vk::UniqueBuffer staging;
+        void* mapped;
+        vk::UniqueCommandBuffer upload;
+        vk::UniqueFence uploaded;
+    };
+
+    vk::Device device;
+    Queues queues;
+
+    Animation animation;
+    Primitives base;
+    float aspect;
+    bool compressedBvh;
+
+    std::vector<Slot> slots;
+    std::vector<size_t> sectionSizes;
+
+    double prepareSeconds;
+    double waitSeconds;
+    Clock::time_point started;
+
+public:
+    /// `sceneBuffers` are the sets the frames are uploaded to in turn, all created from the first frame.
+    static Animator create(vk::Device device, vk::PhysicalDevice physical, vk::CommandPool pool,
+        const Queues& queues, Animation&& animation, Primitives&& base,
+        const std::vector<const SceneBuffers*>& sceneBuffers, vk::Image workImage, float aspect,
+        bool compressedBvh);
+
+    bool enabled() const { return !this->slots.empty(); }
+
+    size_t frameCount() const { return this->animation.frameCount; }
+    size_t samplesPerFrame() const { return this->animation.samplesPerFrame; }
+
+    /// Index of the set of scene buffers `frame` is rendered from.
+    size_t slot(size_t frame) const { return frame % this->slots.size(); }
+
+    /// Build `frame` and write it to the staging buffer of its slot.
+    void prepare(size_t frame);
+
+    /// Submit the upload of `frame`, which must have been prepared. The dispatches of the frame
+    /// have to be submitted after it.
+    void submit(size_t frame);
+
+    /// Print how much time the host spent on the scene updates. The device must be idle.
+    void finish(size_t framesRendered);
+
+private:
+    Animator(vk::Device device, const Queues& queues, Animation&& animation, Primitives&& base, float aspect,
+        bool compressedBvh, std::vector<Slot>&& slots, std::vector<size_t>&& sectionSizes);
+};
+
+} // namespace app
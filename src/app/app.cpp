@@ -1,19 +1,31 @@
 #include "app.h"
 #include "device.h"
 #include "instance.h"
+#include "schedule.h"
 #include "shader.h"
+#include "state.h"
 #include "window.h"
 
+#include <iostream>
+#include <tuple>
+
 namespace app {
 
 App::App(UniqueGlfwWindow&& window, vk::UniqueInstance&& instance, vk::UniqueSurfaceKHR&& surface,
     vk::UniqueDevice&& device, Queues queues, vk::UniqueSwapchainKHR&& swapchain,
     vk::UniqueDescriptorSetLayout&& descriptorLayout, vk::UniqueDeviceMemory&& memory,
     vk::UniqueDeviceMemory&& bufferMemory, vk::UniqueImage&& workImage, vk::UniqueImageView&& workImageView,
-    vk::UniqueBuffer&& stateBuffer, vk::UniqueDescriptorPool&& descriptorPool,
+    vk::UniqueBuffer&& stateBuffer, SceneBuffers&& sceneBuffers, vk::UniqueDeviceMemory&& tileOrderMemory,
+    vk::UniqueBuffer&& tileOrderBuffer, Pager&& pager,
+    TextureStreamer&& textureStreamer, HybridRenderer&& hybrid, TileBinner&& binner,
+    vk::UniqueDeviceMemory&& visibilityMemory, vk::UniqueBuffer&& visibilityBuffer, PathGuide&& guide,
+    EnvironmentLight&& environment, vk::UniqueDescriptorPool&& descriptorPool,
     vk::UniquePipeline&& pipeline, vk::UniquePipelineLayout&& pipelineLayout,
     vk::UniqueCommandPool&& cmdPool, std::vector<vk::UniqueCommandBuffer>&& cmdBuffers,
-    vk::UniqueSemaphore&& imageAvailableSemaphore):
+    SceneBuffers&& animationSceneBuffers, vk::UniqueDescriptorPool&& animationDescriptorPool,
+    vk::UniqueCommandPool&& animationCmdPool, std::vector<vk::UniqueCommandBuffer>&& animationCmdBuffers,
+    Animator&& animator, vk::UniqueSemaphore&& imageAvailableSemaphore, Presenter&& presenter, Checkpointer&& checkpointer,
+    FrameWriter&& frameWriter, Stats&& stats):
     window(std::move(window)),
     instance(std::move(instance)),
     surface(std::move(surface)),
@@ -26,60 +38,283 @@ App::App(UniqueGlfwWindow&& window, vk::UniqueInstance&& instance, vk::UniqueSur
     workImage(std::move(workImage)),
     workImageView(std::move(workImageView)),
     stateBuffer(std::move(stateBuffer)),
+    sceneBuffers(std::move(sceneBuffers)),
+    tileOrderMemory(std::move(tileOrderMemory)),
+    tileOrderBuffer(std::move(tileOrderBuffer)),
+    pager(std::move(pager)),
+    textureStreamer(std::move(textureStreamer)),
+    hybrid(std::move(hybrid)),
+    binner(std::move(binner)),
+    visibilityMemory(std::move(visibilityMemory)),
+    visibilityBuffer(std::move(visibilityBuffer)),
+    guide(std::move(guide)),
+    environment(std::move(environment)),
     descriptorPool(std::move(descriptorPool)),
     pipeline(std::move(pipeline)),
     pipelineLayout(std::move(pipelineLayout)),
     cmdPool(std::move(cmdPool)),
     cmdBuffers(std::move(cmdBuffers)),
-    imageAvailableSemaphore(std::move(imageAvailableSemaphore))
+    animationSceneBuffers(std::move(animationSceneBuffers)),
+    animationDescriptorPool(std::move(animationDescriptorPool)),
+    animationCmdPool(std::move(animationCmdPool)),
+    animationCmdBuffers(std::move(animationCmdBuffers)),
+    animator(std::move(animator)),
+    imageAvailableSemaphore(std::move(imageAvailableSemaphore)),
+    presenter(std::move(presenter)),
+    checkpointer(std::move(checkpointer)),
+    frameWriter(std::move(frameWriter)),
+    stats(std::move(stats))
 {
 }
 
-App App::create() {
+App App::create(const Options& options) {
     const uint32_t width = 800;
     const uint32_t height = 600;
+    const size_t stateSize = sizeof(State);
+
+    // Must match `WORKGROUP_SIZE` in the shader, each workgroup traces a square tile of this size.
+    const uint32_t tileSize = 32;
+    const uint32_t tilesX = (width + tileSize - 1) / tileSize;
+    const uint32_t tilesY = (height + tileSize - 1) / tileSize;
+    const auto workFormat = options.halfPrecision ? vk::Format::eR16G16B16A16Sfloat : vk::Format::eR32G32B32A32Sfloat;
+    const float aspect = float(height) / float(width);
 
     auto window = createWindow(width, height, "GPU raytracer");
     auto instance = createInstance();
     auto surface = createSurface(&*window, *instance);
     auto physical = choosePhysicalDevice(*instance, *surface);
-    auto [device, queues] = createDevice(physical, *surface);
+    auto [device, queues] = createDevice(physical, *surface, options.asyncCompute);
     auto [swapchain, format, extent] = createSwapchain(physical, *device, *surface, queues, width, height);
     auto imageViews = createImageViews(*device, *swapchain, format);
-    auto descriptorLayout = createDescriptorSetLayoyt(*device);
-    auto [memory, workImage, workImageView] = createImage(*device, physical, extent);
-    auto [bufferMemory, stateBuffer] = createBuffer(*device, physical, 3 * sizeof(uint32_t));
-    auto [descriptorPool, descriptorSet] = createDescriptorSet(*device, *descriptorLayout, *workImageView, *stateBuffer);
-    auto [pipeline, pipelineLayout, shader] = createPipeline(*device, *descriptorLayout);
+    auto [memory, workImage, workImageView] = createImage(*device, physical, extent, workFormat);
+
+    std::cout << "Work image: " << extent.width << "x" << extent.height << ", "
+        << extent.width * extent.height * texelSize(workFormat) / 1024 << " KiB\n";
+
+    auto [bufferMemory, stateBuffer] = createBuffer(*device, physical, stateSize);
+
+    // Short lived pool for the commands uploading the scene.
+    auto setupPool = device->createCommandPoolUnique(vk::CommandPoolCreateInfo(
+        vk::CommandPoolCreateFlagBits::eTransient, queues.computeQueueFamily), nullptr);
+
+    auto animation = options.animationPath.empty() ? Animation() : loadAnimation(options.animationPath);
+    auto primitives = scenePrimitives(options);
+    auto firstPrimitives = animation.primitivesAt(primitives, 0);
+    auto firstCamera = animation.cameraAt(0, aspect);
+    auto bvh = buildBvh(firstPrimitives.bounds());
+    auto guide = PathGuide::create(*device, physical, queues, firstPrimitives.bounds(), options);
+    auto pagedGeometry = PagedGeometry();
+
+    // With paging only the materials and the top of the BVH are uploaded with the scene, the clusters
+    // below it are streamed in by the pager.
+    if (options.pageBudget > 0) {
+        pagedGeometry = pageGeometry(firstPrimitives, bvh, options.pageFilePath);
+        firstPrimitives = Primitives { std::move(firstPrimitives.materials), {}, {}, {}, {} };
+        bvh = Bvh { pagedGeometry.topNodes, {} };
+    }
+
+    auto sceneBuffers = createSceneBuffers(*device, physical, *setupPool, queues, firstPrimitives, bvh, firstCamera,
+        options);
+    auto pager = Pager::create(*device, physical, queues, std::move(pagedGeometry), vk::Extent2D(width, height),
+        options);
+    auto textureStreamer = TextureStreamer::create(*device, physical, queues,
+        tileTextures(options, firstPrimitives.materials.size()), options);
+
+    auto tileOrder = mortonTileOrder(tilesX, tilesY);
+    auto [tileOrderMemory, tileOrderBuffer] = createBuffer(*device, physical, tileOrder.size() * sizeof(uint32_t));
+    uploadBuffer(*device, physical, *setupPool, queues, *tileOrderBuffer, tileOrder.data(),
+        tileOrder.size() * sizeof(uint32_t));
+
+    auto hybrid = HybridRenderer::create(*device, physical, queues, firstPrimitives, bvh, firstCamera, tileOrder,
+        vk::Extent2D(width, height), options);
+    auto binner = TileBinner::create(*device, physical, tilesX * tilesY,
+        sceneBuffers.sphereCount + sceneBuffers.ellipsoidCount, options);
+    auto [visibilityMemory, visibilityBuffer] = createVisibilityBuffer(*device, physical, *setupPool, queues,
+        firstPrimitives, firstCamera, vk::Extent2D(width, height), options);
+    auto environment = EnvironmentLight::create(*device, physical, *setupPool, queues, options);
+
+    auto storageBuffers = [state = *stateBuffer, tileOrder = *tileOrderBuffer, paging = pager.bindings(),
+        textures = textureStreamer.bindings(), hostSamples = hybrid.bindings(),
+        bins = binner.bindings(), visibility = *visibilityBuffer, guiding = guide.bindings(),
+        environmentMap = environment.bindings(), deferred = pager.deferredPaths()](const SceneBuffers& scene)
+    {
+        auto buffers = scene.bindings();
+        buffers.insert(buffers.begin(), state);
+        buffers.push_back(tileOrder);
+        buffers.insert(buffers.end(), paging.begin(), paging.end());
+        buffers.insert(buffers.end(), textures.begin(), textures.end());
+        buffers.insert(buffers.end(), hostSamples.begin(), hostSamples.end());
+        buffers.insert(buffers.end(), bins.begin(), bins.end());
+        buffers.push_back(visibility);
+        buffers.insert(buffers.end(), guiding.begin(), guiding.end());
+        buffers.insert(buffers.end(), environmentMap.begin(), environmentMap.end());
+        buffers.push_back(deferred);
+        return buffers;
+    };
+
+    auto descriptorLayout = createDescriptorSetLayoyt(*device, storageBuffers(sceneBuffers).size());
+    auto [descriptorPool, descriptorSet] = createDescriptorSet(*device, *descriptorLayout, *workImageView,
+        storageBuffers(sceneBuffers));
+
+    // Without persistent workgroups every frame traces each tile once.
+    const auto frameBudget = options.frameBudget == 0 ? tilesX * tilesY : uint32_t(options.frameBudget);
+    const auto groupCount = options.persistent
+        ? vk::Extent2D(uint32_t(options.persistentGroups), 1)
+        : vk::Extent2D(tilesX, tilesY);
+
+    std::cout << (options.persistent ? "Persistent" : "Full grid") << " dispatch of " << groupCount.width
+        << "x" << groupCount.height << " workgroups, " << frameBudget << " of " << tilesX * tilesY
+        << " tiles per frame\n";
+
+    auto constants = ShaderConstants { sceneBuffers.sphereCount, sceneBuffers.ellipsoidCount,
+        options.compressedBvh, options.persistent, frameBudget, uint32_t(options.tileBatch), pager.enabled(),
+        textureStreamer.enabled(), false, uint32_t(options.tileBinCapacity), false,
+        options.visibilityBuffer, options.checkVisibility, options.guiding, environment.enabled() };
+    auto [pipeline, pipelineLayout, shader] = createPipeline(*device, *descriptorLayout, workFormat, constants);
+    binner.createPipeline(*descriptorLayout, workFormat, constants);
+
+    // With separate queue families the trace commands end in a resolve image instead of the swapchain.
+    auto presenter = Presenter::create(*device, physical, queues, *swapchain, workFormat, extent);
+    const auto deferredPaths = pager.enabled() ? pager.deferredPaths() : vk::Buffer();
     auto [cmdPool, cmdBuffers] = createCommands(*device, *swapchain, queues, *pipeline, *pipelineLayout,
-        descriptorSet, *workImage, extent);
+        descriptorSet, *workImage, extent, *stateBuffer, groupCount, binner.pass(), deferredPaths,
+        presenter.resolveImages());
+
+    // An animation renders every other frame from a second set of scene buffers, so the next
+    // frame can be uploaded while the current one is traced.
+    auto animationSceneBuffers = SceneBuffers();
+    auto animationDescriptorPool = vk::UniqueDescriptorPool();
+    auto animationCmdPool = vk::UniqueCommandPool();
+    auto animationCmdBuffers = std::vector<vk::UniqueCommandBuffer>();
+
+    if (animation.enabled()) {
+        animationSceneBuffers = createSceneBuffers(*device, physical, *setupPool, queues, firstPrimitives, bvh,
+            firstCamera, options);
+
+        auto animationDescriptorSet = vk::DescriptorSet();
+        std::tie(animationDescriptorPool, animationDescriptorSet) = createDescriptorSet(*device, *descriptorLayout,
+            *workImageView, storageBuffers(animationSceneBuffers));
+        std::tie(animationCmdPool, animationCmdBuffers) = createCommands(*device, *swapchain, queues, *pipeline,
+            *pipelineLayout, animationDescriptorSet, *workImage, extent, *stateBuffer, groupCount, binner.pass(),
+            deferredPaths, presenter.resolveImages());
+    }
+
     auto imageAvailableSemaphore = device->createSemaphoreUnique(vk::SemaphoreCreateInfo(), nullptr);
 
-    zeroBuffer(*device, physical, *cmdPool, queues, *stateBuffer, 3 * sizeof(uint32_t));
+    submitOnce(*device, *cmdPool, queues, [&queues = queues, image = *workImage](vk::CommandBuffer cmd) {
+        initWorkImage(cmd, queues, image);
+    });
+    zeroBuffer(*device, physical, *cmdPool, queues, *stateBuffer, stateSize);
+
+    auto checkpointer = Checkpointer::create(*device, physical, *cmdPool, queues, *workImage, workFormat, extent,
+        *stateBuffer, stateSize, options);
+
+    if (options.resume) {
+        checkpointer.restore(*cmdPool);
+    }
+
+    auto frameWriter = FrameWriter::create(*device, physical, *cmdPool, queues, *workImage, workFormat, extent,
+        options);
+    auto animator = Animator::create(*device, physical, *cmdPool, queues, std::move(animation),
+        std::move(primitives), { &sceneBuffers, &animationSceneBuffers }, *workImage, aspect, options.compressedBvh);
+    auto stats = Stats::create(*device, physical, *cmdPool, queues, *stateBuffer, options);
+
+    hybrid.start(*descriptorLayout, descriptorSet, workFormat, constants, *workImage, *stateBuffer, frameBudget);
 
     return App(std::move(window), std::move(instance), std::move(surface),
         std::move(device), queues, std::move(swapchain), std::move(descriptorLayout),
         std::move(memory), std::move(bufferMemory), std::move(workImage), std::move(workImageView),
-        std::move(stateBuffer), std::move(descriptorPool), std::move(pipeline), std::move(pipelineLayout),
-        std::move(cmdPool), std::move(cmdBuffers), std::move(imageAvailableSemaphore));
+        std::move(stateBuffer), std::move(sceneBuffers), std::move(tileOrderMemory), std::move(tileOrderBuffer),
+        std::move(pager), std::move(textureStreamer), std::move(hybrid), std::move(binner),
+        std::move(visibilityMemory), std::move(visibilityBuffer), std::move(guide), std::move(environment),
+        std::move(descriptorPool),
+        std::move(pipeline), std::move(pipelineLayout), std::move(cmdPool), std::move(cmdBuffers),
+        std::move(animationSceneBuffers),
+        std::move(animationDescriptorPool), std::move(animationCmdPool), std::move(animationCmdBuffers),
+        std::move(animator), std::move(imageAvailableSemaphore), std::move(presenter),
+        std::move(checkpointer), std::move(frameWriter), std::move(stats));
 }
 
 void App::mainLoop() {
     bool running = true;
+    size_t framesRendered = 0;
+
+    if (this->animator.enabled()) {
+        framesRendered = this->renderAnimation();
+        running = false;
+    }
 
     while (running) {
         glfwPollEvents();
 
         this->drawFrame();
+        this->pager.update();
+        this->textureStreamer.update();
+        this->guide.update();
+        this->checkpointer.update();
+        this->frameWriter.update();
+        this->stats.update();
 
         running &= !glfwWindowShouldClose(&*this->window);
         running &= !glfwGetKey(&*this->window, GLFW_KEY_ESCAPE);
     }
 
     this->device->waitIdle();
+    this->checkpointer.finish();
+    this->frameWriter.finish();
+    this->animator.finish(framesRendered);
+    this->pager.finish();
+    this->textureStreamer.finish();
+    this->guide.finish();
+    this->hybrid.finish();
+    this->presenter.finish();
+    this->stats.finish();
+}
+
+size_t App::renderAnimation() {
+    const size_t frameCount = this->animator.frameCount();
+    const size_t samples = this->animator.samplesPerFrame();
+
+    this->animator.prepare(0);
+
+    for (size_t frame = 0; frame < frameCount; frame++) {
+        const auto& cmdBuffers = this->animator.slot(frame) == 0 ? this->cmdBuffers : this->animationCmdBuffers;
+        this->animator.submit(frame);
+
+        for (size_t sample = 0; sample < samples; sample++) {
+            glfwPollEvents();
+            this->drawFrame(cmdBuffers);
+            this->textureStreamer.update();
+            this->stats.update();
+
+            // Build the next frame on the host while the GPU traces this one.
+            if (sample == 0 && frame + 1 < frameCount) {
+                this->animator.prepare(frame + 1);
+            }
+        }
+
+        this->frameWriter.write(frame);
+
+        if (glfwWindowShouldClose(&*this->window) || glfwGetKey(&*this->window, GLFW_KEY_ESCAPE)) {
+            return frame + 1;
+        }
+    }
+
+    return frameCount;
 }
 
 void App::drawFrame() {
+    this->drawFrame(this->cmdBuffers);
+}
+
+void App::drawFrame(const std::vector<vk::UniqueCommandBuffer>& cmdBuffers) {
+    this->hybrid.submit();
+
+    if (this->presenter.enabled()) {
+        this->presenter.drawFrame(cmdBuffers);
+        return;
+    }
+
     auto imageIndex = this->device->acquireNextImageKHR(*this->swapchain,
         std::numeric_limits<uint64_t>::max(), *this->imageAvailableSemaphore, nullptr).value;
 
@@ -90,7 +325,7 @@ void App::drawFrame() {
         &*this->imageAvailableSemaphore,    // pWaitSemaphores
         &waitStage,                         // pWaitDstStageMask
         1,                                  // commandBufferCount
-        &*this->cmdBuffers[imageIndex],     // pCommandBuffers
+        &*cmdBuffers[imageIndex],           // pCommandBuffers
         0,                                  // signalSemaphoreCount
         nullptr                             // pSignalSemaphores
     );
@@ -1,8 +1,22 @@
 #pragma once
 
+#include "animation.h"
+#include "binning.h"
+#include "checkpoint.h"
 #include "deps.h"
 #include "device.h"
+#include "environment.h"
+#include "guiding.h"
+#include "hybrid.h"
+#include "options.h"
+#include "paging.h"
+#include "present.h"
+#include "readback.h"
+#include "scene.h"
+#include "stats.h"
+#include "texture.h"
 #include "util.h"
+#include "visibility.h"
 #include "window.h"
 
 #include <vector>
@@ -23,15 +37,35 @@ private:
     vk::UniqueImage workImage;
     vk::UniqueImageView workImageView;
     vk::UniqueBuffer stateBuffer;
+    SceneBuffers sceneBuffers;
+    vk::UniqueDeviceMemory tileOrderMemory;
+    vk::UniqueBuffer tileOrderBuffer;
+    Pager pager;
+    TextureStreamer textureStreamer;
+    HybridRenderer hybrid;
+    TileBinner binner;
+    vk::UniqueDeviceMemory visibilityMemory;
+    vk::UniqueBuffer visibilityBuffer;
+    PathGuide guide;
+    EnvironmentLight environment;
     vk::UniqueDescriptorPool descriptorPool;
     vk::UniquePipeline pipeline;
     vk::UniquePipelineLayout pipelineLayout;
     vk::UniqueCommandPool cmdPool;
     std::vector<vk::UniqueCommandBuffer> cmdBuffers;
+    SceneBuffers animationSceneBuffers;
+    vk::UniqueDescriptorPool animationDescriptorPool;
+    vk::UniqueCommandPool animationCmdPool;
+    std::vector<vk::UniqueCommandBuffer> animationCmdBuffers;
+    Animator animator;
     vk::UniqueSemaphore imageAvailableSemaphore;
+    Presenter presenter;
+    Checkpointer checkpointer;
+    FrameWriter frameWriter;
+    Stats stats;
 
 public:
-    static App create();
+    static App create(const Options& options);
 
     App(const App&) = delete;
     App& operator=(const App&) = delete;
@@ -43,14 +77,25 @@ public:
     void drawFrame();
 
 private:
+    /// Render every frame of the animation, returns the number of frames rendered.
+    size_t renderAnimation();
+    void drawFrame(const std::vector<vk::UniqueCommandBuffer>& cmdBuffers);
+
     App(UniqueGlfwWindow&& window, vk::UniqueInstance&& instance, vk::UniqueSurfaceKHR&& surface,
         vk::UniqueDevice&& device, Queues queues, vk::UniqueSwapchainKHR&& swapchain,
         vk::UniqueDescriptorSetLayout&& descriptorLayout, vk::UniqueDeviceMemory&& memory,
         vk::UniqueDeviceMemory&& bufferMemory, vk::UniqueImage&& workImage, vk::UniqueImageView&& workImageView,
-        vk::UniqueBuffer&& stateBuffer, vk::UniqueDescriptorPool&& descriptorPool,
+        vk::UniqueBuffer&& stateBuffer, SceneBuffers&& sceneBuffers, vk::UniqueDeviceMemory&& tileOrderMemory,
+        vk::UniqueBuffer&& tileOrderBuffer, Pager&& pager,
+        TextureStreamer&& textureStreamer, HybridRenderer&& hybrid, TileBinner&& binner,
+        vk::UniqueDeviceMemory&& visibilityMemory, vk::UniqueBuffer&& visibilityBuffer, PathGuide&& guide,
+        EnvironmentLight&& environment, vk::UniqueDescriptorPool&& descriptorPool,
         vk::UniquePipeline&& pipeline, vk::UniquePipelineLayout&& pipelineLayout,
         vk::UniqueCommandPool&& cmdPool, std::vector<vk::UniqueCommandBuffer>&& cmdBuffers,
-        vk::UniqueSemaphore&& imageAvailableSemaphore);
+        SceneBuffers&& animationSceneBuffers, vk::UniqueDescriptorPool&& animationDescriptorPool,
+        vk::UniqueCommandPool&& animationCmdPool, std::vector<vk::UniqueCommandBuffer>&& animationCmdBuffers,
+        Animator&& animator, vk::UniqueSemaphore&& imageAvailableSemaphore, Presenter&& presenter, Checkpointer&& checkpointer,
+        FrameWriter&& frameWriter, Stats&& stats);
 };
 
 } // namespace app
@@ -0,0 +1,60 @@
+#include "binning.h"
+
+#include <iostream>
+#include <tuple>
+
+namespace app {
+
+TileBinner::TileBinner(vk::Device device, uint32_t tileCount, uint32_t capacity, uint32_t primitiveCount):
+    device(device),
+    tileCount(tileCount),
+    capacity(capacity),
+    primitiveCount(primitiveCount)
+{
+}
+
+TileBinner TileBinner::create(vk::Device device, vk::PhysicalDevice physical, uint32_t tileCount,
+    uint32_t primitiveCount, const Options& options)
+{
+    auto binner = TileBinner(device, tileCount, uint32_t(options.tileBinCapacity), primitiveCount);
+
+    // A count per tile, followed by the lists of all tiles.
+    const size_t size = size_t(tileCount) * (1 + binner.capacity) * sizeof(uint32_t);
+    std::tie(binner.binsMemory, binner.bins) = createBuffer(device, physical, size);
+
+    if (binner.enabled()) {
+        std::cout << "Tile binning of " << primitiveCount << " primitives into " << tileCount << " tiles of "
+            << binner.capacity << " primitives, " << size / 1024 << " KiB\n";
+    }
+
+    return binner;
+}
+
+std::vector<vk::Buffer> TileBinner::bindings() const {
+    return std::vector<vk::Buffer> { *this->bins };
+}
+
+void TileBinner::createPipeline(vk::DescriptorSetLayout descriptorLayout, vk::Format workFormat,
+    const ShaderConstants& constants)
+{
+    if (!this->enabled()) { return; }
+
+    auto binConstants = constants;
+    binConstants.binPrimitives = true;
+    std::tie(this->pipeline, this->pipelineLayout, std::ignore) = app::createPipeline(this->device,
+        descriptorLayout, workFormat, binConstants);
+}
+
+BinningPass TileBinner::pass() const {
+    // Every invocation of a workgroup bins one primitive.
+    const uint32_t groupSize = 32 * 32;
+
+    return BinningPass {
+        *this->pipeline,
+        *this->bins,
+        this->tileCount * sizeof(uint32_t),
+        (this->primitiveCount + groupSize - 1) / groupSize
+    };
+}
+
+} // namespace app
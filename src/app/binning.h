@@ -0,0 +1,52 @@
+#pragma once
+
+#include "deps.h"
+#include "options.h"
+#include "shader.h"
+
+namespace app {
+
+/// Culls the primitives tested by primary rays to the ones overlapping their tile of the image.
+///
+/// Before tracing, each frame runs a binning pass (`BIN_PRIMITIVES` in `shader/main.comp`) which projects
+/// the bounding sphere of every primitive onto the screen and appends the primitive to the list of each
+/// tile it covers. Primary rays test the list of their tile instead of traversing the BVH, all pixels of
+/// a workgroup reading the same list. A tile whose list overflows `Options::tileBinCapacity` falls back
+/// to the BVH for that frame.
+class TileBinner {
+private:
+    vk::Device device;
+
+    vk::UniqueDeviceMemory binsMemory;
+    vk::UniqueBuffer bins;
+    uint32_t tileCount;
+    uint32_t capacity;
+    uint32_t primitiveCount;
+
+    vk::UniquePipeline pipeline;
+    vk::UniquePipelineLayout pipelineLayout;
+
+    TileBinner(vk::Device device, uint32_t tileCount, uint32_t capacity, uint32_t primitiveCount);
+
+public:
+    /// With binning disabled the bound buffer only holds the unused counts.
+    static TileBinner create(vk::Device device, vk::PhysicalDevice physical, uint32_t tileCount,
+        uint32_t primitiveCount, const Options& options);
+
+    TileBinner(TileBinner&&) = default;
+    TileBinner& operator=(TileBinner&&) = default;
+
+    bool enabled() const { return this->capacity > 0; }
+
+    /// The counts and lists of primitives of all tiles, bound right after the host samples.
+    std::vector<vk::Buffer> bindings() const;
+
+    /// Create the binning pipeline from the tracing one's layout and constants.
+    void createPipeline(vk::DescriptorSetLayout descriptorLayout, vk::Format workFormat,
+        const ShaderConstants& constants);
+
+    /// The pass recorded ahead of the trace dispatch of every frame, see `createCommands`.
+    BinningPass pass() const;
+};
+
+} // namespace app
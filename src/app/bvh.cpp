@@ -0,0 +1,215 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+namespace app {
+
+namespace {
+
+const size_t MAX_LEAF_SIZE = 4;
+const uint32_t MAX_LEAF_FIRST = (uint32_t(1) << 24) - 1;
+
+Bounds emptyBounds() {
+    const float inf = std::numeric_limits<float>::infinity();
+    return Bounds { { inf, inf, inf }, { -inf, -inf, -inf } };
+}
+
+void extend(Bounds& bounds, const Bounds& other) {
+    for (int i = 0; i < 3; i++) {
+        bounds.min[i] = std::min(bounds.min[i], other.min[i]);
+        bounds.max[i] = std::max(bounds.max[i], other.max[i]);
+    }
+}
+
+float centroid(const Bounds& bounds, int axis) {
+    return 0.5f * (bounds.min[axis] + bounds.max[axis]);
+}
+
+struct Builder {
+    const std::vector<Bounds>& bounds;
+    std::vector<uint32_t>& indices;
+    std::vector<BvhNode> nodes;
+
+    using Iter = std::vector<uint32_t>::iterator;
+
+    Bounds rangeBounds(Iter begin, Iter end) const {
+        auto result = emptyBounds();
+        std::for_each(begin, end, [&](uint32_t i) { extend(result, this->bounds[i]); });
+        return result;
+    }
+
+    /// Split the range in two at the median centroid along the axis where the centroids spread the most.
+    Iter split(Iter begin, Iter end) const {
+        auto centroids = emptyBounds();
+        std::for_each(begin, end, [&](uint32_t i) {
+            for (int axis = 0; axis < 3; axis++) {
+                float c = centroid(this->bounds[i], axis);
+                centroids.min[axis] = std::min(centroids.min[axis], c);
+                centroids.max[axis] = std::max(centroids.max[axis], c);
+            }
+        });
+
+        int axis = 0;
+        for (int i = 1; i < 3; i++) {
+            if (centroids.max[i] - centroids.min[i] > centroids.max[axis] - centroids.min[axis]) {
+                axis = i;
+            }
+        }
+
+        auto middle = begin + (end - begin) / 2;
+        std::nth_element(begin, middle, end, [&](uint32_t a, uint32_t b) {
+            return centroid(this->bounds[a], axis) < centroid(this->bounds[b], axis);
+        });
+
+        return middle;
+    }
+
+    uint32_t buildChild(Iter begin, Iter end) {
+        if (size_t(end - begin) > MAX_LEAF_SIZE) {
+            return this->buildNode(begin, end);
+        }
+
+        auto first = size_t(begin - this->indices.begin());
+        if (first > MAX_LEAF_FIRST) {
+            throw std::runtime_error("too many primitives for the BVH");
+        }
+
+        return BvhNode::leaf(uint32_t(first), uint32_t(end - begin));
+    }
+
+    /// Build a node with up to four children, by splitting the range in two and then each half again.
+    uint32_t buildNode(Iter begin, Iter end) {
+        auto index = uint32_t(this->nodes.size());
+        this->nodes.push_back(BvhNode());
+
+        auto ranges = std::vector<std::pair<Iter, Iter>>();
+
+        if (size_t(end - begin) <= MAX_LEAF_SIZE) {
+            ranges.emplace_back(begin, end);
+        } else {
+            auto middle = this->split(begin, end);
+
+            for (auto [first, last] : { std::make_pair(begin, middle), std::make_pair(middle, end) }) {
+                if (size_t(last - first) <= MAX_LEAF_SIZE) {
+                    ranges.emplace_back(first, last);
+                } else {
+                    auto quarter = this->split(first, last);
+                    ranges.emplace_back(first, quarter);
+                    ranges.emplace_back(quarter, last);
+                }
+            }
+        }
+
+        auto node = BvhNode();
+        std::fill(std::begin(node.children), std::end(node.children), BvhNode::EMPTY);
+
+        for (size_t i = 0; i < 4; i++) {
+            auto bounds = Bounds { { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f } };
+
+            if (i < ranges.size() && ranges[i].first != ranges[i].second) {
+                bounds = this->rangeBounds(ranges[i].first, ranges[i].second);
+                node.children[i] = this->buildChild(ranges[i].first, ranges[i].second);
+            }
+
+            node.minX[i] = bounds.min[0];
+            node.maxX[i] = bounds.max[0];
+            node.minY[i] = bounds.min[1];
+            node.maxY[i] = bounds.max[1];
+            node.minZ[i] = bounds.min[2];
+            node.maxZ[i] = bounds.max[2];
+        }
+
+        this->nodes[index] = node;
+        return index;
+    }
+};
+
+/// Quantize the bounds of the children along one axis. Returns the biased exponent of the cell size.
+uint32_t quantizeAxis(const float min[4], const float max[4], const uint32_t children[4], float& origin,
+    uint32_t bounds[2])
+{
+    origin = std::numeric_limits<float>::infinity();
+    float end = -std::numeric_limits<float>::infinity();
+
+    for (int i = 0; i < 4; i++) {
+        if (children[i] == BvhNode::EMPTY) { continue; }
+        origin = std::min(origin, min[i]);
+        end = std::max(end, max[i]);
+    }
+
+    if (origin > end) {
+        origin = 0.0f;
+        end = 0.0f;
+    }
+
+    // Smallest power of two cell size such that 255 cells cover the node, as a float exponent.
+    int exponent;
+    std::frexp((end - origin) / 255.0f, &exponent);
+    uint32_t biased = uint32_t(std::clamp(exponent + 127, 1, 254));
+    float cell = std::ldexp(1.0f, int(biased) - 127);
+
+    bounds[0] = 0;
+    bounds[1] = 0;
+
+    for (int i = 0; i < 4; i++) {
+        if (children[i] == BvhNode::EMPTY) { continue; }
+
+        // Round outwards, checking against the values the shader will decode.
+        int lo = std::clamp(int(std::floor((min[i] - origin) / cell)), 0, 255);
+        while (lo > 0 && origin + float(lo) * cell > min[i]) { lo--; }
+
+        int hi = std::clamp(int(std::ceil((max[i] - origin) / cell)), 0, 255);
+        while (hi < 255 && origin + float(hi) * cell < max[i]) { hi++; }
+
+        bounds[0] |= uint32_t(lo) << (8 * i);
+        bounds[1] |= uint32_t(hi) << (8 * i);
+    }
+
+    return biased;
+}
+
+} // namespace
+
+uint32_t BvhNode::leaf(uint32_t first, uint32_t count) {
+    return LEAF | (count << 24) | first;
+}
+
+Bvh buildBvh(const std::vector<Bounds>& bounds) {
+    auto bvh = Bvh();
+    bvh.primitives.resize(bounds.size());
+    std::iota(bvh.primitives.begin(), bvh.primitives.end(), 0);
+
+    auto builder = Builder { bounds, bvh.primitives, {} };
+    builder.buildNode(bvh.primitives.begin(), bvh.primitives.end());
+
+    bvh.nodes = std::move(builder.nodes);
+    return bvh;
+}
+
+std::vector<CompressedBvhNode> compressBvh(const std::vector<BvhNode>& nodes) {
+    auto result = std::vector<CompressedBvhNode>();
+    result.reserve(nodes.size());
+
+    for (const auto& node : nodes) {
+        auto compressed = CompressedBvhNode();
+
+        uint32_t exponentX = quantizeAxis(node.minX, node.maxX, node.children, compressed.origin[0],
+            compressed.boundsX);
+        uint32_t exponentY = quantizeAxis(node.minY, node.maxY, node.children, compressed.origin[1],
+            compressed.boundsY);
+        uint32_t exponentZ = quantizeAxis(node.minZ, node.maxZ, node.children, compressed.origin[2],
+            compressed.boundsZ);
+
+        compressed.exponents = exponentX | (exponentY << 8) | (exponentZ << 16);
+        std::copy(std::begin(node.children), std::end(node.children), compressed.children);
+        result.push_back(compressed);
+    }
+
+    return result;
+}
+
+} // namespace app
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "primitives.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace app {
+
+/// A node of the 4-wide BVH over the primitives, laid out as `BvhNode` in `shader/main.comp`.
+///
+/// The bounds of the four children are stored per axis, so the shader can test all four at once.
+struct BvhNode {
+    float minX[4];
+    float maxX[4];
+    float minY[4];
+    float maxY[4];
+    float minZ[4];
+    float maxZ[4];
+
+    /// Index of each child node, a leaf made with `leaf` or `EMPTY`.
+    ///
+    /// In the top level of a paged BVH a child can also be `CLUSTER | index`, see `pageGeometry`.
+    uint32_t children[4];
+
+    static constexpr uint32_t EMPTY = ~uint32_t(0);
+    static constexpr uint32_t LEAF = uint32_t(1) << 31;
+    static constexpr uint32_t CLUSTER = uint32_t(1) << 30;
+
+    /// Leaves are stored in the parent, as a range of `count` entries of `Bvh::primitives` starting at `first`.
+    static uint32_t leaf(uint32_t first, uint32_t count);
+};
+
+/// The same node as `BvhNode`, with the child bounds quantized to 8 bits.
+///
+/// Laid out as `CompressedBvhNode` in `shader/main.comp`. The bounds are stored in a local grid
+/// starting at `origin` with a power of two cell size per axis, rounded outwards so they stay
+/// conservative. The node takes 64 bytes instead of 112.
+struct CompressedBvhNode {
+    float origin[3];
+
+    /// Biased exponents of the cell sizes along x, y and z, in the lowest three bytes.
+    uint32_t exponents;
+
+    /// Minimum and maximum of the four children along each axis, one byte per child.
+    uint32_t boundsX[2];
+    uint32_t boundsY[2];
+    uint32_t boundsZ[2];
+    uint32_t padding[2];
+
+    uint32_t children[4];
+};
+
+struct Bvh {
+    /// The root is the first node.
+    std::vector<BvhNode> nodes;
+
+    /// Primitive indices referenced by the leaves.
+    std::vector<uint32_t> primitives;
+};
+
+/// Build a BVH over primitives with the given bounds.
+Bvh buildBvh(const std::vector<Bounds>& bounds);
+
+std::vector<CompressedBvhNode> compressBvh(const std::vector<BvhNode>& nodes);
+
+} // namespace app
@@ -0,0 +1,70 @@
+#include "camera.h"
+
+#include <cmath>
+#include <stdexcept>
+
+namespace app {
+
+namespace {
+
+const double PI = 3.14159265358979323846;
+
+void cross(const float a[3], const float b[3], float out[3]) {
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+float normalize(float v[3]) {
+    float length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    if (length > 0.0f) {
+        for (int i = 0; i < 3; i++) {
+            v[i] /= length;
+        }
+    }
+    return length;
+}
+
+} // namespace
+
+Camera Camera::lookAt(const float position[3], const float target[3], float fov, float aspect) {
+    float forward[3] = { target[0] - position[0], target[1] - position[1], target[2] - position[2] };
+    if (normalize(forward) == 0.0f) {
+        throw std::runtime_error("camera position and target must differ");
+    }
+
+    // Keep the image upright, unless looking straight up or down where any roll will do.
+    float down[3] = { 0.0f, 1.0f, 0.0f };
+    float right[3];
+    cross(down, forward, right);
+    if (normalize(right) == 0.0f) {
+        float back[3] = { 0.0f, 0.0f, -1.0f };
+        cross(back, forward, right);
+        normalize(right);
+    }
+    cross(forward, right, down);
+
+    float halfWidth = float(std::tan(0.5 * double(fov) * PI / 180.0));
+    float halfHeight = halfWidth * aspect;
+
+    auto camera = Camera();
+    for (int i = 0; i < 3; i++) {
+        camera.position[i] = position[i];
+        camera.forward[i] = forward[i];
+        camera.right[i] = right[i] * halfWidth;
+        camera.down[i] = down[i] * halfHeight;
+    }
+
+    return camera;
+}
+
+Camera defaultCamera(float aspect) {
+    // The image plane 10 units away is 2 units wide.
+    const float position[3] = { 0.0f, 0.0f, -10.0f };
+    const float target[3] = { 0.0f, 0.0f, 0.0f };
+    const float fov = float(2.0 * std::atan(0.1) * 180.0 / PI);
+
+    return Camera::lookAt(position, target, fov, aspect);
+}
+
+} // namespace app
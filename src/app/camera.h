@@ -0,0 +1,24 @@
+#pragma once
+
+namespace app {
+
+/// A pinhole camera, laid out as the `Camera` buffer in `shader/main.comp`.
+///
+/// The ray through a pixel at `(u, v)` in `[-1, 1]` starts at `position` and goes along
+/// `forward + u * right + v * down`. `right` and `down` are scaled to half the size of
+/// the image plane at unit distance. The `w` components are unused.
+struct Camera {
+    float position[4];
+    float forward[4];
+    float right[4];
+    float down[4];
+
+    /// Camera at `position` looking at `target`, with `fov` degrees of horizontal field of view
+    /// and an image `aspect` (height over width). The world is laid out with `+y` pointing down.
+    static Camera lookAt(const float position[3], const float target[3], float fov, float aspect);
+};
+
+/// The camera of the default scene, looking along `+z` at the origin from 10 units away.
+Camera defaultCamera(float aspect);
+
+} // namespace app
@@ -0,0 +1,414 @@
+#include "checkpoint.h"
+#include "util.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <iostream>
+
+namespace app {
+
+namespace {
+
+const char CHECKPOINT_MAGIC[8] = { 'F', 'M', 'I', 'C', 'K', 'P', 'T', '1' };
+
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t reserved;
+    uint64_t imageSize;
+    uint64_t stateSize;
+};
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// Write the staging buffer contents to `path`. Returns the number of seconds it took.
+///
+/// The data is first written to a temporary file which then replaces the old checkpoint,
+/// so a process killed in the middle of a write still leaves the previous checkpoint intact.
+double writeCheckpoint(const std::string& path, CheckpointHeader header, const void* data) {
+    auto start = std::chrono::steady_clock::now();
+    auto tmpPath = path + ".tmp";
+
+    {
+        auto file = std::ofstream(tmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(static_cast<const char*>(data), header.imageSize + header.stateSize);
+
+        if (!file) {
+            throw std::runtime_error("failed to write checkpoint " + tmpPath);
+        }
+    }
+
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("failed to replace checkpoint " + path);
+    }
+
+    return secondsSince(start);
+}
+
+} // namespace
+
+Checkpointer::Checkpointer(vk::Device device, const Queues& queues, vk::Image workImage, vk::Buffer stateBuffer,
+    vk::Format format, vk::Extent2D extent, size_t imageSize, size_t stateSize,
+    vk::UniqueDeviceMemory&& stagingMemory, vk::UniqueBuffer&& staging, void* mapped,
+    vk::UniqueCommandBuffer&& cmd, vk::UniqueFence&& fence, vk::UniqueQueryPool&& queryPool,
+    double timestampPeriod, const Options& options):
+    device(device),
+    queues(queues),
+    workImage(workImage),
+    stateBuffer(stateBuffer),
+    format(format),
+    extent(extent),
+    imageSize(imageSize),
+    stateSize(stateSize),
+    stagingMemory(std::move(stagingMemory)),
+    staging(std::move(staging)),
+    mapped(mapped),
+    cmd(std::move(cmd)),
+    fence(std::move(fence)),
+    queryPool(std::move(queryPool)),
+    timestampPeriod(timestampPeriod),
+    path(options.checkpointPath),
+    interval(options.checkpointInterval),
+    budget(options.checkpointBudget),
+    stage(Stage::Idle),
+    writer(),
+    started(Clock::now()),
+    lastCheckpoint(Clock::now()),
+    overhead(0.0),
+    count(0)
+{
+}
+
+Checkpointer Checkpointer::create(vk::Device device, vk::PhysicalDevice physical, vk::CommandPool pool,
+    const Queues& queues, vk::Image workImage, vk::Format format, vk::Extent2D extent,
+    vk::Buffer stateBuffer, size_t stateSize, const Options& options)
+{
+    if (options.checkpointPath.empty()) {
+        return Checkpointer(device, queues, workImage, stateBuffer, format, extent, 0, 0,
+            vk::UniqueDeviceMemory(), vk::UniqueBuffer(), nullptr, vk::UniqueCommandBuffer(),
+            vk::UniqueFence(), vk::UniqueQueryPool(), 0.0, options);
+    }
+
+    // The image goes first, since its offset in the buffer must be a multiple of the texel size.
+    const size_t imageSize = size_t(extent.width) * extent.height * texelSize(format);
+    const size_t bufferSize = imageSize + stateSize;
+
+    auto [stagingMemory, staging] = createHostBuffer(device, physical, bufferSize,
+        vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst);
+    auto mapped = device.mapMemory(*stagingMemory, 0, bufferSize, vk::MemoryMapFlags());
+
+    // Timestamps are only used for reporting, so they are skipped if the queue can't write them.
+    const auto validBits = physical.getQueueFamilyProperties()[queues.computeQueueFamily].timestampValidBits;
+    const double timestampPeriod = validBits != 0 ? physical.getProperties().limits.timestampPeriod : 0.0;
+
+    auto queryPool = vk::UniqueQueryPool();
+    if (timestampPeriod != 0.0) {
+        queryPool = device.createQueryPoolUnique(vk::QueryPoolCreateInfo(
+            vk::QueryPoolCreateFlags(),             // flags
+            vk::QueryType::eTimestamp,              // queryType
+            2,                                      // queryCount
+            vk::QueryPipelineStatisticFlags()       // pipelineStatistics
+        ), nullptr);
+    }
+
+    auto fence = device.createFenceUnique(vk::FenceCreateInfo(), nullptr);
+
+    auto allocInfo = vk::CommandBufferAllocateInfo(
+        pool,                                   // commandPool,
+        vk::CommandBufferLevel::ePrimary,       // level
+        1                                       // commandBufferCount
+    );
+
+    auto cmds = device.allocateCommandBuffersUnique(allocInfo);
+    auto cmd = std::move(cmds[0]);
+
+    cmd->begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlags(), nullptr));
+
+    if (queryPool) {
+        cmd->resetQueryPool(*queryPool, 0, 2);
+    }
+
+    // The frame leaves the work image in TransferSrc layout, only the writes
+    // from the compute shader need to become visible to the copy.
+    const auto computeToTransfer = vk::MemoryBarrier(
+        vk::AccessFlagBits::eShaderWrite,       // srcAccessMask
+        vk::AccessFlagBits::eTransferRead       // dstAccessMask
+    );
+
+    cmd->pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,  // srcStageMask
+        vk::PipelineStageFlagBits::eTransfer,       // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &computeToTransfer,                         // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        0,                                          // imageMemoryBarrierCount
+        nullptr                                     // pImageMemoryBarriers
+    );
+
+    if (queryPool) {
+        cmd->writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, *queryPool, 0);
+    }
+
+    const auto imageRegion = vk::BufferImageCopy(
+        0,                                      // bufferOffset
+        0,                                      // bufferRowLength
+        0,                                      // bufferImageHeight
+        vk::ImageSubresourceLayers(             // imageSubresource
+            vk::ImageAspectFlagBits::eColor,        // aspectMask
+            0,                                      // mipLevel
+            0,                                      // baseArrayLayer
+            1                                       // layerCount
+        ),
+        vk::Offset3D(0, 0, 0),                  // imageOffset
+        vk::Extent3D(extent.width, extent.height, 1)    // imageExtent
+    );
+
+    cmd->copyImageToBuffer(workImage, vk::ImageLayout::eTransferSrcOptimal, *staging, 1, &imageRegion);
+
+    const auto stateRegion = vk::BufferCopy(0, imageSize, stateSize);
+    cmd->copyBuffer(stateBuffer, *staging, 1, &stateRegion);
+
+    const auto transferToHost = vk::MemoryBarrier(
+        vk::AccessFlagBits::eTransferWrite,     // srcAccessMask
+        vk::AccessFlagBits::eHostRead           // dstAccessMask
+    );
+
+    cmd->pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,       // srcStageMask
+        vk::PipelineStageFlagBits::eHost,           // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &transferToHost,                            // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        0,                                          // imageMemoryBarrierCount
+        nullptr                                     // pImageMemoryBarriers
+    );
+
+    if (queryPool) {
+        cmd->writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, *queryPool, 1);
+    }
+
+    cmd->end();
+
+    return Checkpointer(device, queues, workImage, stateBuffer, format, extent, imageSize, stateSize,
+        std::move(stagingMemory), std::move(staging), mapped, std::move(cmd), std::move(fence),
+        std::move(queryPool), timestampPeriod, options);
+}
+
+void Checkpointer::restore(vk::CommandPool pool) {
+    auto file = std::ifstream(this->path, std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("checkpoint file not found: " + this->path);
+    }
+
+    auto header = CheckpointHeader();
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    if (!file || std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0) {
+        throw std::runtime_error("not a checkpoint file: " + this->path);
+    }
+
+    if (header.format != uint32_t(this->format) || header.width != this->extent.width ||
+        header.height != this->extent.height || header.imageSize != this->imageSize ||
+        header.stateSize != this->stateSize)
+    {
+        throw std::runtime_error("checkpoint does not match the current render settings: " + this->path);
+    }
+
+    file.read(static_cast<char*>(this->mapped), this->imageSize + this->stateSize);
+    if (!file) {
+        throw std::runtime_error("truncated checkpoint file: " + this->path);
+    }
+
+    submitOnce(this->device, pool, this->queues, [&](vk::CommandBuffer cmd) {
+        const auto range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+
+        const auto toTransferDst = vk::ImageMemoryBarrier(
+            vk::AccessFlags(),                      // srcAccessMask
+            vk::AccessFlagBits::eTransferWrite,     // dstAccessMask
+            vk::ImageLayout::eTransferSrcOptimal,   // oldLayout
+            vk::ImageLayout::eTransferDstOptimal,   // newLayout
+            this->queues.computeQueueFamily,        // srcQueueFamilyIndex
+            this->queues.computeQueueFamily,        // dstQueueFamilyIndex
+            this->workImage,                        // image
+            range                                   // subresourceRange
+        );
+
+        cmd.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,       // srcStageMask
+            vk::PipelineStageFlagBits::eTransfer,       // dstStageMask
+            vk::DependencyFlags(),                      // dependencyFlags
+            0,                                          // memoryBarrierCount
+            nullptr,                                    // pMemoryBarriers
+            0,                                          // bufferMemoryBarrierCount
+            nullptr,                                    // pBufferMemoryBarriers
+            1,                                          // imageMemoryBarrierCount
+            &toTransferDst                              // pImageMemoryBarriers
+        );
+
+        const auto imageRegion = vk::BufferImageCopy(
+            0,                                      // bufferOffset
+            0,                                      // bufferRowLength
+            0,                                      // bufferImageHeight
+            vk::ImageSubresourceLayers(             // imageSubresource
+                vk::ImageAspectFlagBits::eColor,        // aspectMask
+                0,                                      // mipLevel
+                0,                                      // baseArrayLayer
+                1                                       // layerCount
+            ),
+            vk::Offset3D(0, 0, 0),                  // imageOffset
+            vk::Extent3D(this->extent.width, this->extent.height, 1)    // imageExtent
+        );
+
+        cmd.copyBufferToImage(*this->staging, this->workImage, vk::ImageLayout::eTransferDstOptimal,
+            1, &imageRegion);
+
+        const auto stateRegion = vk::BufferCopy(this->imageSize, 0, this->stateSize);
+        cmd.copyBuffer(*this->staging, this->stateBuffer, 1, &stateRegion);
+
+        const auto toTransferSrc = vk::ImageMemoryBarrier(
+            vk::AccessFlagBits::eTransferWrite,     // srcAccessMask
+            vk::AccessFlagBits::eShaderRead,        // dstAccessMask
+            vk::ImageLayout::eTransferDstOptimal,   // oldLayout
+            vk::ImageLayout::eTransferSrcOptimal,   // newLayout
+            this->queues.computeQueueFamily,        // srcQueueFamilyIndex
+            this->queues.computeQueueFamily,        // dstQueueFamilyIndex
+            this->workImage,                        // image
+            range                                   // subresourceRange
+        );
+
+        const auto stateWritten = vk::MemoryBarrier(
+            vk::AccessFlagBits::eTransferWrite,     // srcAccessMask
+            vk::AccessFlagBits::eShaderRead |
+                vk::AccessFlagBits::eShaderWrite    // dstAccessMask
+        );
+
+        cmd.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,       // srcStageMask
+            vk::PipelineStageFlagBits::eComputeShader,  // dstStageMask
+            vk::DependencyFlags(),                      // dependencyFlags
+            1,                                          // memoryBarrierCount
+            &stateWritten,                              // pMemoryBarriers
+            0,                                          // bufferMemoryBarrierCount
+            nullptr,                                    // pBufferMemoryBarriers
+            1,                                          // imageMemoryBarrierCount
+            &toTransferSrc                              // pImageMemoryBarriers
+        );
+    });
+
+    std::cout << "Resumed from checkpoint " << this->path << "\n";
+}
+
+void Checkpointer::update() {
+    if (!this->enabled()) { return; }
+
+    auto start = Clock::now();
+
+    if (this->stage == Stage::Copying && this->device.getFenceStatus(*this->fence) == vk::Result::eSuccess) {
+        this->overhead += this->copyDuration();
+        this->startWrite();
+    }
+
+    if (this->stage == Stage::Writing &&
+        this->writer.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+        double writeTime = this->writer.get();
+        double elapsed = secondsSince(this->started);
+        double share = 100.0 * this->overhead / elapsed;
+
+        this->stage = Stage::Idle;
+        this->count += 1;
+
+        std::cout << "Checkpoint " << this->count << " written to " << this->path
+            << " (write " << writeTime * 1000.0 << " ms, overhead " << share << "% of render time)\n";
+
+        // Checkpoints are spaced so that their average cost stays within the budget.
+        if (share > this->budget) {
+            this->interval *= share / this->budget;
+            std::cout << "Checkpoint interval increased to " << this->interval << " s\n";
+        }
+    }
+
+    if (this->stage == Stage::Idle && secondsSince(this->lastCheckpoint) >= this->interval) {
+        this->submitCopy();
+    }
+
+    this->overhead += secondsSince(start);
+}
+
+void Checkpointer::finish() {
+    if (!this->enabled()) { return; }
+
+    if (this->stage == Stage::Writing) {
+        this->writer.get();
+        this->stage = Stage::Idle;
+    }
+
+    if (this->stage == Stage::Idle) {
+        this->submitCopy();
+    }
+
+    this->device.waitForFences(1, &*this->fence, true, std::numeric_limits<uint64_t>::max());
+    this->startWrite();
+    this->writer.get();
+    this->stage = Stage::Idle;
+
+    std::cout << "Final checkpoint written to " << this->path << " (total checkpoint overhead "
+        << 100.0 * this->overhead / secondsSince(this->started) << "% of render time)\n";
+}
+
+void Checkpointer::submitCopy() {
+    this->device.resetFences(1, &*this->fence);
+
+    auto submitInfo = vk::SubmitInfo(
+        0,                                  // waitSemaphoreCount
+        nullptr,                            // pWaitSemaphores
+        nullptr,                            // pWaitDstStageMask
+        1,                                  // commandBufferCount
+        &*this->cmd,                        // pCommandBuffers
+        0,                                  // signalSemaphoreCount
+        nullptr                             // pSignalSemaphores
+    );
+
+    this->queues.compute.submit(1, &submitInfo, *this->fence);
+    this->stage = Stage::Copying;
+    this->lastCheckpoint = Clock::now();
+}
+
+void Checkpointer::startWrite() {
+    auto header = CheckpointHeader();
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header.format = uint32_t(this->format);
+    header.width = this->extent.width;
+    header.height = this->extent.height;
+    header.imageSize = this->imageSize;
+    header.stateSize = this->stateSize;
+
+    // The staging buffer is not touched by the device until the write finishes.
+    this->writer = std::async(std::launch::async, writeCheckpoint, this->path, header, this->mapped);
+    this->stage = Stage::Writing;
+}
+
+double Checkpointer::copyDuration() {
+    if (!this->queryPool) { return 0.0; }
+
+    uint64_t timestamps[2] = { 0, 0 };
+    auto result = this->device.getQueryPoolResults(*this->queryPool, 0, 2, sizeof(timestamps), timestamps,
+        sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+
+    if (result != vk::Result::eSuccess) { return 0.0; }
+
+    return double(timestamps[1] - timestamps[0]) * this->timestampPeriod * 1e-9;
+}
+
+} // namespace app
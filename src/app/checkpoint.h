@@ -0,0 +1,88 @@
+#pragma once
+
+#include "deps.h"
+#include "device.h"
+#include "options.h"
+
+#include <chrono>
+#include <future>
+#include <string>
+
+namespace app {
+
+/// Periodically stores the render progress on disk so a long render can be resumed.
+///
+/// A checkpoint consists of the accumulated work image and the contents of the state buffer
+/// (which holds the work counter and with it the progress of the random sequences).
+/// Both are copied to a persistently mapped staging buffer by a prerecorded command buffer
+/// submitted after a frame. The file is then written from a background thread, so neither
+/// the queue nor the render loop waits for the disk.
+class Checkpointer {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    enum class Stage {
+        Idle,
+        Copying,
+        Writing,
+    };
+
+    vk::Device device;
+    Queues queues;
+    vk::Image workImage;
+    vk::Buffer stateBuffer;
+    vk::Format format;
+    vk::Extent2D extent;
+    size_t imageSize;
+    size_t stateSize;
+
+    vk::UniqueDeviceMemory stagingMemory;
+    vk::UniqueBuffer staging;
+    void* mapped;
+    vk::UniqueCommandBuffer cmd;
+    vk::UniqueFence fence;
+    vk::UniqueQueryPool queryPool;
+    double timestampPeriod;
+
+    std::string path;
+    double interval;
+    double budget;
+
+    Stage stage;
+    std::future<double> writer;
+    Clock::time_point started;
+    Clock::time_point lastCheckpoint;
+    double overhead;
+    size_t count;
+
+public:
+    static Checkpointer create(vk::Device device, vk::PhysicalDevice physical, vk::CommandPool pool,
+        const Queues& queues, vk::Image workImage, vk::Format format, vk::Extent2D extent,
+        vk::Buffer stateBuffer, size_t stateSize, const Options& options);
+
+    bool enabled() const { return !this->path.empty(); }
+
+    /// Load a checkpoint file into the work image and the state buffer.
+    ///
+    /// Must be called before any frame is submitted.
+    void restore(vk::CommandPool pool);
+
+    /// Advance the checkpointing state machine. Called once per frame, after the frame is submitted.
+    void update();
+
+    /// Wait for pending checkpoints and store the final progress. The device must be idle.
+    void finish();
+
+private:
+    Checkpointer(vk::Device device, const Queues& queues, vk::Image workImage, vk::Buffer stateBuffer,
+        vk::Format format, vk::Extent2D extent, size_t imageSize, size_t stateSize,
+        vk::UniqueDeviceMemory&& stagingMemory, vk::UniqueBuffer&& staging, void* mapped,
+        vk::UniqueCommandBuffer&& cmd, vk::UniqueFence&& fence, vk::UniqueQueryPool&& queryPool,
+        double timestampPeriod, const Options& options);
+
+    void submitCopy();
+    void startWrite();
+    double copyDuration();
+};
+
+} // namespace app
@@ -32,7 +32,9 @@ vk::PhysicalDevice choosePhysicalDevice(vk::Instance instance, vk::SurfaceKHR su
     return devices[DEVICE_INDEX];
 }
 
-std::tuple<vk::UniqueDevice, Queues> createDevice(vk::PhysicalDevice physical, vk::SurfaceKHR surface) {
+std::tuple<vk::UniqueDevice, Queues> createDevice(vk::PhysicalDevice physical, vk::SurfaceKHR surface,
+    bool asyncCompute)
+{
     const auto deviceExtensions = make_array(
         VK_KHR_SWAPCHAIN_EXTENSION_NAME
     );
@@ -40,20 +42,41 @@ std::tuple<vk::UniqueDevice, Queues> createDevice(vk::PhysicalDevice physical, v
     const auto queueFamilies = physical.getQueueFamilyProperties();
     const auto queueFamilyIndices = boost::irange(size_t(0), queueFamilies.size());
 
-    const auto computeQueue = std::find_if(queueFamilyIndices.begin(), queueFamilyIndices.end(),
+    auto computeQueue = std::find_if(queueFamilyIndices.begin(), queueFamilyIndices.end(),
         [&](size_t i){ return queueFamilies[i].queueFlags & vk::QueueFlagBits::eCompute; });
 
     if (computeQueue == queueFamilyIndices.end()) {
         throw std::runtime_error("no queue with compute capability");
     }
 
+    if (asyncCompute) {
+        const auto asyncQueue = std::find_if(queueFamilyIndices.begin(), queueFamilyIndices.end(),
+            [&](size_t i){
+                return (queueFamilies[i].queueFlags & vk::QueueFlagBits::eCompute)
+                    && !(queueFamilies[i].queueFlags & vk::QueueFlagBits::eGraphics);
+            });
+
+        if (asyncQueue != queueFamilyIndices.end()) {
+            computeQueue = asyncQueue;
+        } else {
+            std::cout << "No async compute queue family, tracing on the first compute queue family\n";
+        }
+    }
+
+    // The traced image is blitted to the swapchain, which needs a graphics queue.
     const auto presentQueue = std::find_if(queueFamilyIndices.begin(), queueFamilyIndices.end(),
-        [&](size_t i){ return physical.getSurfaceSupportKHR(i, surface); });
+        [&](size_t i){
+            return (queueFamilies[i].queueFlags & vk::QueueFlagBits::eGraphics)
+                && physical.getSurfaceSupportKHR(i, surface);
+        });
 
     if (presentQueue == queueFamilyIndices.end()) {
-        throw std::runtime_error("no queue with present capability");
+        throw std::runtime_error("no queue with graphics and present capability");
     }
 
+    std::cout << "Tracing on queue family " << *computeQueue << ", presenting on queue family " << *presentQueue
+        << "\n";
+
     const auto queuePriorities = make_array(1.0f);
     auto queueInfos = std::vector<vk::DeviceQueueCreateInfo>();
 
@@ -143,29 +166,26 @@ std::tuple<vk::UniqueSwapchainKHR, vk::SurfaceFormatKHR, vk::Extent2D> createSwa
     auto presentMode = choosePresentMode(physical.getSurfacePresentModesKHR(surface));
     auto extent = chooseExtent(capabilities, windowWidth, windowHeight);
 
-    vk::SwapchainCreateInfoKHR info;
-    if (queues.compute == queues.present) {
-        info = vk::SwapchainCreateInfoKHR(
-            vk::SwapchainCreateFlagBitsKHR(),       // flags
-            surface,                                // surface
-            imageCount,                             // minImageCount
-            format.format,                          // imageFormat
-            format.colorSpace,                      // imageColorSpace
-            extent,                                 // imageExtent
-            1,                                      // imageArrayLayers
-            vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferDst,   // imageUsage
-            vk::SharingMode::eExclusive,            // imageSharingMode
-            0,                                      // queueFamilyIndexCount
-            nullptr,                                // pQueueFamilyIndices
-            capabilities.currentTransform,          // preTransform
-            vk::CompositeAlphaFlagBitsKHR::eOpaque, // compositeAlpha
-            presentMode,                            // presentMode
-            true,                                   // clipped
-            nullptr                                 // oldSwapchain
-        );
-    } else {
-        throw std::runtime_error("unimplemented");
-    }
+    // With separate queue families the images are only touched by the present queue, so they
+    // can stay exclusive to it. The compute queue hands over the traced image instead, see `Presenter`.
+    const auto info = vk::SwapchainCreateInfoKHR(
+        vk::SwapchainCreateFlagBitsKHR(),       // flags
+        surface,                                // surface
+        imageCount,                             // minImageCount
+        format.format,                          // imageFormat
+        format.colorSpace,                      // imageColorSpace
+        extent,                                 // imageExtent
+        1,                                      // imageArrayLayers
+        vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferDst,   // imageUsage
+        vk::SharingMode::eExclusive,            // imageSharingMode
+        0,                                      // queueFamilyIndexCount
+        nullptr,                                // pQueueFamilyIndices
+        capabilities.currentTransform,          // preTransform
+        vk::CompositeAlphaFlagBitsKHR::eOpaque, // compositeAlpha
+        presentMode,                            // presentMode
+        true,                                   // clipped
+        nullptr                                 // oldSwapchain
+    );
 
     auto swapchain = device.createSwapchainKHRUnique(info, nullptr);
     return std::make_tuple(std::move(swapchain), format, extent);
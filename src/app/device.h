@@ -16,8 +16,12 @@ struct Queues {
 
 vk::PhysicalDevice choosePhysicalDevice(vk::Instance instance, vk::SurfaceKHR surface);
 
-std::tuple<vk::UniqueDevice, Queues> createDevice(vk::PhysicalDevice physical, vk::SurfaceKHR surface);
+/// With `asyncCompute`, tracing goes to a compute queue family without graphics support if the device has one.
+/// The present queue family is always able to blit, so it can copy the traced image to the swapchain.
+std::tuple<vk::UniqueDevice, Queues> createDevice(vk::PhysicalDevice physical, vk::SurfaceKHR surface,
+    bool asyncCompute);
 
+/// The swapchain images are only ever used by the present queue, see `Presenter`.
 std::tuple<vk::UniqueSwapchainKHR, vk::SurfaceFormatKHR, vk::Extent2D> createSwapchain(
     vk::PhysicalDevice physical, vk::Device device, vk::SurfaceKHR surface,
     const Queues& queues, uint32_t windowWidth, uint32_t windowHeight);
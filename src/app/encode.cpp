@@ -0,0 +1,399 @@
+#include "encode.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace app {
+
+namespace {
+
+float halfToFloat(uint16_t half) {
+    uint32_t sign = uint32_t(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    uint32_t bits;
+
+    if (exponent == 0x1f) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else if (exponent != 0) {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        bits = sign;
+    } else {
+        // Subnormal halves are normal floats.
+        exponent = 113;
+        while ((mantissa & 0x400) == 0) {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+/// Channel `c` of texel `i`.
+float channel(const void* texels, bool halfFloat, size_t i, size_t c) {
+    if (halfFloat) {
+        return halfToFloat(static_cast<const uint16_t*>(texels)[4 * i + c]);
+    }
+
+    return static_cast<const float*>(texels)[4 * i + c];
+}
+
+uint8_t toSrgb8(float linear) {
+    float x = std::clamp(linear, 0.0f, 1.0f);
+    float srgb = x <= 0.0031308f ? 12.92f * x : 1.055f * std::pow(x, 1.0f / 2.4f) - 0.055f;
+    return uint8_t(srgb * 255.0f + 0.5f);
+}
+
+const std::array<uint32_t, 256>& crcTable() {
+    static const auto table = [] {
+        auto result = std::array<uint32_t, 256>();
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            }
+            result[n] = c;
+        }
+        return result;
+    }();
+
+    return table;
+}
+
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+    const auto& table = crcTable();
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+uint32_t adler32(const uint8_t* data, size_t size) {
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i < size; i++) {
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+void appendBigEndian(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(uint8_t(value >> 24));
+    out.push_back(uint8_t(value >> 16));
+    out.push_back(uint8_t(value >> 8));
+    out.push_back(uint8_t(value));
+}
+
+void appendChunk(std::vector<uint8_t>& out, const char type[4], const std::vector<uint8_t>& data) {
+    appendBigEndian(out, uint32_t(data.size()));
+
+    size_t typeStart = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+
+    appendBigEndian(out, crc32(out.data() + typeStart, out.size() - typeStart));
+}
+
+/// Encode as PNG. The image data is stored in uncompressed deflate blocks: compressing
+/// would cost more time than the disk saves, and frames are meant to be post-processed anyway.
+std::vector<uint8_t> encodePng(const void* texels, bool halfFloat, uint32_t width, uint32_t height) {
+    // Each row starts with the filter type, 0 for none.
+    auto raw = std::vector<uint8_t>();
+    raw.reserve(size_t(height) * (1 + 3 * size_t(width)));
+
+    for (uint32_t y = 0; y < height; y++) {
+        raw.push_back(0);
+        for (uint32_t x = 0; x < width; x++) {
+            size_t i = size_t(y) * width + x;
+            for (size_t c = 0; c < 3; c++) {
+                raw.push_back(toSrgb8(channel(texels, halfFloat, i, c)));
+            }
+        }
+    }
+
+    auto zlib = std::vector<uint8_t> { 0x78, 0x01 };
+    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+
+    const size_t MAX_BLOCK = 65535;
+    for (size_t offset = 0; ; offset += MAX_BLOCK) {
+        size_t size = std::min(MAX_BLOCK, raw.size() - offset);
+        bool last = offset + size >= raw.size();
+
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back(uint8_t(size));
+        zlib.push_back(uint8_t(size >> 8));
+        zlib.push_back(uint8_t(~size));
+        zlib.push_back(uint8_t(~size >> 8));
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + size);
+
+        if (last) { break; }
+    }
+
+    appendBigEndian(zlib, adler32(raw.data(), raw.size()));
+
+    auto header = std::vector<uint8_t>();
+    appendBigEndian(header, width);
+    appendBigEndian(header, height);
+    header.push_back(8);     // bit depth
+    header.push_back(2);     // color type: RGB
+    header.push_back(0);     // compression
+    header.push_back(0);     // filter
+    header.push_back(0);     // interlace
+
+    auto png = std::vector<uint8_t> { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    appendChunk(png, "IHDR", header);
+    appendChunk(png, "IDAT", zlib);
+    appendChunk(png, "IEND", {});
+
+    return png;
+}
+
+/// Encode as PFM, which stores the rows bottom to top.
+std::vector<uint8_t> encodePfm(const void* texels, bool halfFloat, uint32_t width, uint32_t height) {
+    // A negative scale marks little endian data.
+    auto header = "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n";
+
+    auto pfm = std::vector<uint8_t>(header.begin(), header.end());
+    pfm.resize(header.size() + size_t(width) * height * 3 * sizeof(float));
+
+    auto out = pfm.data() + header.size();
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            size_t i = size_t(height - 1 - y) * width + x;
+            for (size_t c = 0; c < 3; c++) {
+                float value = channel(texels, halfFloat, i, c);
+                std::memcpy(out, &value, sizeof(value));
+                out += sizeof(value);
+            }
+        }
+    }
+
+    return pfm;
+}
+
+} // namespace
+
+ImageFileFormat imageFileFormat(const std::string& path) {
+    auto dot = path.rfind('.');
+    auto extension = dot == std::string::npos ? std::string() : path.substr(dot + 1);
+
+    if (extension == "png") { return ImageFileFormat::Png; }
+    if (extension == "pfm") { return ImageFileFormat::Pfm; }
+    if (extension == "raw") { return ImageFileFormat::Raw; }
+
+    throw std::runtime_error("unsupported image file extension in " + path + ", expected .png, .pfm or .raw");
+}
+
+FloatImage readPfm(const std::string& path) {
+    auto file = std::ifstream(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("failed to open " + path);
+    }
+
+    auto magic = std::string();
+    auto image = FloatImage();
+    double scale = 0.0;
+    file >> magic >> image.width >> image.height >> scale;
+    file.get();
+
+    if (!file || (magic != "PF" && magic != "Pf") || image.width == 0 || image.height == 0) {
+        throw std::runtime_error("invalid PFM header in " + path);
+    }
+
+    // A negative scale marks little endian data.
+    if (scale >= 0.0) {
+        throw std::runtime_error("big endian PFM files aren't supported: " + path);
+    }
+
+    const size_t channels = magic == "PF" ? 3 : 1;
+    auto row = std::vector<float>(size_t(image.width) * channels);
+    image.texels.resize(size_t(image.width) * image.height * 3);
+
+    // Rows are stored bottom to top.
+    for (uint32_t y = 0; y < image.height; y++) {
+        file.read(reinterpret_cast<char*>(row.data()), std::streamsize(row.size() * sizeof(float)));
+        if (!file) {
+            throw std::runtime_error("PFM file is truncated: " + path);
+        }
+
+        float* out = &image.texels[size_t(image.height - 1 - y) * image.width * 3];
+        for (uint32_t x = 0; x < image.width; x++) {
+            for (size_t c = 0; c < 3; c++) {
+                out[3 * x + c] = row[x * channels + (channels == 3 ? c : 0)];
+            }
+        }
+    }
+
+    return image;
+}
+
+FloatImage readHdr(const std::string& path) {
+    auto file = std::ifstream(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("failed to open " + path);
+    }
+
+    auto line = std::string();
+    std::getline(file, line);
+    if (line != "#?RADIANCE" && line != "#?RGBE") {
+        throw std::runtime_error("invalid Radiance HDR header in " + path);
+    }
+
+    // Header lines up to an empty one, then the resolution.
+    while (std::getline(file, line) && !line.empty()) {
+        if (line.rfind("FORMAT=", 0) == 0 && line != "FORMAT=32-bit_rle_rgbe") {
+            throw std::runtime_error("only RGBE Radiance HDR files are supported: " + path);
+        }
+    }
+
+    auto image = FloatImage();
+    auto yAxis = std::string();
+    auto xAxis = std::string();
+    file >> yAxis >> image.height >> xAxis >> image.width;
+    file.get();
+
+    if (!file || image.width == 0 || image.height == 0) {
+        throw std::runtime_error("invalid Radiance HDR resolution in " + path);
+    }
+    if (yAxis != "-Y" || xAxis != "+X") {
+        throw std::runtime_error("only top to bottom, left to right Radiance HDR files are supported: " + path);
+    }
+
+    const uint32_t width = image.width;
+    auto rgbe = std::vector<uint8_t>(size_t(width) * 4);
+    auto planar = std::vector<uint8_t>(size_t(width) * 4);
+    image.texels.resize(size_t(width) * image.height * 3);
+
+    auto truncated = [&] { return std::runtime_error("Radiance HDR file is truncated: " + path); };
+
+    for (uint32_t y = 0; y < image.height; y++) {
+        uint8_t start[4];
+        if (!file.read(reinterpret_cast<char*>(start), 4)) {
+            throw truncated();
+        }
+
+        // Scanlines of the new run length encoding start with 2, 2 and the width, and store each of the four
+        // channels in turn. Anything else is a flat scanline.
+        const uint32_t encodedWidth = (uint32_t(start[2]) << 8) | start[3];
+        if (width >= 8 && width < 0x8000 && start[0] == 2 && start[1] == 2 && encodedWidth == width) {
+            for (size_t c = 0; c < 4; c++) {
+                uint8_t* out = &planar[c * width];
+                size_t x = 0;
+
+                while (x < width) {
+                    int count = file.get();
+                    if (count == EOF) {
+                        throw truncated();
+                    }
+
+                    if (count > 128) {
+                        count -= 128;
+                        int value = file.get();
+                        if (value == EOF || x + size_t(count) > width) {
+                            throw truncated();
+                        }
+                        std::memset(out + x, value, size_t(count));
+                    } else {
+                        if (count == 0 || x + size_t(count) > width
+                            || !file.read(reinterpret_cast<char*>(out + x), count)) {
+                            throw truncated();
+                        }
+                    }
+
+                    x += size_t(count);
+                }
+            }
+
+            for (uint32_t x = 0; x < width; x++) {
+                for (size_t c = 0; c < 4; c++) {
+                    rgbe[4 * x + c] = planar[c * width + x];
+                }
+            }
+        } else {
+            std::memcpy(rgbe.data(), start, 4);
+            if (!file.read(reinterpret_cast<char*>(rgbe.data() + 4), std::streamsize(rgbe.size() - 4))) {
+                throw truncated();
+            }
+        }
+
+        float* out = &image.texels[size_t(y) * width * 3];
+        for (uint32_t x = 0; x < width; x++) {
+            const uint8_t* texel = &rgbe[4 * x];
+            float scale = texel[3] == 0 ? 0.0f : std::ldexp(1.0f, int(texel[3]) - (128 + 8));
+            for (size_t c = 0; c < 3; c++) {
+                out[3 * x + c] = texel[3] == 0 ? 0.0f : (float(texel[c]) + 0.5f) * scale;
+            }
+        }
+    }
+
+    return image;
+}
+
+double relativeError(const void* texels, bool halfFloat, const FloatImage& reference) {
+    const size_t count = size_t(reference.width) * reference.height;
+    double sum = 0.0;
+
+    for (size_t i = 0; i < count; i++) {
+        for (size_t c = 0; c < 3; c++) {
+            double expected = reference.texels[3 * i + c];
+            double difference = double(channel(texels, halfFloat, i, c)) - expected;
+            sum += difference * difference / (expected * expected + 0.01);
+        }
+    }
+
+    return count > 0 ? sum / double(3 * count) : 0.0;
+}
+
+std::string numberedPath(const std::string& path, uint64_t index) {
+    auto number = std::to_string(index);
+    number.insert(0, number.size() < 6 ? 6 - number.size() : 0, '0');
+
+    auto dot = path.rfind('.');
+    auto slash = path.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return path + "_" + number;
+    }
+
+    return path.substr(0, dot) + "_" + number + path.substr(dot);
+}
+
+size_t writeImage(const std::string& path, ImageFileFormat format, const void* texels, bool halfFloat,
+    uint32_t width, uint32_t height)
+{
+    auto file = std::ofstream(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        throw std::runtime_error("failed to open " + path);
+    }
+
+    size_t size;
+
+    if (format == ImageFileFormat::Raw) {
+        size = size_t(width) * height * 4 * (halfFloat ? 2 : 4);
+        file.write(static_cast<const char*>(texels), size);
+    } else {
+        auto data = format == ImageFileFormat::Png
+            ? encodePng(texels, halfFloat, width, height)
+            : encodePfm(texels, halfFloat, width, height);
+        size = data.size();
+        file.write(reinterpret_cast<const char*>(data.data()), size);
+    }
+
+    if (!file) {
+        throw std::runtime_error("failed to write " + path);
+    }
+
+    return size;
+}
+
+} // namespace app
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace app {
+
+/// An RGB image with 32 bit float channels.
+struct FloatImage {
+    uint32_t width;
+    uint32_t height;
+
+    /// RGB, top row first.
+    std::vector<float> texels;
+};
+
+/// File formats frames can be written in.
+enum class ImageFileFormat {
+    /// 8 bit sRGB, the colors are clamped to [0, 1].
+    Png,
+
+    /// 32 bit float linear RGB, the Portable Float Map format.
+    Pfm,
+
+    /// The texels of the work image as they are, without any header.
+    Raw,
+};
+
+/// Pick the file format from the extension of `path`. Throws for unknown extensions.
+ImageFileFormat imageFileFormat(const std::string& path);
+
+/// `path` with `index` inserted before the extension, e.g. `out/frame.png` becomes `out/frame_000042.png`.
+std::string numberedPath(const std::string& path, uint64_t index);
+
+/// Write an image of RGBA texels with 16 or 32 bit float channels (`halfFloat`) to `path`.
+///
+/// The alpha channel (the sample count of the work image) is dropped by all formats except `Raw`.
+/// Returns the number of bytes written. Throws if the file can't be written.
+size_t writeImage(const std::string& path, ImageFileFormat format, const void* texels, bool halfFloat,
+    uint32_t width, uint32_t height);
+
+/// Read a little endian color or grayscale PFM file. Throws if it can't be read.
+FloatImage readPfm(const std::string& path);
+
+/// Read a Radiance HDR (RGBE) file, flat or run length encoded. Throws if it can't be read.
+FloatImage readHdr(const std::string& path);
+
+/// Relative mean squared error of an image of RGBA texels with 16 or 32 bit float channels (`halfFloat`),
+/// against a `reference` of the same size. The squared difference of each channel is divided by the squared
+/// reference plus 0.01, so dark and bright regions count alike.
+double relativeError(const void* texels, bool halfFloat, const FloatImage& reference);
+
+} // namespace app
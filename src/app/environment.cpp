@@ -0,0 +1,203 @@
+#include "environment.h"
+
+#include "shader.h"
+#include "util.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+
+namespace app {
+
+namespace {
+
+const double PI = 3.14159265358979323846;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool hasExtension(const std::string& path, const std::string& extension) {
+    return path.size() >= extension.size()
+        && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+FloatImage readEnvironment(const std::string& path) {
+    if (hasExtension(path, ".hdr")) {
+        return readHdr(path);
+    }
+    if (hasExtension(path, ".pfm")) {
+        return readPfm(path);
+    }
+
+    throw std::runtime_error("unknown environment map format, expected .hdr or .pfm: " + path);
+}
+
+/// Luminance as computed by `luminance` in `shader/main.comp`.
+double luminance(const float* rgb) {
+    return 0.2126 * rgb[0] + 0.7152 * rgb[1] + 0.0722 * rgb[2];
+}
+
+} // namespace
+
+void buildAliasTable(const double* weights, size_t count, AliasEntry* table) {
+    double sum = 0.0;
+    for (size_t i = 0; i < count; i++) {
+        sum += weights[i];
+    }
+
+    if (!(sum > 0.0)) {
+        for (size_t i = 0; i < count; i++) {
+            table[i] = AliasEntry { 1.0f, uint32_t(i) };
+        }
+        return;
+    }
+
+    // Scale the weights to an average of one, then repeatedly fill the entry of a weight below one with
+    // the excess of a weight above one.
+    auto scaled = std::vector<double>(count);
+    auto small = std::vector<uint32_t>();
+    auto large = std::vector<uint32_t>();
+
+    for (size_t i = 0; i < count; i++) {
+        scaled[i] = weights[i] * double(count) / sum;
+        (scaled[i] < 1.0 ? small : large).push_back(uint32_t(i));
+    }
+
+    while (!small.empty() && !large.empty()) {
+        uint32_t less = small.back();
+        uint32_t more = large.back();
+        small.pop_back();
+
+        table[less] = AliasEntry { float(scaled[less]), more };
+        scaled[more] -= 1.0 - scaled[less];
+
+        if (scaled[more] < 1.0) {
+            large.pop_back();
+            small.push_back(more);
+        }
+    }
+
+    // What is left is one up to rounding.
+    for (uint32_t i : small) {
+        table[i] = AliasEntry { 1.0f, i };
+    }
+    for (uint32_t i : large) {
+        table[i] = AliasEntry { 1.0f, i };
+    }
+}
+
+EnvironmentTables buildEnvironmentTables(const FloatImage& image, float scale, size_t threadCount) {
+    const size_t width = image.width;
+    const size_t height = image.height;
+
+    auto tables = EnvironmentTables();
+    tables.header = EnvironmentHeader { image.width, image.height, 0.0f, 0 };
+    tables.texels.resize(width * height);
+    tables.alias.resize(height + width * height);
+
+    auto weights = std::vector<double>(width * height);
+    auto rowWeights = std::vector<double>(height);
+
+    // Each thread takes every `threadCount`-th row: weighs its texels and builds its conditional table.
+    auto buildRows = [&](size_t first) {
+        for (size_t y = first; y < height; y += threadCount) {
+            double sinTheta = std::sin(PI * (double(y) + 0.5) / double(height));
+            double rowWeight = 0.0;
+
+            for (size_t x = 0; x < width; x++) {
+                size_t i = y * width + x;
+                EnvironmentTexel& texel = tables.texels[i];
+                for (size_t c = 0; c < 3; c++) {
+                    texel.radiance[c] = image.texels[3 * i + c] * scale;
+                }
+
+                weights[i] = std::max(luminance(texel.radiance), 0.0) * sinTheta;
+                rowWeight += weights[i];
+            }
+
+            rowWeights[y] = rowWeight;
+            buildAliasTable(&weights[y * width], width, &tables.alias[height + y * width]);
+        }
+    };
+
+    threadCount = std::max<size_t>(1, std::min(threadCount, height));
+    auto threads = std::vector<std::thread>();
+    for (size_t t = 1; t < threadCount; t++) {
+        threads.emplace_back(buildRows, t);
+    }
+    buildRows(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    buildAliasTable(rowWeights.data(), height, tables.alias.data());
+
+    double total = 0.0;
+    for (double rowWeight : rowWeights) {
+        total += rowWeight;
+    }
+
+    // The shader divides by the probability of the picked texel rather than recomputing it from the luminance,
+    // so it matches the tables exactly.
+    for (size_t i = 0; i < width * height; i++) {
+        tables.texels[i].probability = total > 0.0 ? float(weights[i] / total) : 0.0f;
+    }
+    tables.header.total = float(total);
+
+    return tables;
+}
+
+EnvironmentLight EnvironmentLight::create(vk::Device device, vk::PhysicalDevice physical, vk::CommandPool pool,
+    const Queues& queues, const Options& options)
+{
+    auto light = EnvironmentLight();
+    light.active = !options.environmentPath.empty();
+
+    if (!light.active) {
+        std::tie(light.texelsMemory, light.texels) = createBuffer(device, physical,
+            sizeof(EnvironmentHeader) + sizeof(EnvironmentTexel));
+        std::tie(light.aliasMemory, light.alias) = createBuffer(device, physical, sizeof(AliasEntry));
+        return light;
+    }
+
+    auto image = readEnvironment(options.environmentPath);
+
+    const size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+    auto start = std::chrono::steady_clock::now();
+    auto tables = buildEnvironmentTables(image, float(options.environmentScale), threadCount);
+    double buildSeconds = secondsSince(start);
+
+    // The texels follow the header in one buffer.
+    const size_t texelsSize = tables.texels.size() * sizeof(EnvironmentTexel);
+    auto texelData = std::vector<uint8_t>(sizeof(EnvironmentHeader) + texelsSize);
+    std::memcpy(texelData.data(), &tables.header, sizeof(EnvironmentHeader));
+    std::memcpy(texelData.data() + sizeof(EnvironmentHeader), tables.texels.data(), texelsSize);
+    const size_t aliasSize = tables.alias.size() * sizeof(AliasEntry);
+
+    std::tie(light.texelsMemory, light.texels) = createBuffer(device, physical, texelData.size());
+    std::tie(light.aliasMemory, light.alias) = createBuffer(device, physical, aliasSize);
+    uploadBuffer(device, physical, pool, queues, *light.texels, texelData.data(), texelData.size());
+    uploadBuffer(device, physical, pool, queues, *light.alias, tables.alias.data(), aliasSize);
+
+    std::cout << "Environment map " << options.environmentPath << ": " << image.width << "x" << image.height
+        << ", " << (texelData.size() + aliasSize) / 1024 << " KiB, alias tables built in " << buildSeconds * 1000.0
+        << " ms on " << threadCount << " threads\n";
+
+    if (!(tables.header.total > 0.0f)) {
+        std::cout << "Environment map is black, it won't be sampled\n";
+    }
+
+    return light;
+}
+
+std::vector<vk::Buffer> EnvironmentLight::bindings() const {
+    return std::vector<vk::Buffer> { *this->texels, *this->alias };
+}
+
+} // namespace app
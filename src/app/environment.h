@@ -0,0 +1,86 @@
+#pragma once
+
+#include "deps.h"
+#include "device.h"
+#include "encode.h"
+#include "options.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace app {
+
+/// Start of the `EnvironmentMap` buffer in `shader/main.comp`, followed by the texels.
+struct EnvironmentHeader {
+    uint32_t width;
+    uint32_t height;
+
+    /// Sum of the sampling weights of all texels, zero for a black map which isn't sampled.
+    float total;
+    uint32_t padding;
+};
+
+/// A texel of the environment map: the radiance, and the probability of sampling the texel.
+struct EnvironmentTexel {
+    float radiance[3];
+    float probability;
+};
+
+/// An entry of an alias table, laid out as `AliasEntry` in `shader/main.comp`.
+///
+/// Index `i` is picked uniformly, and kept if a uniform number is below `threshold`, otherwise replaced by
+/// `alias`. The table thus picks every index with a probability proportional to its weight in constant time.
+struct AliasEntry {
+    float threshold;
+    uint32_t alias;
+};
+
+/// Build the alias table of `count` weights into `table` (Vose's method). All-zero weights pick uniformly.
+void buildAliasTable(const double* weights, size_t count, AliasEntry* table);
+
+/// An environment map prepared for sampling by luminance.
+struct EnvironmentTables {
+    EnvironmentHeader header;
+    std::vector<EnvironmentTexel> texels;
+
+    /// The marginal table over the rows, followed by the conditional table over the texels of each row.
+    std::vector<AliasEntry> alias;
+};
+
+/// Weight each texel of an equirectangular `image` by its luminance times the solid angle it covers, and
+/// build the alias tables for picking a row and then a texel of the row. The rows are split among `threadCount`
+/// threads. The radiance is multiplied by `scale`.
+EnvironmentTables buildEnvironmentTables(const FloatImage& image, float scale, size_t threadCount);
+
+/// Lights the scene with an equirectangular HDR image at infinity, in place of the constant background.
+///
+/// The rows of the image go from up (-y) to down (+y) and the columns around the y axis. The texels and the
+/// alias tables are uploaded once into storage buffers. Rays escaping the scene look the radiance up, and
+/// every shading point also samples a direction from the tables (see `ENVIRONMENT` in `shader/main.comp`),
+/// the two combined with multiple importance sampling.
+class EnvironmentLight {
+private:
+    vk::UniqueDeviceMemory texelsMemory;
+    vk::UniqueBuffer texels;
+    vk::UniqueDeviceMemory aliasMemory;
+    vk::UniqueBuffer alias;
+    bool active;
+
+    EnvironmentLight() = default;
+
+public:
+    /// Load `Options::environmentPath`. Without one, the buffers bound to the shader hold a single unused element.
+    static EnvironmentLight create(vk::Device device, vk::PhysicalDevice physical, vk::CommandPool pool,
+        const Queues& queues, const Options& options);
+
+    EnvironmentLight(EnvironmentLight&&) = default;
+    EnvironmentLight& operator=(EnvironmentLight&&) = default;
+
+    bool enabled() const { return this->active; }
+
+    /// The texels and the alias tables, bound right after the guide.
+    std::vector<vk::Buffer> bindings() const;
+};
+
+} // namespace app
@@ -0,0 +1,512 @@
+#include "guiding.h"
+#include "shader.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <tuple>
+
+namespace app {
+
+namespace {
+
+/// The samples follow a count padded to the alignment of the records, see `GuideSamples` in `shader/main.comp`.
+const size_t SAMPLES_OFFSET = 4 * sizeof(uint32_t);
+
+/// A spatial leaf is split when it got more than `GUIDE_SPLIT * sqrt(frames)` samples in an iteration of
+/// `frames` frames. The paper uses 12000 with every pixel recording, the shader records every fourth.
+const double GUIDE_SPLIT = 3000.0;
+const uint32_t GUIDE_SPATIAL_DEPTH = 48;
+
+/// A quadrant is split when it holds more than this share of the energy of its quadtree.
+const float GUIDE_QUAD_SHARE = 0.01f;
+const uint32_t GUIDE_QUAD_DEPTH = 16;
+
+/// Leaves with fewer samples in the last iteration are left to the material.
+const size_t GUIDE_MIN_SAMPLES = 128;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// Whether `value` is neither infinite nor NaN, by its exponent bits, as `std::isfinite` is folded to true
+/// when the build assumes finite math.
+bool isFinite(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return (bits & 0x7f800000) != 0x7f800000;
+}
+
+float totalEnergy(const GuideQuadNode& node) {
+    return node.energy[0] + node.energy[1] + node.energy[2] + node.energy[3];
+}
+
+/// Rebuild a quadtree from the energy splatted into `old`, breadth first, so a tree running out of its budget
+/// of `maxNodes` loses the finest levels. Quadrants which weren't split in `old` share their energy evenly.
+std::vector<GuideQuadNode> rebuildQuadtree(const std::vector<GuideQuadNode>& old, size_t maxNodes) {
+    struct Pending {
+        uint32_t node;
+        uint32_t old;
+        uint32_t depth;
+    };
+
+    auto result = std::vector<GuideQuadNode> { GuideQuadNode { {}, {} } };
+    std::copy(std::begin(old[0].energy), std::end(old[0].energy), result[0].energy);
+
+    const float total = totalEnergy(old[0]);
+    if (!(total > 0.0f)) {
+        return result;
+    }
+
+    auto queue = std::deque<Pending> { Pending { 0, 0, 0 } };
+
+    while (!queue.empty()) {
+        auto pending = queue.front();
+        queue.pop_front();
+
+        for (size_t quadrant = 0; quadrant < 4; quadrant++) {
+            float energy = result[pending.node].energy[quadrant];
+
+            if (energy <= GUIDE_QUAD_SHARE * total || pending.depth + 1 >= GUIDE_QUAD_DEPTH
+                || result.size() >= maxNodes)
+            {
+                continue;
+            }
+
+            uint32_t oldChild = pending.old != GuideSpatialNode::NONE ? old[pending.old].children[quadrant] : 0;
+            auto child = GuideQuadNode { {}, {} };
+
+            if (oldChild != 0) {
+                std::copy(std::begin(old[oldChild].energy), std::end(old[oldChild].energy), child.energy);
+            } else {
+                std::fill(std::begin(child.energy), std::end(child.energy), 0.25f * energy);
+            }
+
+            auto index = uint32_t(result.size());
+            result.push_back(child);
+            result[pending.node].children[quadrant] = index;
+
+            queue.push_back(Pending { index, oldChild != 0 ? oldChild : GuideSpatialNode::NONE, pending.depth + 1 });
+        }
+    }
+
+    return result;
+}
+
+} // namespace
+
+GuideTree::GuideTree(const std::vector<Bounds>& bounds):
+    boundsMin(),
+    boundsSize(),
+    nodes { GuideSpatialNode { GuideSpatialNode::LEAF, 0 } },
+    leaves { Leaf { { GuideQuadNode { {}, {} } }, 0 } }
+{
+    float boundsMax[3];
+
+    for (size_t axis = 0; axis < 3; axis++) {
+        this->boundsMin[axis] = std::numeric_limits<float>::max();
+        boundsMax[axis] = std::numeric_limits<float>::lowest();
+
+        for (const auto& b : bounds) {
+            this->boundsMin[axis] = std::min(this->boundsMin[axis], b.min[axis]);
+            boundsMax[axis] = std::max(boundsMax[axis], b.max[axis]);
+        }
+
+        if (bounds.empty()) {
+            this->boundsMin[axis] = 0.0f;
+            boundsMax[axis] = 0.0f;
+        }
+
+        // Keep a margin, so points on the surface of the outermost primitives land inside.
+        this->boundsSize[axis] = std::max(boundsMax[axis] - this->boundsMin[axis], 1e-3f) * 1.01f;
+        this->boundsMin[axis] -= 0.005f * this->boundsSize[axis];
+    }
+}
+
+size_t GuideTree::quadCount() const {
+    size_t count = 0;
+    for (const auto& leaf : this->leaves) {
+        count += leaf.quads.size();
+    }
+
+    return count;
+}
+
+void GuideTree::splat(const GuideSample* samples, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const auto& sample = samples[i];
+        float value = sample.point[3];
+
+        if (!isFinite(value) || value < 0.0f) { continue; }
+
+        auto& leaf = this->leaves[this->leafAt(sample.point)];
+        leaf.samples += 1;
+
+        float u = std::clamp(sample.direction[0], 0.0f, 1.0f);
+        float v = std::clamp(sample.direction[1], 0.0f, 1.0f);
+        uint32_t node = 0;
+
+        // Every level gets the energy, so each node holds the sum of its children.
+        while (true) {
+            uint32_t upperU = u >= 0.5f;
+            uint32_t upperV = v >= 0.5f;
+            uint32_t quadrant = upperU | (upperV << 1);
+
+            leaf.quads[node].energy[quadrant] += value;
+            u = 2.0f * u - float(upperU);
+            v = 2.0f * v - float(upperV);
+            node = leaf.quads[node].children[quadrant];
+
+            if (node == 0) { break; }
+        }
+    }
+}
+
+void GuideTree::refine(double spatialThreshold) {
+    this->split(0, 0, spatialThreshold);
+
+    const size_t maxNodes = std::max<size_t>(GUIDE_QUAD_NODES / this->leaves.size(), 1);
+    for (auto& leaf : this->leaves) {
+        leaf.quads = rebuildQuadtree(leaf.quads, maxNodes);
+    }
+}
+
+size_t GuideTree::write(GuideHeader& header, GuideSpatialNode* spatial, GuideQuadNode* quads) const {
+    for (size_t axis = 0; axis < 3; axis++) {
+        header.boundsMin[axis] = this->boundsMin[axis];
+        header.boundsSize[axis] = this->boundsSize[axis];
+    }
+
+    size_t quadCount = 0;
+
+    for (size_t i = 0; i < this->nodes.size(); i++) {
+        const auto& node = this->nodes[i];
+
+        if (node.children != GuideSpatialNode::LEAF) {
+            spatial[i] = GuideSpatialNode { node.children, GuideSpatialNode::NONE };
+            continue;
+        }
+
+        const auto& leaf = this->leaves[node.directions];
+
+        if (leaf.samples < GUIDE_MIN_SAMPLES || !(totalEnergy(leaf.quads[0]) > 0.0f)
+            || quadCount + leaf.quads.size() > GUIDE_QUAD_NODES)
+        {
+            spatial[i] = GuideSpatialNode { GuideSpatialNode::LEAF, GuideSpatialNode::NONE };
+            continue;
+        }
+
+        auto base = uint32_t(quadCount);
+        spatial[i] = GuideSpatialNode { GuideSpatialNode::LEAF, base };
+
+        for (const auto& quad : leaf.quads) {
+            auto& out = quads[quadCount++];
+            float total = totalEnergy(quad);
+
+            for (size_t quadrant = 0; quadrant < 4; quadrant++) {
+                out.energy[quadrant] = total > 0.0f ? quad.energy[quadrant] / total : 0.25f;
+                out.children[quadrant] = quad.children[quadrant] != 0 ? base + quad.children[quadrant] : 0;
+            }
+        }
+    }
+
+    return quadCount;
+}
+
+void GuideTree::clear() {
+    for (auto& leaf : this->leaves) {
+        leaf.samples = 0;
+
+        for (auto& quad : leaf.quads) {
+            std::fill(std::begin(quad.energy), std::end(quad.energy), 0.0f);
+        }
+    }
+}
+
+/// The index into `leaves` of the leaf containing `point`, found as in `guide_tree_at` in the shader.
+size_t GuideTree::leafAt(const float point[3]) const {
+    float local[3];
+    for (size_t axis = 0; axis < 3; axis++) {
+        local[axis] = std::clamp((point[axis] - this->boundsMin[axis]) / this->boundsSize[axis], 0.0f, 1.0f);
+    }
+
+    uint32_t node = 0;
+    size_t axis = 0;
+
+    while (this->nodes[node].children != GuideSpatialNode::LEAF) {
+        uint32_t upper = local[axis] >= 0.5f;
+        node = this->nodes[node].children + upper;
+        local[axis] = 2.0f * local[axis] - float(upper);
+        axis = (axis + 1) % 3;
+    }
+
+    return this->nodes[node].directions;
+}
+
+/// Split the leaves below `node` with more than `threshold` samples, assuming each half got half of them.
+/// Both halves start from the quadtree of the leaf.
+void GuideTree::split(uint32_t node, uint32_t depth, double threshold) {
+    if (this->nodes[node].children == GuideSpatialNode::LEAF) {
+        auto leafIndex = this->nodes[node].directions;
+
+        if (double(this->leaves[leafIndex].samples) <= threshold || depth >= GUIDE_SPATIAL_DEPTH
+            || this->nodes.size() + 2 > GUIDE_SPATIAL_NODES)
+        {
+            return;
+        }
+
+        this->leaves[leafIndex].samples /= 2;
+        auto copy = this->leaves[leafIndex];
+        this->leaves.push_back(std::move(copy));
+
+        auto children = uint32_t(this->nodes.size());
+        this->nodes.push_back(GuideSpatialNode { GuideSpatialNode::LEAF, leafIndex });
+        this->nodes.push_back(GuideSpatialNode { GuideSpatialNode::LEAF, uint32_t(this->leaves.size() - 1) });
+        this->nodes[node] = GuideSpatialNode { children, 0 };
+    }
+
+    auto children = this->nodes[node].children;
+    this->split(children, depth + 1, threshold);
+    this->split(children + 1, depth + 1, threshold);
+}
+
+PathGuide::PathGuide(vk::Device device, const Queues& queues, GuideTree&& tree, size_t iterationCount):
+    device(device),
+    queues(queues),
+    tree(std::move(tree)),
+    readbackMapped(nullptr),
+    readbackPending(false),
+    stagingMapped(nullptr),
+    iterationCount(iterationCount),
+    iteration(0),
+    frame(0),
+    iterationStart(0),
+    training(iterationCount > 0),
+    samplesSplatted(0),
+    samplesDropped(0),
+    quadNodes(0),
+    trainSeconds(0.0),
+    started(Clock::now()),
+    trainedAt(0.0)
+{
+}
+
+PathGuide PathGuide::create(vk::Device device, vk::PhysicalDevice physical, const Queues& queues,
+    const std::vector<Bounds>& bounds, const Options& options)
+{
+    auto guide = PathGuide(device, queues, GuideTree(bounds), options.guideIterations);
+
+    const size_t spatialSize = sizeof(GuideHeader)
+        + (options.guiding ? GUIDE_SPATIAL_NODES : 1) * sizeof(GuideSpatialNode);
+    const size_t quadsSize = (options.guiding ? GUIDE_QUAD_NODES : 1) * sizeof(GuideQuadNode);
+    const size_t samplesSize = SAMPLES_OFFSET + (options.guiding ? GUIDE_SAMPLES : 1) * sizeof(GuideSample);
+
+    std::tie(guide.spatialMemory, guide.spatial) = createBuffer(device, physical, spatialSize);
+    std::tie(guide.quadsMemory, guide.quads) = createBuffer(device, physical, quadsSize);
+    std::tie(guide.samplesMemory, guide.samples) = createBuffer(device, physical, samplesSize);
+
+    if (!options.guiding) {
+        return guide;
+    }
+
+    guide.cmdPool = device.createCommandPoolUnique(vk::CommandPoolCreateInfo(
+        vk::CommandPoolCreateFlagBits::eResetCommandBuffer, queues.computeQueueFamily), nullptr);
+
+    zeroBuffer(device, physical, *guide.cmdPool, queues, *guide.samples, samplesSize);
+
+    std::tie(guide.readbackMemory, guide.readback) = createHostBuffer(device, physical, samplesSize,
+        vk::BufferUsageFlagBits::eTransferDst);
+    guide.readbackMapped = static_cast<const uint32_t*>(device.mapMemory(*guide.readbackMemory, 0, samplesSize,
+        vk::MemoryMapFlags()));
+    guide.readbackCmd = recordFeedbackReadback(device, *guide.cmdPool, *guide.samples, *guide.readback,
+        samplesSize);
+    guide.readbackFence = device.createFenceUnique(vk::FenceCreateInfo(), nullptr);
+
+    // The staging buffer holds the spatial buffer at full capacity, followed by the quadtree nodes.
+    std::tie(guide.stagingMemory, guide.staging) = createHostBuffer(device, physical, spatialSize + quadsSize,
+        vk::BufferUsageFlagBits::eTransferSrc);
+    guide.stagingMapped = device.mapMemory(*guide.stagingMemory, 0, spatialSize + quadsSize, vk::MemoryMapFlags());
+
+    auto allocInfo = vk::CommandBufferAllocateInfo(
+        *guide.cmdPool,                         // commandPool,
+        vk::CommandBufferLevel::ePrimary,       // level
+        1                                       // commandBufferCount
+    );
+
+    auto cmds = device.allocateCommandBuffersUnique(allocInfo);
+    guide.uploadCmd = std::move(cmds[0]);
+
+    // Signalled, as there is no upload in flight yet.
+    guide.uploadFence = device.createFenceUnique(vk::FenceCreateInfo(vk::FenceCreateFlagBits::eSignaled), nullptr);
+
+    // Until the first iteration is done, the single leaf isn't trained and every bounce samples the material.
+    guide.upload();
+
+    std::cout << "Path guiding: " << guide.iterationCount << " training iterations, "
+        << (spatialSize + quadsSize) / (1024 * 1024) << " MiB for the tree, "
+        << samplesSize / (1024 * 1024) << " MiB for the samples of a frame\n";
+
+    return guide;
+}
+
+std::vector<vk::Buffer> PathGuide::bindings() const {
+    return std::vector<vk::Buffer> { *this->spatial, *this->quads, *this->samples };
+}
+
+void PathGuide::update() {
+    if (!this->enabled() || !this->training) { return; }
+
+    this->frame += 1;
+
+    if (this->readbackPending && this->device.getFenceStatus(*this->readbackFence) == vk::Result::eSuccess) {
+        this->readbackPending = false;
+        this->train();
+    }
+
+    if (this->training && !this->readbackPending) {
+        this->device.resetFences(1, &*this->readbackFence);
+        this->submit(*this->readbackCmd, *this->readbackFence);
+        this->readbackPending = true;
+    }
+}
+
+void PathGuide::finish() {
+    if (!this->enabled()) { return; }
+
+    std::cout << std::fixed << std::setprecision(2) << "Path guiding: ";
+
+    if (this->training) {
+        std::cout << "stopped in training iteration " << this->iteration + 1 << " of " << this->iterationCount
+            << "\n";
+    } else {
+        std::cout << this->iterationCount << " training iterations done after " << this->trainedAt << " s\n";
+    }
+
+    std::cout << "    spatial tree: " << this->tree.leafCount() << " leaves, quadtrees: " << this->quadNodes
+        << " nodes uploaded\n"
+        << "    samples: " << this->samplesSplatted << " splatted, " << this->samplesDropped
+        << " dropped with the buffer full\n"
+        << "    training time on the host: " << this->trainSeconds << " s\n";
+}
+
+/// Splat the samples just read back, and refine and upload the tree at the end of an iteration.
+void PathGuide::train() {
+    auto start = Clock::now();
+
+    const size_t count = this->readbackMapped[0];
+    const size_t kept = std::min(count, GUIDE_SAMPLES);
+    const auto* records = reinterpret_cast<const GuideSample*>(
+        reinterpret_cast<const uint8_t*>(this->readbackMapped) + SAMPLES_OFFSET);
+
+    this->tree.splat(records, kept);
+    this->samplesSplatted += kept;
+    this->samplesDropped += count - kept;
+
+    // Iterations double in length, so each one trains on about as many samples as all earlier ones together.
+    const uint64_t frames = this->frame - this->iterationStart;
+
+    if (frames >= (uint64_t(1) << this->iteration)) {
+        this->tree.refine(GUIDE_SPLIT * std::sqrt(double(frames)));
+
+        this->iteration += 1;
+        this->iterationStart = this->frame;
+        this->training = this->iteration < this->iterationCount;
+
+        this->upload();
+        this->tree.clear();
+
+        if (!this->training) {
+            this->trainedAt = secondsSince(this->started);
+        }
+    }
+
+    this->trainSeconds += secondsSince(start);
+}
+
+/// Upload the tree, with the training flag for the frames after it.
+void PathGuide::upload() {
+    // The staging buffer is reused, so the previous upload has to be done with it.
+    this->device.waitForFences(1, &*this->uploadFence, true, std::numeric_limits<uint64_t>::max());
+
+    auto bytes = static_cast<uint8_t*>(this->stagingMapped);
+    auto& header = *reinterpret_cast<GuideHeader*>(bytes);
+    const size_t quadsOffset = sizeof(GuideHeader) + GUIDE_SPATIAL_NODES * sizeof(GuideSpatialNode);
+
+    header = GuideHeader {};
+    header.training = this->training;
+    this->quadNodes = this->tree.write(header, reinterpret_cast<GuideSpatialNode*>(bytes + sizeof(GuideHeader)),
+        reinterpret_cast<GuideQuadNode*>(bytes + quadsOffset));
+
+    auto cmd = *this->uploadCmd;
+    cmd.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit, nullptr));
+
+    // Wait for the frames still sampling the previous tree.
+    const auto computeToTransfer = vk::MemoryBarrier(
+        vk::AccessFlagBits::eShaderRead,        // srcAccessMask
+        vk::AccessFlagBits::eTransferWrite      // dstAccessMask
+    );
+
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,  // srcStageMask
+        vk::PipelineStageFlagBits::eTransfer,       // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &computeToTransfer,                         // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        0,                                          // imageMemoryBarrierCount
+        nullptr                                     // pImageMemoryBarriers
+    );
+
+    const auto spatialRegion = vk::BufferCopy(0, 0,
+        sizeof(GuideHeader) + this->tree.nodeCount() * sizeof(GuideSpatialNode));
+    cmd.copyBuffer(*this->staging, *this->spatial, 1, &spatialRegion);
+
+    if (this->quadNodes > 0) {
+        const auto quadsRegion = vk::BufferCopy(quadsOffset, 0, this->quadNodes * sizeof(GuideQuadNode));
+        cmd.copyBuffer(*this->staging, *this->quads, 1, &quadsRegion);
+    }
+
+    const auto transferToCompute = vk::MemoryBarrier(
+        vk::AccessFlagBits::eTransferWrite,     // srcAccessMask
+        vk::AccessFlagBits::eShaderRead         // dstAccessMask
+    );
+
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,       // srcStageMask
+        vk::PipelineStageFlagBits::eComputeShader,  // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &transferToCompute,                         // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        0,                                          // imageMemoryBarrierCount
+        nullptr                                     // pImageMemoryBarriers
+    );
+
+    cmd.end();
+
+    this->device.resetFences(1, &*this->uploadFence);
+    this->submit(cmd, *this->uploadFence);
+}
+
+void PathGuide::submit(vk::CommandBuffer cmd, vk::Fence fence) {
+    auto submitInfo = vk::SubmitInfo(
+        0,                                  // waitSemaphoreCount
+        nullptr,                            // pWaitSemaphores
+        nullptr,                            // pWaitDstStageMask
+        1,                                  // commandBufferCount
+        &cmd,                               // pCommandBuffers
+        0,                                  // signalSemaphoreCount
+        nullptr                             // pSignalSemaphores
+    );
+
+    this->queues.compute.submit(1, &submitInfo, fence);
+}
+
+} // namespace app
@@ -0,0 +1,190 @@
+#pragma once
+
+#include "deps.h"
+#include "device.h"
+#include "options.h"
+#include "primitives.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace app {
+
+/// Capacity of the guide on the device, in nodes of the spatial tree and of all directional quadtrees.
+const size_t GUIDE_SPATIAL_NODES = 1 << 15;
+const size_t GUIDE_QUAD_NODES = 1 << 19;
+
+/// Capacity of the buffer the shader records path vertices into, per frame.
+const size_t GUIDE_SAMPLES = 1 << 19;
+
+/// Start of the `GuideSpatial` buffer in `shader/main.comp`, followed by the nodes of the spatial tree.
+struct GuideHeader {
+    float boundsMin[4];
+    float boundsSize[4];
+
+    /// Non-zero while the shader records path vertices.
+    uint32_t training;
+    uint32_t padding[3];
+};
+
+/// A node of the spatial binary tree, laid out as `GuideSpatialNode` in `shader/main.comp`.
+struct GuideSpatialNode {
+    static constexpr uint32_t LEAF = ~uint32_t(0);
+    static constexpr uint32_t NONE = ~uint32_t(0);
+
+    /// Index of the first of the two children, or `LEAF`.
+    uint32_t children;
+
+    /// Root of the directional quadtree of a leaf in the quadtree buffer, or `NONE`.
+    uint32_t directions;
+};
+
+/// A node of a directional quadtree, laid out as `GuideQuadNode` in `shader/main.comp`.
+///
+/// The tree covers the square of `(cos(theta), phi)`, which maps the sphere of directions without distortion
+/// of area. The quadrants are numbered with the bit 0 set for the right half and the bit 1 for the upper one.
+/// A child index of zero marks a quadrant which isn't split, since no node is a child of the root.
+struct GuideQuadNode {
+    /// Energy of each quadrant on the host, normalized to probabilities for the device.
+    float energy[4];
+    uint32_t children[4];
+};
+
+/// A path vertex recorded by the shader, laid out as `GuideSample` in `shader/main.comp`.
+struct GuideSample {
+    /// The position, and the luminance of the incident light divided by the density of its direction.
+    float point[4];
+
+    /// The direction mapped onto the square of the quadtrees, the rest is unused.
+    float direction[4];
+};
+
+/// The guiding distribution: a binary tree over the scene bounds (split along x, y and z in turn), whose
+/// leaves hold quadtrees over the sphere of directions (an SD-tree, after Müller et al. "Practical Path
+/// Guiding for Efficient Light-Transport Simulation").
+///
+/// Recorded samples are splatted into the quadtrees of the current structure. Refining then splits the
+/// leaves which got many samples in space, and rebuilds every quadtree so that each quadrant with more
+/// than a small share of the energy is split. The refined tree keeps the energy for sampling, and the
+/// next iteration is splatted into it from zero.
+class GuideTree {
+private:
+    struct Leaf {
+        std::vector<GuideQuadNode> quads;
+        size_t samples;
+    };
+
+    float boundsMin[3];
+    float boundsSize[3];
+
+    /// Host copy of the spatial tree. The `directions` of a leaf index `leaves` instead.
+    std::vector<GuideSpatialNode> nodes;
+    std::vector<Leaf> leaves;
+
+public:
+    /// A tree with a single spatial leaf over `bounds`, which isn't trained yet.
+    explicit GuideTree(const std::vector<Bounds>& bounds);
+
+    size_t nodeCount() const { return this->nodes.size(); }
+    size_t leafCount() const { return this->leaves.size(); }
+    size_t quadCount() const;
+
+    /// Add the samples to the quadtrees of their leaves.
+    void splat(const GuideSample* samples, size_t count);
+
+    /// Split the leaves with more than `spatialThreshold` samples and rebuild the quadtrees from their energy.
+    void refine(double spatialThreshold);
+
+    /// Write the spatial tree after `header` and the quadtrees, normalized to probabilities, for the device.
+    /// Leaves with too few samples to be trusted are left to the material. Returns the number of quadtree nodes.
+    size_t write(GuideHeader& header, GuideSpatialNode* spatial, GuideQuadNode* quads) const;
+
+    /// Forget the energy of the last iteration, keeping the structure.
+    void clear();
+
+private:
+    size_t leafAt(const float point[3]) const;
+    void split(uint32_t node, uint32_t depth, double threshold);
+};
+
+/// Guides the bounces of paths with a distribution of the incident light learned from earlier paths.
+///
+/// While training, the shader records the first vertices of a share of the paths with the light they
+/// received along the bounce into a buffer, which is read back after every frame and splatted into the
+/// `GuideTree` on the host. Training goes on in iterations of 1, 2, 4, ... frames. After each iteration the
+/// tree is refined and uploaded, ordered after the frames already submitted by barriers. Once the last
+/// iteration is done the shader stops recording and keeps sampling the final tree. The bounces of opaque
+/// materials pick the guide or the material with equal probability, weighted by the density of the mixture.
+class PathGuide {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    vk::Device device;
+    Queues queues;
+    GuideTree tree;
+
+    vk::UniqueDeviceMemory spatialMemory;
+    vk::UniqueBuffer spatial;
+    vk::UniqueDeviceMemory quadsMemory;
+    vk::UniqueBuffer quads;
+    vk::UniqueDeviceMemory samplesMemory;
+    vk::UniqueBuffer samples;
+
+    vk::UniqueCommandPool cmdPool;
+
+    vk::UniqueDeviceMemory readbackMemory;
+    vk::UniqueBuffer readback;
+    const uint32_t* readbackMapped;
+    vk::UniqueCommandBuffer readbackCmd;
+    vk::UniqueFence readbackFence;
+    bool readbackPending;
+
+    vk::UniqueDeviceMemory stagingMemory;
+    vk::UniqueBuffer staging;
+    void* stagingMapped;
+    vk::UniqueCommandBuffer uploadCmd;
+    vk::UniqueFence uploadFence;
+
+    size_t iterationCount;
+    size_t iteration;
+    uint64_t frame;
+    uint64_t iterationStart;
+    bool training;
+
+    size_t samplesSplatted;
+    size_t samplesDropped;
+    size_t quadNodes;
+    double trainSeconds;
+    Clock::time_point started;
+    double trainedAt;
+
+    PathGuide(vk::Device device, const Queues& queues, GuideTree&& tree, size_t iterationCount);
+
+public:
+    /// With guiding disabled, the buffers bound to the shader hold a single unused element.
+    static PathGuide create(vk::Device device, vk::PhysicalDevice physical, const Queues& queues,
+        const std::vector<Bounds>& bounds, const Options& options);
+
+    PathGuide(PathGuide&&) = default;
+    PathGuide& operator=(PathGuide&&) = default;
+
+    bool enabled() const { return bool(this->cmdPool); }
+
+    /// Spatial tree, quadtrees and recorded samples, bound right after the visibility buffer.
+    std::vector<vk::Buffer> bindings() const;
+
+    /// Train on the samples of earlier frames. Called once per frame, after the frame is submitted.
+    void update();
+
+    /// Print the training statistics. The device must be idle.
+    void finish();
+
+private:
+    void train();
+    void upload();
+    void submit(vk::CommandBuffer cmd, vk::Fence fence);
+};
+
+} // namespace app
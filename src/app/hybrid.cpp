@@ -0,0 +1,434 @@
+#include "hybrid.h"
+#include "lights.h"
+#include "scene.h"
+#include "state.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+
+namespace app {
+
+namespace {
+
+/// Number of frames whose commands can be in flight ahead of the render loop.
+const size_t HYBRID_SLOTS = 4;
+
+/// Seconds between two merges of the host samples into the work image.
+const double MERGE_INTERVAL = 0.1;
+
+/// Floats per pixel of the accumulation buffers, laid out as `HOST_SAMPLES` in `shader/main.comp`.
+const size_t SAMPLE_FLOATS = 4;
+
+} // namespace
+
+HybridRenderer::HybridRenderer(vk::Device device, const Queues& queues):
+    device(device),
+    queues(queues),
+    hostSamplesMapped(nullptr),
+    basesMapped(nullptr),
+    nextSlot(0),
+    tileCount(0, 0),
+    frameBudget(0),
+    threadCount(0),
+    mergePending(false),
+    gpuTiles(0),
+    merges(0),
+    mergeSeconds(0.0),
+    waitSeconds(0.0)
+{
+}
+
+HybridRenderer::~HybridRenderer() {
+    this->stop();
+}
+
+HybridRenderer HybridRenderer::create(vk::Device device, vk::PhysicalDevice physical, const Queues& queues,
+    const Primitives& primitives, const Bvh& bvh, const Camera& camera, std::vector<uint32_t> tileOrder,
+    vk::Extent2D extent, const Options& options)
+{
+    auto renderer = HybridRenderer(device, queues);
+
+    if (!options.hybrid) {
+        // The shader still needs a buffer to bind.
+        std::tie(renderer.hostSamplesMemory, renderer.hostSamples) = createBuffer(device, physical,
+            SAMPLE_FLOATS * sizeof(float));
+        return renderer;
+    }
+
+    const size_t pixelCount = size_t(extent.width) * extent.height;
+    const size_t samplesSize = pixelCount * SAMPLE_FLOATS * sizeof(float);
+
+    // Leave a core to the render loop, so the GPU is kept fed.
+    renderer.threadCount = options.hybridThreads > 0
+        ? options.hybridThreads
+        : std::max<size_t>(1, std::thread::hardware_concurrency() - 1);
+    renderer.tileCount = vk::Extent2D((extent.width + CPU_TILE - 1) / CPU_TILE,
+        (extent.height + CPU_TILE - 1) / CPU_TILE);
+
+    auto lights = sceneLights(options);
+    auto lightTree = buildLightTree(lights);
+
+    renderer.shared = std::make_unique<Shared>();
+    auto& shared = *renderer.shared;
+    shared.scene = CpuScene { primitives, primitives.primitiveMaterials(), bvh, std::move(lights),
+        std::move(lightTree), camera, extent.width, extent.height };
+    shared.tileOrder = std::move(tileOrder);
+    shared.tilesX = renderer.tileCount.width;
+    shared.samples = std::vector<float>(pixelCount * SAMPLE_FLOATS, 0.0f);
+    shared.dirtyTiles = std::vector<uint8_t>(shared.tileOrder.size(), 0);
+
+    renderer.draining = std::vector<float>(pixelCount * SAMPLE_FLOATS, 0.0f);
+    renderer.drainingTiles = std::vector<uint8_t>(shared.tileOrder.size(), 0);
+    renderer.mergedTiles = std::vector<uint8_t>(shared.tileOrder.size(), 0);
+
+    std::tie(renderer.hostSamplesMemory, renderer.hostSamples) = createHostBuffer(device, physical,
+        samplesSize, vk::BufferUsageFlagBits::eStorageBuffer);
+    renderer.hostSamplesMapped = static_cast<float*>(device.mapMemory(*renderer.hostSamplesMemory, 0,
+        samplesSize, vk::MemoryMapFlags()));
+    std::memset(renderer.hostSamplesMapped, 0, samplesSize);
+
+    std::tie(renderer.basesMemory, renderer.bases) = createHostBuffer(device, physical,
+        HYBRID_SLOTS * sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferSrc);
+    renderer.basesMapped = static_cast<uint32_t*>(device.mapMemory(*renderer.basesMemory, 0,
+        HYBRID_SLOTS * sizeof(uint32_t), vk::MemoryMapFlags()));
+
+    renderer.cmdPool = device.createCommandPoolUnique(vk::CommandPoolCreateInfo(
+        vk::CommandPoolCreateFlagBits::eResetCommandBuffer, queues.computeQueueFamily), nullptr);
+
+    auto allocInfo = vk::CommandBufferAllocateInfo(
+        *renderer.cmdPool,                      // commandPool,
+        vk::CommandBufferLevel::ePrimary,       // level
+        HYBRID_SLOTS                            // commandBufferCount
+    );
+
+    auto cmds = device.allocateCommandBuffersUnique(allocInfo);
+    for (auto& cmd : cmds) {
+        auto slot = Slot();
+        slot.cmd = std::move(cmd);
+        slot.done = device.createFenceUnique(vk::FenceCreateInfo(vk::FenceCreateFlagBits::eSignaled), nullptr);
+        renderer.slots.push_back(std::move(slot));
+    }
+
+    return renderer;
+}
+
+std::vector<vk::Buffer> HybridRenderer::bindings() const {
+    return std::vector<vk::Buffer> { *this->hostSamples };
+}
+
+void HybridRenderer::start(vk::DescriptorSetLayout descriptorLayout, vk::DescriptorSet descriptorSet,
+    vk::Format workFormat, const ShaderConstants& constants, vk::Image workImage, vk::Buffer stateBuffer,
+    uint32_t frameBudget)
+{
+    if (!this->enabled()) { return; }
+
+    auto mergeConstants = constants;
+    mergeConstants.mergeHostSamples = true;
+    std::tie(this->mergePipeline, this->mergeLayout, std::ignore) = createPipeline(this->device,
+        descriptorLayout, workFormat, mergeConstants);
+
+    this->descriptorSet = descriptorSet;
+    this->workImage = workImage;
+    this->stateBuffer = stateBuffer;
+    this->frameBudget = frameBudget;
+
+    this->startTime = Clock::now();
+    this->lastMerge = this->startTime;
+
+    for (size_t i = 0; i < this->threadCount; i++) {
+        this->threads.emplace_back(workLoop, std::ref(*this->shared));
+    }
+
+    std::cout << "Hybrid rendering with " << this->threads.size() << " CPU threads, "
+        << this->frameBudget << " tiles per GPU frame\n";
+}
+
+void HybridRenderer::submit() {
+    if (!this->enabled()) { return; }
+
+    const uint32_t index = uint32_t(this->nextSlot);
+    auto& slot = this->slots[index];
+    this->nextSlot = (this->nextSlot + 1) % this->slots.size();
+
+    if (this->device.getFenceStatus(*slot.done) != vk::Result::eSuccess) {
+        auto start = Clock::now();
+        this->device.waitForFences(1, &*slot.done, true, std::numeric_limits<uint64_t>::max());
+        this->waitSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    this->device.resetFences(1, &*slot.done);
+
+    if (slot.merging) {
+        slot.merging = false;
+        this->mergePending = false;
+    }
+
+    // The GPU takes its tiles from the same counter as the workers, the device counter is 32 bits.
+    const uint64_t base = this->shared->next.fetch_add(this->frameBudget);
+    this->basesMapped[index] = uint32_t(base);
+    this->gpuTiles += this->frameBudget;
+
+    // Only one merge reads `hostSamples` at a time.
+    auto now = Clock::now();
+    bool merge = false;
+
+    if (!this->mergePending && std::chrono::duration<double>(now - this->lastMerge).count() >= MERGE_INTERVAL) {
+        this->lastMerge = now;
+        merge = this->drain();
+        this->mergeSeconds += std::chrono::duration<double>(Clock::now() - now).count();
+    }
+
+    if (merge) {
+        slot.merging = true;
+        this->mergePending = true;
+        this->merges += 1;
+    }
+
+    this->record(*slot.cmd, index, merge);
+
+    auto submitInfo = vk::SubmitInfo(
+        0,                                  // waitSemaphoreCount
+        nullptr,                            // pWaitSemaphores
+        nullptr,                            // pWaitDstStageMask
+        1,                                  // commandBufferCount
+        &*slot.cmd,                         // pCommandBuffers
+        0,                                  // signalSemaphoreCount
+        nullptr                             // pSignalSemaphores
+    );
+
+    this->queues.compute.submit(1, &submitInfo, *slot.done);
+}
+
+bool HybridRenderer::drain() {
+    auto& shared = *this->shared;
+
+    {
+        auto lock = std::unique_lock<std::mutex>(shared.mutex);
+        if (std::find(shared.dirtyTiles.begin(), shared.dirtyTiles.end(), 1) == shared.dirtyTiles.end()) {
+            return false;
+        }
+
+        std::swap(shared.samples, this->draining);
+        std::swap(shared.dirtyTiles, this->drainingTiles);
+    }
+
+    const auto& scene = shared.scene;
+    const size_t rowFloats = size_t(scene.width) * SAMPLE_FLOATS;
+
+    // Copy the tiles with new samples and clear the ones left over from the last merge, row by row.
+    for (size_t tile = 0; tile < this->drainingTiles.size(); tile++) {
+        if (this->drainingTiles[tile] == 0 && this->mergedTiles[tile] == 0) { continue; }
+
+        const size_t tileX = tile % this->tileCount.width;
+        const size_t tileY = tile / this->tileCount.width;
+        const size_t x = tileX * CPU_TILE;
+        const size_t width = std::min<size_t>(CPU_TILE, scene.width - x) * SAMPLE_FLOATS * sizeof(float);
+
+        for (size_t y = tileY * CPU_TILE; y < std::min<size_t>((tileY + 1) * CPU_TILE, scene.height); y++) {
+            float* row = this->draining.data() + y * rowFloats + x * SAMPLE_FLOATS;
+            float* mapped = this->hostSamplesMapped + y * rowFloats + x * SAMPLE_FLOATS;
+
+            if (this->drainingTiles[tile] != 0) {
+                std::memcpy(mapped, row, width);
+                std::memset(row, 0, width);
+            } else {
+                std::memset(mapped, 0, width);
+            }
+        }
+    }
+
+    std::swap(this->mergedTiles, this->drainingTiles);
+    std::fill(this->drainingTiles.begin(), this->drainingTiles.end(), 0);
+
+    return true;
+}
+
+/// Write the first tile of the frame to `invocation_id`, then with `merge` add `hostSamples` to the work image.
+void HybridRenderer::record(vk::CommandBuffer cmd, uint32_t slot, bool merge) {
+    cmd.reset(vk::CommandBufferResetFlags());
+    cmd.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit, nullptr));
+
+    const auto computeToTransfer = vk::MemoryBarrier(
+        vk::AccessFlagBits::eShaderRead |
+            vk::AccessFlagBits::eShaderWrite,   // srcAccessMask
+        vk::AccessFlagBits::eTransferWrite      // dstAccessMask
+    );
+
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,  // srcStageMask
+        vk::PipelineStageFlagBits::eTransfer,       // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &computeToTransfer,                         // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        0,                                          // imageMemoryBarrierCount
+        nullptr                                     // pImageMemoryBarriers
+    );
+
+    const auto region = vk::BufferCopy(
+        slot * sizeof(uint32_t),                // srcOffset
+        offsetof(State, invocationId),          // dstOffset
+        sizeof(uint32_t)                        // size
+    );
+
+    cmd.copyBuffer(*this->bases, this->stateBuffer, 1, &region);
+
+    const auto range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+
+    // Between frames the work image is left in `TransferSrcOptimal`, see `createCommands`.
+    const auto transferToCompute = vk::MemoryBarrier(
+        vk::AccessFlagBits::eTransferWrite,     // srcAccessMask
+        vk::AccessFlagBits::eShaderRead |
+            vk::AccessFlagBits::eShaderWrite    // dstAccessMask
+    );
+    const auto transferToGeneral = vk::ImageMemoryBarrier(
+        vk::AccessFlags(),                      // srcAccessMask
+        vk::AccessFlagBits::eShaderRead |
+            vk::AccessFlagBits::eShaderWrite,   // dstAccessMask
+        vk::ImageLayout::eTransferSrcOptimal,   // oldLayout
+        vk::ImageLayout::eGeneral,              // newLayout
+        this->queues.computeQueueFamily,        // srcQueueFamilyIndex
+        this->queues.computeQueueFamily,        // dstQueueFamilyIndex
+        this->workImage,                        // image
+        range                                   // subresourceRange
+    );
+
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,       // srcStageMask
+        vk::PipelineStageFlagBits::eComputeShader,  // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &transferToCompute,                         // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        merge ? 1 : 0,                              // imageMemoryBarrierCount
+        &transferToGeneral                          // pImageMemoryBarriers
+    );
+
+    if (merge) {
+        cmd.bindPipeline(vk::PipelineBindPoint::eCompute, *this->mergePipeline);
+        cmd.bindDescriptorSets(
+            vk::PipelineBindPoint::eCompute,        // pipelineBindPoint,
+            *this->mergeLayout,                     // layout
+            0,                                      // firstSet
+            1,                                      // descriptorSetCount
+            &this->descriptorSet,                   // pDescriptorSets
+            0,                                      // dynamicOffsetCount
+            nullptr                                 // pDynamicOffsets
+        );
+
+        cmd.dispatch(this->tileCount.width, this->tileCount.height, 1);
+
+        const auto generalToTransfer = vk::ImageMemoryBarrier(
+            vk::AccessFlagBits::eShaderWrite,       // srcAccessMask
+            vk::AccessFlagBits::eTransferRead,      // dstAccessMask
+            vk::ImageLayout::eGeneral,              // oldLayout
+            vk::ImageLayout::eTransferSrcOptimal,   // newLayout
+            this->queues.computeQueueFamily,        // srcQueueFamilyIndex
+            this->queues.computeQueueFamily,        // dstQueueFamilyIndex
+            this->workImage,                        // image
+            range                                   // subresourceRange
+        );
+
+        cmd.pipelineBarrier(
+            vk::PipelineStageFlagBits::eComputeShader,  // srcStageMask
+            vk::PipelineStageFlagBits::eTransfer,       // dstStageMask
+            vk::DependencyFlags(),                      // dependencyFlags
+            0,                                          // memoryBarrierCount
+            nullptr,                                    // pMemoryBarriers
+            0,                                          // bufferMemoryBarrierCount
+            nullptr,                                    // pBufferMemoryBarriers
+            1,                                          // imageMemoryBarrierCount
+            &generalToTransfer                          // pImageMemoryBarriers
+        );
+    }
+
+    cmd.end();
+}
+
+void HybridRenderer::finish() {
+    if (!this->enabled()) { return; }
+
+    this->stop();
+
+    const auto& shared = *this->shared;
+    const double seconds = std::chrono::duration<double>(Clock::now() - this->startTime).count();
+    const size_t total = std::max<size_t>(this->gpuTiles + shared.tiles, 1);
+    const double tilesPerSecond = seconds > 0.0 ? 1.0 / seconds : 0.0;
+
+    std::cout << std::fixed << std::setprecision(2)
+        << "Hybrid: " << total << " tiles in " << seconds << " s, " << double(total) * tilesPerSecond
+        << " tiles/s\n"
+        << "    GPU: " << this->gpuTiles << " tiles (" << 100.0 * double(this->gpuTiles) / double(total) << " %), "
+        << double(this->gpuTiles) * tilesPerSecond << " tiles/s\n"
+        << "    CPU: " << shared.tiles << " tiles (" << 100.0 * double(shared.tiles) / double(total) << " %), "
+        << double(shared.tiles) * tilesPerSecond << " tiles/s on " << this->threads.size() << " threads, "
+        << shared.counters.rays << " rays, " << shared.counters.shadowRays << " shadow rays\n"
+        << "    " << this->merges << " merges, " << 1000.0 * this->mergeSeconds << " ms copying samples, "
+        << 1000.0 * this->waitSeconds << " ms waiting for the device\n";
+}
+
+void HybridRenderer::stop() {
+    if (!this->shared) { return; }
+
+    this->shared->stopping = true;
+
+    for (auto& thread : this->threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+}
+
+/// Take tiles from the queue and trace them, until stopped.
+void HybridRenderer::workLoop(Shared& shared) {
+    const auto& scene = shared.scene;
+    const size_t tileCount = shared.tileOrder.size();
+    const size_t rowFloats = size_t(scene.width) * SAMPLE_FLOATS;
+
+    auto colors = std::vector<float>(CPU_TILE * CPU_TILE * 3);
+    auto counters = CpuCounters();
+
+    while (!shared.stopping) {
+        const uint64_t index = shared.next.fetch_add(1);
+        const uint32_t packed = shared.tileOrder[index % tileCount];
+        const uint32_t tileX = packed & 0xffff;
+        const uint32_t tileY = packed >> 16;
+
+        traceCpuTile(scene, tileX, tileY, index, colors.data(), counters);
+
+        auto lock = std::unique_lock<std::mutex>(shared.mutex);
+
+        for (uint32_t y = 0; y < CPU_TILE && tileY * CPU_TILE + y < scene.height; y++) {
+            for (uint32_t x = 0; x < CPU_TILE && tileX * CPU_TILE + x < scene.width; x++) {
+                const float* color = colors.data() + 3 * (y * CPU_TILE + x);
+                float* sample = shared.samples.data() + (tileY * CPU_TILE + y) * rowFloats
+                    + (tileX * CPU_TILE + x) * SAMPLE_FLOATS;
+
+                sample[0] += color[0];
+                sample[1] += color[1];
+                sample[2] += color[2];
+                sample[3] += 1.0f;
+            }
+        }
+
+        shared.dirtyTiles[tileY * shared.tilesX + tileX] = 1;
+        shared.tiles += 1;
+    }
+
+    auto lock = std::unique_lock<std::mutex>(shared.mutex);
+    shared.counters.rays += counters.rays;
+    shared.counters.rayTests += counters.rayTests;
+    shared.counters.shadowRays += counters.shadowRays;
+    shared.counters.shadowTests += counters.shadowTests;
+    shared.counters.shadowHits += counters.shadowHits;
+}
+
+} // namespace app
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "bvh.h"
+#include "camera.h"
+#include "deps.h"
+#include "device.h"
+#include "options.h"
+#include "primitives.h"
+#include "shader.h"
+#include "tracer.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace app {
+
+/// Traces part of the image on host threads while the GPU traces the rest.
+///
+/// Both take tiles from one queue, the sequence traced by the persistent workgroups: tile `i` is
+/// `TILE_ORDER[i % tileCount]` with sample `i / tileCount`. The counter of the queue lives on the host.
+/// Worker threads take one tile at a time, and the render loop takes the frame budget for the GPU before
+/// submitting a frame. A short command buffer submitted ahead of the frame writes the first of its tiles
+/// to `invocation_id`, so the persistent workgroups claim exactly those.
+///
+/// The workers add their samples to a host accumulation buffer. Every `MERGE_INTERVAL` it is swapped with
+/// a second one, whose samples are copied to a host visible buffer and added to the work image between two
+/// frames by the merge pipeline, see `MERGE_HOST_SAMPLES` in `shader/main.comp`.
+class HybridRenderer {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    /// State shared with the worker threads, kept behind a pointer so the renderer can be moved.
+    struct Shared {
+        CpuScene scene;
+        std::vector<uint32_t> tileOrder;
+        uint32_t tilesX;
+
+        std::atomic<uint64_t> next{0};
+        std::atomic<bool> stopping{false};
+
+        std::mutex mutex;
+
+        /// Sum of the samples and their count for each pixel, and which tiles have any.
+        std::vector<float> samples;
+        std::vector<uint8_t> dirtyTiles;
+
+        size_t tiles = 0;
+        CpuCounters counters;
+    };
+
+    /// Command buffer and fence for the commands submitted ahead of a frame.
+    struct Slot {
+        vk::UniqueCommandBuffer cmd;
+        vk::UniqueFence done;
+        bool merging = false;
+    };
+
+    vk::Device device;
+    Queues queues;
+
+    vk::UniqueDeviceMemory hostSamplesMemory;
+    vk::UniqueBuffer hostSamples;
+    float* hostSamplesMapped;
+    vk::UniqueDeviceMemory basesMemory;
+    vk::UniqueBuffer bases;
+    uint32_t* basesMapped;
+
+    vk::UniqueCommandPool cmdPool;
+    std::vector<Slot> slots;
+    size_t nextSlot;
+
+    vk::UniquePipeline mergePipeline;
+    vk::UniquePipelineLayout mergeLayout;
+    vk::DescriptorSet descriptorSet;
+    vk::Image workImage;
+    vk::Buffer stateBuffer;
+    vk::Extent2D tileCount;
+    uint32_t frameBudget;
+
+    std::unique_ptr<Shared> shared;
+    size_t threadCount;
+    std::vector<std::thread> threads;
+
+    /// Samples swapped out of `Shared::samples`, and the tiles of the last merge, which are non-zero
+    /// in `hostSamples`.
+    std::vector<float> draining;
+    std::vector<uint8_t> drainingTiles;
+    std::vector<uint8_t> mergedTiles;
+    bool mergePending;
+
+    Clock::time_point startTime;
+    Clock::time_point lastMerge;
+    size_t gpuTiles;
+    size_t merges;
+    double mergeSeconds;
+    double waitSeconds;
+
+    HybridRenderer(vk::Device device, const Queues& queues);
+
+public:
+    /// Disabled unless `Options::hybrid` is set, then the scene is copied for the workers.
+    static HybridRenderer create(vk::Device device, vk::PhysicalDevice physical, const Queues& queues,
+        const Primitives& primitives, const Bvh& bvh, const Camera& camera, std::vector<uint32_t> tileOrder,
+        vk::Extent2D extent, const Options& options);
+
+    HybridRenderer(HybridRenderer&&) = default;
+    HybridRenderer& operator=(HybridRenderer&&) = default;
+    ~HybridRenderer();
+
+    bool enabled() const { return this->shared != nullptr; }
+
+    /// The host visible buffer of merged samples, bound right after the texture streamer's buffers.
+    std::vector<vk::Buffer> bindings() const;
+
+    /// Create the merge pipeline from the tracing one's layout and constants, and start the workers.
+    void start(vk::DescriptorSetLayout descriptorLayout, vk::DescriptorSet descriptorSet, vk::Format workFormat,
+        const ShaderConstants& constants, vk::Image workImage, vk::Buffer stateBuffer, uint32_t frameBudget);
+
+    /// Claim the tiles of the next frame for the GPU and merge the host samples if it's time.
+    /// Called right before each frame is submitted to the compute queue.
+    void submit();
+
+    /// Stop the workers and print how the work was split. The device must be idle.
+    void finish();
+
+private:
+    /// Swap the accumulation buffers and copy the samples swapped out to `hostSamples`.
+    /// Returns false if no samples were added since the last merge.
+    bool drain();
+
+    void record(vk::CommandBuffer cmd, uint32_t slot, bool merge);
+    void stop();
+
+    static void workLoop(Shared& shared);
+};
+
+} // namespace app
@@ -0,0 +1,311 @@
+#include "lights.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+
+namespace app {
+
+namespace {
+
+const float PI = 3.14159265358979323846f;
+
+struct Vec3 {
+    float x, y, z;
+
+    float operator[](int i) const { return i == 0 ? x : (i == 1 ? y : z); }
+};
+
+Vec3 operator+(Vec3 a, Vec3 b) { return Vec3 { a.x + b.x, a.y + b.y, a.z + b.z }; }
+Vec3 operator-(Vec3 a, Vec3 b) { return Vec3 { a.x - b.x, a.y - b.y, a.z - b.z }; }
+Vec3 operator*(Vec3 a, float k) { return Vec3 { a.x * k, a.y * k, a.z * k }; }
+float dot(Vec3 a, Vec3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+float length(Vec3 a) { return std::sqrt(dot(a, a)); }
+Vec3 normalize(Vec3 a) { return a * (1.0f / length(a)); }
+Vec3 min(Vec3 a, Vec3 b) { return Vec3 { std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z) }; }
+Vec3 max(Vec3 a, Vec3 b) { return Vec3 { std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z) }; }
+
+/// Spatial and directional bounds of a set of lights.
+struct LightBounds {
+    Vec3 min;
+    Vec3 max;
+    float power;
+
+    Vec3 axis;
+    float thetaO;
+    float thetaE;
+
+    Vec3 centroid() const { return (this->min + this->max) * 0.5f; }
+
+    float area() const {
+        auto d = this->max - this->min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    /// Solid angle measure of the directions the lights can emit in.
+    float orientationMeasure() const {
+        float thetaW = std::min(this->thetaO + this->thetaE, PI);
+        return 2.0f * PI * (1.0f - std::cos(this->thetaO)) + PI / 2.0f * (2.0f * thetaW * std::sin(this->thetaO)
+            - std::cos(this->thetaO - 2.0f * thetaW) - 2.0f * this->thetaO * std::sin(this->thetaO)
+            + std::cos(this->thetaO));
+    }
+};
+
+float luminance(const float color[4]) {
+    return color[0] * 0.2126f + color[1] * 0.7152f + color[2] * 0.0722f;
+}
+
+Vec3 cross(Vec3 a, Vec3 b) {
+    return Vec3 { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+LightBounds lightBounds(const Light& light) {
+    auto pos = Vec3 { light.position[0], light.position[1], light.position[2] };
+
+    switch (light.type) {
+        case Light::POINT: {
+            // Emits in every direction.
+            return LightBounds { pos, pos, 4.0f * PI * luminance(light.color),
+                Vec3 { 0.0f, 0.0f, 1.0f }, PI, PI / 2.0f };
+        }
+        case Light::SPHERE: {
+            float radius = light.position[3];
+            auto extent = Vec3 { radius, radius, radius };
+            float power = PI * luminance(light.color) * 4.0f * PI * radius * radius;
+
+            return LightBounds { pos - extent, pos + extent, power, Vec3 { 0.0f, 0.0f, 1.0f }, PI, PI / 2.0f };
+        }
+        case Light::RECT: {
+            auto u = Vec3 { light.edgeU[0], light.edgeU[1], light.edgeU[2] };
+            auto v = Vec3 { light.edgeV[0], light.edgeV[1], light.edgeV[2] };
+            auto normal = cross(u, v);
+            float power = PI * luminance(light.color) * length(normal);
+
+            // Emits in a hemisphere around the normal.
+            auto lo = min(min(pos, pos + u), min(pos + v, pos + u + v));
+            auto hi = max(max(pos, pos + u), max(pos + v, pos + u + v));
+            return LightBounds { lo, hi, power, normalize(normal), 0.0f, PI / 2.0f };
+        }
+    }
+
+    throw std::runtime_error("unknown light type");
+}
+
+/// Smallest cone containing both cones, as in "Importance Sampling of Many Lights
+/// with Adaptive Tree Splitting" by Conty Estevez and Kulla.
+void unionCones(const LightBounds& a, const LightBounds& b, Vec3& axis, float& thetaO) {
+    if (b.thetaO > a.thetaO) {
+        unionCones(b, a, axis, thetaO);
+        return;
+    }
+
+    float thetaD = std::acos(std::max(-1.0f, std::min(1.0f, dot(a.axis, b.axis))));
+
+    if (std::min(thetaD + b.thetaO, PI) <= a.thetaO) {
+        axis = a.axis;
+        thetaO = a.thetaO;
+        return;
+    }
+
+    thetaO = (a.thetaO + thetaD + b.thetaO) / 2.0f;
+    if (thetaO >= PI) {
+        axis = a.axis;
+        thetaO = PI;
+        return;
+    }
+
+    // Rotate `a.axis` towards `b.axis` by the difference in the angles.
+    float thetaR = thetaO - a.thetaO;
+    auto ortho = b.axis - a.axis * dot(a.axis, b.axis);
+    if (length(ortho) < 1e-6f) {
+        axis = a.axis;
+        return;
+    }
+
+    axis = normalize(a.axis * std::cos(thetaR) + normalize(ortho) * std::sin(thetaR));
+}
+
+LightBounds unionBounds(const LightBounds& a, const LightBounds& b) {
+    if (a.power == 0.0f) { return b; }
+    if (b.power == 0.0f) { return a; }
+
+    auto result = LightBounds {
+        min(a.min, b.min), max(a.max, b.max), a.power + b.power,
+        a.axis, a.thetaO, std::max(a.thetaE, b.thetaE)
+    };
+
+    unionCones(a, b, result.axis, result.thetaO);
+    return result;
+}
+
+const LightBounds EMPTY_BOUNDS = LightBounds {
+    Vec3 { INFINITY, INFINITY, INFINITY }, Vec3 { -INFINITY, -INFINITY, -INFINITY }, 0.0f,
+    Vec3 { 0.0f, 0.0f, 1.0f }, 0.0f, 0.0f
+};
+
+/// Cost of a node by the surface area orientation heuristic.
+float nodeCost(const LightBounds& bounds) {
+    if (bounds.power == 0.0f) { return 0.0f; }
+
+    return bounds.power * std::max(bounds.area(), 1e-6f) * bounds.orientationMeasure();
+}
+
+struct Builder {
+    /// Past this depth the lights are split in halves, to keep the tree paths within 64 bits.
+    static const uint32_t MAX_HEURISTIC_DEPTH = 32;
+
+    const std::vector<LightBounds>& bounds;
+    std::vector<Light>& lights;
+    std::vector<LightNode> nodes;
+
+    uint32_t build(std::vector<uint32_t>::iterator begin, std::vector<uint32_t>::iterator end,
+        uint32_t depth, uint64_t path)
+    {
+        auto total = EMPTY_BOUNDS;
+        for (auto it = begin; it != end; it++) {
+            total = unionBounds(total, this->bounds[*it]);
+        }
+
+        auto index = uint32_t(this->nodes.size());
+        this->nodes.push_back(LightNode {
+            { total.min.x, total.min.y, total.min.z, total.power },
+            { total.max.x, total.max.y, total.max.z, std::cos(total.thetaE) },
+            { total.axis.x, total.axis.y, total.axis.z, std::cos(total.thetaO) },
+            { LightNode::LEAF, LightNode::LEAF, *begin, 0 }
+        });
+
+        if (end - begin == 1) {
+            auto& light = this->lights[*begin];
+            light.treeDepth = depth;
+            light.treePath[0] = uint32_t(path);
+            light.treePath[1] = uint32_t(path >> 32);
+            return index;
+        }
+
+        auto split = depth < MAX_HEURISTIC_DEPTH ? this->findSplit(begin, end) : begin + (end - begin) / 2;
+        auto left = this->build(begin, split, depth + 1, path);
+        auto right = this->build(split, end, depth + 1, path | (uint64_t(1) << depth));
+
+        this->nodes[index].children[0] = left;
+        this->nodes[index].children[1] = right;
+        return index;
+    }
+
+    /// Sort the lights along the best axis and return the best split position.
+    std::vector<uint32_t>::iterator findSplit(std::vector<uint32_t>::iterator begin,
+        std::vector<uint32_t>::iterator end)
+    {
+        const auto count = size_t(end - begin);
+
+        float bestCost = INFINITY;
+        int bestAxis = 0;
+        size_t bestSplit = count / 2;
+
+        auto suffix = std::vector<LightBounds>(count + 1, EMPTY_BOUNDS);
+
+        for (int axis = 0; axis < 3; axis++) {
+            std::sort(begin, end, [&](uint32_t a, uint32_t b) {
+                return this->bounds[a].centroid()[axis] < this->bounds[b].centroid()[axis];
+            });
+
+            for (size_t i = count; i-- > 0;) {
+                suffix[i] = unionBounds(suffix[i + 1], this->bounds[begin[i]]);
+            }
+
+            auto prefix = EMPTY_BOUNDS;
+            for (size_t i = 1; i < count; i++) {
+                prefix = unionBounds(prefix, this->bounds[begin[i - 1]]);
+
+                float cost = nodeCost(prefix) + nodeCost(suffix[i]);
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = i;
+                }
+            }
+
+            std::fill(suffix.begin(), suffix.end(), EMPTY_BOUNDS);
+        }
+
+        std::sort(begin, end, [&](uint32_t a, uint32_t b) {
+            return this->bounds[a].centroid()[bestAxis] < this->bounds[b].centroid()[bestAxis];
+        });
+
+        return begin + bestSplit;
+    }
+};
+
+} // namespace
+
+Light Light::point(float x, float y, float z, float r, float g, float b) {
+    return Light { { x, y, z, 0.0f }, { r, g, b, 0.0f }, {}, {}, POINT, 0, { 0, 0 } };
+}
+
+Light Light::sphere(float x, float y, float z, float radius, float r, float g, float b) {
+    return Light { { x, y, z, radius }, { r, g, b, 0.0f }, {}, {}, SPHERE, 0, { 0, 0 } };
+}
+
+Light Light::rect(const float corner[3], const float edgeU[3], const float edgeV[3], float r, float g, float b) {
+    return Light {
+        { corner[0], corner[1], corner[2], 0.0f }, { r, g, b, 0.0f },
+        { edgeU[0], edgeU[1], edgeU[2], 0.0f }, { edgeV[0], edgeV[1], edgeV[2], 0.0f },
+        RECT, 0, { 0, 0 }
+    };
+}
+
+std::vector<Light> defaultLights() {
+    // A square light above the spheres, facing down.
+    const float corner[3] = { -0.3f, -1.0f, 1.5f };
+    const float edgeU[3] = { 0.6f, 0.0f, 0.0f };
+    const float edgeV[3] = { 0.0f, 0.0f, -0.6f };
+
+    return std::vector<Light> {
+        Light::rect(corner, edgeU, edgeV, 50.0f, 50.0f, 50.0f),
+        // Light::point(0.0f, -1.0f, 0.0f, 4.5f, 4.5f, 4.5f),
+        // Light::sphere(-0.9f, -0.9f, 0.6f, 0.05f, 40.0f, 40.0f, 120.0f),
+    };
+}
+
+std::vector<Light> randomLights(size_t count) {
+    auto rng = std::mt19937(1);
+    auto coord = std::uniform_real_distribution<float>(-1.5f, 1.5f);
+    auto tint = std::uniform_real_distribution<float>(0.2f, 1.0f);
+
+    const float power = 9.0f / float(count);
+
+    auto lights = std::vector<Light>();
+    lights.reserve(count);
+
+    for (size_t i = 0; i < count; i++) {
+        float x = coord(rng);
+        float y = -1.0f + 0.3f * coord(rng);
+        float z = 1.5f + coord(rng);
+
+        lights.push_back(Light::point(x, y, z, power * tint(rng), power * tint(rng), power * tint(rng)));
+    }
+
+    return lights;
+}
+
+std::vector<LightNode> buildLightTree(std::vector<Light>& lights) {
+    if (lights.empty()) {
+        throw std::runtime_error("the scene needs at least one light");
+    }
+
+    auto bounds = std::vector<LightBounds>();
+    bounds.reserve(lights.size());
+    std::transform(lights.begin(), lights.end(), std::back_inserter(bounds), lightBounds);
+
+    auto indices = std::vector<uint32_t>(lights.size());
+    std::iota(indices.begin(), indices.end(), 0);
+
+    auto builder = Builder { bounds, lights, {} };
+    builder.nodes.reserve(2 * lights.size() - 1);
+    builder.build(indices.begin(), indices.end(), 0, 0);
+
+    return std::move(builder.nodes);
+}
+
+} // namespace app
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace app {
+
+/// A light source, laid out as `Light` in `shader/main.comp`.
+struct Light {
+    enum Type : uint32_t {
+        POINT = 0,
+        RECT = 1,
+        SPHERE = 2,
+    };
+
+    /// Position of a point light, center of a sphere light or a corner of a rectangle light.
+    ///
+    /// `w` is the radius of a sphere light.
+    float position[4];
+
+    /// Intensity of a point light or emitted radiance of an area light, `w` is unused.
+    float color[4];
+
+    /// The two edges of a rectangle light, starting at `position`. Their cross product
+    /// is the direction the light emits in. `w` is unused.
+    float edgeU[4];
+    float edgeV[4];
+
+    Type type;
+
+    /// Path from the root of the light tree to the leaf with this light.
+    ///
+    /// Bit `i` of `treePath` is set if the path goes right at depth `i`.
+    /// Filled in by `buildLightTree`.
+    uint32_t treeDepth;
+    uint32_t treePath[2];
+
+    static Light point(float x, float y, float z, float r, float g, float b);
+    static Light sphere(float x, float y, float z, float radius, float r, float g, float b);
+    static Light rect(const float corner[3], const float edgeU[3], const float edgeV[3], float r, float g, float b);
+};
+
+/// A node of the light tree, laid out as `LightNode` in `shader/main.comp`.
+///
+/// Every node bounds the lights below it spatially (with a box) and directionally (with a cone
+/// of emission normals `axis` and `cosThetaO`, widened by `cosThetaE` for the spread of the emission).
+/// The shader walks from the root to a leaf, picking a child at random with a probability
+/// proportional to an estimate of how much light it contributes to the shading point.
+///
+/// The boxes also serve as a BVH for finding the area lights hit by a ray.
+struct LightNode {
+    /// Minimum corner of the bounding box, `w` is the total power of the lights.
+    float boundsMin[4];
+
+    /// Maximum corner of the bounding box, `w` is the cosine of the emission angle `theta_e`.
+    float boundsMax[4];
+
+    /// Axis of the normals cone, `w` is the cosine of its half angle `theta_o`.
+    float axis[4];
+
+    /// Indices of the left and right child, or `LEAF` and the index of the light.
+    uint32_t children[4];
+
+    static constexpr uint32_t LEAF = ~uint32_t(0);
+};
+
+/// The lights of the default scene.
+std::vector<Light> defaultLights();
+
+/// A set of `count` small lights scattered around the default scene, for testing many-light sampling.
+///
+/// Their total power is the same regardless of their number.
+std::vector<Light> randomLights(size_t count);
+
+/// Build a light tree and fill in the tree paths of the lights. The root is the first node in the result.
+std::vector<LightNode> buildLightTree(std::vector<Light>& lights);
+
+} // namespace app
@@ -0,0 +1,956 @@
+#include "mesh.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace app {
+
+namespace {
+
+/// Work is cut into this many ranges per thread, so threads which finish early take over the rest.
+const size_t RANGES_PER_THREAD = 8;
+
+/// Marks a corner without a texture coordinate or normal.
+const uint32_t NO_INDEX = ~uint32_t(0);
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool hasExtension(const std::string& path, const std::string& extension) {
+    return path.size() >= extension.size()
+        && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+/// Map the whole file at `path` read-only into memory, unmapped when the last reference goes away.
+std::shared_ptr<const char> mapFile(const std::string& path, size_t& size) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("failed to open " + path);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw std::runtime_error("failed to read the size of " + path);
+    }
+
+    size = size_t(info.st_size);
+    if (size == 0) {
+        close(fd);
+        throw std::runtime_error("mesh file is empty: " + path);
+    }
+
+    // The mapping stays valid after the file is closed.
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("failed to map " + path);
+    }
+
+    madvise(mapped, size, MADV_SEQUENTIAL);
+
+    return std::shared_ptr<const char>(static_cast<const char*>(mapped),
+        [size](const char* data) { munmap(const_cast<char*>(data), size); });
+}
+
+/// Call `f(begin, end)` for ranges covering `[0, count)` on `threadCount` threads. The first exception thrown
+/// by `f` is rethrown once all threads are done.
+template<typename F>
+void parallelFor(size_t count, size_t threadCount, F f) {
+    const size_t rangeCount = std::max<size_t>(1, std::min(count, threadCount * RANGES_PER_THREAD));
+    auto next = std::atomic<size_t>(0);
+    auto error = std::exception_ptr();
+    auto errorMutex = std::mutex();
+
+    auto work = [&] {
+        for (size_t range = next++; range < rangeCount; range = next++) {
+            try {
+                f(count * range / rangeCount, count * (range + 1) / rangeCount);
+            } catch (...) {
+                auto lock = std::lock_guard(errorMutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+    };
+
+    auto threads = std::vector<std::thread>();
+    for (size_t i = 1; i < std::min(threadCount, rangeCount); i++) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+const char* skipSpaces(const char* p, const char* end) {
+    while (p < end && isSpace(*p)) {
+        p++;
+    }
+    return p;
+}
+
+/// Call `f(begin, end)` for each line in `[begin, end)`, without the line break.
+template<typename F>
+void forEachLine(const char* begin, const char* end, F f) {
+    while (begin < end) {
+        auto lineEnd = static_cast<const char*>(std::memchr(begin, '\n', size_t(end - begin)));
+        if (lineEnd == nullptr) {
+            lineEnd = end;
+        }
+
+        f(begin, lineEnd);
+        begin = lineEnd + 1;
+    }
+}
+
+/// The error for the line `[begin, end)` of the file mapped at `data`. The line number is only counted here,
+/// as the chunks don't know how many lines come before them.
+std::runtime_error invalidLine(const std::string& path, const char* data, const char* begin, const char* end) {
+    const auto number = std::count(data, begin, '\n') + 1;
+    return std::runtime_error("invalid line " + std::to_string(number) + " in " + path + ": "
+        + std::string(begin, end));
+}
+
+enum class ObjLine {
+    Position,
+    Texcoord,
+    Normal,
+    Face,
+    Other,
+};
+
+/// The kind of the line starting at `p`, after leading spaces.
+ObjLine classifyObjLine(const char* p, const char* end) {
+    if (end - p >= 2 && p[0] == 'v') {
+        if (isSpace(p[1])) { return ObjLine::Position; }
+        if (end - p >= 3 && p[1] == 't' && isSpace(p[2])) { return ObjLine::Texcoord; }
+        if (end - p >= 3 && p[1] == 'n' && isSpace(p[2])) { return ObjLine::Normal; }
+    }
+
+    if (end - p >= 2 && p[0] == 'f' && isSpace(p[1])) {
+        return ObjLine::Face;
+    }
+
+    return ObjLine::Other;
+}
+
+/// Number of whitespace separated tokens in `[p, end)`.
+size_t countTokens(const char* p, const char* end) {
+    size_t count = 0;
+    while ((p = skipSpaces(p, end)) < end) {
+        count++;
+        while (p < end && !isSpace(*p)) {
+            p++;
+        }
+    }
+    return count;
+}
+
+bool parseFloat(const char*& p, const char* end, float& value) {
+    p = skipSpaces(p, end);
+    if (p < end && *p == '+') {
+        p++;
+    }
+
+    auto [next, ec] = std::from_chars(p, end, value);
+    if (ec == std::errc::result_out_of_range) {
+        // Values past the range of floats don't occur in meshes, other than denormals flushed to zero.
+        value = 0.0f;
+    } else if (ec != std::errc()) {
+        return false;
+    }
+
+    p = next;
+    return true;
+}
+
+/// Parse an OBJ index at `p`, 1-based or negative relative to the `defined` elements before the line,
+/// into a 0-based index below `total`.
+bool parseObjIndex(const char*& p, const char* end, size_t defined, size_t total, uint32_t& index) {
+    int64_t value = 0;
+    auto [next, ec] = std::from_chars(p, end, value);
+    if (ec != std::errc() || value == 0) {
+        return false;
+    }
+
+    int64_t resolved = value > 0 ? value - 1 : int64_t(defined) + value;
+    if (resolved < 0 || uint64_t(resolved) >= total) {
+        return false;
+    }
+
+    p = next;
+    index = uint32_t(resolved);
+    return true;
+}
+
+struct ObjCounts {
+    size_t positions = 0;
+    size_t texcoords = 0;
+    size_t normals = 0;
+    size_t triangles = 0;
+};
+
+/// A line aligned range of an OBJ file, with the number of elements it defines and the number defined before it.
+struct ObjChunk {
+    const char* begin;
+    const char* end;
+    ObjCounts counts;
+    ObjCounts first;
+    bool attributes;
+};
+
+/// OBJ elements, indexed by the corners of the triangles.
+struct ObjData {
+    std::vector<float> positions[3];
+    std::vector<float> texcoords[2];
+    std::vector<float> normals[3];
+
+    /// Position, texture coordinate and normal of each corner.
+    std::vector<uint32_t> corners[3];
+};
+
+uint64_t hashCorner(uint32_t position, uint32_t texcoord, uint32_t normal) {
+    uint64_t h = uint64_t(position) * 0x9e3779b97f4a7c15ull;
+    h ^= (uint64_t(texcoord) + 0x632be59bd9b4e019ull) * 0xc2b2ae3d27d4eb4full;
+    h ^= (uint64_t(normal) + 0x8cb92ba72f3d8dd7ull) * 0x165667b19e3779f9ull;
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ull;
+    return h ^ (h >> 32);
+}
+
+/// Merge the corners which share the same position, texture coordinate and normal into vertices, in the order
+/// of their first use.
+///
+/// Corners are inserted in parallel into an open addressing table of corner indices. A slot is claimed with a
+/// compare and swap, and a corner finding its equal lowers the slot to the smaller of the two indices, so once
+/// all corners are in every slot holds the first corner of its vertex, however the threads raced.
+Mesh mergeObjCorners(ObjData& data, bool hasTexcoords, bool hasNormals, size_t threadCount) {
+    const auto& corners = data.corners;
+    const size_t cornerCount = corners[0].size();
+
+    size_t slotCount = 1;
+    while (slotCount < 2 * cornerCount) {
+        slotCount *= 2;
+    }
+
+    // Slots hold a corner index plus one, zero for empty slots.
+    auto slots = std::vector<std::atomic<uint32_t>>(slotCount);
+    auto cornerSlots = std::vector<uint32_t>(cornerCount);
+    const size_t mask = slotCount - 1;
+
+    parallelFor(cornerCount, threadCount, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; c++) {
+            const uint32_t position = corners[0][c], texcoord = corners[1][c], normal = corners[2][c];
+            size_t slot = hashCorner(position, texcoord, normal) & mask;
+            uint32_t stored = slots[slot].load(std::memory_order_relaxed);
+
+            while (true) {
+                if (stored == 0) {
+                    if (slots[slot].compare_exchange_weak(stored, uint32_t(c + 1), std::memory_order_relaxed)) {
+                        break;
+                    }
+                    continue;
+                }
+
+                const size_t other = stored - 1;
+                if (corners[0][other] == position && corners[1][other] == texcoord && corners[2][other] == normal) {
+                    while (c + 1 < stored
+                        && !slots[slot].compare_exchange_weak(stored, uint32_t(c + 1), std::memory_order_relaxed))
+                    {
+                    }
+                    break;
+                }
+
+                slot = (slot + 1) & mask;
+                stored = slots[slot].load(std::memory_order_relaxed);
+            }
+
+            cornerSlots[c] = uint32_t(slot);
+        }
+    });
+
+    // Look each slot up once more for the first corner of the vertex, the table isn't needed after that.
+    auto& firstCorners = cornerSlots;
+    parallelFor(cornerCount, threadCount, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; c++) {
+            firstCorners[c] = slots[cornerSlots[c]].load(std::memory_order_relaxed) - 1;
+        }
+    });
+    slots = std::vector<std::atomic<uint32_t>>();
+
+    // Number the first corners of the vertices in order, one range after the other.
+    const size_t rangeCount = std::max<size_t>(1, threadCount * RANGES_PER_THREAD);
+    auto rangeVertices = std::vector<size_t>(rangeCount + 1);
+
+    parallelFor(rangeCount, threadCount, [&](size_t begin, size_t end) {
+        for (size_t range = begin; range < end; range++) {
+            size_t count = 0;
+            for (size_t c = cornerCount * range / rangeCount; c < cornerCount * (range + 1) / rangeCount; c++) {
+                count += firstCorners[c] == c;
+            }
+            rangeVertices[range + 1] = count;
+        }
+    });
+
+    for (size_t range = 0; range < rangeCount; range++) {
+        rangeVertices[range + 1] += rangeVertices[range];
+    }
+
+    const size_t vertexCount = rangeVertices[rangeCount];
+    auto vertexIds = std::vector<uint32_t>(cornerCount);
+    auto vertexCorners = std::vector<uint32_t>(vertexCount);
+
+    parallelFor(rangeCount, threadCount, [&](size_t begin, size_t end) {
+        for (size_t range = begin; range < end; range++) {
+            size_t vertex = rangeVertices[range];
+            for (size_t c = cornerCount * range / rangeCount; c < cornerCount * (range + 1) / rangeCount; c++) {
+                if (firstCorners[c] == c) {
+                    vertexIds[c] = uint32_t(vertex);
+                    vertexCorners[vertex++] = uint32_t(c);
+                }
+            }
+        }
+    });
+
+    auto mesh = Mesh();
+    mesh.indices.resize(cornerCount);
+    mesh.positionX.resize(vertexCount);
+    mesh.positionY.resize(vertexCount);
+    mesh.positionZ.resize(vertexCount);
+    if (hasTexcoords) {
+        mesh.texcoordU.resize(vertexCount);
+        mesh.texcoordV.resize(vertexCount);
+    }
+    if (hasNormals) {
+        mesh.normalX.resize(vertexCount);
+        mesh.normalY.resize(vertexCount);
+        mesh.normalZ.resize(vertexCount);
+    }
+
+    parallelFor(cornerCount, threadCount, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; c++) {
+            mesh.indices[c] = vertexIds[firstCorners[c]];
+        }
+    });
+
+    // Corners without a texture coordinate or normal get zeroes.
+    parallelFor(vertexCount, threadCount, [&](size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++) {
+            const uint32_t c = vertexCorners[v];
+            const uint32_t position = corners[0][c], texcoord = corners[1][c], normal = corners[2][c];
+
+            mesh.positionX[v] = data.positions[0][position];
+            mesh.positionY[v] = data.positions[1][position];
+            mesh.positionZ[v] = data.positions[2][position];
+
+            if (hasTexcoords && texcoord != NO_INDEX) {
+                mesh.texcoordU[v] = data.texcoords[0][texcoord];
+                mesh.texcoordV[v] = data.texcoords[1][texcoord];
+            }
+            if (hasNormals && normal != NO_INDEX) {
+                mesh.normalX[v] = data.normals[0][normal];
+                mesh.normalY[v] = data.normals[1][normal];
+                mesh.normalZ[v] = data.normals[2][normal];
+            }
+        }
+    });
+
+    return mesh;
+}
+
+Mesh importObj(const std::string& path, const char* data, size_t size, size_t threadCount) {
+    // Cut the file at the first line break after evenly spaced offsets.
+    const size_t chunkCount = std::max<size_t>(1, std::min(size / 4096, threadCount * RANGES_PER_THREAD));
+    auto chunks = std::vector<ObjChunk>();
+    const char* chunkBegin = data;
+    const char* fileEnd = data + size;
+
+    for (size_t i = 1; i <= chunkCount; i++) {
+        const char* chunkEnd = fileEnd;
+        if (i < chunkCount) {
+            chunkEnd = std::max(chunkBegin, data + size * i / chunkCount);
+            auto lineEnd = static_cast<const char*>(std::memchr(chunkEnd, '\n', size_t(fileEnd - chunkEnd)));
+            chunkEnd = lineEnd == nullptr ? fileEnd : lineEnd + 1;
+        }
+
+        if (chunkEnd > chunkBegin) {
+            chunks.push_back(ObjChunk { chunkBegin, chunkEnd, {}, {}, false });
+        }
+        chunkBegin = chunkEnd;
+    }
+
+    parallelFor(chunks.size(), threadCount, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            ObjCounts& counts = chunks[i].counts;
+            forEachLine(chunks[i].begin, chunks[i].end, [&](const char* p, const char* lineEnd) {
+                p = skipSpaces(p, lineEnd);
+                switch (classifyObjLine(p, lineEnd)) {
+                case ObjLine::Position: counts.positions++; break;
+                case ObjLine::Texcoord: counts.texcoords++; break;
+                case ObjLine::Normal: counts.normals++; break;
+                case ObjLine::Face: counts.triangles += std::max<size_t>(countTokens(p + 1, lineEnd), 2) - 2; break;
+                case ObjLine::Other: break;
+                }
+            });
+        }
+    });
+
+    auto total = ObjCounts();
+    for (auto& chunk : chunks) {
+        chunk.first = total;
+        total.positions += chunk.counts.positions;
+        total.texcoords += chunk.counts.texcoords;
+        total.normals += chunk.counts.normals;
+        total.triangles += chunk.counts.triangles;
+    }
+
+    if (3 * total.triangles >= NO_INDEX || total.positions >= NO_INDEX) {
+        throw std::runtime_error("mesh has too many triangles or vertices for 32 bit indices: " + path);
+    }
+
+    auto obj = ObjData();
+    for (size_t c = 0; c < 3; c++) {
+        obj.positions[c].resize(total.positions);
+        obj.normals[c].resize(total.normals);
+        obj.corners[c].resize(3 * total.triangles);
+    }
+    for (size_t c = 0; c < 2; c++) {
+        obj.texcoords[c].resize(total.texcoords);
+    }
+
+    parallelFor(chunks.size(), threadCount, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            ObjCounts next = chunks[i].first;
+            bool attributes = false;
+
+            forEachLine(chunks[i].begin, chunks[i].end, [&](const char* line, const char* lineEnd) {
+                const char* p = skipSpaces(line, lineEnd);
+                const ObjLine kind = classifyObjLine(p, lineEnd);
+                bool valid = true;
+
+                if (kind == ObjLine::Position) {
+                    p += 1;
+                    for (size_t c = 0; c < 3; c++) {
+                        valid = valid && parseFloat(p, lineEnd, obj.positions[c][next.positions]);
+                    }
+                    next.positions++;
+                } else if (kind == ObjLine::Texcoord) {
+                    // The second coordinate is optional.
+                    p += 2;
+                    valid = parseFloat(p, lineEnd, obj.texcoords[0][next.texcoords]);
+                    if (valid && !parseFloat(p, lineEnd, obj.texcoords[1][next.texcoords])) {
+                        obj.texcoords[1][next.texcoords] = 0.0f;
+                    }
+                    next.texcoords++;
+                } else if (kind == ObjLine::Normal) {
+                    p += 2;
+                    for (size_t c = 0; c < 3; c++) {
+                        valid = valid && parseFloat(p, lineEnd, obj.normals[c][next.normals]);
+                    }
+                    next.normals++;
+                } else if (kind == ObjLine::Face) {
+                    // `v`, `v/vt`, `v//vn` or `v/vt/vn` per corner, triangulated as a fan around the first one.
+                    uint32_t firstCorner[3];
+                    uint32_t lastCorner[3];
+                    size_t corner = 0;
+                    p += 1;
+
+                    while (valid && (p = skipSpaces(p, lineEnd)) < lineEnd) {
+                        uint32_t indices[3] = { NO_INDEX, NO_INDEX, NO_INDEX };
+                        valid = parseObjIndex(p, lineEnd, next.positions, total.positions, indices[0]);
+
+                        if (valid && p < lineEnd && *p == '/') {
+                            p++;
+                            if (p < lineEnd && *p != '/') {
+                                valid = parseObjIndex(p, lineEnd, next.texcoords, total.texcoords, indices[1]);
+                            }
+                            if (valid && p < lineEnd && *p == '/') {
+                                p++;
+                                valid = parseObjIndex(p, lineEnd, next.normals, total.normals, indices[2]);
+                            }
+                        }
+
+                        valid = valid && (p == lineEnd || isSpace(*p));
+                        if (!valid) {
+                            break;
+                        }
+
+                        attributes = attributes || indices[1] != NO_INDEX || indices[2] != NO_INDEX;
+
+                        if (corner == 0) {
+                            std::copy(indices, indices + 3, firstCorner);
+                        } else if (corner >= 2) {
+                            const size_t base = 3 * next.triangles++;
+                            for (size_t c = 0; c < 3; c++) {
+                                obj.corners[c][base] = firstCorner[c];
+                                obj.corners[c][base + 1] = lastCorner[c];
+                                obj.corners[c][base + 2] = indices[c];
+                            }
+                        }
+
+                        std::copy(indices, indices + 3, lastCorner);
+                        corner++;
+                    }
+
+                    valid = valid && corner >= 3;
+                }
+
+                if (!valid) {
+                    throw invalidLine(path, data, line, lineEnd);
+                }
+            });
+
+            chunks[i].attributes = attributes;
+        }
+    });
+
+    bool attributes = false;
+    for (const auto& chunk : chunks) {
+        attributes = attributes || chunk.attributes;
+    }
+
+    if (attributes) {
+        return mergeObjCorners(obj, total.texcoords > 0, total.normals > 0, threadCount);
+    }
+
+    // Without texture coordinates and normals the positions are the vertices, and the arrays are kept as they are.
+    auto mesh = Mesh();
+    mesh.positionX = std::move(obj.positions[0]);
+    mesh.positionY = std::move(obj.positions[1]);
+    mesh.positionZ = std::move(obj.positions[2]);
+    mesh.indices = std::move(obj.corners[0]);
+    return mesh;
+}
+
+enum class PlyType {
+    Int8,
+    Uint8,
+    Int16,
+    Uint16,
+    Int32,
+    Uint32,
+    Float32,
+    Float64,
+};
+
+size_t plyTypeSize(PlyType type) {
+    switch (type) {
+    case PlyType::Int8: case PlyType::Uint8: return 1;
+    case PlyType::Int16: case PlyType::Uint16: return 2;
+    case PlyType::Int32: case PlyType::Uint32: case PlyType::Float32: return 4;
+    case PlyType::Float64: return 8;
+    }
+    return 0;
+}
+
+PlyType parsePlyType(const std::string& name, const std::string& path) {
+    if (name == "char" || name == "int8") { return PlyType::Int8; }
+    if (name == "uchar" || name == "uint8") { return PlyType::Uint8; }
+    if (name == "short" || name == "int16") { return PlyType::Int16; }
+    if (name == "ushort" || name == "uint16") { return PlyType::Uint16; }
+    if (name == "int" || name == "int32") { return PlyType::Int32; }
+    if (name == "uint" || name == "uint32") { return PlyType::Uint32; }
+    if (name == "float" || name == "float32") { return PlyType::Float32; }
+    if (name == "double" || name == "float64") { return PlyType::Float64; }
+    throw std::runtime_error("unknown PLY property type " + name + " in " + path);
+}
+
+/// Read a little endian value of `type` at `p`.
+template<typename T>
+T readPly(const char* p, PlyType type) {
+    switch (type) {
+    case PlyType::Int8: { int8_t v; std::memcpy(&v, p, sizeof(v)); return T(v); }
+    case PlyType::Uint8: { uint8_t v; std::memcpy(&v, p, sizeof(v)); return T(v); }
+    case PlyType::Int16: { int16_t v; std::memcpy(&v, p, sizeof(v)); return T(v); }
+    case PlyType::Uint16: { uint16_t v; std::memcpy(&v, p, sizeof(v)); return T(v); }
+    case PlyType::Int32: { int32_t v; std::memcpy(&v, p, sizeof(v)); return T(v); }
+    case PlyType::Uint32: { uint32_t v; std::memcpy(&v, p, sizeof(v)); return T(v); }
+    case PlyType::Float32: { float v; std::memcpy(&v, p, sizeof(v)); return T(v); }
+    case PlyType::Float64: { double v; std::memcpy(&v, p, sizeof(v)); return T(v); }
+    }
+    return T(0);
+}
+
+struct PlyProperty {
+    std::string name;
+    PlyType type;
+
+    /// For lists, `type` is the type of the items, preceded by their count.
+    bool list;
+    PlyType countType;
+
+    /// Offset in the element, for elements without lists.
+    size_t offset;
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count;
+    std::vector<PlyProperty> properties;
+
+    /// Size of each element, zero if it has lists.
+    size_t size;
+};
+
+/// Position of the property called one of `names` in `element`, or -1.
+int findPlyProperty(const PlyElement& element, std::initializer_list<const char*> names) {
+    for (size_t i = 0; i < element.properties.size(); i++) {
+        for (const char* name : names) {
+            if (element.properties[i].name == name && !element.properties[i].list) {
+                return int(i);
+            }
+        }
+    }
+    return -1;
+}
+
+Mesh importPly(const std::string& path, const char* data, size_t size, size_t threadCount) {
+    // The header is text, up to a line with `end_header`.
+    const char* fileEnd = data + size;
+    const char* body = nullptr;
+    auto elements = std::vector<PlyElement>();
+    bool littleEndian = false;
+    size_t lineNumber = 0;
+
+    for (const char* line = data; line < fileEnd && body == nullptr; lineNumber++) {
+        auto lineEnd = static_cast<const char*>(std::memchr(line, '\n', size_t(fileEnd - line)));
+        if (lineEnd == nullptr) {
+            break;
+        }
+
+        auto words = std::istringstream(std::string(line, lineEnd));
+        auto keyword = std::string();
+        words >> keyword;
+
+        if (lineNumber == 0 && keyword != "ply") {
+            throw std::runtime_error("invalid PLY header in " + path);
+        } else if (keyword == "format") {
+            auto format = std::string();
+            words >> format;
+            littleEndian = format == "binary_little_endian";
+        } else if (keyword == "element") {
+            auto element = PlyElement { "", 0, {}, 0 };
+            if (!(words >> element.name >> element.count)) {
+                throw std::runtime_error("invalid PLY element in " + path);
+            }
+            elements.push_back(element);
+        } else if (keyword == "property" && !elements.empty()) {
+            auto type = std::string();
+            auto property = PlyProperty { "", PlyType::Uint8, false, PlyType::Uint8, 0 };
+            words >> type;
+
+            if (type == "list") {
+                auto countType = std::string();
+                words >> countType >> type;
+                property.list = true;
+                property.countType = parsePlyType(countType, path);
+            }
+
+            property.type = parsePlyType(type, path);
+            if (!(words >> property.name)) {
+                throw std::runtime_error("invalid PLY property in " + path);
+            }
+            elements.back().properties.push_back(property);
+        } else if (keyword == "end_header") {
+            body = lineEnd + 1;
+        }
+
+        line = lineEnd + 1;
+    }
+
+    if (body == nullptr) {
+        throw std::runtime_error("PLY header has no end in " + path);
+    }
+    if (!littleEndian) {
+        throw std::runtime_error("only binary little endian PLY files are supported: " + path);
+    }
+
+    for (auto& element : elements) {
+        bool hasList = false;
+        for (auto& property : element.properties) {
+            property.offset = element.size;
+            element.size += plyTypeSize(property.type);
+            hasList = hasList || property.list;
+        }
+        if (hasList) {
+            element.size = 0;
+        }
+    }
+
+    // Elements before the faces must have a fixed size to be skipped, the ones after them are ignored.
+    const PlyElement* vertices = nullptr;
+    const PlyElement* faces = nullptr;
+    const char* vertexData = nullptr;
+    const char* faceData = nullptr;
+    const char* p = body;
+
+    for (const auto& element : elements) {
+        if (element.name == "vertex") {
+            vertices = &element;
+            vertexData = p;
+        } else if (element.name == "face") {
+            faces = &element;
+            faceData = p;
+            break;
+        }
+
+        if (element.size == 0) {
+            throw std::runtime_error("PLY element " + element.name + " has lists and comes before the faces: " + path);
+        }
+        if (element.count > size_t(fileEnd - p) / element.size) {
+            throw std::runtime_error("PLY file is truncated: " + path);
+        }
+        p += element.count * element.size;
+    }
+
+    if (vertices == nullptr || faces == nullptr) {
+        throw std::runtime_error("PLY file needs vertex and face elements: " + path);
+    }
+    if (faces->properties.size() != 1 || !faces->properties[0].list) {
+        throw std::runtime_error("PLY faces must have a single list of vertex indices: " + path);
+    }
+    if (vertices->count >= NO_INDEX) {
+        throw std::runtime_error("mesh has too many vertices for 32 bit indices: " + path);
+    }
+
+    const int x = findPlyProperty(*vertices, { "x" });
+    const int y = findPlyProperty(*vertices, { "y" });
+    const int z = findPlyProperty(*vertices, { "z" });
+    const int nx = findPlyProperty(*vertices, { "nx" });
+    const int ny = findPlyProperty(*vertices, { "ny" });
+    const int nz = findPlyProperty(*vertices, { "nz" });
+    const int u = findPlyProperty(*vertices, { "u", "s", "texture_u", "texture_s" });
+    const int v = findPlyProperty(*vertices, { "v", "t", "texture_v", "texture_t" });
+
+    if (x < 0 || y < 0 || z < 0) {
+        throw std::runtime_error("PLY vertices have no position: " + path);
+    }
+
+    const bool hasNormals = nx >= 0 && ny >= 0 && nz >= 0;
+    const bool hasTexcoords = u >= 0 && v >= 0;
+    const size_t vertexCount = vertices->count;
+
+    auto mesh = Mesh();
+    auto attributes = std::vector<std::pair<std::vector<float>*, const PlyProperty*>> {
+        { &mesh.positionX, &vertices->properties[x] },
+        { &mesh.positionY, &vertices->properties[y] },
+        { &mesh.positionZ, &vertices->properties[z] },
+    };
+    if (hasNormals) {
+        attributes.push_back({ &mesh.normalX, &vertices->properties[nx] });
+        attributes.push_back({ &mesh.normalY, &vertices->properties[ny] });
+        attributes.push_back({ &mesh.normalZ, &vertices->properties[nz] });
+    }
+    if (hasTexcoords) {
+        attributes.push_back({ &mesh.texcoordU, &vertices->properties[u] });
+        attributes.push_back({ &mesh.texcoordV, &vertices->properties[v] });
+    }
+
+    for (auto& [array, property] : attributes) {
+        array->resize(vertexCount);
+    }
+
+    parallelFor(vertexCount, threadCount, [&](size_t begin, size_t end) {
+        for (auto& [array, property] : attributes) {
+            const char* src = vertexData + property->offset;
+            float* dst = array->data();
+
+            if (property->type == PlyType::Float32) {
+                for (size_t i = begin; i < end; i++) {
+                    std::memcpy(&dst[i], src + i * vertices->size, sizeof(float));
+                }
+            } else {
+                for (size_t i = begin; i < end; i++) {
+                    dst[i] = readPly<float>(src + i * vertices->size, property->type);
+                }
+            }
+        }
+    });
+
+    // If all faces are triangles their offsets are known right away. Otherwise a sequential pass over the counts
+    // finds the start of every block of faces and the first triangle of the block.
+    const PlyProperty& list = faces->properties[0];
+    const size_t countSize = plyTypeSize(list.countType);
+    const size_t indexSize = plyTypeSize(list.type);
+    const size_t triangleSize = countSize + 3 * indexSize;
+    const size_t faceCount = faces->count;
+    const size_t faceBytes = size_t(fileEnd - faceData);
+
+    auto isTriangle = std::atomic<bool>(faceCount <= faceBytes / triangleSize);
+    if (isTriangle) {
+        parallelFor(faceCount, threadCount, [&](size_t begin, size_t end) {
+            for (size_t f = begin; f < end && isTriangle.load(std::memory_order_relaxed); f++) {
+                if (readPly<uint64_t>(faceData + f * triangleSize, list.countType) != 3) {
+                    isTriangle = false;
+                }
+            }
+        });
+    }
+
+    const size_t BLOCK_FACES = 1 << 16;
+    auto blockStarts = std::vector<const char*>();
+    auto blockTriangles = std::vector<size_t>();
+    size_t triangleCount = 0;
+
+    if (isTriangle) {
+        triangleCount = faceCount;
+    } else {
+        const char* face = faceData;
+        for (size_t f = 0; f < faceCount; f++) {
+            if (f % BLOCK_FACES == 0) {
+                blockStarts.push_back(face);
+                blockTriangles.push_back(triangleCount);
+            }
+            if (size_t(fileEnd - face) < countSize) {
+                throw std::runtime_error("PLY file is truncated: " + path);
+            }
+
+            auto corners = readPly<uint64_t>(face, list.countType);
+            if (corners > (size_t(fileEnd - face) - countSize) / indexSize) {
+                throw std::runtime_error("PLY file is truncated: " + path);
+            }
+
+            triangleCount += corners >= 3 ? corners - 2 : 0;
+            face += countSize + corners * indexSize;
+        }
+    }
+
+    if (3 * triangleCount >= NO_INDEX) {
+        throw std::runtime_error("mesh has too many triangles for 32 bit indices: " + path);
+    }
+
+    mesh.indices.resize(3 * triangleCount);
+
+    auto checkIndex = [&](int64_t index) {
+        if (index < 0 || uint64_t(index) >= vertexCount) {
+            throw std::runtime_error("PLY face refers to a missing vertex: " + path);
+        }
+        return uint32_t(index);
+    };
+
+    if (isTriangle) {
+        parallelFor(faceCount, threadCount, [&](size_t begin, size_t end) {
+            for (size_t f = begin; f < end; f++) {
+                const char* indices = faceData + f * triangleSize + countSize;
+                for (size_t c = 0; c < 3; c++) {
+                    mesh.indices[3 * f + c] = checkIndex(readPly<int64_t>(indices + c * indexSize, list.type));
+                }
+            }
+        });
+    } else {
+        parallelFor(blockStarts.size(), threadCount, [&](size_t begin, size_t end) {
+            for (size_t block = begin; block < end; block++) {
+                const char* face = blockStarts[block];
+                uint32_t* out = &mesh.indices[3 * blockTriangles[block]];
+                const size_t blockEnd = std::min(faceCount, (block + 1) * BLOCK_FACES);
+
+                for (size_t f = block * BLOCK_FACES; f < blockEnd; f++) {
+                    auto corners = readPly<uint64_t>(face, list.countType);
+                    const char* indices = face + countSize;
+
+                    // A fan around the first corner.
+                    for (size_t c = 2; c < corners; c++) {
+                        *out++ = checkIndex(readPly<int64_t>(indices, list.type));
+                        *out++ = checkIndex(readPly<int64_t>(indices + (c - 1) * indexSize, list.type));
+                        *out++ = checkIndex(readPly<int64_t>(indices + c * indexSize, list.type));
+                    }
+
+                    face += countSize + corners * indexSize;
+                }
+            }
+        });
+    }
+
+    return mesh;
+}
+
+} // namespace
+
+std::vector<Bounds> Mesh::bounds() const {
+    auto bounds = std::vector<Bounds>(this->triangleCount());
+    const std::vector<float>* positions[3] = { &this->positionX, &this->positionY, &this->positionZ };
+
+    for (size_t t = 0; t < bounds.size(); t++) {
+        for (size_t axis = 0; axis < 3; axis++) {
+            const auto& p = *positions[axis];
+            float a = p[this->indices[3 * t]], b = p[this->indices[3 * t + 1]], c = p[this->indices[3 * t + 2]];
+            bounds[t].min[axis] = std::min({ a, b, c });
+            bounds[t].max[axis] = std::max({ a, b, c });
+        }
+    }
+
+    return bounds;
+}
+
+Mesh importMesh(const std::string& path, size_t threadCount) {
+    const bool obj = hasExtension(path, ".obj");
+    if (!obj && !hasExtension(path, ".ply")) {
+        throw std::runtime_error("unknown mesh format, expected .obj or .ply: " + path);
+    }
+
+    size_t size = 0;
+    auto data = mapFile(path, size);
+    threadCount = std::max<size_t>(1, threadCount);
+
+    return obj
+        ? importObj(path, data.get(), size, threadCount)
+        : importPly(path, data.get(), size, threadCount);
+}
+
+void benchmarkMeshImport(const Options& options) {
+    const size_t threadCount = options.importThreads > 0
+        ? options.importThreads
+        : std::max(1u, std::thread::hardware_concurrency());
+
+    struct stat info;
+    if (stat(options.importBenchPath.c_str(), &info) != 0) {
+        throw std::runtime_error("failed to open " + options.importBenchPath);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto mesh = importMesh(options.importBenchPath, threadCount);
+    double seconds = secondsSince(start);
+
+    // The peak includes the pages of the mapped file, which are dropped once it's unmapped.
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    const double megabytes = double(info.st_size) / 1e6;
+    std::cout << "Imported " << options.importBenchPath << " on " << threadCount << " threads: "
+        << mesh.vertexCount() << " vertices, " << mesh.triangleCount() << " triangles"
+        << (mesh.normalX.empty() ? "" : ", normals") << (mesh.texcoordU.empty() ? "" : ", texture coordinates")
+        << "\n";
+    std::cout << "Parsed " << megabytes << " MB in " << seconds << " s (" << megabytes / seconds << " MB/s), peak RSS "
+        << usage.ru_maxrss / 1024 << " MiB\n";
+}
+
+} // namespace app
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "options.h"
+#include "primitives.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace app {
+
+/// A triangle mesh with one array per vertex attribute, so each can be uploaded as it is into its own
+/// storage buffer.
+struct Mesh {
+    std::vector<float> positionX;
+    std::vector<float> positionY;
+    std::vector<float> positionZ;
+
+    /// Empty if the file has no normals.
+    std::vector<float> normalX;
+    std::vector<float> normalY;
+    std::vector<float> normalZ;
+
+    /// Empty if the file has no texture coordinates.
+    std::vector<float> texcoordU;
+    std::vector<float> texcoordV;
+
+    /// Three vertex indices per triangle.
+    std::vector<uint32_t> indices;
+
+    size_t vertexCount() const { return this->positionX.size(); }
+    size_t triangleCount() const { return this->indices.size() / 3; }
+
+    /// Bounding boxes of the triangles, for `buildBvh`.
+    std::vector<Bounds> bounds() const;
+};
+
+/// Import a Wavefront OBJ or a binary PLY mesh, picked by the extension of `path`, on `threadCount` threads.
+///
+/// The file is mapped into memory instead of read through a stream. OBJ files are cut into chunks at line
+/// breaks, which are parsed in parallel twice: once to count the elements of each chunk, which gives every
+/// chunk its offsets in the output arrays, and once to parse the numbers straight into place. Faces are
+/// triangulated as fans. The OBJ corners which share the same position, texture coordinate and normal are
+/// merged into one vertex through a lock-free hash table, keeping the vertices in the order of their first
+/// use. Without texture coordinates and normals the positions are the vertices and nothing is merged.
+/// PLY vertices have a fixed size and are converted in parallel ranges, as are the faces once their offsets
+/// are known (right away if they're all triangles).
+///
+/// Throws if the file can't be read or isn't valid.
+Mesh importMesh(const std::string& path, size_t threadCount);
+
+/// Import `Options::importBenchPath` and print the throughput and the peak memory use of the process.
+void benchmarkMeshImport(const Options& options);
+
+} // namespace app
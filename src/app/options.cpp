@@ -0,0 +1,196 @@
+#include "options.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace app {
+
+namespace {
+
+const char* nextArg(int argc, const char* const* argv, int& i) {
+    if (i + 1 >= argc) {
+        throw std::runtime_error(std::string("missing value for ") + argv[i]);
+    }
+
+    return argv[++i];
+}
+
+double parseNumber(const char* name, const char* value) {
+    char* end = nullptr;
+    double number = std::strtod(value, &end);
+
+    if (end == value || *end != '\0' || number < 0.0) {
+        throw std::runtime_error(std::string("invalid value for ") + name + ": " + value);
+    }
+
+    return number;
+}
+
+/// Parse `<material>:<path>`.
+std::pair<uint32_t, std::string> parseTexture(const char* name, const char* value) {
+    const char* colon = std::strchr(value, ':');
+    if (colon == nullptr || colon[1] == '\0') {
+        throw std::runtime_error(std::string("invalid value for ") + name + ", expected <material>:<file>: " + value);
+    }
+
+    auto material = parseNumber(name, std::string(value, colon).c_str());
+    return std::make_pair(uint32_t(material), std::string(colon + 1));
+}
+
+} // namespace
+
+Options parseOptions(int argc, const char* const* argv) {
+    auto options = Options();
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+
+        if (std::strcmp(arg, "--checkpoint") == 0) {
+            options.checkpointPath = nextArg(argc, argv, i);
+        } else if (std::strcmp(arg, "--checkpoint-interval") == 0) {
+            options.checkpointInterval = parseNumber(arg, nextArg(argc, argv, i));
+        } else if (std::strcmp(arg, "--checkpoint-budget") == 0) {
+            options.checkpointBudget = parseNumber(arg, nextArg(argc, argv, i));
+        } else if (std::strcmp(arg, "--resume") == 0) {
+            options.resume = true;
+        } else if (std::strcmp(arg, "--lights") == 0) {
+            options.lightCount = size_t(parseNumber(arg, nextArg(argc, argv, i)));
+        } else if (std::strcmp(arg, "--primitives") == 0) {
+            options.primitiveCount = size_t(parseNumber(arg, nextArg(argc, argv, i)));
+        } else if (std::strcmp(arg, "--compressed-bvh") == 0) {
+            options.compressedBvh = true;
+        } else if (std::strcmp(arg, "--half-precision") == 0) {
+            options.halfPrecision = true;
+        } else if (std::strcmp(arg, "--persistent") == 0) {
+            options.persistent = true;
+        } else if (std::strcmp(arg, "--persistent-groups") == 0) {
+            options.persistent = true;
+            options.persistentGroups = size_t(parseNumber(arg, nextArg(argc, argv, i)));
+        } else if (std::strcmp(arg, "--frame-budget") == 0) {
+            options.frameBudget = size_t(parseNumber(arg, nextArg(argc, argv, i)));
+        } else if (std::strcmp(arg, "--tile-batch") == 0) {
+            options.tileBatch = size_t(parseNumber(arg, nextArg(argc, argv, i)));
+        } else if (std::strcmp(arg, "--output") == 0) {
+            options.outputPath = nextArg(argc, argv, i);
+        } else if (std::strcmp(arg, "--output-interval") == 0) {
+            options.outputInterval = size_t(parseNumber(arg, nextArg(argc, argv, i)));
+        } else if (std::strcmp(arg, "--output-depth") == 0) {
+            options.outputDepth = size_t(parseNumber(arg, nextArg(argc, argv, i)));
+        } else if (std::strcmp(arg, "--encoder-threads") == 0) {
+            options.encoderThreads = size_t(parseNumber(arg, nextArg(argc, argv, i)));
+        } else if (std::strcmp(arg, "--reference") == 0) {
+            options.referencePath = nextArg(argc, argv, i);
+        } else if (std::strcmp(arg, "--animation") == 0) {
+            options.animationPath = nextArg(argc, argv, i);
+        } else if (std::strcmp(arg, "--page-budget") == 0) {
+            options.pageBudget = size_t(parseNumber(arg, nextArg(argc, argv, i)));
+        } else if (std::strcmp(arg, "--page-file") == 0) {
+            options.pageFilePath = nextArg(argc, argv, i);
+        } else if (std::strcmp(arg, "--texture") == 0) {
+            options.textures.push_back(parseTexture(arg, nextArg(argc, argv, i)));
+        } else if (std::strcmp(arg, "--texture-budget") == 0) {
+            options.textureBudget = size_t(parseNumber(arg, nextArg(argc, argv, i)));
+        } else if (std::strcmp(arg, "--async-compute") == 0) {
+            options.asyncCompute = true;
+        } else if (std::strcmp(arg, "--hybrid") == 0) {
+            options.hybrid = true;
+            options.persistent = true;
+        } else if (std::strcmp(arg, "--hybrid-threads") == 0) {
+            options.hybrid = true;
+            options.persistent = true;
+            options.hybridThreads = size_t(parseNumber(arg, nextArg(argc, argv, i)));
+        } else if (std::strcmp(arg, "--tile-bins") == 0) {
+            options.tileBinCapacity = size_t(parseNumber(arg, nextArg(argc, argv, i)));
+        } else if (std::strcmp(arg, "--visibility-buffer") == 0) {
+            options.visibilityBuffer = true;
+        } else if (std::strcmp(arg, "--check-visibility") == 0) {
+            options.visibilityBuffer = true;
+            options.checkVisibility = true;
+            options.stats = true;
+        } else if (std::strcmp(arg, "--guiding") == 0) {
+            options.guiding = true;
+        } else if (std::strcmp(arg, "--guide-iterations") == 0) {
+            options.guiding = true;
+            options.guideIterations = size_t(parseNumber(arg, nextArg(argc, argv, i)));
+        } else if (std::strcmp(arg, "--environment") == 0) {
+            options.environmentPath = nextArg(argc, argv, i);
+        } else if (std::strcmp(arg, "--environment-scale") == 0) {
+            options.environmentScale = parseNumber(arg, nextArg(argc, argv, i));
+        } else if (std::strcmp(arg, "--import-bench") == 0) {
+            options.importBenchPath = nextArg(argc, argv, i);
+        } else if (std::strcmp(arg, "--import-threads") == 0) {
+            options.importThreads = size_t(parseNumber(arg, nextArg(argc, argv, i)));
+        } else if (std::strcmp(arg, "--stats") == 0) {
+            options.stats = true;
+        } else if (std::strcmp(arg, "--stats-interval") == 0) {
+            options.stats = true;
+            options.statsInterval = parseNumber(arg, nextArg(argc, argv, i));
+        } else {
+            throw std::runtime_error(std::string("unknown argument ") + arg);
+        }
+    }
+
+    if (options.outputInterval == 0 || options.outputDepth == 0) {
+        throw std::runtime_error("--output-interval and --output-depth must be positive");
+    }
+
+    if (options.persistentGroups == 0 || options.tileBatch == 0) {
+        throw std::runtime_error("--persistent-groups and --tile-batch must be positive");
+    }
+
+    if (!options.referencePath.empty() && options.outputPath.empty()) {
+        throw std::runtime_error("--reference requires --output <file>");
+    }
+
+    if (options.resume && options.checkpointPath.empty()) {
+        throw std::runtime_error("--resume requires --checkpoint <file>");
+    }
+
+    if (!options.animationPath.empty() && !options.checkpointPath.empty()) {
+        throw std::runtime_error("--animation can't be combined with --checkpoint");
+    }
+
+    if (options.pageBudget > 0 && (options.compressedBvh || !options.animationPath.empty())) {
+        throw std::runtime_error("--page-budget can't be combined with --compressed-bvh or --animation");
+    }
+
+    if (!options.pageFilePath.empty() && options.pageBudget == 0) {
+        throw std::runtime_error("--page-file requires --page-budget <MiB>");
+    }
+
+    // Paged primitives aren't known to the binning pass.
+    if (options.tileBinCapacity > 0 && options.pageBudget > 0) {
+        throw std::runtime_error("--tile-bins can't be combined with --page-budget");
+    }
+
+    // The visibility buffer is rasterized once for the scene at startup, and replaces the tile bins.
+    if (options.visibilityBuffer && (options.pageBudget > 0 || !options.animationPath.empty()
+        || options.tileBinCapacity > 0))
+    {
+        throw std::runtime_error(
+            "--visibility-buffer can't be combined with --page-budget, --animation or --tile-bins");
+    }
+
+    // The CPU tracer has no paging or textures, and the queue counter starts over on the host.
+    if (options.hybrid && (options.pageBudget > 0 || !options.textures.empty() || !options.animationPath.empty()
+        || options.resume))
+    {
+        throw std::runtime_error("--hybrid can't be combined with --page-budget, --texture, --animation or --resume");
+    }
+
+    // The CPU tracer doesn't guide, and a guide trained on one frame of an animation is stale for the next.
+    if (options.guiding && (options.guideIterations == 0 || options.hybrid || !options.animationPath.empty())) {
+        throw std::runtime_error("--guiding needs a positive --guide-iterations, and can't be combined with "
+            "--hybrid or --animation");
+    }
+
+    // The CPU tracer only knows the constant background.
+    if (!options.environmentPath.empty() && options.hybrid) {
+        throw std::runtime_error("--environment can't be combined with --hybrid");
+    }
+
+    return options;
+}
+
+} // namespace app
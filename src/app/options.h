@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace app {
+
+/// Runtime settings picked from the command line.
+struct Options {
+    /// File to periodically store the render progress in.
+    ///
+    /// Empty if checkpointing is disabled.
+    std::string checkpointPath;
+
+    /// Seconds between two checkpoints.
+    double checkpointInterval = 300.0;
+
+    /// Maximum share of the render time (in percent) which can be spent on checkpoints.
+    ///
+    /// If a checkpoint turns out to be more expensive, the interval is stretched.
+    double checkpointBudget = 1.0;
+
+    /// Restore the render progress from `checkpointPath` before starting.
+    bool resume = false;
+
+    /// Replace the lights of the default scene with this many randomly placed lights.
+    ///
+    /// Zero keeps the default lights.
+    size_t lightCount = 0;
+
+    /// Add this many small randomly placed spheres and ellipsoids to the default scene.
+    size_t primitiveCount = 0;
+
+    /// Store the BVH with 8 bit child bounds, which takes about half the memory and bandwidth.
+    bool compressedBvh = false;
+
+    /// Accumulate the image in 16 bit floats instead of 32 bit ones.
+    bool halfPrecision = false;
+
+    /// Trace the image with a fixed number of workgroups which pull tiles from a queue in Z-order,
+    /// instead of launching one workgroup per tile.
+    bool persistent = false;
+
+    /// Number of workgroups launched in persistent mode, enough to fill the GPU.
+    size_t persistentGroups = 128;
+
+    /// Number of tiles traced per frame in persistent mode, zero for as many as there are tiles in the image.
+    size_t frameBudget = 0;
+
+    /// Number of tiles a persistent workgroup takes from the queue at once.
+    size_t tileBatch = 4;
+
+    /// Write frames to files named after this path, with the frame number inserted before the extension.
+    ///
+    /// The extension picks the format: `.png`, `.pfm` or `.raw`. Empty if frames aren't written.
+    std::string outputPath;
+
+    /// Write every n-th frame.
+    size_t outputInterval = 1;
+
+    /// Number of frames which can be read back and encoded at the same time.
+    size_t outputDepth = 3;
+
+    /// Number of threads encoding frames, zero for half the hardware threads.
+    size_t encoderThreads = 0;
+
+    /// A PFM image of the converged render, which the written frames are compared against.
+    /// The error of each one is printed at the end along with the time it was rendered at. Empty to skip this.
+    std::string referencePath;
+
+    /// Render the image sequence described by this keyframe file instead of a still image,
+    /// see `loadAnimation`. Empty for a still image.
+    std::string animationPath;
+
+    /// Keep only the top of the BVH on the device and stream the clusters below it in on demand,
+    /// into a page pool of this many MiB. Zero keeps the whole scene resident.
+    size_t pageBudget = 0;
+
+    /// File the clusters are written to for paging, an anonymous temporary file if empty.
+    std::string pageFilePath;
+
+    /// Textures modulating the diffuse color of materials, as material index and path to a PFM file.
+    std::vector<std::pair<uint32_t, std::string>> textures;
+
+    /// Size of the atlas the texture tiles are streamed into, in MiB.
+    size_t textureBudget = 32;
+
+    /// Trace on a compute-only queue family if the device has one, and present from another queue
+    /// through a ring of resolve images, so presenting doesn't stall tracing.
+    bool asyncCompute = false;
+
+    /// Trace part of the image on the CPU, with worker threads taking tiles from the same queue as the GPU.
+    /// Implies `persistent`.
+    bool hybrid = false;
+
+    /// Number of CPU worker threads in hybrid mode, zero for all hardware threads but one.
+    size_t hybridThreads = 0;
+
+    /// Test primary rays only against the primitives overlapping their tile of the image, with lists of
+    /// up to this many primitives per tile built every frame. Zero traces primary rays through the BVH.
+    size_t tileBinCapacity = 0;
+
+    /// Rasterize the primitives hit by primary rays into a visibility buffer once, and start every path
+    /// from there instead of tracing the primary ray.
+    bool visibilityBuffer = false;
+
+    /// Trace primary rays through the BVH anyway and count where the hit differs from the visibility buffer.
+    /// Implies `visibilityBuffer` and `stats`.
+    bool checkVisibility = false;
+
+    /// Sample the bounces off opaque materials from a distribution of the incident light learned from
+    /// earlier paths, see `PathGuide`.
+    bool guiding = false;
+
+    /// Number of training iterations of the guide, each twice as long as the one before, starting with one frame.
+    size_t guideIterations = 8;
+
+    /// An equirectangular HDR image (`.hdr` or `.pfm`) lighting the scene from all directions instead of the
+    /// constant background, see `EnvironmentLight`. Empty for the constant background.
+    std::string environmentPath;
+
+    /// Factor the radiance of the environment map is multiplied by.
+    double environmentScale = 1.0;
+
+    /// Only import this OBJ or PLY mesh, print the throughput and the peak memory use, and exit,
+    /// see `benchmarkMeshImport`.
+    std::string importBenchPath;
+
+    /// Threads importing meshes, zero for all CPU threads.
+    size_t importThreads = 0;
+
+    /// Periodically print the ray counters collected by the shader.
+    bool stats = false;
+
+    /// Seconds between two stats reports.
+    double statsInterval = 2.0;
+};
+
+Options parseOptions(int argc, const char* const* argv);
+
+} // namespace app
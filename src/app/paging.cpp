@@ -0,0 +1,503 @@
+#include "paging.h"
+#include "shader.h"
+#include "util.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <tuple>
+
+using std::experimental::make_array;
+
+namespace app {
+
+namespace {
+
+/// Most pages uploaded after a single frame, which is also the size of the staging buffer.
+const size_t MAX_PAGE_UPLOADS = 64;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool isLeaf(uint32_t child) {
+    return child != BvhNode::EMPTY && (child & BvhNode::LEAF) != 0;
+}
+
+/// Splits a BVH into the top level nodes and the pages written to a file.
+struct Clusterer {
+    const Primitives& primitives;
+    const std::vector<uint32_t> primitiveMaterials;
+    const Bvh& bvh;
+    std::FILE* file;
+
+    /// Number of primitives below each node and the first of them in `bvh.primitives`.
+    std::vector<uint32_t> counts;
+    std::vector<uint32_t> firsts;
+
+    std::vector<BvhNode> topNodes;
+    uint32_t clusterCount;
+
+    /// Primitive count and first primitive of a child reference.
+    std::pair<uint32_t, uint32_t> measure(uint32_t child) {
+        if (child == BvhNode::EMPTY) {
+            return std::make_pair(0, std::numeric_limits<uint32_t>::max());
+        }
+
+        if (isLeaf(child)) {
+            return std::make_pair((child >> 24) & 0x7f, child & 0xffffff);
+        }
+
+        uint32_t count = 0;
+        uint32_t first = std::numeric_limits<uint32_t>::max();
+
+        for (auto grandchild : this->bvh.nodes[child].children) {
+            auto [childCount, childFirst] = this->measure(grandchild);
+            count += childCount;
+            first = std::min(first, childFirst);
+        }
+
+        this->counts[child] = count;
+        this->firsts[child] = first;
+        return std::make_pair(count, first);
+    }
+
+    uint32_t addTopNode(uint32_t index) {
+        auto node = this->bvh.nodes[index];
+        auto top = uint32_t(this->topNodes.size());
+        this->topNodes.push_back(node);
+
+        for (size_t i = 0; i < 4; i++) {
+            uint32_t child = node.children[i];
+            if (child == BvhNode::EMPTY) { continue; }
+
+            if (isLeaf(child) || this->counts[child] <= PAGE_PRIMITIVES) {
+                node.children[i] = BvhNode::CLUSTER | this->writeCluster(node, i);
+            } else {
+                node.children[i] = this->addTopNode(child);
+            }
+        }
+
+        this->topNodes[top] = node;
+        return top;
+    }
+
+    /// Write the subtree of child `i` of `parent` as a page, returns the index of the cluster.
+    uint32_t writeCluster(const BvhNode& parent, size_t i) {
+        auto page = std::make_unique<Page>();
+        uint32_t child = parent.children[i];
+        uint32_t first;
+        uint32_t count;
+
+        if (isLeaf(child)) {
+            // A leaf right below the top level gets a root node of its own.
+            first = child & 0xffffff;
+            count = (child >> 24) & 0x7f;
+
+            auto& root = page->nodes[0];
+            root = parent;
+            std::fill(std::begin(root.children), std::end(root.children), BvhNode::EMPTY);
+            root.children[i] = BvhNode::leaf(0, count);
+        } else {
+            first = this->firsts[child];
+            count = this->counts[child];
+
+            uint32_t nodeCount = 0;
+            this->copySubtree(child, first, *page, nodeCount);
+        }
+
+        for (uint32_t j = 0; j < count; j++) {
+            uint32_t primitive = this->bvh.primitives[first + j];
+
+            if (primitive < this->primitives.spheres.size()) {
+                const auto& sphere = this->primitives.spheres[primitive];
+                const float transform[3][4] = {
+                    { sphere.radius, 0.0f, 0.0f, sphere.center[0] },
+                    { 0.0f, sphere.radius, 0.0f, sphere.center[1] },
+                    { 0.0f, 0.0f, sphere.radius, sphere.center[2] },
+                };
+                page->primitives[j] = Ellipsoid::fromTransform(transform);
+            } else {
+                page->primitives[j] = this->primitives.ellipsoids[primitive - this->primitives.spheres.size()];
+            }
+
+            page->materials[j] = this->primitiveMaterials[primitive];
+        }
+
+        if (std::fwrite(page.get(), sizeof(Page), 1, this->file) != 1) {
+            throw std::runtime_error("failed to write the page file");
+        }
+
+        return this->clusterCount++;
+    }
+
+    /// Copy a subtree into `page`, with the node and primitive indices made relative to the page.
+    uint32_t copySubtree(uint32_t index, uint32_t first, Page& page, uint32_t& nodeCount) {
+        if (nodeCount >= PAGE_NODES) {
+            throw std::runtime_error("BVH cluster doesn't fit in a page");
+        }
+
+        uint32_t local = nodeCount++;
+        auto node = this->bvh.nodes[index];
+
+        for (auto& child : node.children) {
+            if (child == BvhNode::EMPTY) { continue; }
+
+            if (isLeaf(child)) {
+                child = BvhNode::leaf((child & 0xffffff) - first, (child >> 24) & 0x7f);
+            } else {
+                child = this->copySubtree(child, first, page, nodeCount);
+            }
+        }
+
+        page.nodes[local] = node;
+        return local;
+    }
+};
+
+} // namespace
+
+PagedGeometry pageGeometry(const Primitives& primitives, const Bvh& bvh, const std::string& path) {
+    std::FILE* file = path.empty() ? std::tmpfile() : std::fopen(path.c_str(), "w+b");
+    if (file == nullptr) {
+        throw std::runtime_error("failed to create the page file " + path);
+    }
+
+    auto clusterer = Clusterer {
+        primitives, primitives.primitiveMaterials(), bvh, file,
+        std::vector<uint32_t>(bvh.nodes.size()), std::vector<uint32_t>(bvh.nodes.size()), {}, 0
+    };
+
+    try {
+        clusterer.measure(0);
+        clusterer.addTopNode(0);
+    } catch (...) {
+        std::fclose(file);
+        throw;
+    }
+
+    auto geometry = PagedGeometry();
+    geometry.topNodes = std::move(clusterer.topNodes);
+    geometry.clusterCount = clusterer.clusterCount;
+
+    const size_t size = geometry.clusterCount * sizeof(Page);
+
+    if (size > 0) {
+        // The mapping stays valid after the file is closed, a temporary file is only deleted once it's unmapped.
+        void* mapped = std::fflush(file) == 0
+            ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fileno(file), 0)
+            : MAP_FAILED;
+
+        if (mapped == MAP_FAILED) {
+            std::fclose(file);
+            throw std::runtime_error("failed to map the page file " + path);
+        }
+
+        geometry.pages = std::shared_ptr<const Page>(static_cast<const Page*>(mapped),
+            [size](const Page* pages) { munmap(const_cast<Page*>(pages), size); });
+    }
+
+    std::fclose(file);
+
+    std::cout << "Paged geometry: " << geometry.topNodes.size() << " resident BVH nodes, "
+        << geometry.clusterCount << " clusters in " << size / (1024 * 1024) << " MiB of pages\n";
+
+    return geometry;
+}
+
+Pager::Pager(vk::Device device, const Queues& queues, PagedGeometry&& geometry):
+    device(device),
+    queues(queues),
+    geometry(std::move(geometry)),
+    readbackMapped(nullptr),
+    readbackPending(false),
+    readbackFrame(0),
+    stagingMapped(nullptr),
+    frame(0),
+    requests(0),
+    pagesLoaded(0),
+    pagesEvicted(0),
+    pagesPostponed(0),
+    pathsDropped(0),
+    peakMissing(0),
+    streamSeconds(0.0)
+{
+}
+
+Pager Pager::create(vk::Device device, vk::PhysicalDevice physical, const Queues& queues,
+    PagedGeometry&& geometry, vk::Extent2D extent, const Options& options)
+{
+    auto pager = Pager(device, queues, std::move(geometry));
+
+    const size_t clusterCount = std::max<size_t>(pager.geometry.clusterCount, 1);
+    const size_t slotCount = pager.enabled()
+        ? std::min(std::max<size_t>(options.pageBudget * 1024 * 1024 / sizeof(Page), 1), clusterCount)
+        : 1;
+
+    // The shader wraps the ring around by masking the counters.
+    size_t deferredCount = 1;
+    while (pager.enabled() && deferredCount < size_t(extent.width) * extent.height / 4) {
+        deferredCount *= 2;
+    }
+
+    // The word after the clusters in the feedback counts the deferred paths dropped while the ring was full.
+    const size_t feedbackSize = (clusterCount + 1) * sizeof(uint32_t);
+    const size_t deferredSize = sizeof(DeferredHeader) + deferredCount * sizeof(DeferredPath);
+
+    std::tie(pager.pageTableMemory, pager.pageTable) = createBuffer(device, physical,
+        clusterCount * sizeof(uint32_t));
+    std::tie(pager.feedbackMemory, pager.feedback) = createBuffer(device, physical, feedbackSize);
+    std::tie(pager.nodesMemory, pager.nodes) = createBuffer(device, physical,
+        slotCount * sizeof(Page::nodes));
+    std::tie(pager.primitivesMemory, pager.primitives) = createBuffer(device, physical,
+        slotCount * sizeof(Page::primitives));
+    std::tie(pager.materialsMemory, pager.materials) = createBuffer(device, physical,
+        slotCount * sizeof(Page::materials));
+    std::tie(pager.deferredMemory, pager.deferred) = createBuffer(device, physical, deferredSize);
+
+    if (!pager.enabled()) {
+        return pager;
+    }
+
+    // Nothing is resident at first.
+    pager.clusterSlots.assign(clusterCount, NONE);
+    pager.slotClusters.assign(slotCount, NONE);
+    pager.slotUsed.assign(slotCount, 0);
+
+    pager.cmdPool = device.createCommandPoolUnique(vk::CommandPoolCreateInfo(
+        vk::CommandPoolCreateFlagBits::eResetCommandBuffer, queues.computeQueueFamily), nullptr);
+
+    uploadBuffer(device, physical, *pager.cmdPool, queues, *pager.pageTable, pager.clusterSlots.data(),
+        clusterCount * sizeof(uint32_t));
+    zeroBuffer(device, physical, *pager.cmdPool, queues, *pager.feedback, feedbackSize);
+    zeroBuffer(device, physical, *pager.cmdPool, queues, *pager.deferred, deferredSize);
+
+    std::tie(pager.readbackMemory, pager.readback) = createHostBuffer(device, physical,
+        feedbackSize, vk::BufferUsageFlagBits::eTransferDst);
+    pager.readbackMapped = static_cast<const uint32_t*>(device.mapMemory(*pager.readbackMemory, 0,
+        feedbackSize, vk::MemoryMapFlags()));
+    pager.readbackCmd = recordFeedbackReadback(device, *pager.cmdPool, *pager.feedback, *pager.readback,
+        feedbackSize);
+    pager.readbackFence = device.createFenceUnique(vk::FenceCreateInfo(), nullptr);
+
+    std::tie(pager.stagingMemory, pager.staging) = createHostBuffer(device, physical,
+        MAX_PAGE_UPLOADS * sizeof(Page), vk::BufferUsageFlagBits::eTransferSrc);
+    pager.stagingMapped = static_cast<Page*>(device.mapMemory(*pager.stagingMemory, 0,
+        MAX_PAGE_UPLOADS * sizeof(Page), vk::MemoryMapFlags()));
+
+    auto allocInfo = vk::CommandBufferAllocateInfo(
+        *pager.cmdPool,                         // commandPool,
+        vk::CommandBufferLevel::ePrimary,       // level
+        1                                       // commandBufferCount
+    );
+
+    auto cmds = device.allocateCommandBuffersUnique(allocInfo);
+    pager.uploadCmd = std::move(cmds[0]);
+
+    // Signalled, as there is no upload in flight yet.
+    pager.uploadFence = device.createFenceUnique(vk::FenceCreateInfo(vk::FenceCreateFlagBits::eSignaled), nullptr);
+
+    std::cout << "Page pool: " << slotCount << " of " << clusterCount << " clusters, "
+        << slotCount * sizeof(Page) / (1024 * 1024) << " MiB, room for " << deferredCount << " deferred paths in "
+        << deferredSize / (1024 * 1024) << " MiB\n";
+
+    return pager;
+}
+
+std::vector<vk::Buffer> Pager::bindings() const {
+    return std::vector<vk::Buffer> {
+        *this->pageTable, *this->feedback, *this->nodes, *this->primitives, *this->materials
+    };
+}
+
+void Pager::update() {
+    if (!this->enabled()) { return; }
+
+    this->frame += 1;
+
+    // The staging buffer is reused, so the feedback waits until the previous upload is done with it.
+    if (this->readbackPending && this->device.getFenceStatus(*this->readbackFence) == vk::Result::eSuccess
+        && this->device.getFenceStatus(*this->uploadFence) == vk::Result::eSuccess)
+    {
+        this->readbackPending = false;
+        this->stream();
+    }
+
+    if (!this->readbackPending) {
+        this->device.resetFences(1, &*this->readbackFence);
+        this->submit(*this->readbackCmd, *this->readbackFence);
+        this->readbackPending = true;
+        this->readbackFrame = this->frame;
+    }
+}
+
+void Pager::finish() {
+    if (!this->enabled()) { return; }
+
+    const size_t resident = size_t(std::count_if(this->slotClusters.begin(), this->slotClusters.end(),
+        [](uint32_t cluster) { return cluster != NONE; }));
+
+    std::cout << std::fixed << std::setprecision(2)
+        << "Paging: " << resident << " of " << this->geometry.clusterCount << " clusters resident in "
+        << this->slotClusters.size() << " slots\n"
+        << "    requests: " << this->requests << ", at most " << this->peakMissing << " missing after a frame\n"
+        << "    pages loaded: " << this->pagesLoaded << " ("
+        << double(this->pagesLoaded * sizeof(Page)) / (1024.0 * 1024.0) << " MiB), evicted: " << this->pagesEvicted
+        << ", postponed as every slot was pinned: " << this->pagesPostponed << "\n"
+        << "    deferred paths dropped as the queue was full: " << this->pathsDropped << "\n"
+        << "    streaming time on the host: " << this->streamSeconds << " s\n";
+
+    if (this->pagesPostponed > 0 || this->pathsDropped > 0) {
+        std::cout << "    the budget is smaller than the clusters a single frame needs, consider raising "
+            "--page-budget\n";
+    }
+}
+
+/// Load the clusters missing in the frame whose feedback was just read back.
+void Pager::stream() {
+    auto start = Clock::now();
+    auto missing = std::vector<uint32_t>();
+
+    this->pathsDropped += this->readbackMapped[this->geometry.clusterCount];
+
+    for (uint32_t cluster = 0; cluster < this->geometry.clusterCount; cluster++) {
+        if (this->readbackMapped[cluster] == 0) { continue; }
+
+        uint32_t slot = this->clusterSlots[cluster];
+        if (slot != NONE) {
+            this->slotUsed[slot] = this->readbackFrame;
+        } else {
+            missing.push_back(cluster);
+        }
+    }
+
+    this->requests += missing.size();
+    this->peakMissing = std::max(this->peakMissing, missing.size());
+
+    if (missing.empty()) {
+        this->streamSeconds += secondsSince(start);
+        return;
+    }
+
+    // Free slots come first, as they were never used. The slots the frame used are pinned, the paths
+    // deferred in it may still need them.
+    auto order = std::vector<uint32_t>(this->slotClusters.size());
+    std::iota(order.begin(), order.end(), 0);
+    order.erase(std::remove_if(order.begin(), order.end(), [&](uint32_t slot) {
+        return this->slotUsed[slot] >= this->readbackFrame;
+    }), order.end());
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return this->slotUsed[a] < this->slotUsed[b];
+    });
+
+    // The rest stay missing, they are requested again by the paths waiting for them.
+    const size_t loads = std::min({ missing.size(), order.size(), MAX_PAGE_UPLOADS });
+    this->pagesPostponed += std::min(missing.size(), MAX_PAGE_UPLOADS) - loads;
+
+    if (loads == 0) {
+        this->streamSeconds += secondsSince(start);
+        return;
+    }
+
+    auto cmd = *this->uploadCmd;
+
+    cmd.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit, nullptr));
+
+    // Wait for the frames still reading the slots and the page table.
+    const auto computeToTransfer = vk::MemoryBarrier(
+        vk::AccessFlagBits::eShaderRead,        // srcAccessMask
+        vk::AccessFlagBits::eTransferWrite      // dstAccessMask
+    );
+
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,  // srcStageMask
+        vk::PipelineStageFlagBits::eTransfer,       // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &computeToTransfer,                         // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        0,                                          // imageMemoryBarrierCount
+        nullptr                                     // pImageMemoryBarriers
+    );
+
+    for (size_t i = 0; i < loads; i++) {
+        uint32_t cluster = missing[i];
+        uint32_t slot = order[i];
+        uint32_t evicted = this->slotClusters[slot];
+
+        if (evicted != NONE) {
+            this->clusterSlots[evicted] = NONE;
+            this->pagesEvicted += 1;
+
+            cmd.updateBuffer(*this->pageTable, evicted * sizeof(uint32_t), sizeof(uint32_t), &NONE);
+        }
+
+        this->stagingMapped[i] = this->geometry.pages.get()[cluster];
+
+        const auto regions = make_array(
+            std::make_tuple(*this->nodes, offsetof(Page, nodes), sizeof(Page::nodes)),
+            std::make_tuple(*this->primitives, offsetof(Page, primitives), sizeof(Page::primitives)),
+            std::make_tuple(*this->materials, offsetof(Page, materials), sizeof(Page::materials))
+        );
+
+        for (const auto& [buffer, offset, size] : regions) {
+            const auto region = vk::BufferCopy(i * sizeof(Page) + offset, slot * size, size);
+            cmd.copyBuffer(*this->staging, buffer, 1, &region);
+        }
+
+        cmd.updateBuffer(*this->pageTable, cluster * sizeof(uint32_t), sizeof(uint32_t), &slot);
+
+        this->clusterSlots[cluster] = slot;
+        this->slotClusters[slot] = cluster;
+        this->slotUsed[slot] = this->frame;
+    }
+
+    const auto transferToCompute = vk::MemoryBarrier(
+        vk::AccessFlagBits::eTransferWrite,     // srcAccessMask
+        vk::AccessFlagBits::eShaderRead         // dstAccessMask
+    );
+
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,       // srcStageMask
+        vk::PipelineStageFlagBits::eComputeShader,  // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &transferToCompute,                         // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        0,                                          // imageMemoryBarrierCount
+        nullptr                                     // pImageMemoryBarriers
+    );
+
+    cmd.end();
+
+    this->device.resetFences(1, &*this->uploadFence);
+    this->submit(cmd, *this->uploadFence);
+
+    this->pagesLoaded += loads;
+    this->streamSeconds += secondsSince(start);
+}
+
+void Pager::submit(vk::CommandBuffer cmd, vk::Fence fence) {
+    auto submitInfo = vk::SubmitInfo(
+        0,                                  // waitSemaphoreCount
+        nullptr,                            // pWaitSemaphores
+        nullptr,                            // pWaitDstStageMask
+        1,                                  // commandBufferCount
+        &cmd,                               // pCommandBuffers
+        0,                                  // signalSemaphoreCount
+        nullptr                             // pSignalSemaphores
+    );
+
+    this->queues.compute.submit(1, &submitInfo, fence);
+}
+
+} // namespace app
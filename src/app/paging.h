@@ -0,0 +1,172 @@
+#pragma once
+
+#include "bvh.h"
+#include "deps.h"
+#include "device.h"
+#include "options.h"
+#include "primitives.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace app {
+
+/// Capacity of a page, must match `PAGE_NODES` and `PAGE_PRIMITIVES` in `shader/main.comp`.
+///
+/// A BVH subtree over `PAGE_PRIMITIVES` primitives has leaves of at least two primitives
+/// and nodes of at least two children, so it always fits in `PAGE_NODES` nodes.
+const size_t PAGE_NODES = 128;
+const size_t PAGE_PRIMITIVES = 256;
+
+/// A cluster of the scene: a BVH subtree with its primitives, as stored in the page file and in a slot
+/// of the page pool on the device.
+///
+/// The root of the subtree is the first node. Child nodes and leaf ranges are indices into the page.
+/// Spheres are stored as ellipsoids, so all primitives in a page have the same layout.
+struct Page {
+    BvhNode nodes[PAGE_NODES];
+    Ellipsoid primitives[PAGE_PRIMITIVES];
+    uint32_t materials[PAGE_PRIMITIVES];
+};
+
+/// Geometry split into a top level BVH, which stays resident, and clusters kept in a memory mapped file.
+struct PagedGeometry {
+    /// The top of the BVH. Children are other top level nodes, `BvhNode::CLUSTER | cluster` or empty.
+    std::vector<BvhNode> topNodes;
+
+    size_t clusterCount = 0;
+
+    /// The mapped page file, one `Page` per cluster.
+    std::shared_ptr<const Page> pages;
+};
+
+/// Start of the `DeferredPaths` buffer in `shader/main.comp`, followed by a ring of `DeferredPath`s.
+///
+/// The counters keep counting across frames, an entry is at the counter value modulo the size of the ring.
+struct DeferredHeader {
+    /// Where the next path is queued.
+    uint32_t tail;
+
+    /// The paths queued before the current frame and not resumed yet, set before every frame.
+    uint32_t frameStart;
+    uint32_t frameEnd;
+
+    /// Number of paths claimed by the workgroups for resuming in the current frame, zeroed before every frame.
+    uint32_t resumed;
+};
+
+/// A path waiting for a cluster, laid out as `PathState` in `shader/main.comp`. Only ever written by the shader.
+struct DeferredPath {
+    float start[4];
+    float dir[4];
+    float lightMult[4];
+    float outColor[4];
+    float prevPoint[4];
+    float prevNormal[4];
+    uint32_t info[4];
+    uint32_t index;
+    uint32_t padding[3];
+};
+
+/// Cut `bvh` into clusters of up to `PAGE_PRIMITIVES` primitives and write them to the file at `path`,
+/// or to an anonymous temporary file if `path` is empty. The file is mapped back for streaming.
+PagedGeometry pageGeometry(const Primitives& primitives, const Bvh& bvh, const std::string& path);
+
+/// Keeps the clusters the shader needs resident in a fixed pool of page slots on the device.
+///
+/// The shader marks every cluster it reaches in a feedback buffer. A path whose rays reach a cluster which
+/// isn't resident is queued with its state at the start of the segment which missed it, and traced on from
+/// there once the cluster is resident, so no sample is lost. After a frame the feedback is copied to the host,
+/// and once the copy is done the missing clusters are copied from the mapped file into free slots or the
+/// slots of the least recently used clusters, and the page table is updated. The clusters the frame used are
+/// pinned, a deferred path would otherwise miss its cluster again. The upload is ordered after the frames
+/// already submitted by barriers, and the fences of the readback and of the previous upload are only polled,
+/// so the render loop never waits for the device.
+class Pager {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    vk::Device device;
+    Queues queues;
+    PagedGeometry geometry;
+
+    vk::UniqueDeviceMemory pageTableMemory;
+    vk::UniqueBuffer pageTable;
+    vk::UniqueDeviceMemory feedbackMemory;
+    vk::UniqueBuffer feedback;
+    vk::UniqueDeviceMemory nodesMemory;
+    vk::UniqueBuffer nodes;
+    vk::UniqueDeviceMemory primitivesMemory;
+    vk::UniqueBuffer primitives;
+    vk::UniqueDeviceMemory materialsMemory;
+    vk::UniqueBuffer materials;
+    vk::UniqueDeviceMemory deferredMemory;
+    vk::UniqueBuffer deferred;
+
+    vk::UniqueCommandPool cmdPool;
+
+    vk::UniqueDeviceMemory readbackMemory;
+    vk::UniqueBuffer readback;
+    const uint32_t* readbackMapped;
+    vk::UniqueCommandBuffer readbackCmd;
+    vk::UniqueFence readbackFence;
+    bool readbackPending;
+    uint64_t readbackFrame;
+
+    vk::UniqueDeviceMemory stagingMemory;
+    vk::UniqueBuffer staging;
+    Page* stagingMapped;
+    vk::UniqueCommandBuffer uploadCmd;
+    vk::UniqueFence uploadFence;
+
+    /// Cluster in each slot, or `NONE`, and the last frame it was used in.
+    std::vector<uint32_t> slotClusters;
+    std::vector<uint64_t> slotUsed;
+
+    /// Host copy of the page table, the slot of each cluster or `NONE`.
+    std::vector<uint32_t> clusterSlots;
+
+    uint64_t frame;
+    size_t requests;
+    size_t pagesLoaded;
+    size_t pagesEvicted;
+    size_t pagesPostponed;
+    size_t pathsDropped;
+    size_t peakMissing;
+    double streamSeconds;
+
+    Pager(vk::Device device, const Queues& queues, PagedGeometry&& geometry);
+
+public:
+    static constexpr uint32_t NONE = ~uint32_t(0);
+
+    /// The ring of deferred paths holds a quarter of the pixels of `extent`, rounded up to a power of two.
+    /// With paging disabled, the buffers bound to the shader hold a single unused element.
+    static Pager create(vk::Device device, vk::PhysicalDevice physical, const Queues& queues,
+        PagedGeometry&& geometry, vk::Extent2D extent, const Options& options);
+
+    Pager(Pager&&) = default;
+    Pager& operator=(Pager&&) = default;
+
+    bool enabled() const { return this->geometry.clusterCount > 0; }
+
+    /// Page table, feedback, nodes, primitives and materials, bound right after the tile order.
+    std::vector<vk::Buffer> bindings() const;
+
+    /// The `DeferredHeader` and the ring of deferred paths, bound after the environment map.
+    vk::Buffer deferredPaths() const { return *this->deferred; }
+
+    /// Stream in the clusters missed by earlier frames. Called once per frame, after the frame is submitted.
+    void update();
+
+    /// Print the paging statistics. The device must be idle.
+    void finish();
+
+private:
+    void stream();
+    void submit(vk::CommandBuffer cmd, vk::Fence fence);
+};
+
+} // namespace app
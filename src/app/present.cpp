@@ -0,0 +1,224 @@
+#include "present.h"
+#include "shader.h"
+
+#include <experimental/array>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+
+using std::experimental::make_array;
+
+namespace app {
+
+namespace {
+
+/// Number of frames which can be traced ahead of the one being presented.
+const size_t RESOLVE_IMAGES = 2;
+
+/// Record the acquire of `resolveImage` from the compute queue family and its blit to `swapchainImage`.
+void recordBlit(vk::CommandBuffer cmd, const Queues& queues, vk::Image resolveImage, vk::Image swapchainImage,
+    vk::Extent2D extent)
+{
+    const auto range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+
+    cmd.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eSimultaneousUse, nullptr));
+
+    const auto initialLayouts = make_array(
+        // The acquire half of the ownership transfer released by `createCommands`.
+        vk::ImageMemoryBarrier(
+            vk::AccessFlags(),                      // srcAccessMask
+            vk::AccessFlagBits::eTransferRead,      // dstAccessMask
+            vk::ImageLayout::eTransferDstOptimal,   // oldLayout
+            vk::ImageLayout::eTransferSrcOptimal,   // newLayout
+            queues.computeQueueFamily,              // srcQueueFamilyIndex
+            queues.presentQueueFamily,              // dstQueueFamilyIndex
+            resolveImage,                           // image
+            range                                   // subresourceRange
+        ),
+        vk::ImageMemoryBarrier(
+            vk::AccessFlags(),                      // srcAccessMask
+            vk::AccessFlagBits::eTransferWrite,     // dstAccessMask
+            vk::ImageLayout::eUndefined,            // oldLayout
+            vk::ImageLayout::eTransferDstOptimal,   // newLayout
+            queues.presentQueueFamily,              // srcQueueFamilyIndex
+            queues.presentQueueFamily,              // dstQueueFamilyIndex
+            swapchainImage,                         // image
+            range                                   // subresourceRange
+        )
+    );
+
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,       // srcStageMask
+        vk::PipelineStageFlagBits::eTransfer,       // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        0,                                          // memoryBarrierCount
+        nullptr,                                    // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        initialLayouts.size(),                      // imageMemoryBarrierCount
+        initialLayouts.data()                       // pImageMemoryBarriers
+    );
+
+    blitImage(cmd, resolveImage, swapchainImage, extent);
+
+    const auto transferToPresent = vk::ImageMemoryBarrier(
+        vk::AccessFlagBits::eTransferWrite,     // srcAccessMask
+        vk::AccessFlags(),                      // dstAccessMask
+        vk::ImageLayout::eTransferDstOptimal,   // oldLayout
+        vk::ImageLayout::ePresentSrcKHR,        // newLayout
+        queues.presentQueueFamily,              // srcQueueFamilyIndex
+        queues.presentQueueFamily,              // dstQueueFamilyIndex
+        swapchainImage,                         // image
+        range                                   // subresourceRange
+    );
+
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,       // srcStageMask
+        vk::PipelineStageFlagBits::eBottomOfPipe,   // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        0,                                          // memoryBarrierCount
+        nullptr,                                    // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        1,                                          // imageMemoryBarrierCount
+        &transferToPresent                          // pImageMemoryBarriers
+    );
+
+    cmd.end();
+}
+
+} // namespace
+
+Presenter::Presenter(vk::Device device, const Queues& queues, vk::SwapchainKHR swapchain):
+    device(device),
+    queues(queues),
+    swapchain(swapchain),
+    next(0),
+    frames(0),
+    stalls(0),
+    stallSeconds(0.0)
+{
+}
+
+Presenter Presenter::create(vk::Device device, vk::PhysicalDevice physical, const Queues& queues,
+    vk::SwapchainKHR swapchain, vk::Format workFormat, vk::Extent2D extent)
+{
+    auto presenter = Presenter(device, queues, swapchain);
+
+    if (queues.computeQueueFamily == queues.presentQueueFamily) {
+        return presenter;
+    }
+
+    presenter.cmdPool = device.createCommandPoolUnique(vk::CommandPoolCreateInfo(
+        vk::CommandPoolCreateFlags(), queues.presentQueueFamily), nullptr);
+
+    auto swapchainImages = device.getSwapchainImagesKHR(swapchain);
+
+    for (size_t i = 0; i < RESOLVE_IMAGES; i++) {
+        auto slot = Slot();
+        std::tie(slot.memory, slot.image, std::ignore) = createImage(device, physical, extent, workFormat);
+
+        auto allocInfo = vk::CommandBufferAllocateInfo(
+            *presenter.cmdPool,                     // commandPool,
+            vk::CommandBufferLevel::ePrimary,       // level
+            swapchainImages.size()                  // commandBufferCount
+        );
+
+        slot.blits = device.allocateCommandBuffersUnique(allocInfo);
+        for (size_t j = 0; j < swapchainImages.size(); j++) {
+            recordBlit(*slot.blits[j], queues, *slot.image, swapchainImages[j], extent);
+        }
+
+        slot.traced = device.createSemaphoreUnique(vk::SemaphoreCreateInfo(), nullptr);
+        slot.imageAvailable = device.createSemaphoreUnique(vk::SemaphoreCreateInfo(), nullptr);
+        slot.blitted = device.createSemaphoreUnique(vk::SemaphoreCreateInfo(), nullptr);
+
+        // Signalled, as the image isn't in use yet.
+        slot.done = device.createFenceUnique(vk::FenceCreateInfo(vk::FenceCreateFlagBits::eSignaled), nullptr);
+
+        presenter.slots.push_back(std::move(slot));
+    }
+
+    std::cout << "Presenting from a separate queue through " << RESOLVE_IMAGES << " resolve images\n";
+
+    return presenter;
+}
+
+std::vector<vk::Image> Presenter::resolveImages() const {
+    auto images = std::vector<vk::Image>();
+    for (const auto& slot : this->slots) {
+        images.push_back(*slot.image);
+    }
+    return images;
+}
+
+void Presenter::drawFrame(const std::vector<vk::UniqueCommandBuffer>& traceCmds) {
+    const size_t index = this->next;
+    auto& slot = this->slots[index];
+    this->next = (this->next + 1) % this->slots.size();
+
+    // Normally the blit of the frame traced from this slot before is long done.
+    if (this->device.getFenceStatus(*slot.done) != vk::Result::eSuccess) {
+        auto start = Clock::now();
+        this->device.waitForFences(1, &*slot.done, true, std::numeric_limits<uint64_t>::max());
+        this->stalls += 1;
+        this->stallSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    this->device.resetFences(1, &*slot.done);
+
+    auto traceInfo = vk::SubmitInfo(
+        0,                                  // waitSemaphoreCount
+        nullptr,                            // pWaitSemaphores
+        nullptr,                            // pWaitDstStageMask
+        1,                                  // commandBufferCount
+        &*traceCmds[index],                 // pCommandBuffers
+        1,                                  // signalSemaphoreCount
+        &*slot.traced                       // pSignalSemaphores
+    );
+
+    this->queues.compute.submit(1, &traceInfo, nullptr);
+
+    auto imageIndex = this->device.acquireNextImageKHR(this->swapchain,
+        std::numeric_limits<uint64_t>::max(), *slot.imageAvailable, nullptr).value;
+
+    const auto waitSemaphores = make_array(*slot.traced, *slot.imageAvailable);
+    const auto waitStages = make_array(
+        vk::PipelineStageFlags(vk::PipelineStageFlagBits::eTransfer),
+        vk::PipelineStageFlags(vk::PipelineStageFlagBits::eTransfer)
+    );
+
+    auto blitInfo = vk::SubmitInfo(
+        waitSemaphores.size(),              // waitSemaphoreCount
+        waitSemaphores.data(),              // pWaitSemaphores
+        waitStages.data(),                  // pWaitDstStageMask
+        1,                                  // commandBufferCount
+        &*slot.blits[imageIndex],           // pCommandBuffers
+        1,                                  // signalSemaphoreCount
+        &*slot.blitted                      // pSignalSemaphores
+    );
+
+    this->queues.present.submit(1, &blitInfo, *slot.done);
+
+    auto presentInfo = vk::PresentInfoKHR(
+        1,                      // waitSemaphoreCount
+        &*slot.blitted,         // pWaitSemaphores
+        1,                      // swapchainCount
+        &this->swapchain,       // pSwapchains
+        &imageIndex,            // pImageIndices
+        nullptr                 // pResults
+    );
+
+    this->queues.present.presentKHR(&presentInfo);
+    this->frames += 1;
+}
+
+void Presenter::finish() {
+    if (!this->enabled()) { return; }
+
+    std::cout << std::fixed << std::setprecision(2)
+        << "Presenter: " << this->frames << " frames, tracing waited for a resolve image " << this->stalls
+        << " times, " << this->stallSeconds << " s in total\n";
+}
+
+} // namespace app
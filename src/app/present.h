@@ -0,0 +1,69 @@
+#pragma once
+
+#include "deps.h"
+#include "device.h"
+
+#include <chrono>
+#include <vector>
+
+namespace app {
+
+/// Presents frames from the present queue while the compute queue goes on tracing, when the two are
+/// in different queue families.
+///
+/// The trace commands end by copying the work image into one of a ring of resolve images and releasing
+/// it to the present queue family, see `createCommands`. Commands on the present queue wait for the trace
+/// with a semaphore, acquire the resolve image, blit it to the swapchain image and present it. The compute
+/// queue never touches the swapchain, so presenting a frame overlaps with tracing the next one. A fence per
+/// resolve image keeps the trace of a later frame from overwriting it before its blit is done.
+class Presenter {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Slot {
+        vk::UniqueDeviceMemory memory;
+        vk::UniqueImage image;
+
+        /// A command buffer per swapchain image, blitting from this slot.
+        std::vector<vk::UniqueCommandBuffer> blits;
+
+        vk::UniqueSemaphore traced;
+        vk::UniqueSemaphore imageAvailable;
+        vk::UniqueSemaphore blitted;
+        vk::UniqueFence done;
+    };
+
+    vk::Device device;
+    Queues queues;
+    vk::SwapchainKHR swapchain;
+
+    vk::UniqueCommandPool cmdPool;
+    std::vector<Slot> slots;
+    size_t next;
+
+    size_t frames;
+    size_t stalls;
+    double stallSeconds;
+
+public:
+    /// Disabled when tracing and presenting share a queue family.
+    static Presenter create(vk::Device device, vk::PhysicalDevice physical, const Queues& queues,
+        vk::SwapchainKHR swapchain, vk::Format workFormat, vk::Extent2D extent);
+
+    bool enabled() const { return !this->slots.empty(); }
+
+    /// The images `createCommands` copies the work image into, one trace command buffer per image.
+    std::vector<vk::Image> resolveImages() const;
+
+    /// Submit the trace commands of the next slot on the compute queue, then blit and present the result
+    /// on the present queue.
+    void drawFrame(const std::vector<vk::UniqueCommandBuffer>& traceCmds);
+
+    /// Print how often tracing waited for a resolve image. The device must be idle.
+    void finish();
+
+private:
+    Presenter(vk::Device device, const Queues& queues, vk::SwapchainKHR swapchain);
+};
+
+} // namespace app
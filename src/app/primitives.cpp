@@ -0,0 +1,147 @@
+#include "primitives.h"
+
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+namespace app {
+
+namespace {
+
+/// Invert an affine transform given as the rows of a 3x4 matrix.
+void invertAffine(const float m[3][4], float result[3][4]) {
+    // Inverse of the linear part through the adjugate.
+    float cofactors[3][3];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+            int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+            cofactors[i][j] = m[i1][j1] * m[i2][j2] - m[i1][j2] * m[i2][j1];
+        }
+    }
+
+    float det = m[0][0] * cofactors[0][0] + m[0][1] * cofactors[0][1] + m[0][2] * cofactors[0][2];
+    if (std::abs(det) < 1e-12f) {
+        throw std::runtime_error("degenerate ellipsoid transform");
+    }
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            result[i][j] = cofactors[j][i] / det;
+        }
+
+        // The translation is undone after the inverse linear part is applied.
+        result[i][3] = -(result[i][0] * m[0][3] + result[i][1] * m[1][3] + result[i][2] * m[2][3]);
+    }
+}
+
+} // namespace
+
+Ellipsoid Ellipsoid::fromTransform(const float localToWorld[3][4]) {
+    auto ellipsoid = Ellipsoid();
+    invertAffine(localToWorld, ellipsoid.worldToLocal);
+    return ellipsoid;
+}
+
+std::vector<uint32_t> Primitives::primitiveMaterials() const {
+    auto result = this->sphereMaterials;
+    result.insert(result.end(), this->ellipsoidMaterials.begin(), this->ellipsoidMaterials.end());
+    return result;
+}
+
+std::vector<Bounds> Primitives::bounds() const {
+    auto result = std::vector<Bounds>();
+    result.reserve(this->spheres.size() + this->ellipsoids.size());
+
+    for (const auto& sphere : this->spheres) {
+        auto bounds = Bounds();
+        for (int i = 0; i < 3; i++) {
+            bounds.min[i] = sphere.center[i] - sphere.radius;
+            bounds.max[i] = sphere.center[i] + sphere.radius;
+        }
+        result.push_back(bounds);
+    }
+
+    for (const auto& ellipsoid : this->ellipsoids) {
+        float m[3][4];
+        invertAffine(ellipsoid.worldToLocal, m);
+
+        // The unit sphere reaches furthest along each axis where the row of the transform points.
+        auto bounds = Bounds();
+        for (int i = 0; i < 3; i++) {
+            float extent = std::sqrt(m[i][0] * m[i][0] + m[i][1] * m[i][1] + m[i][2] * m[i][2]);
+            bounds.min[i] = m[i][3] - extent;
+            bounds.max[i] = m[i][3] + extent;
+        }
+        result.push_back(bounds);
+    }
+
+    return result;
+}
+
+Primitives defaultPrimitives() {
+    auto primitives = Primitives();
+
+    primitives.materials = {
+        Material { { 0.0f, 0.0f, 0.0f }, 0.0f, { 1.00f, 0.71f, 0.29f }, 16.0f },  // gold
+        Material { { 0.8f, 0.2f, 0.2f }, 0.0f, { 0.05f, 0.05f, 0.05f }, 8.0f },   // red plastic
+        Material { { 0.0f, 0.0f, 0.0f }, 1.4f, { 0.03f, 0.03f, 0.03f }, 64.0f },  // glass
+    };
+
+    primitives.spheres = {
+        Sphere { { -0.4f, -0.2f, 1.5f }, 0.3f },
+        Sphere { { 0.4f, -0.2f, 1.5f }, 0.3f },
+        Sphere { { 0.2f, -0.2f, 0.5f }, 0.2f },
+    };
+    primitives.sphereMaterials = { 0, 1, 2 };
+
+    return primitives;
+}
+
+Primitives randomPrimitives(size_t count) {
+    auto primitives = defaultPrimitives();
+
+    auto rng = std::mt19937(2);
+    auto coord = std::uniform_real_distribution<float>(-1.0f, 1.0f);
+    auto size = std::uniform_real_distribution<float>(0.01f, 0.05f);
+    auto normal = std::normal_distribution<float>(0.0f, 1.0f);
+    auto material = std::uniform_int_distribution<uint32_t>(0, uint32_t(primitives.materials.size() - 1));
+
+    for (size_t i = 0; i < count; i++) {
+        float center[3] = { 1.5f * coord(rng), 0.5f * coord(rng), 1.5f + coord(rng) };
+
+        // Every fourth primitive is a randomly rotated ellipsoid, the rest are spheres.
+        if (i % 4 != 3) {
+            primitives.spheres.push_back(Sphere { { center[0], center[1], center[2] }, size(rng) });
+            primitives.sphereMaterials.push_back(material(rng));
+            continue;
+        }
+
+        // Rotation from a uniformly distributed unit quaternion.
+        float q[4] = { normal(rng), normal(rng), normal(rng), normal(rng) };
+        float len = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+        float w = q[0] / len, x = q[1] / len, y = q[2] / len, z = q[3] / len;
+
+        float rotation[3][3] = {
+            { 1 - 2 * (y * y + z * z), 2 * (x * y - w * z), 2 * (x * z + w * y) },
+            { 2 * (x * y + w * z), 1 - 2 * (x * x + z * z), 2 * (y * z - w * x) },
+            { 2 * (x * z - w * y), 2 * (y * z + w * x), 1 - 2 * (x * x + y * y) },
+        };
+        float scale[3] = { size(rng), size(rng), 2.0f * size(rng) };
+
+        float transform[3][4];
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 3; c++) {
+                transform[r][c] = rotation[r][c] * scale[c];
+            }
+            transform[r][3] = center[r];
+        }
+
+        primitives.ellipsoids.push_back(Ellipsoid::fromTransform(transform));
+        primitives.ellipsoidMaterials.push_back(material(rng));
+    }
+
+    return primitives;
+}
+
+} // namespace app
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace app {
+
+/// A material, laid out as `Material` in `shader/main.comp`.
+struct Material {
+    float diffColor[3];
+    float refrIndex;
+    float specColor[3];
+    float roughness;
+};
+
+/// A uniformly scaled sphere, laid out as a `vec4` in `SPHERES` in `shader/main.comp`.
+struct Sphere {
+    float center[3];
+    float radius;
+};
+
+/// An ellipsoid, stored as the affine transform mapping world space onto the unit sphere.
+///
+/// Laid out as three consecutive `vec4` rows in `ELLIPSOIDS` in `shader/main.comp`.
+struct Ellipsoid {
+    float worldToLocal[3][4];
+
+    /// Ellipsoid covering the unit sphere transformed by `localToWorld` (rows of a 3x4 affine matrix).
+    static Ellipsoid fromTransform(const float localToWorld[3][4]);
+};
+
+/// An axis aligned bounding box.
+struct Bounds {
+    float min[3];
+    float max[3];
+};
+
+/// Geometry of the scene, split into one array per primitive type.
+///
+/// Primitives refer to their material by its index in `materials`.
+struct Primitives {
+    std::vector<Material> materials;
+
+    std::vector<Sphere> spheres;
+    std::vector<uint32_t> sphereMaterials;
+
+    std::vector<Ellipsoid> ellipsoids;
+    std::vector<uint32_t> ellipsoidMaterials;
+
+    /// Material indices of all primitives, as seen by the shader: spheres first, ellipsoids after them.
+    std::vector<uint32_t> primitiveMaterials() const;
+
+    /// Bounding boxes of all primitives, in the same order as `primitiveMaterials`.
+    std::vector<Bounds> bounds() const;
+};
+
+/// The objects of the default scene.
+Primitives defaultPrimitives();
+
+/// A cloud of `count` small spheres and ellipsoids around the default scene, for testing intersection throughput.
+Primitives randomPrimitives(size_t count);
+
+} // namespace app
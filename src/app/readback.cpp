@@ -0,0 +1,395 @@
+#include "readback.h"
+#include "util.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+namespace app {
+
+namespace {
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+vk::UniqueCommandBuffer recordCopy(vk::Device device, vk::CommandPool pool, vk::Image workImage,
+    vk::Extent2D extent, vk::Buffer buffer)
+{
+    auto allocInfo = vk::CommandBufferAllocateInfo(
+        pool,                                   // commandPool,
+        vk::CommandBufferLevel::ePrimary,       // level
+        1                                       // commandBufferCount
+    );
+
+    auto cmds = device.allocateCommandBuffersUnique(allocInfo);
+    auto cmd = std::move(cmds[0]);
+
+    cmd->begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlags(), nullptr));
+
+    // The frame leaves the work image in TransferSrc layout, only the writes
+    // from the compute shader need to become visible to the copy.
+    const auto computeToTransfer = vk::MemoryBarrier(
+        vk::AccessFlagBits::eShaderWrite,       // srcAccessMask
+        vk::AccessFlagBits::eTransferRead       // dstAccessMask
+    );
+
+    cmd->pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,  // srcStageMask
+        vk::PipelineStageFlagBits::eTransfer,       // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &computeToTransfer,                         // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        0,                                          // imageMemoryBarrierCount
+        nullptr                                     // pImageMemoryBarriers
+    );
+
+    const auto region = vk::BufferImageCopy(
+        0,                                      // bufferOffset
+        0,                                      // bufferRowLength
+        0,                                      // bufferImageHeight
+        vk::ImageSubresourceLayers(             // imageSubresource
+            vk::ImageAspectFlagBits::eColor,        // aspectMask
+            0,                                      // mipLevel
+            0,                                      // baseArrayLayer
+            1                                       // layerCount
+        ),
+        vk::Offset3D(0, 0, 0),                  // imageOffset
+        vk::Extent3D(extent.width, extent.height, 1)    // imageExtent
+    );
+
+    cmd->copyImageToBuffer(workImage, vk::ImageLayout::eTransferSrcOptimal, buffer, 1, &region);
+
+    const auto transferToHost = vk::MemoryBarrier(
+        vk::AccessFlagBits::eTransferWrite,     // srcAccessMask
+        vk::AccessFlagBits::eHostRead           // dstAccessMask
+    );
+
+    cmd->pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,       // srcStageMask
+        vk::PipelineStageFlagBits::eHost,           // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &transferToHost,                            // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        0,                                          // imageMemoryBarrierCount
+        nullptr                                     // pImageMemoryBarriers
+    );
+
+    cmd->end();
+
+    return cmd;
+}
+
+} // namespace
+
+FrameWriter::FrameWriter(vk::Device device, const Queues& queues, vk::Extent2D extent, bool halfFloat,
+    std::vector<Slot>&& slots, const Options& options):
+    device(device),
+    queues(queues),
+    extent(extent),
+    halfFloat(halfFloat),
+    path(options.outputPath),
+    fileFormat(options.outputPath.empty() ? ImageFileFormat::Raw : imageFileFormat(options.outputPath)),
+    interval(std::max<size_t>(options.outputInterval, 1)),
+    referencePath(options.referencePath),
+    slots(std::move(slots)),
+    encoders(std::make_unique<Encoders>()),
+    threads(),
+    frame(0),
+    framesWritten(0),
+    maxInFlight(0),
+    stalls(0),
+    stallSeconds(0.0),
+    started(Clock::now())
+{
+    if (!this->enabled()) { return; }
+
+    for (const auto& slot : this->slots) {
+        this->encoders->mapped.push_back(slot.mapped);
+    }
+
+    if (!this->referencePath.empty()) {
+        this->encoders->reference = readPfm(this->referencePath);
+
+        if (this->encoders->reference.width != extent.width || this->encoders->reference.height != extent.height) {
+            throw std::runtime_error("the reference image " + this->referencePath + " doesn't match the size of the "
+                "rendered image");
+        }
+    }
+
+    size_t threadCount = options.encoderThreads;
+    if (threadCount == 0) {
+        threadCount = std::max<size_t>(std::thread::hardware_concurrency() / 2, 1);
+    }
+
+    for (size_t i = 0; i < threadCount; i++) {
+        this->threads.emplace_back(encodeLoop, std::ref(*this->encoders), this->path, this->fileFormat,
+            this->halfFloat, this->extent);
+    }
+
+    std::cout << "Writing frames to " << numberedPath(this->path, 0) << " and on, through " << this->slots.size()
+        << " readback buffers and " << threadCount << " encoder threads\n";
+}
+
+FrameWriter::~FrameWriter() {
+    this->stop();
+}
+
+FrameWriter FrameWriter::create(vk::Device device, vk::PhysicalDevice physical, vk::CommandPool pool,
+    const Queues& queues, vk::Image workImage, vk::Format format, vk::Extent2D extent, const Options& options)
+{
+    const bool halfFloat = format == vk::Format::eR16G16B16A16Sfloat;
+    auto slots = std::vector<Slot>();
+
+    if (!options.outputPath.empty()) {
+        const size_t imageSize = size_t(extent.width) * extent.height * texelSize(format);
+
+        for (size_t i = 0; i < std::max<size_t>(options.outputDepth, 1); i++) {
+            auto [memory, buffer] = createHostBuffer(device, physical, imageSize,
+                vk::BufferUsageFlagBits::eTransferDst);
+            auto mapped = device.mapMemory(*memory, 0, imageSize, vk::MemoryMapFlags());
+            auto cmd = recordCopy(device, pool, workImage, extent, *buffer);
+            auto fence = device.createFenceUnique(vk::FenceCreateInfo(), nullptr);
+
+            slots.push_back(Slot { std::move(memory), std::move(buffer), mapped, std::move(cmd), std::move(fence),
+                Stage::Free, 0, 0.0 });
+        }
+    }
+
+    return FrameWriter(device, queues, extent, halfFloat, std::move(slots), options);
+}
+
+void FrameWriter::update() {
+    if (!this->enabled()) { return; }
+
+    uint64_t current = this->frame;
+    this->frame += 1;
+
+    if (current % this->interval == 0) {
+        this->write(current);
+    } else {
+        this->collect();
+    }
+}
+
+void FrameWriter::write(uint64_t index) {
+    if (!this->enabled()) { return; }
+
+    this->collect();
+
+    auto isFree = [](const Slot& slot) { return slot.stage == Stage::Free; };
+    auto slot = std::find_if(this->slots.begin(), this->slots.end(), isFree);
+
+    if (slot == this->slots.end()) {
+        auto stallStart = Clock::now();
+
+        while (slot == this->slots.end()) {
+            this->waitForProgress();
+            this->collect();
+            slot = std::find_if(this->slots.begin(), this->slots.end(), isFree);
+        }
+
+        this->stalls += 1;
+        this->stallSeconds += secondsSince(stallStart);
+    }
+
+    slot->frame = index;
+    slot->seconds = secondsSince(this->started);
+    this->submitCopy(*slot);
+
+    auto inFlight = size_t(std::count_if(this->slots.begin(), this->slots.end(),
+        [&](const Slot& s) { return !isFree(s); }));
+    this->maxInFlight = std::max(this->maxInFlight, inFlight);
+}
+
+void FrameWriter::finish() {
+    if (!this->enabled()) { return; }
+
+    auto isFree = [](const Slot& slot) { return slot.stage == Stage::Free; };
+
+    this->collect();
+    while (!std::all_of(this->slots.begin(), this->slots.end(), isFree)) {
+        this->waitForProgress();
+        this->collect();
+    }
+
+    this->stop();
+
+    auto seconds = secondsSince(this->started);
+    auto megabytes = double(this->encoders->bytesWritten) / (1024.0 * 1024.0);
+    auto encodeSeconds = this->encoders->encodeSeconds;
+
+    std::cout << std::fixed << std::setprecision(2)
+        << "Frames written: " << this->framesWritten << " (" << megabytes << " MiB) in " << seconds << " s\n"
+        << "    pipeline depth: " << this->slots.size() << " buffers, at most " << this->maxInFlight
+        << " in flight\n"
+        << "    encode throughput: "
+        << (this->framesWritten > 0 ? 1000.0 * encodeSeconds / double(this->framesWritten) : 0.0)
+        << " ms per frame, " << (encodeSeconds > 0.0 ? megabytes / encodeSeconds : 0.0)
+        << " MiB/s per thread, " << this->threads.size() << " threads\n"
+        << "    stalls: " << this->stalls << ", " << this->stallSeconds << " s waiting for a free buffer ("
+        << (seconds > 0.0 ? 100.0 * this->stallSeconds / seconds : 0.0) << "% of the render time)\n";
+
+    if (this->referencePath.empty()) { return; }
+
+    auto& errors = this->encoders->frameErrors;
+    std::sort(errors.begin(), errors.end(), [](const FrameError& a, const FrameError& b) {
+        return a.frame < b.frame;
+    });
+
+    std::cout << "    relative MSE against " << this->referencePath << ":\n";
+    for (const auto& frameError : errors) {
+        std::cout << std::setprecision(2) << "        frame " << frameError.frame << " at " << frameError.seconds
+            << " s: " << std::setprecision(6) << frameError.error << "\n";
+    }
+
+    std::cout << std::defaultfloat;
+}
+
+/// Hand finished copies to the encoders and take back the buffers they are done with.
+void FrameWriter::collect() {
+    auto lock = std::unique_lock<std::mutex>(this->encoders->mutex);
+
+    if (!this->encoders->error.empty()) {
+        throw std::runtime_error("failed to write frame: " + this->encoders->error);
+    }
+
+    for (auto index : this->encoders->done) {
+        this->slots[index].stage = Stage::Free;
+        this->framesWritten += 1;
+    }
+    this->encoders->done.clear();
+
+    bool added = false;
+    for (size_t i = 0; i < this->slots.size(); i++) {
+        auto& slot = this->slots[i];
+
+        if (slot.stage == Stage::Copying && this->device.getFenceStatus(*slot.fence) == vk::Result::eSuccess) {
+            slot.stage = Stage::Encoding;
+            this->encoders->jobs.push_back(Job { i, slot.frame, slot.seconds });
+            added = true;
+        }
+    }
+
+    lock.unlock();
+
+    if (added) {
+        this->encoders->jobAdded.notify_all();
+    }
+}
+
+/// Wait until a copy or an encode finishes, or a millisecond passes.
+void FrameWriter::waitForProgress() {
+    const auto poll = std::chrono::milliseconds(1);
+
+    auto copying = std::vector<vk::Fence>();
+    for (const auto& slot : this->slots) {
+        if (slot.stage == Stage::Copying) {
+            copying.push_back(*slot.fence);
+        }
+    }
+
+    if (!copying.empty()) {
+        this->device.waitForFences(copying.size(), copying.data(), false,
+            std::chrono::nanoseconds(poll).count());
+    } else {
+        auto lock = std::unique_lock<std::mutex>(this->encoders->mutex);
+        this->encoders->jobDone.wait_for(lock, poll, [&] { return !this->encoders->done.empty(); });
+    }
+}
+
+void FrameWriter::submitCopy(Slot& slot) {
+    this->device.resetFences(1, &*slot.fence);
+
+    auto submitInfo = vk::SubmitInfo(
+        0,                                  // waitSemaphoreCount
+        nullptr,                            // pWaitSemaphores
+        nullptr,                            // pWaitDstStageMask
+        1,                                  // commandBufferCount
+        &*slot.cmd,                         // pCommandBuffers
+        0,                                  // signalSemaphoreCount
+        nullptr                             // pSignalSemaphores
+    );
+
+    this->queues.compute.submit(1, &submitInfo, *slot.fence);
+    slot.stage = Stage::Copying;
+}
+
+void FrameWriter::stop() {
+    if (!this->encoders || this->threads.empty()) { return; }
+
+    {
+        auto lock = std::unique_lock<std::mutex>(this->encoders->mutex);
+        this->encoders->stopping = true;
+    }
+
+    this->encoders->jobAdded.notify_all();
+
+    for (auto& thread : this->threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+}
+
+void FrameWriter::encodeLoop(Encoders& encoders, std::string path, ImageFileFormat fileFormat, bool halfFloat,
+    vk::Extent2D extent)
+{
+    auto lock = std::unique_lock<std::mutex>(encoders.mutex);
+
+    while (true) {
+        encoders.jobAdded.wait(lock, [&] { return encoders.stopping || !encoders.jobs.empty(); });
+
+        if (encoders.jobs.empty()) {
+            return;
+        }
+
+        auto job = encoders.jobs.front();
+        encoders.jobs.pop_front();
+        lock.unlock();
+
+        // The slot isn't reused until it is reported as done, so its memory can be read without the lock.
+        auto start = Clock::now();
+        auto error = std::string();
+        size_t size = 0;
+
+        try {
+            size = writeImage(numberedPath(path, job.frame), fileFormat, encoders.mapped[job.slot], halfFloat,
+                extent.width, extent.height);
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+
+        // The reference is only read, so it is shared without the lock as well.
+        double frameError = 0.0;
+        if (error.empty() && !encoders.reference.texels.empty()) {
+            frameError = relativeError(encoders.mapped[job.slot], halfFloat, encoders.reference);
+        }
+
+        auto seconds = secondsSince(start);
+
+        lock.lock();
+        encoders.bytesWritten += size;
+
+        if (!encoders.reference.texels.empty()) {
+            encoders.frameErrors.push_back(FrameError { job.frame, job.seconds, frameError });
+        }
+
+        encoders.encodeSeconds += seconds;
+        encoders.done.push_back(job.slot);
+
+        if (!error.empty() && encoders.error.empty()) {
+            encoders.error = error;
+        }
+
+        encoders.jobDone.notify_all();
+    }
+}
+
+} // namespace app
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "deps.h"
+#include "device.h"
+#include "encode.h"
+#include "options.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace app {
+
+/// Writes rendered frames to disk without stalling the GPU.
+///
+/// The work image is copied into one of a ring of persistently mapped host buffers by a
+/// prerecorded command buffer submitted right after the frame. Once the copy's fence is
+/// signalled, the buffer is handed to a pool of encoder threads which write the file straight
+/// from the mapped memory and then return the buffer to the ring. The render loop only waits
+/// when every buffer of the ring is still in flight, which is counted as a stall.
+///
+/// With a reference image the encoders also measure the error of each frame, which is reported with
+/// the time the frame was rendered at. Comparing two runs at equal times shows which one converges faster.
+class FrameWriter {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    enum class Stage {
+        Free,
+        Copying,
+        Encoding,
+    };
+
+    struct Slot {
+        vk::UniqueDeviceMemory memory;
+        vk::UniqueBuffer buffer;
+        const void* mapped;
+        vk::UniqueCommandBuffer cmd;
+        vk::UniqueFence fence;
+        Stage stage;
+        uint64_t frame;
+
+        /// Seconds from the start of rendering to the frame being submitted.
+        double seconds;
+    };
+
+    struct Job {
+        size_t slot;
+        uint64_t frame;
+        double seconds;
+    };
+
+    /// Error of a frame against the reference image, see `relativeError`.
+    struct FrameError {
+        uint64_t frame;
+        double seconds;
+        double error;
+    };
+
+    /// State shared with the encoder threads, kept behind a pointer so the writer can be moved.
+    struct Encoders {
+        /// Mapped memory of each slot.
+        std::vector<const void*> mapped;
+
+        /// Image the frames are compared against, empty if there is none.
+        FloatImage reference;
+
+        std::mutex mutex;
+        std::condition_variable jobAdded;
+        std::condition_variable jobDone;
+        std::deque<Job> jobs;
+        std::vector<size_t> done;
+        bool stopping = false;
+
+        size_t bytesWritten = 0;
+        double encodeSeconds = 0.0;
+        std::vector<FrameError> frameErrors;
+        std::string error;
+    };
+
+    vk::Device device;
+    Queues queues;
+    vk::Extent2D extent;
+    bool halfFloat;
+
+    std::string path;
+    ImageFileFormat fileFormat;
+    size_t interval;
+    std::string referencePath;
+
+    std::vector<Slot> slots;
+    std::unique_ptr<Encoders> encoders;
+    std::vector<std::thread> threads;
+
+    uint64_t frame;
+    size_t framesWritten;
+    size_t maxInFlight;
+    size_t stalls;
+    double stallSeconds;
+    Clock::time_point started;
+
+public:
+    static FrameWriter create(vk::Device device, vk::PhysicalDevice physical, vk::CommandPool pool,
+        const Queues& queues, vk::Image workImage, vk::Format format, vk::Extent2D extent, const Options& options);
+
+    FrameWriter(FrameWriter&&) = default;
+    FrameWriter& operator=(FrameWriter&&) = default;
+    ~FrameWriter();
+
+    bool enabled() const { return !this->path.empty(); }
+
+    /// Read back the frame if it is due. Called once per frame, after the frame is submitted.
+    void update();
+
+    /// Read back the frame just submitted, as file number `index`.
+    void write(uint64_t index);
+
+    /// Wait until every frame read back is on disk and print a report. The device must be idle.
+    void finish();
+
+private:
+    FrameWriter(vk::Device device, const Queues& queues, vk::Extent2D extent, bool halfFloat,
+        std::vector<Slot>&& slots, const Options& options);
+
+    void collect();
+    void waitForProgress();
+    void submitCopy(Slot& slot);
+    void stop();
+
+    static void encodeLoop(Encoders& encoders, std::string path, ImageFileFormat fileFormat, bool halfFloat,
+        vk::Extent2D extent);
+};
+
+} // namespace app
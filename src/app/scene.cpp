@@ -0,0 +1,112 @@
+#include "bvh.h"
+#include "lights.h"
+#include "scene.h"
+#include "shader.h"
+#include "util.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+namespace app {
+
+namespace {
+
+template<typename T>
+std::tuple<vk::UniqueDeviceMemory, vk::UniqueBuffer> createStorageBuffer(vk::Device device,
+    vk::PhysicalDevice physical, vk::CommandPool pool, const Queues& queues, const char* name,
+    const std::vector<T>& data, size_t& totalSize)
+{
+    const size_t size = data.size() * sizeof(T);
+    totalSize += size;
+
+    std::cout << "    " << std::left << std::setw(20) << name << std::right << std::setw(10) << size
+        << " bytes (" << data.size() << " x " << sizeof(T) << ")\n";
+
+    // Buffers can't be empty, a scene without primitives of some type still gets one unused element.
+    auto [memory, buffer] = createBuffer(device, physical, std::max(size, sizeof(T)));
+
+    if (size > 0) {
+        uploadBuffer(device, physical, pool, queues, *buffer, data.data(), size);
+    }
+
+    return std::make_tuple(std::move(memory), std::move(buffer));
+}
+
+} // namespace
+
+std::vector<vk::Buffer> SceneBuffers::bindings() const {
+    return std::vector<vk::Buffer> {
+        *this->lights, *this->lightTree, *this->materials, *this->spheres, *this->ellipsoids,
+        *this->primitiveMaterials, *this->bvh, *this->compressedBvh, *this->bvhPrimitives, *this->camera
+    };
+}
+
+Primitives scenePrimitives(const Options& options) {
+    return options.primitiveCount == 0 ? defaultPrimitives() : randomPrimitives(options.primitiveCount);
+}
+
+std::vector<Light> sceneLights(const Options& options) {
+    return options.lightCount == 0 ? defaultLights() : randomLights(options.lightCount);
+}
+
+SceneBuffers createSceneBuffers(vk::Device device, vk::PhysicalDevice physical, vk::CommandPool pool,
+    const Queues& queues, const Primitives& primitives, const Bvh& bvh, const Camera& camera,
+    const Options& options)
+{
+    auto lights = sceneLights(options);
+    auto lightTree = buildLightTree(lights);
+
+    // The layout which isn't used still needs a buffer to bind, it gets a single empty node.
+    auto bvhNodes = options.compressedBvh ? std::vector<BvhNode>(1) : bvh.nodes;
+    auto compressedBvhNodes = options.compressedBvh
+        ? compressBvh(bvh.nodes)
+        : std::vector<CompressedBvhNode>(1);
+
+    std::cout << "Scene has " << lights.size() << " lights (" << lightTree.size() << " light tree nodes), "
+        << primitives.spheres.size() << " spheres and " << primitives.ellipsoids.size() << " ellipsoids ("
+        << bvh.nodes.size() << (options.compressedBvh ? " compressed" : "") << " BVH nodes)\n";
+    std::cout << "Scene memory:\n";
+
+    size_t totalSize = 0;
+
+    auto [lightsMemory, lightsBuffer] = createStorageBuffer(device, physical, pool, queues,
+        "lights", lights, totalSize);
+    auto [lightTreeMemory, lightTreeBuffer] = createStorageBuffer(device, physical, pool, queues,
+        "light tree", lightTree, totalSize);
+    auto [materialsMemory, materialsBuffer] = createStorageBuffer(device, physical, pool, queues,
+        "materials", primitives.materials, totalSize);
+    auto [spheresMemory, spheresBuffer] = createStorageBuffer(device, physical, pool, queues,
+        "spheres", primitives.spheres, totalSize);
+    auto [ellipsoidsMemory, ellipsoidsBuffer] = createStorageBuffer(device, physical, pool, queues,
+        "ellipsoids", primitives.ellipsoids, totalSize);
+    auto [primitiveMaterialsMemory, primitiveMaterialsBuffer] = createStorageBuffer(device, physical, pool, queues,
+        "primitive materials", primitives.primitiveMaterials(), totalSize);
+    auto [bvhMemory, bvhBuffer] = createStorageBuffer(device, physical, pool, queues,
+        "BVH", bvhNodes, totalSize);
+    auto [compressedBvhMemory, compressedBvhBuffer] = createStorageBuffer(device, physical, pool, queues,
+        "compressed BVH", compressedBvhNodes, totalSize);
+    auto [bvhPrimitivesMemory, bvhPrimitivesBuffer] = createStorageBuffer(device, physical, pool, queues,
+        "BVH primitives", bvh.primitives, totalSize);
+    auto [cameraMemory, cameraBuffer] = createStorageBuffer(device, physical, pool, queues,
+        "camera", std::vector<Camera> { camera }, totalSize);
+
+    std::cout << "    " << std::left << std::setw(20) << "total" << std::right << std::setw(10) << totalSize
+        << " bytes\n";
+
+    return SceneBuffers {
+        std::move(lightsMemory), std::move(lightsBuffer),
+        std::move(lightTreeMemory), std::move(lightTreeBuffer),
+        std::move(materialsMemory), std::move(materialsBuffer),
+        std::move(spheresMemory), std::move(spheresBuffer),
+        std::move(ellipsoidsMemory), std::move(ellipsoidsBuffer),
+        std::move(primitiveMaterialsMemory), std::move(primitiveMaterialsBuffer),
+        std::move(bvhMemory), std::move(bvhBuffer),
+        std::move(compressedBvhMemory), std::move(compressedBvhBuffer),
+        std::move(bvhPrimitivesMemory), std::move(bvhPrimitivesBuffer),
+        std::move(cameraMemory), std::move(cameraBuffer),
+        uint32_t(primitives.spheres.size()), uint32_t(primitives.ellipsoids.size())
+    };
+}
+
+} // namespace app
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "bvh.h"
+#include "camera.h"
+#include "deps.h"
+#include "device.h"
+#include "lights.h"
+#include "options.h"
+#include "primitives.h"
+
+#include <vector>
+
+namespace app {
+
+/// Device buffers holding the scene description.
+///
+/// They are bound to the shader right after the state buffer, in the order returned by `bindings`.
+/// Only one of `bvh` and `compressedBvh` is filled in, depending on `Options::compressedBvh`,
+/// the other one holds a single unused node.
+///
+/// The primitives, BVH and camera can be rewritten between frames, see `Animator`.
+struct SceneBuffers {
+    vk::UniqueDeviceMemory lightsMemory;
+    vk::UniqueBuffer lights;
+    vk::UniqueDeviceMemory lightTreeMemory;
+    vk::UniqueBuffer lightTree;
+    vk::UniqueDeviceMemory materialsMemory;
+    vk::UniqueBuffer materials;
+    vk::UniqueDeviceMemory spheresMemory;
+    vk::UniqueBuffer spheres;
+    vk::UniqueDeviceMemory ellipsoidsMemory;
+    vk::UniqueBuffer ellipsoids;
+    vk::UniqueDeviceMemory primitiveMaterialsMemory;
+    vk::UniqueBuffer primitiveMaterials;
+    vk::UniqueDeviceMemory bvhMemory;
+    vk::UniqueBuffer bvh;
+    vk::UniqueDeviceMemory compressedBvhMemory;
+    vk::UniqueBuffer compressedBvh;
+    vk::UniqueDeviceMemory bvhPrimitivesMemory;
+    vk::UniqueBuffer bvhPrimitives;
+    vk::UniqueDeviceMemory cameraMemory;
+    vk::UniqueBuffer camera;
+
+    uint32_t sphereCount;
+    uint32_t ellipsoidCount;
+
+    std::vector<vk::Buffer> bindings() const;
+};
+
+/// The primitives of the scene picked by the options.
+Primitives scenePrimitives(const Options& options);
+
+/// The lights picked by the options.
+std::vector<Light> sceneLights(const Options& options);
+
+/// Upload the lights picked by the options along with `primitives`, their `bvh` and `camera`.
+SceneBuffers createSceneBuffers(vk::Device device, vk::PhysicalDevice physical, vk::CommandPool pool,
+    const Queues& queues, const Primitives& primitives, const Bvh& bvh, const Camera& camera,
+    const Options& options);
+
+} // namespace app
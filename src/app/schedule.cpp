@@ -0,0 +1,40 @@
+#include "schedule.h"
+
+#include <algorithm>
+
+namespace app {
+
+namespace {
+
+/// Spread the lower 16 bits of `x` out to the even bits.
+uint32_t spreadBits(uint32_t x) {
+    x &= 0x0000ffff;
+    x = (x | (x << 8)) & 0x00ff00ff;
+    x = (x | (x << 4)) & 0x0f0f0f0f;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    return x;
+}
+
+uint32_t mortonCode(uint32_t packed) {
+    return spreadBits(packed & 0xffff) | (spreadBits(packed >> 16) << 1);
+}
+
+} // namespace
+
+std::vector<uint32_t> mortonTileOrder(uint32_t tilesX, uint32_t tilesY) {
+    auto tiles = std::vector<uint32_t>();
+    tiles.reserve(size_t(tilesX) * tilesY);
+
+    for (uint32_t y = 0; y < tilesY; y++) {
+        for (uint32_t x = 0; x < tilesX; x++) {
+            tiles.push_back(x | (y << 16));
+        }
+    }
+
+    std::sort(tiles.begin(), tiles.end(), [](uint32_t a, uint32_t b) { return mortonCode(a) < mortonCode(b); });
+
+    return tiles;
+}
+
+} // namespace app
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace app {
+
+/// Order in which the persistent workgroups trace the tiles of the image.
+///
+/// Tiles are sorted along a Z-order (Morton) curve, so consecutive tiles are close to each other
+/// and the workgroups running at the same time trace nearby, coherent rays. Each entry is
+/// packed as `x | y << 16`, as read from `TILE_ORDER` in `shader/main.comp`.
+std::vector<uint32_t> mortonTileOrder(uint32_t tilesX, uint32_t tilesY);
+
+} // namespace app
@@ -1,7 +1,10 @@
 #include "shader.h"
+#include "paging.h"
+#include "state.h"
 
 #include <array>
 #include <cassert>
+#include <cstddef>
 #include <experimental/array>
 #include <fstream>
 #include <vector>
@@ -42,12 +45,12 @@ std::vector<uint32_t> loadShader(const char* filename) {
 }
 
 std::tuple<vk::UniqueDeviceMemory, vk::UniqueImage, vk::UniqueImageView> createImage(
-    vk::Device device, vk::PhysicalDevice physical, vk::Extent2D extent)
+    vk::Device device, vk::PhysicalDevice physical, vk::Extent2D extent, vk::Format format)
 {
     const auto info = vk::ImageCreateInfo(
         vk::ImageCreateFlags(),                         // flags
         vk::ImageType::e2D,                             // imageType
-        vk::Format::eR32G32B32A32Sfloat,                // format
+        format,                                         // format
         vk::Extent3D(extent.width, extent.height, 1),   // extent
         1,                                              // mipLevels
         1,                                              // arrayLayers
@@ -77,14 +80,14 @@ std::tuple<vk::UniqueDeviceMemory, vk::UniqueImage, vk::UniqueImageView> createI
         vk::ImageViewCreateFlags(),             // flags
         *image,                                 // image
         vk::ImageViewType::e2D,                 // viewType
-        vk::Format::eR32G32B32A32Sfloat,        // format
+        format,                                 // format
         vk::ComponentMapping(),                 // components
         vk::ImageSubresourceRange(              // subresourceRange
             vk::ImageAspectFlagBits::eColor,        // aspectMask
             0,                                      // baseMipLevel
             1,                                      // levelCount
             0,                                      // baseArrayLayer
-            1                                       // layerCountauto memory = device.allocateMemoryUnique(allocInfo, nullptr);
+            1                                       // layerCount
         )
     );
 
@@ -100,6 +103,7 @@ std::tuple<vk::UniqueDeviceMemory, vk::UniqueBuffer> createBuffer(vk::Device dev
         vk::BufferCreateFlags(),                    // flags
         bufferSize,                                 // size
         vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eTransferSrc |
             vk::BufferUsageFlagBits::eTransferDst,  // usage
         vk::SharingMode::eExclusive,                // sharingMode
         0,                                          // queueFamilyIndexCount
@@ -119,22 +123,26 @@ std::tuple<vk::UniqueDeviceMemory, vk::UniqueBuffer> createBuffer(vk::Device dev
     return std::make_tuple(std::move(memory), std::move(buffer));
 }
 
-vk::UniqueDescriptorSetLayout createDescriptorSetLayoyt(vk::Device device) {
-    const auto bindings = make_array(
-        vk::DescriptorSetLayoutBinding(
-            0,                                      // binding
-            vk::DescriptorType::eStorageImage,      // descriptorType
-            1,                                      // descriptorCount
-            vk::ShaderStageFlagBits::eCompute,      // stageFlags
-            nullptr                                 // pImmutableSamplers
-        ),
-        vk::DescriptorSetLayoutBinding(
-            1,                                      // binding
+vk::UniqueDescriptorSetLayout createDescriptorSetLayoyt(vk::Device device, size_t storageBufferCount) {
+    auto bindings = std::vector<vk::DescriptorSetLayoutBinding>();
+
+    bindings.push_back(vk::DescriptorSetLayoutBinding(
+        0,                                      // binding
+        vk::DescriptorType::eStorageImage,      // descriptorType
+        1,                                      // descriptorCount
+        vk::ShaderStageFlagBits::eCompute,      // stageFlags
+        nullptr                                 // pImmutableSamplers
+    ));
+
+    for (size_t i = 0; i < storageBufferCount; i++) {
+        bindings.push_back(vk::DescriptorSetLayoutBinding(
+            1 + i,                                  // binding
             vk::DescriptorType::eStorageBuffer,     // descriptorType
             1,                                      // descriptorCount
             vk::ShaderStageFlagBits::eCompute,      // stageFlags
             nullptr                                 // pImmutableSamplers
         ));
+    }
 
     const auto layoutInfo = vk::DescriptorSetLayoutCreateInfo(
         vk::DescriptorSetLayoutCreateFlags(),   // flags
@@ -146,11 +154,12 @@ vk::UniqueDescriptorSetLayout createDescriptorSetLayoyt(vk::Device device) {
 }
 
 std::tuple<vk::UniqueDescriptorPool, vk::DescriptorSet> createDescriptorSet(
-    vk::Device device, vk::DescriptorSetLayout layout, vk::ImageView workImageView, vk::Buffer buffer)
+    vk::Device device, vk::DescriptorSetLayout layout, vk::ImageView workImageView,
+    const std::vector<vk::Buffer>& buffers)
 {
     const auto poolSize = make_array(
         vk::DescriptorPoolSize(vk::DescriptorType::eStorageImage, 1),
-        vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, 1));
+        vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, buffers.size()));
     const auto poolInfo = vk::DescriptorPoolCreateInfo(
         vk::DescriptorPoolCreateFlags(),        // flags
         1,                                      // maxSets
@@ -170,28 +179,37 @@ std::tuple<vk::UniqueDescriptorPool, vk::DescriptorSet> createDescriptorSet(
     auto set = std::move(sets[0]);
 
     const auto imageInfo = vk::DescriptorImageInfo(nullptr, workImageView, vk::ImageLayout::eGeneral);
-    const auto bufferInfo = vk::DescriptorBufferInfo(buffer, 0, VK_WHOLE_SIZE);
-    const auto writeInfo = make_array(
-        vk::WriteDescriptorSet(
-            set,                                    // dstSet
-            0,                                      // dstBinding
-            0,                                      // dstArrayElement
-            1,                                      // descriptorCount
-            vk::DescriptorType::eStorageImage,      // descriptorType
-            &imageInfo,                             // pImageInfo
-            nullptr,                                // pBufferInfo
-            nullptr                                 // pTexelBufferView
-        ),
-        vk::WriteDescriptorSet(
+
+    auto bufferInfos = std::vector<vk::DescriptorBufferInfo>();
+    for (auto buffer: buffers) {
+        bufferInfos.push_back(vk::DescriptorBufferInfo(buffer, 0, VK_WHOLE_SIZE));
+    }
+
+    auto writeInfo = std::vector<vk::WriteDescriptorSet>();
+
+    writeInfo.push_back(vk::WriteDescriptorSet(
+        set,                                    // dstSet
+        0,                                      // dstBinding
+        0,                                      // dstArrayElement
+        1,                                      // descriptorCount
+        vk::DescriptorType::eStorageImage,      // descriptorType
+        &imageInfo,                             // pImageInfo
+        nullptr,                                // pBufferInfo
+        nullptr                                 // pTexelBufferView
+    ));
+
+    for (size_t i = 0; i < bufferInfos.size(); i++) {
+        writeInfo.push_back(vk::WriteDescriptorSet(
             set,                                    // dstSet
-            1,                                      // dstBinding
+            1 + i,                                  // dstBinding
             0,                                      // dstArrayElement
             1,                                      // descriptorCount
             vk::DescriptorType::eStorageBuffer,     // descriptorType
             nullptr,                                // pImageInfo
-            &bufferInfo,                            // pBufferInfo
+            &bufferInfos[i],                        // pBufferInfo
             nullptr                                 // pTexelBufferView
         ));
+    }
 
     device.updateDescriptorSets(writeInfo.size(), writeInfo.data(), 0, nullptr);
 
@@ -199,7 +217,8 @@ std::tuple<vk::UniqueDescriptorPool, vk::DescriptorSet> createDescriptorSet(
 }
 
 std::tuple<vk::UniquePipeline, vk::UniquePipelineLayout, vk::UniqueShaderModule> createPipeline(
-    vk::Device device, vk::DescriptorSetLayout descriptorLayout)
+    vk::Device device, vk::DescriptorSetLayout descriptorLayout, vk::Format workFormat,
+    const ShaderConstants& constants)
 {
     auto layoutInfo = vk::PipelineLayoutCreateInfo(
         vk::PipelineLayoutCreateFlags(),        // flags
@@ -211,7 +230,9 @@ std::tuple<vk::UniquePipeline, vk::UniquePipelineLayout, vk::UniqueShaderModule>
 
     auto layout = device.createPipelineLayoutUnique(layoutInfo, nullptr);
 
-    auto code = loadShader("shader/comp.spv");
+    auto code = loadShader(workFormat == vk::Format::eR16G16B16A16Sfloat
+        ? "shader/comp_half.spv"
+        : "shader/comp.spv");
     auto shaderInfo = vk::ShaderModuleCreateInfo(
         vk::ShaderModuleCreateFlags(),          // flags
         code.size() * 4,                        // codeSize
@@ -220,12 +241,25 @@ std::tuple<vk::UniquePipeline, vk::UniquePipelineLayout, vk::UniqueShaderModule>
 
     auto shader = device.createShaderModuleUnique(shaderInfo, nullptr);
 
+    // All constants are 32 bit and declared in order, so they map onto consecutive words of `constants`.
+    auto constantEntries = std::vector<vk::SpecializationMapEntry>();
+    for (uint32_t i = 0; i < sizeof(ShaderConstants) / sizeof(uint32_t); i++) {
+        constantEntries.push_back(vk::SpecializationMapEntry(i, i * sizeof(uint32_t), sizeof(uint32_t)));
+    }
+
+    auto specializationInfo = vk::SpecializationInfo(
+        constantEntries.size(),                 // mapEntryCount
+        constantEntries.data(),                 // pMapEntries
+        sizeof(ShaderConstants),                // dataSize
+        &constants                              // pData
+    );
+
     auto stageInfo = vk::PipelineShaderStageCreateInfo(
         vk::PipelineShaderStageCreateFlags(),   // flags
         vk::ShaderStageFlagBits::eCompute,      // stage
         *shader,                                // module
         "main",                                 // pName
-        nullptr                                 // pSpecializationInfo
+        &specializationInfo                     // pSpecializationInfo
     );
 
     auto info = vk::ComputePipelineCreateInfo(
@@ -244,13 +278,18 @@ std::tuple<vk::UniquePipeline, vk::UniquePipelineLayout, vk::UniqueShaderModule>
 void initialLayoutsBarrier(vk::CommandBuffer& buffer, const Queues& quques, vk::Image framebufferImage, vk::Image workImage);
 void transferLayoutsBarrier(vk::CommandBuffer& buffer, const Queues& queues, vk::Image workImage);
 void clearWorkImage(vk::CommandBuffer& buffer, vk::Image workImage);
-void blitImage(vk::CommandBuffer& buffer, vk::Image srcImage, vk::Image dstImage, vk::Extent2D extent);
+void resetFrameTiles(vk::CommandBuffer& buffer, vk::Buffer stateBuffer, const BinningPass& binning,
+    vk::Buffer deferredPaths);
+void binPrimitives(vk::CommandBuffer& buffer, const BinningPass& binning);
 void presentLayoutBarrier(vk::CommandBuffer& buffer, const Queues& queues, vk::Image image);
+void resolveWorkImage(vk::CommandBuffer& buffer, const Queues& queues, vk::Image workImage, vk::Image resolveImage,
+    vk::Extent2D extent);
 
 std::tuple<vk::UniqueCommandPool, std::vector<vk::UniqueCommandBuffer>> createCommands(
     vk::Device device, vk::SwapchainKHR swapchain, const Queues& queues, vk::Pipeline pipeline,
     vk::PipelineLayout pipelineLayout, vk::DescriptorSet descriptorSet, vk::Image workImage,
-    vk::Extent2D extent)
+    vk::Extent2D extent, vk::Buffer stateBuffer, vk::Extent2D groupCount, const BinningPass& binning,
+    vk::Buffer deferredPaths, const std::vector<vk::Image>& resolveImages)
 {
     auto poolInfo = vk::CommandPoolCreateInfo(
         vk::CommandPoolCreateFlags(),           // flags
@@ -259,7 +298,8 @@ std::tuple<vk::UniqueCommandPool, std::vector<vk::UniqueCommandBuffer>> createCo
 
     auto pool = device.createCommandPoolUnique(poolInfo, nullptr);
 
-    auto images = device.getSwapchainImagesKHR(swapchain);
+    const bool resolve = !resolveImages.empty();
+    auto images = resolve ? resolveImages : device.getSwapchainImagesKHR(swapchain);
 
     auto allocInfo = vk::CommandBufferAllocateInfo(
         *pool,                                  // commandPool,
@@ -280,7 +320,7 @@ std::tuple<vk::UniqueCommandPool, std::vector<vk::UniqueCommandBuffer>> createCo
 
         buffer->begin(beginInfo);
 
-        buffer->bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+        // The binning pipeline has a compatible layout, so the descriptor set stays bound for both.
         buffer->bindDescriptorSets(
             vk::PipelineBindPoint::eCompute,        // pipelineBindPoint,
             pipelineLayout,                         // layout
@@ -293,8 +333,20 @@ std::tuple<vk::UniqueCommandPool, std::vector<vk::UniqueCommandBuffer>> createCo
 
         initialLayoutsBarrier(*buffer, queues, image, workImage);
         // clearWorkImage(*buffer, workImage);
+        resetFrameTiles(*buffer, stateBuffer, binning, deferredPaths);
 
-        buffer->dispatch(1, 1, 1);
+        if (binning.pipeline) {
+            binPrimitives(*buffer, binning);
+        }
+
+        buffer->bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+        buffer->dispatch(groupCount.width, groupCount.height, 1);
+
+        if (resolve) {
+            resolveWorkImage(*buffer, queues, workImage, image, extent);
+            buffer->end();
+            continue;
+        }
 
         // change workImage from General to TransferSrc layout.
         transferLayoutsBarrier(*buffer, queues, workImage);
@@ -310,6 +362,115 @@ std::tuple<vk::UniqueCommandPool, std::vector<vk::UniqueCommandBuffer>> createCo
     return std::make_tuple(std::move(pool), std::move(buffers));
 }
 
+/// Zero the tile counter of the frame in the state buffer and the counts of the tile bins,
+/// and hand the paths deferred by the previous frame over for resuming, after the previous frame is done with them.
+void resetFrameTiles(vk::CommandBuffer& buffer, vk::Buffer stateBuffer, const BinningPass& binning,
+    vk::Buffer deferredPaths)
+{
+    const auto computeToTransfer = vk::MemoryBarrier(
+        vk::AccessFlagBits::eShaderRead |
+            vk::AccessFlagBits::eShaderWrite,   // srcAccessMask
+        vk::AccessFlagBits::eTransferRead |
+            vk::AccessFlagBits::eTransferWrite  // dstAccessMask
+    );
+
+    buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,  // srcStageMask
+        vk::PipelineStageFlagBits::eTransfer,       // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &computeToTransfer,                         // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        0,                                          // imageMemoryBarrierCount
+        nullptr                                     // pImageMemoryBarriers
+    );
+
+    buffer.fillBuffer(stateBuffer, offsetof(State, frameTiles), sizeof(uint32_t), 0);
+
+    if (binning.pipeline) {
+        buffer.fillBuffer(binning.bins, 0, binning.countsSize, 0);
+    }
+
+    // The frame resumes the paths queued up to the current tail, the ones before were resumed by the previous frame.
+    if (deferredPaths) {
+        const auto endToStart = vk::BufferCopy(
+            offsetof(DeferredHeader, frameEnd),     // srcOffset
+            offsetof(DeferredHeader, frameStart),   // dstOffset
+            sizeof(uint32_t)                        // size
+        );
+
+        buffer.copyBuffer(deferredPaths, deferredPaths, 1, &endToStart);
+
+        const auto readToWrite = vk::MemoryBarrier(
+            vk::AccessFlagBits::eTransferRead,      // srcAccessMask
+            vk::AccessFlagBits::eTransferWrite      // dstAccessMask
+        );
+
+        buffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,   // srcStageMask
+            vk::PipelineStageFlagBits::eTransfer,   // dstStageMask
+            vk::DependencyFlags(),                  // dependencyFlags
+            1,                                      // memoryBarrierCount
+            &readToWrite,                           // pMemoryBarriers
+            0,                                      // bufferMemoryBarrierCount
+            nullptr,                                // pBufferMemoryBarriers
+            0,                                      // imageMemoryBarrierCount
+            nullptr                                 // pImageMemoryBarriers
+        );
+
+        const auto tailToEnd = vk::BufferCopy(
+            offsetof(DeferredHeader, tail),         // srcOffset
+            offsetof(DeferredHeader, frameEnd),     // dstOffset
+            sizeof(uint32_t)                        // size
+        );
+
+        buffer.copyBuffer(deferredPaths, deferredPaths, 1, &tailToEnd);
+        buffer.fillBuffer(deferredPaths, offsetof(DeferredHeader, resumed), sizeof(uint32_t), 0);
+    }
+
+    const auto transferToCompute = vk::MemoryBarrier(
+        vk::AccessFlagBits::eTransferWrite,     // srcAccessMask
+        vk::AccessFlagBits::eShaderRead |
+            vk::AccessFlagBits::eShaderWrite    // dstAccessMask
+    );
+
+    buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,       // srcStageMask
+        vk::PipelineStageFlagBits::eComputeShader,  // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &transferToCompute,                         // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        0,                                          // imageMemoryBarrierCount
+        nullptr                                     // pImageMemoryBarriers
+    );
+}
+
+/// Fill the tile bins for the trace dispatch which follows.
+void binPrimitives(vk::CommandBuffer& buffer, const BinningPass& binning) {
+    buffer.bindPipeline(vk::PipelineBindPoint::eCompute, binning.pipeline);
+    buffer.dispatch(binning.groupCount, 1, 1);
+
+    const auto binsToTrace = vk::MemoryBarrier(
+        vk::AccessFlagBits::eShaderWrite,   // srcAccessMask
+        vk::AccessFlagBits::eShaderRead     // dstAccessMask
+    );
+
+    buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,  // srcStageMask
+        vk::PipelineStageFlagBits::eComputeShader,  // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &binsToTrace,                               // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        0,                                          // imageMemoryBarrierCount
+        nullptr                                     // pImageMemoryBarriers
+    );
+}
+
 void initialLayoutsBarrier(vk::CommandBuffer& buffer, const Queues& queues, vk::Image framebufferImage, vk::Image workImage) {
     const auto initialLayouts = make_array(
         vk::ImageMemoryBarrier(
@@ -333,7 +494,7 @@ void initialLayoutsBarrier(vk::CommandBuffer& buffer, const Queues& queues, vk::
             vk::AccessFlagBits::eMemoryWrite |
                 vk::AccessFlagBits::eShaderRead |
                 vk::AccessFlagBits::eShaderWrite,   // dstAccessMask
-            vk::ImageLayout::eUndefined,            // oldLayout
+            vk::ImageLayout::eTransferSrcOptimal,   // oldLayout
             vk::ImageLayout::eGeneral,              // newLayout
             queues.computeQueueFamily,              // srcQueueFamilyIndex
             queues.computeQueueFamily,              // dstQueueFamilyIndex
@@ -348,8 +509,10 @@ void initialLayoutsBarrier(vk::CommandBuffer& buffer, const Queues& queues, vk::
         )
     );
 
+    // The work image keeps its contents between frames, so wait for any transfer
+    // still reading it (the blit of the previous frame or a checkpoint copy).
     buffer.pipelineBarrier(
-        vk::PipelineStageFlagBits::eTopOfPipe,      // srcStageMask
+        vk::PipelineStageFlagBits::eTransfer,       // srcStageMask
         vk::PipelineStageFlagBits::eComputeShader,  // dstStageMask
         vk::DependencyFlags(),                      // dependencyFlags
         0,                                          // memoryBarrierCount
@@ -361,6 +524,61 @@ void initialLayoutsBarrier(vk::CommandBuffer& buffer, const Queues& queues, vk::
     );
 }
 
+void initWorkImage(vk::CommandBuffer buffer, const Queues& queues, vk::Image workImage) {
+    const auto range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+
+    const auto undefinedToTransfer = vk::ImageMemoryBarrier(
+        vk::AccessFlags(),                      // srcAccessMask
+        vk::AccessFlagBits::eTransferWrite,     // dstAccessMask
+        vk::ImageLayout::eUndefined,            // oldLayout
+        vk::ImageLayout::eTransferDstOptimal,   // newLayout
+        queues.computeQueueFamily,              // srcQueueFamilyIndex
+        queues.computeQueueFamily,              // dstQueueFamilyIndex
+        workImage,                              // image
+        range                                   // subresourceRange
+    );
+
+    buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTopOfPipe,  // srcStageMask
+        vk::PipelineStageFlagBits::eTransfer,   // dstStageMask
+        vk::DependencyFlags(),                  // dependencyFlags
+        0,                                      // memoryBarrierCount
+        nullptr,                                // pMemoryBarriers
+        0,                                      // bufferMemoryBarrierCount
+        nullptr,                                // pBufferMemoryBarriers
+        1,                                      // imageMemoryBarrierCount
+        &undefinedToTransfer                    // pImageMemoryBarriers
+    );
+
+    const auto clearColor = vk::ClearColorValue(make_array(0.0f, 0.0f, 0.0f, 0.0f));
+    buffer.clearColorImage(workImage, vk::ImageLayout::eTransferDstOptimal, &clearColor, 1, &range);
+
+    const auto transferToSrc = vk::ImageMemoryBarrier(
+        vk::AccessFlagBits::eTransferWrite,     // srcAccessMask
+        vk::AccessFlagBits::eTransferRead |
+            vk::AccessFlagBits::eShaderRead,    // dstAccessMask
+        vk::ImageLayout::eTransferDstOptimal,   // oldLayout
+        vk::ImageLayout::eTransferSrcOptimal,   // newLayout
+        queues.computeQueueFamily,              // srcQueueFamilyIndex
+        queues.computeQueueFamily,              // dstQueueFamilyIndex
+        workImage,                              // image
+        range                                   // subresourceRange
+    );
+
+    buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,   // srcStageMask
+        vk::PipelineStageFlagBits::eTransfer |
+            vk::PipelineStageFlagBits::eComputeShader,    // dstStageMask
+        vk::DependencyFlags(),                  // dependencyFlags
+        0,                                      // memoryBarrierCount
+        nullptr,                                // pMemoryBarriers
+        0,                                      // bufferMemoryBarrierCount
+        nullptr,                                // pBufferMemoryBarriers
+        1,                                      // imageMemoryBarrierCount
+        &transferToSrc                          // pImageMemoryBarriers
+    );
+}
+
 void clearWorkImage(vk::CommandBuffer& buffer, vk::Image workImage) {
     auto clearRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
     auto clearColor = vk::ClearColorValue(make_array(0.0f, 0.0f, 0.0f, 1.0f));
@@ -468,4 +686,79 @@ void presentLayoutBarrier(vk::CommandBuffer& buffer, const Queues& queues, vk::I
     );
 }
 
+/// Copy the work image into `resolveImage`, which is then released to the present queue family.
+///
+/// The resolve image was put into the `TransferDstOptimal` layout by `initialLayoutsBarrier`. Its old
+/// contents are discarded, so it doesn't have to be acquired back from the present queue family first.
+void resolveWorkImage(vk::CommandBuffer& buffer, const Queues& queues, vk::Image workImage, vk::Image resolveImage,
+    vk::Extent2D extent)
+{
+    const auto range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+
+    const auto generalToTransfer = vk::ImageMemoryBarrier(
+        vk::AccessFlagBits::eShaderWrite,       // srcAccessMask
+        vk::AccessFlagBits::eTransferRead,      // dstAccessMask
+        vk::ImageLayout::eGeneral,              // oldLayout
+        vk::ImageLayout::eTransferSrcOptimal,   // newLayout
+        queues.computeQueueFamily,              // srcQueueFamilyIndex
+        queues.computeQueueFamily,              // dstQueueFamilyIndex
+        workImage,                              // image
+        range                                   // subresourceRange
+    );
+
+    buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,  // srcStageMask
+        vk::PipelineStageFlagBits::eTransfer,       // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        0,                                          // memoryBarrierCount
+        nullptr,                                    // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        1,                                          // imageMemoryBarrierCount
+        &generalToTransfer                          // pImageMemoryBarriers
+    );
+
+    const auto layers = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+    const auto region = vk::ImageCopy(
+        layers,                                         // srcSubresource
+        vk::Offset3D(0, 0, 0),                          // srcOffset
+        layers,                                         // dstSubresource
+        vk::Offset3D(0, 0, 0),                          // dstOffset
+        vk::Extent3D(extent.width, extent.height, 1)    // extent
+    );
+
+    buffer.copyImage(
+        workImage,                              // srcImage
+        vk::ImageLayout::eTransferSrcOptimal,   // srcImageLayout
+        resolveImage,                           // dstImage
+        vk::ImageLayout::eTransferDstOptimal,   // dstImageLayout
+        1,                                      // regionCount
+        &region                                 // pRegions
+    );
+
+    // The release half of the ownership transfer, the present commands do the matching acquire.
+    const auto release = vk::ImageMemoryBarrier(
+        vk::AccessFlagBits::eTransferWrite,     // srcAccessMask
+        vk::AccessFlags(),                      // dstAccessMask
+        vk::ImageLayout::eTransferDstOptimal,   // oldLayout
+        vk::ImageLayout::eTransferSrcOptimal,   // newLayout
+        queues.computeQueueFamily,              // srcQueueFamilyIndex
+        queues.presentQueueFamily,              // dstQueueFamilyIndex
+        resolveImage,                           // image
+        range                                   // subresourceRange
+    );
+
+    buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,       // srcStageMask
+        vk::PipelineStageFlagBits::eBottomOfPipe,   // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        0,                                          // memoryBarrierCount
+        nullptr,                                    // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        1,                                          // imageMemoryBarrierCount
+        &release                                    // pImageMemoryBarriers
+    );
+}
+
 } // namespace app
@@ -4,25 +4,77 @@
 #include "device.h"
 #include "util.h"
 
+#include <vector>
+
 namespace app {
 
+/// Load a SPIR-V file, relative to the working directory.
+std::vector<uint32_t> loadShader(const char* filename);
+
 std::tuple<vk::UniqueDeviceMemory, vk::UniqueImage, vk::UniqueImageView> createImage(
-    vk::Device device, vk::PhysicalDevice physical, vk::Extent2D extent);
+    vk::Device device, vk::PhysicalDevice physical, vk::Extent2D extent, vk::Format format);
+
+/// Record commands that clear the work image and leave it in the layout expected at the start of a frame.
+void initWorkImage(vk::CommandBuffer buffer, const Queues& queues, vk::Image workImage);
 
 std::tuple<vk::UniqueDeviceMemory, vk::UniqueBuffer> createBuffer(vk::Device device, vk::PhysicalDevice physical,
     size_t bufferSize);
 
-vk::UniqueDescriptorSetLayout createDescriptorSetLayoyt(vk::Device device);
+/// Layout with the work image at binding 0, followed by `storageBufferCount` storage buffers.
+vk::UniqueDescriptorSetLayout createDescriptorSetLayoyt(vk::Device device, size_t storageBufferCount);
 
 std::tuple<vk::UniqueDescriptorPool, vk::DescriptorSet> createDescriptorSet(
-    vk::Device device, vk::DescriptorSetLayout layout, vk::ImageView workImageView, vk::Buffer buffer);
+    vk::Device device, vk::DescriptorSetLayout layout, vk::ImageView workImageView,
+    const std::vector<vk::Buffer>& buffers);
+
+/// Values of the specialization constants of `shader/main.comp`, in the order of their `constant_id`.
+struct ShaderConstants {
+    uint32_t sphereCount;
+    uint32_t ellipsoidCount;
+    uint32_t compressedBvh;
+    uint32_t persistent;
+    uint32_t frameBudget;
+    uint32_t tileBatch;
+    uint32_t paged;
+    uint32_t textured;
+    uint32_t mergeHostSamples;
+    uint32_t tileBinCapacity;
+    uint32_t binPrimitives;
+    uint32_t visibilityBuffer;
+    uint32_t checkVisibility;
+    uint32_t guiding;
+    uint32_t environment;
+};
 
+/// The format of the work image is baked into the shader, so `workFormat` picks the SPIR-V file to load.
 std::tuple<vk::UniquePipeline, vk::UniquePipelineLayout, vk::UniqueShaderModule> createPipeline(
-    vk::Device device, vk::DescriptorSetLayout descriptorLayout);
+    vk::Device device, vk::DescriptorSetLayout descriptorLayout, vk::Format workFormat,
+    const ShaderConstants& constants);
 
+/// Binning pass run ahead of the trace dispatch, see `TileBinner`. Skipped if `pipeline` is null.
+struct BinningPass {
+    vk::Pipeline pipeline;
+
+    /// Buffer of the bins, starting with `countsSize` bytes of counts which are zeroed before the pass.
+    vk::Buffer bins;
+    vk::DeviceSize countsSize;
+
+    uint32_t groupCount;
+};
+
+/// Record a command buffer per swapchain image, which traces with a `groupCount` dispatch
+/// and copies the work image to the swapchain image. The `binning` pass is recorded ahead of the dispatch.
+/// Unless `deferredPaths` is null, the paths the previous frame deferred for paging are resumed, see `Pager`.
+///
+/// With `resolveImages` the command buffers are recorded per resolve image instead. They copy the work
+/// image into the resolve image and release it to the present queue family, see `Presenter`.
 std::tuple<vk::UniqueCommandPool, std::vector<vk::UniqueCommandBuffer>> createCommands(
     vk::Device device, vk::SwapchainKHR swapchain, const Queues& queues, vk::Pipeline pipeline,
     vk::PipelineLayout pipelineLayout, vk::DescriptorSet descriptorSet, vk::Image workImage,
-    vk::Extent2D imageExtent);
+    vk::Extent2D imageExtent, vk::Buffer stateBuffer, vk::Extent2D groupCount, const BinningPass& binning,
+    vk::Buffer deferredPaths, const std::vector<vk::Image>& resolveImages);
+
+/// Record a blit of `srcImage` in the `TransferSrcOptimal` layout to `dstImage` in `TransferDstOptimal`.
+void blitImage(vk::CommandBuffer& buffer, vk::Image srcImage, vk::Image dstImage, vk::Extent2D extent);
 
 }
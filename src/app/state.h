@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace app {
+
+/// Number of materials for which sampling statistics are collected.
+const size_t STAT_MATERIALS = 8;
+
+/// Host mirror of the `State` storage buffer in `shader/main.comp`.
+///
+/// The layout must be kept in sync with the shader.
+struct State {
+    /// Number of tiles traced so far, which also picks the sample index of the next tile.
+    uint32_t invocationId;
+
+    /// Number of tiles claimed in the current frame by the persistent workgroups, reset before each frame.
+    uint32_t frameTiles;
+
+    /// Number of closest-hit rays traced.
+    uint32_t rays;
+
+    /// Number of primitive intersection tests done for closest-hit rays.
+    uint32_t rayTests;
+
+    /// Number of shadow (occlusion) rays traced.
+    uint32_t shadowRays;
+
+    /// Number of primitive intersection tests done for shadow rays.
+    uint32_t shadowTests;
+
+    /// Number of shadow rays which found an occluder.
+    uint32_t shadowHits;
+
+    /// Number of times a path was queued because its rays needed geometry which wasn't resident, again for
+    /// every frame it keeps waiting, see `Pager`.
+    uint32_t deferredSamples;
+
+    /// Number of primary rays traced, and the primitive intersection tests done for them
+    /// (also counted in `rays` and `rayTests`).
+    uint32_t primaryRays;
+    uint32_t primaryTests;
+
+    /// Number of tiles whose bin overflowed in the binning pass, see `TileBinner`.
+    uint32_t binOverflows;
+
+    /// Number of primary rays whose traced hit differs from the visibility buffer, see `Options::checkVisibility`.
+    uint32_t visibilityMismatches;
+
+    /// Number of path bounces off each material.
+    uint32_t materialSamples[STAT_MATERIALS];
+
+    /// Sum of the bounce weights (luminance of the throughput factor) for each material,
+    /// as 64 bit fixed point numbers with 10 fractional bits, split in low and high word.
+    uint32_t materialWeight[STAT_MATERIALS][2];
+
+    /// Sum of the squared bounce weights, in the same format as `materialWeight`.
+    uint32_t materialWeight2[STAT_MATERIALS][2];
+};
+
+} // namespace app
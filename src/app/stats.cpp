@@ -0,0 +1,229 @@
+#include "stats.h"
+#include "util.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+
+namespace app {
+
+namespace {
+
+uint64_t fixedPoint(const uint32_t words[2]) {
+    return uint64_t(words[0]) | (uint64_t(words[1]) << 32);
+}
+
+} // namespace
+
+Stats::Stats(vk::Device device, const Queues& queues, vk::UniqueDeviceMemory&& memory, vk::UniqueBuffer&& buffer,
+    const State* mapped, vk::UniqueCommandBuffer&& cmd, vk::UniqueFence&& fence, double interval,
+    bool checkVisibility):
+    device(device),
+    queues(queues),
+    memory(std::move(memory)),
+    buffer(std::move(buffer)),
+    mapped(mapped),
+    cmd(std::move(cmd)),
+    fence(std::move(fence)),
+    interval(interval),
+    checkVisibility(checkVisibility),
+    pending(false),
+    last(),
+    lastTime(Clock::now()),
+    lastReport(Clock::now())
+{
+}
+
+Stats Stats::create(vk::Device device, vk::PhysicalDevice physical, vk::CommandPool pool,
+    const Queues& queues, vk::Buffer stateBuffer, const Options& options)
+{
+    if (!options.stats) {
+        return Stats(device, queues, vk::UniqueDeviceMemory(), vk::UniqueBuffer(), nullptr,
+            vk::UniqueCommandBuffer(), vk::UniqueFence(), options.statsInterval, false);
+    }
+
+    auto [memory, buffer] = createHostBuffer(device, physical, sizeof(State), vk::BufferUsageFlagBits::eTransferDst);
+    auto mapped = device.mapMemory(*memory, 0, sizeof(State), vk::MemoryMapFlags());
+    auto fence = device.createFenceUnique(vk::FenceCreateInfo(), nullptr);
+
+    auto allocInfo = vk::CommandBufferAllocateInfo(
+        pool,                                   // commandPool,
+        vk::CommandBufferLevel::ePrimary,       // level
+        1                                       // commandBufferCount
+    );
+
+    auto cmds = device.allocateCommandBuffersUnique(allocInfo);
+    auto cmd = std::move(cmds[0]);
+
+    cmd->begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlags(), nullptr));
+
+    const auto computeToTransfer = vk::MemoryBarrier(
+        vk::AccessFlagBits::eShaderWrite,       // srcAccessMask
+        vk::AccessFlagBits::eTransferRead       // dstAccessMask
+    );
+
+    cmd->pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,  // srcStageMask
+        vk::PipelineStageFlagBits::eTransfer,       // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &computeToTransfer,                         // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        0,                                          // imageMemoryBarrierCount
+        nullptr                                     // pImageMemoryBarriers
+    );
+
+    const auto region = vk::BufferCopy(0, 0, sizeof(State));
+    cmd->copyBuffer(stateBuffer, *buffer, 1, &region);
+
+    const auto transferToHost = vk::MemoryBarrier(
+        vk::AccessFlagBits::eTransferWrite,     // srcAccessMask
+        vk::AccessFlagBits::eHostRead           // dstAccessMask
+    );
+
+    cmd->pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,       // srcStageMask
+        vk::PipelineStageFlagBits::eHost,           // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &transferToHost,                            // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        0,                                          // imageMemoryBarrierCount
+        nullptr                                     // pImageMemoryBarriers
+    );
+
+    cmd->end();
+
+    return Stats(device, queues, std::move(memory), std::move(buffer), static_cast<const State*>(mapped),
+        std::move(cmd), std::move(fence), options.statsInterval, options.checkVisibility);
+}
+
+void Stats::update() {
+    if (!this->enabled()) { return; }
+
+    if (this->pending && this->device.getFenceStatus(*this->fence) == vk::Result::eSuccess) {
+        auto now = Clock::now();
+        auto current = *this->mapped;
+
+        this->report(current, this->last, std::chrono::duration<double>(now - this->lastTime).count());
+        this->last = current;
+        this->lastTime = now;
+        this->pending = false;
+    }
+
+    auto sinceReport = std::chrono::duration<double>(Clock::now() - this->lastReport).count();
+    if (!this->pending && sinceReport >= this->interval) {
+        this->submitCopy();
+    }
+}
+
+void Stats::finish() {
+    if (!this->enabled()) { return; }
+
+    if (!this->pending) {
+        this->submitCopy();
+    }
+
+    this->device.waitForFences(1, &*this->fence, true, std::numeric_limits<uint64_t>::max());
+    this->pending = false;
+
+    std::cout << "Totals:\n";
+    this->report(*this->mapped, State(), 0.0);
+}
+
+void Stats::submitCopy() {
+    this->device.resetFences(1, &*this->fence);
+
+    auto submitInfo = vk::SubmitInfo(
+        0,                                  // waitSemaphoreCount
+        nullptr,                            // pWaitSemaphores
+        nullptr,                            // pWaitDstStageMask
+        1,                                  // commandBufferCount
+        &*this->cmd,                        // pCommandBuffers
+        0,                                  // signalSemaphoreCount
+        nullptr                             // pSignalSemaphores
+    );
+
+    this->queues.compute.submit(1, &submitInfo, *this->fence);
+    this->pending = true;
+    this->lastReport = Clock::now();
+}
+
+void Stats::report(const State& current, const State& previous, double seconds) {
+    // Counters are 32 bit and wrap around, unsigned subtraction still gives the right delta.
+    auto rays = double(current.rays - previous.rays);
+    auto rayTests = double(current.rayTests - previous.rayTests);
+    auto shadowRays = double(current.shadowRays - previous.shadowRays);
+    auto shadowTests = double(current.shadowTests - previous.shadowTests);
+    auto shadowHits = double(current.shadowHits - previous.shadowHits);
+    auto deferredSamples = double(current.deferredSamples - previous.deferredSamples);
+    auto primaryRays = double(current.primaryRays - previous.primaryRays);
+    auto primaryTests = double(current.primaryTests - previous.primaryTests);
+    auto binOverflows = double(current.binOverflows - previous.binOverflows);
+    auto visibilityMismatches = double(current.visibilityMismatches - previous.visibilityMismatches);
+
+    auto testsPerRay = rays > 0.0 ? rayTests / rays : 0.0;
+    auto testsPerShadowRay = shadowRays > 0.0 ? shadowTests / shadowRays : 0.0;
+
+    std::cout << std::fixed << std::setprecision(2);
+
+    if (seconds > 0.0) {
+        auto tiles = double(current.invocationId - previous.invocationId);
+
+        std::cout << "tiles: " << tiles / seconds << " /s, "
+            << "rays: " << (rays + shadowRays) / seconds * 1e-6 << " M/s, "
+            << "intersection tests: " << (rayTests + shadowTests) / seconds * 1e-6 << " M/s, ";
+    }
+
+    std::cout << "primary: " << (primaryRays > 0.0 ? primaryTests / primaryRays : 0.0) << " tests/ray; "
+        << "closest-hit: " << rays << " rays, " << testsPerRay << " tests/ray; "
+        << "shadow: " << shadowRays << " rays, " << testsPerShadowRay << " tests/ray, "
+        << (shadowRays > 0.0 ? 100.0 * shadowHits / shadowRays : 0.0) << "% occluded";
+
+    // A shadow ray traced with closest-hit traversal costs as much as any other ray.
+    if (testsPerRay > 0.0) {
+        std::cout << ", " << 100.0 * (1.0 - testsPerShadowRay / testsPerRay) << "% tests saved";
+    }
+
+    if (binOverflows > 0.0) {
+        std::cout << "; " << binOverflows << " tile bins overflowed";
+    }
+
+    if (this->checkVisibility) {
+        std::cout << "; " << visibilityMismatches << " primary hits differ from the visibility buffer";
+    }
+
+    if (deferredSamples > 0.0) {
+        std::cout << "; " << deferredSamples << " paths deferred for paging";
+    }
+
+    std::cout << "\n";
+
+    // The variance of the bounce weights shows how well the material sampling matches the BRDF,
+    // the number of samples needed for a given noise level is proportional to it.
+    for (size_t i = 0; i < STAT_MATERIALS; i++) {
+        auto samples = double(current.materialSamples[i] - previous.materialSamples[i]);
+        if (samples == 0.0) { continue; }
+
+        auto sum = double(fixedPoint(current.materialWeight[i]) - fixedPoint(previous.materialWeight[i])) / 1024.0;
+        auto sum2 = double(fixedPoint(current.materialWeight2[i]) - fixedPoint(previous.materialWeight2[i])) / 1024.0;
+        auto mean = sum / samples;
+        auto variance = std::max(0.0, sum2 / samples - mean * mean);
+
+        std::cout << "    material " << i << ": " << samples << " bounces, weight mean " << mean
+            << ", variance " << variance;
+
+        if (mean > 0.0) {
+            std::cout << ", relative variance " << variance / (mean * mean);
+        }
+
+        std::cout << "\n";
+    }
+
+    std::cout << std::defaultfloat;
+}
+
+} // namespace app
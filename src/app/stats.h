@@ -0,0 +1,56 @@
+#pragma once
+
+#include "deps.h"
+#include "device.h"
+#include "options.h"
+#include "state.h"
+
+#include <chrono>
+
+namespace app {
+
+/// Periodically reads back the counters in the state buffer and prints them.
+///
+/// The copy is submitted after a frame and collected once its fence signals,
+/// so reporting never waits for the device.
+class Stats {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    vk::Device device;
+    Queues queues;
+    vk::UniqueDeviceMemory memory;
+    vk::UniqueBuffer buffer;
+    const State* mapped;
+    vk::UniqueCommandBuffer cmd;
+    vk::UniqueFence fence;
+
+    double interval;
+    bool checkVisibility;
+    bool pending;
+    State last;
+    Clock::time_point lastTime;
+    Clock::time_point lastReport;
+
+public:
+    static Stats create(vk::Device device, vk::PhysicalDevice physical, vk::CommandPool pool,
+        const Queues& queues, vk::Buffer stateBuffer, const Options& options);
+
+    bool enabled() const { return bool(this->cmd); }
+
+    /// Called once per frame, after the frame is submitted.
+    void update();
+
+    /// Print the counters for the whole run. The device must be idle.
+    void finish();
+
+private:
+    Stats(vk::Device device, const Queues& queues, vk::UniqueDeviceMemory&& memory, vk::UniqueBuffer&& buffer,
+        const State* mapped, vk::UniqueCommandBuffer&& cmd, vk::UniqueFence&& fence, double interval,
+        bool checkVisibility);
+
+    void submitCopy();
+    void report(const State& current, const State& previous, double seconds);
+};
+
+} // namespace app
@@ -0,0 +1,539 @@
+#include "texture.h"
+#include "encode.h"
+#include "shader.h"
+#include "util.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <tuple>
+
+namespace app {
+
+namespace {
+
+/// Most tiles requested from the loader at once and uploaded after a single frame.
+const size_t MAX_TILE_REQUESTS = 256;
+const size_t MAX_TILE_UPLOADS = 64;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// Half the resolution, averaging 2x2 blocks. An odd last row or column is averaged with itself.
+FloatImage downsample(const FloatImage& image) {
+    auto result = FloatImage {
+        std::max<uint32_t>(image.width / 2, 1), std::max<uint32_t>(image.height / 2, 1), {}
+    };
+    result.texels.resize(size_t(result.width) * result.height * 3);
+
+    for (uint32_t y = 0; y < result.height; y++) {
+        for (uint32_t x = 0; x < result.width; x++) {
+            uint32_t x0 = std::min(2 * x, image.width - 1);
+            uint32_t x1 = std::min(2 * x + 1, image.width - 1);
+            uint32_t y0 = std::min(2 * y, image.height - 1);
+            uint32_t y1 = std::min(2 * y + 1, image.height - 1);
+
+            for (size_t c = 0; c < 3; c++) {
+                auto at = [&](uint32_t sx, uint32_t sy) {
+                    return image.texels[(size_t(sy) * image.width + sx) * 3 + c];
+                };
+                result.texels[(size_t(y) * result.width + x) * 3 + c] =
+                    0.25f * (at(x0, y0) + at(x1, y0) + at(x0, y1) + at(x1, y1));
+            }
+        }
+    }
+
+    return result;
+}
+
+uint32_t packTexel(const float* rgb) {
+    uint32_t packed = 0xff000000;
+    for (size_t c = 0; c < 3; c++) {
+        float value = std::sqrt(std::min(std::max(rgb[c], 0.0f), 1.0f));
+        packed |= uint32_t(value * 255.0f + 0.5f) << (8 * c);
+    }
+    return packed;
+}
+
+size_t tileCount(uint32_t size) {
+    return (size + TEXTURE_TILE_CONTENT - 1) / TEXTURE_TILE_CONTENT;
+}
+
+/// Write the tiles of one level, returns the number of tiles written.
+size_t writeTiles(const FloatImage& image, std::FILE* file) {
+    const size_t tilesX = tileCount(image.width);
+    const size_t tilesY = tileCount(image.height);
+    auto tile = std::vector<uint32_t>(TEXTURE_TILE * TEXTURE_TILE);
+
+    for (size_t ty = 0; ty < tilesY; ty++) {
+        for (size_t tx = 0; tx < tilesX; tx++) {
+            for (size_t y = 0; y < TEXTURE_TILE; y++) {
+                // Wrap around horizontally and clamp vertically, as the textures are mapped onto spheres.
+                auto sy = int64_t(ty * TEXTURE_TILE_CONTENT + y) - 1;
+                sy = std::min<int64_t>(std::max<int64_t>(sy, 0), image.height - 1);
+
+                for (size_t x = 0; x < TEXTURE_TILE; x++) {
+                    auto sx = int64_t(tx * TEXTURE_TILE_CONTENT + x) - 1;
+                    sx = (sx % image.width + image.width) % image.width;
+
+                    tile[y * TEXTURE_TILE + x] = packTexel(&image.texels[(size_t(sy) * image.width + size_t(sx)) * 3]);
+                }
+            }
+
+            if (std::fwrite(tile.data(), TEXTURE_TILE_BYTES, 1, file) != 1) {
+                throw std::runtime_error("failed to write the texture tile file");
+            }
+        }
+    }
+
+    return tilesX * tilesY;
+}
+
+} // namespace
+
+TiledTextures tileTextures(const Options& options, size_t materialCount) {
+    auto tiles = TiledTextures();
+    tiles.materialTextures.assign(std::max<size_t>(materialCount, 1), TiledTextures::NO_TEXTURE);
+
+    if (options.textures.empty()) {
+        return tiles;
+    }
+
+    tiles.file = std::shared_ptr<std::FILE>(std::tmpfile(), [](std::FILE* file) {
+        if (file != nullptr) { std::fclose(file); }
+    });
+
+    if (!tiles.file) {
+        throw std::runtime_error("failed to create the texture tile file");
+    }
+
+    for (const auto& [material, path] : options.textures) {
+        if (material >= materialCount) {
+            throw std::runtime_error("texture " + path + " is assigned to material " + std::to_string(material)
+                + ", but there are only " + std::to_string(materialCount));
+        }
+
+        auto image = readPfm(path);
+        auto info = TextureInfo { image.width, image.height, 0, uint32_t(tiles.tileCount) };
+
+        while (true) {
+            tiles.tileCount += writeTiles(image, tiles.file.get());
+            info.mipCount += 1;
+
+            if (image.width <= TEXTURE_TILE_CONTENT && image.height <= TEXTURE_TILE_CONTENT) { break; }
+            image = downsample(image);
+        }
+
+        tiles.pinnedTiles.push_back(uint32_t(tiles.tileCount - 1));
+        tiles.materialTextures[material] = uint32_t(tiles.textures.size());
+        tiles.textures.push_back(info);
+
+        std::cout << "Texture " << path << ": " << info.width << "x" << info.height << ", " << info.mipCount
+            << " levels, " << tiles.tileCount - info.firstTile << " tiles\n";
+    }
+
+    if (std::fflush(tiles.file.get()) != 0) {
+        throw std::runtime_error("failed to write the texture tile file");
+    }
+
+    std::cout << "Texture tiles: " << tiles.tileCount << ", "
+        << tiles.tileCount * TEXTURE_TILE_BYTES / (1024 * 1024) << " MiB on disk\n";
+
+    return tiles;
+}
+
+TextureStreamer::TextureStreamer(vk::Device device, const Queues& queues, TiledTextures&& tiles):
+    device(device),
+    queues(queues),
+    tiles(std::move(tiles)),
+    readbackMapped(nullptr),
+    readbackPending(false),
+    readbackFrame(0),
+    stagingMapped(nullptr),
+    uploadPending(false),
+    loader(std::make_unique<Loader>()),
+    frame(0),
+    tilesRequested(0),
+    tilesLoaded(0),
+    tilesEvicted(0),
+    latencySeconds(0.0),
+    maxLatencySeconds(0.0),
+    latencyFrames(0),
+    maxLatencyFrames(0)
+{
+}
+
+TextureStreamer::~TextureStreamer() {
+    this->stop();
+}
+
+TextureStreamer TextureStreamer::create(vk::Device device, vk::PhysicalDevice physical, const Queues& queues,
+    TiledTextures&& tiles, const Options& options)
+{
+    auto streamer = TextureStreamer(device, queues, std::move(tiles));
+    auto& textures = streamer.tiles;
+
+    const size_t tileCount = std::max<size_t>(textures.tileCount, 1);
+    const size_t pinnedCount = textures.pinnedTiles.size();
+    const size_t slotCount = streamer.enabled()
+        ? std::min(options.textureBudget * 1024 * 1024 / TEXTURE_TILE_BYTES, tileCount)
+        : 1;
+
+    if (slotCount <= pinnedCount && slotCount < tileCount) {
+        throw std::runtime_error("--texture-budget must leave room for more than the " + std::to_string(pinnedCount)
+            + " tiles kept resident");
+    }
+
+    std::tie(streamer.texturesMemory, streamer.texturesBuffer) = createBuffer(device, physical,
+        std::max<size_t>(textures.textures.size(), 1) * sizeof(TextureInfo));
+    std::tie(streamer.materialTexturesMemory, streamer.materialTexturesBuffer) = createBuffer(device, physical,
+        textures.materialTextures.size() * sizeof(uint32_t));
+    std::tie(streamer.tileTableMemory, streamer.tileTable) = createBuffer(device, physical,
+        tileCount * sizeof(uint32_t));
+    std::tie(streamer.feedbackMemory, streamer.feedback) = createBuffer(device, physical,
+        tileCount * sizeof(uint32_t));
+    std::tie(streamer.atlasMemory, streamer.atlas) = createBuffer(device, physical, slotCount * TEXTURE_TILE_BYTES);
+
+    if (!streamer.enabled()) {
+        return streamer;
+    }
+
+    streamer.cmdPool = device.createCommandPoolUnique(vk::CommandPoolCreateInfo(
+        vk::CommandPoolCreateFlagBits::eResetCommandBuffer, queues.computeQueueFamily), nullptr);
+
+    // The last level of each texture goes into the first slots for good, everything else starts out missing.
+    streamer.tileSlots.assign(tileCount, NONE);
+    streamer.slotTiles.assign(slotCount, NONE);
+    streamer.slotUsed.assign(slotCount, 0);
+
+    auto pinned = std::vector<uint32_t>(pinnedCount * TEXTURE_TILE * TEXTURE_TILE);
+    for (size_t i = 0; i < pinnedCount; i++) {
+        uint32_t tile = textures.pinnedTiles[i];
+        const auto offset = off_t(tile * TEXTURE_TILE_BYTES);
+
+        if (pread(fileno(textures.file.get()), &pinned[i * TEXTURE_TILE * TEXTURE_TILE], TEXTURE_TILE_BYTES, offset)
+            != ssize_t(TEXTURE_TILE_BYTES))
+        {
+            throw std::runtime_error("failed to read the texture tile file");
+        }
+
+        streamer.tileSlots[tile] = uint32_t(i);
+        streamer.slotTiles[i] = tile;
+        streamer.slotUsed[i] = std::numeric_limits<uint64_t>::max();
+    }
+
+    uploadBuffer(device, physical, *streamer.cmdPool, queues, *streamer.texturesBuffer, textures.textures.data(),
+        textures.textures.size() * sizeof(TextureInfo));
+    uploadBuffer(device, physical, *streamer.cmdPool, queues, *streamer.materialTexturesBuffer,
+        textures.materialTextures.data(), textures.materialTextures.size() * sizeof(uint32_t));
+    uploadBuffer(device, physical, *streamer.cmdPool, queues, *streamer.tileTable, streamer.tileSlots.data(),
+        tileCount * sizeof(uint32_t));
+    uploadBuffer(device, physical, *streamer.cmdPool, queues, *streamer.atlas, pinned.data(),
+        pinnedCount * TEXTURE_TILE_BYTES);
+    zeroBuffer(device, physical, *streamer.cmdPool, queues, *streamer.feedback, tileCount * sizeof(uint32_t));
+
+    std::tie(streamer.readbackMemory, streamer.readback) = createHostBuffer(device, physical,
+        tileCount * sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferDst);
+    streamer.readbackMapped = static_cast<const uint32_t*>(device.mapMemory(*streamer.readbackMemory, 0,
+        tileCount * sizeof(uint32_t), vk::MemoryMapFlags()));
+    streamer.readbackCmd = recordFeedbackReadback(device, *streamer.cmdPool, *streamer.feedback,
+        *streamer.readback, tileCount * sizeof(uint32_t));
+    streamer.readbackFence = device.createFenceUnique(vk::FenceCreateInfo(), nullptr);
+
+    std::tie(streamer.stagingMemory, streamer.staging) = createHostBuffer(device, physical,
+        MAX_TILE_UPLOADS * TEXTURE_TILE_BYTES, vk::BufferUsageFlagBits::eTransferSrc);
+    streamer.stagingMapped = static_cast<uint32_t*>(device.mapMemory(*streamer.stagingMemory, 0,
+        MAX_TILE_UPLOADS * TEXTURE_TILE_BYTES, vk::MemoryMapFlags()));
+
+    auto allocInfo = vk::CommandBufferAllocateInfo(
+        *streamer.cmdPool,                      // commandPool,
+        vk::CommandBufferLevel::ePrimary,       // level
+        1                                       // commandBufferCount
+    );
+
+    auto cmds = device.allocateCommandBuffersUnique(allocInfo);
+    streamer.uploadCmd = std::move(cmds[0]);
+    streamer.uploadFence = device.createFenceUnique(vk::FenceCreateInfo(), nullptr);
+
+    streamer.loader->file = textures.file;
+    streamer.thread = std::thread(loadLoop, std::ref(*streamer.loader));
+
+    std::cout << "Texture atlas: " << slotCount << " of " << textures.tileCount << " tiles, "
+        << slotCount * TEXTURE_TILE_BYTES / (1024 * 1024) << " MiB\n";
+
+    return streamer;
+}
+
+std::vector<vk::Buffer> TextureStreamer::bindings() const {
+    return std::vector<vk::Buffer> {
+        *this->texturesBuffer, *this->materialTexturesBuffer, *this->tileTable, *this->feedback, *this->atlas
+    };
+}
+
+void TextureStreamer::update() {
+    if (!this->enabled()) { return; }
+
+    this->frame += 1;
+
+    if (this->uploadPending && this->device.getFenceStatus(*this->uploadFence) == vk::Result::eSuccess) {
+        this->completeUpload();
+    }
+
+    {
+        auto lock = std::unique_lock<std::mutex>(this->loader->mutex);
+
+        if (!this->loader->error.empty()) {
+            throw std::runtime_error("failed to load texture tiles: " + this->loader->error);
+        }
+
+        std::move(this->loader->loaded.begin(), this->loader->loaded.end(), std::back_inserter(this->loaded));
+        this->loader->loaded.clear();
+    }
+
+    if (!this->uploadPending && !this->loaded.empty()) {
+        this->upload();
+    }
+
+    if (this->readbackPending && this->device.getFenceStatus(*this->readbackFence) == vk::Result::eSuccess) {
+        this->readbackPending = false;
+        this->request();
+    }
+
+    if (!this->readbackPending) {
+        this->device.resetFences(1, &*this->readbackFence);
+        this->submit(*this->readbackCmd, *this->readbackFence);
+        this->readbackPending = true;
+        this->readbackFrame = this->frame;
+    }
+}
+
+void TextureStreamer::finish() {
+    if (!this->enabled()) { return; }
+
+    this->stop();
+
+    if (this->uploadPending) {
+        this->completeUpload();
+    }
+
+    const size_t resident = size_t(std::count_if(this->slotTiles.begin(), this->slotTiles.end(),
+        [](uint32_t tile) { return tile != NONE; }));
+    const double mib = 1024.0 * 1024.0;
+
+    std::cout << std::fixed << std::setprecision(2)
+        << "Textures: " << resident << " of " << this->tiles.tileCount << " tiles resident, "
+        << double(resident * TEXTURE_TILE_BYTES) / mib << " of " << double(this->slotTiles.size() * TEXTURE_TILE_BYTES) / mib
+        << " MiB of atlas\n"
+        << "    tiles requested: " << this->tilesRequested << ", loaded: " << this->tilesLoaded << ", evicted: "
+        << this->tilesEvicted << "\n"
+        << "    read " << double(this->loader->bytesRead) / mib << " MiB in " << this->loader->readSeconds << " s\n";
+
+    if (this->tilesLoaded > 0) {
+        std::cout << "    feedback to resident latency: " << 1000.0 * this->latencySeconds / double(this->tilesLoaded)
+            << " ms (" << double(this->latencyFrames) / double(this->tilesLoaded) << " frames) on average, "
+            << 1000.0 * this->maxLatencySeconds << " ms (" << this->maxLatencyFrames << " frames) at most\n";
+    }
+}
+
+/// Hand the tiles missing in the frame whose feedback was just read back to the loader.
+void TextureStreamer::request() {
+    auto now = Clock::now();
+    auto missing = std::vector<uint32_t>();
+
+    for (uint32_t tile = 0; tile < this->tiles.tileCount; tile++) {
+        if (this->readbackMapped[tile] == 0) { continue; }
+
+        uint32_t slot = this->tileSlots[tile];
+        if (slot != NONE) {
+            this->slotUsed[slot] = std::max(this->slotUsed[slot], this->readbackFrame);
+        } else if (this->requests.size() < MAX_TILE_REQUESTS && this->requests.count(tile) == 0) {
+            // The time of the readback is the earliest the host could know about the request.
+            this->requests.emplace(tile, Request { now, this->readbackFrame });
+            missing.push_back(tile);
+        }
+    }
+
+    if (missing.empty()) { return; }
+
+    this->tilesRequested += missing.size();
+
+    {
+        auto lock = std::unique_lock<std::mutex>(this->loader->mutex);
+        this->loader->requested.insert(this->loader->requested.end(), missing.begin(), missing.end());
+    }
+
+    this->loader->tileRequested.notify_one();
+}
+
+/// Copy the loaded tiles into the atlas, replacing the least recently used ones.
+void TextureStreamer::upload() {
+    auto order = std::vector<uint32_t>(this->slotTiles.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return this->slotUsed[a] < this->slotUsed[b];
+    });
+
+    // The pinned tiles sort last and are never replaced.
+    const size_t uploads = std::min({ this->loaded.size(), MAX_TILE_UPLOADS,
+        this->slotTiles.size() - this->tiles.pinnedTiles.size() });
+    auto cmd = *this->uploadCmd;
+
+    cmd.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit, nullptr));
+
+    // Wait for the frames still reading the slots and the tile table.
+    const auto computeToTransfer = vk::MemoryBarrier(
+        vk::AccessFlagBits::eShaderRead,        // srcAccessMask
+        vk::AccessFlagBits::eTransferWrite      // dstAccessMask
+    );
+
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,  // srcStageMask
+        vk::PipelineStageFlagBits::eTransfer,       // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &computeToTransfer,                         // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        0,                                          // imageMemoryBarrierCount
+        nullptr                                     // pImageMemoryBarriers
+    );
+
+    for (size_t i = 0; i < uploads; i++) {
+        const auto& entry = this->loaded[i];
+        uint32_t slot = order[i];
+        uint32_t evicted = this->slotTiles[slot];
+
+        if (evicted != NONE) {
+            this->tileSlots[evicted] = NONE;
+            this->tilesEvicted += 1;
+            cmd.updateBuffer(*this->tileTable, evicted * sizeof(uint32_t), sizeof(uint32_t), &NONE);
+        }
+
+        std::memcpy(this->stagingMapped + i * TEXTURE_TILE * TEXTURE_TILE, entry.texels.data(), TEXTURE_TILE_BYTES);
+
+        const auto region = vk::BufferCopy(i * TEXTURE_TILE_BYTES, slot * TEXTURE_TILE_BYTES, TEXTURE_TILE_BYTES);
+        cmd.copyBuffer(*this->staging, *this->atlas, 1, &region);
+        cmd.updateBuffer(*this->tileTable, entry.tile * sizeof(uint32_t), sizeof(uint32_t), &slot);
+
+        this->tileSlots[entry.tile] = slot;
+        this->slotTiles[slot] = entry.tile;
+        this->slotUsed[slot] = this->frame;
+        this->uploading.emplace_back(entry.tile, this->requests.at(entry.tile));
+    }
+
+    const auto transferToCompute = vk::MemoryBarrier(
+        vk::AccessFlagBits::eTransferWrite,     // srcAccessMask
+        vk::AccessFlagBits::eShaderRead         // dstAccessMask
+    );
+
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,       // srcStageMask
+        vk::PipelineStageFlagBits::eComputeShader,  // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &transferToCompute,                         // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        0,                                          // imageMemoryBarrierCount
+        nullptr                                     // pImageMemoryBarriers
+    );
+
+    cmd.end();
+
+    this->loaded.erase(this->loaded.begin(), this->loaded.begin() + ptrdiff_t(uploads));
+
+    this->device.resetFences(1, &*this->uploadFence);
+    this->submit(cmd, *this->uploadFence);
+    this->uploadPending = true;
+}
+
+/// Account for the latency of the tiles in the finished upload.
+void TextureStreamer::completeUpload() {
+    auto now = Clock::now();
+
+    for (const auto& [tile, request] : this->uploading) {
+        auto seconds = std::chrono::duration<double>(now - request.time).count();
+        auto frames = this->frame - request.frame;
+
+        this->latencySeconds += seconds;
+        this->maxLatencySeconds = std::max(this->maxLatencySeconds, seconds);
+        this->latencyFrames += frames;
+        this->maxLatencyFrames = std::max(this->maxLatencyFrames, frames);
+        this->requests.erase(tile);
+    }
+
+    this->tilesLoaded += this->uploading.size();
+    this->uploading.clear();
+    this->uploadPending = false;
+}
+
+void TextureStreamer::submit(vk::CommandBuffer cmd, vk::Fence fence) {
+    auto submitInfo = vk::SubmitInfo(
+        0,                                  // waitSemaphoreCount
+        nullptr,                            // pWaitSemaphores
+        nullptr,                            // pWaitDstStageMask
+        1,                                  // commandBufferCount
+        &cmd,                               // pCommandBuffers
+        0,                                  // signalSemaphoreCount
+        nullptr                             // pSignalSemaphores
+    );
+
+    this->queues.compute.submit(1, &submitInfo, fence);
+}
+
+void TextureStreamer::stop() {
+    if (!this->loader || !this->thread.joinable()) { return; }
+
+    {
+        auto lock = std::unique_lock<std::mutex>(this->loader->mutex);
+        this->loader->stopping = true;
+    }
+
+    this->loader->tileRequested.notify_all();
+    this->thread.join();
+}
+
+void TextureStreamer::loadLoop(Loader& loader) {
+    auto lock = std::unique_lock<std::mutex>(loader.mutex);
+
+    while (true) {
+        loader.tileRequested.wait(lock, [&] { return loader.stopping || !loader.requested.empty(); });
+
+        if (loader.stopping) {
+            return;
+        }
+
+        uint32_t tile = loader.requested.front();
+        loader.requested.pop_front();
+        lock.unlock();
+
+        auto start = Clock::now();
+        auto texels = std::vector<uint32_t>(TEXTURE_TILE * TEXTURE_TILE);
+        const auto offset = off_t(size_t(tile) * TEXTURE_TILE_BYTES);
+        bool ok = pread(fileno(loader.file.get()), texels.data(), TEXTURE_TILE_BYTES, offset)
+            == ssize_t(TEXTURE_TILE_BYTES);
+        double seconds = secondsSince(start);
+
+        lock.lock();
+
+        if (!ok) {
+            loader.error = "failed to read tile " + std::to_string(tile);
+            return;
+        }
+
+        loader.loaded.push_back(LoadedTile { tile, std::move(texels) });
+        loader.bytesRead += TEXTURE_TILE_BYTES;
+        loader.readSeconds += seconds;
+    }
+}
+
+} // namespace app
@@ -0,0 +1,195 @@
+#pragma once
+
+#include "deps.h"
+#include "device.h"
+#include "options.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace app {
+
+/// Size of a tile of a virtual texture, must match `TEXTURE_TILE` in `shader/main.comp`.
+///
+/// Each tile holds `TEXTURE_TILE_CONTENT` texels of the texture with a border of one texel
+/// copied from its neighbours, so bilinear filtering never has to look into another tile.
+const size_t TEXTURE_TILE = 128;
+const size_t TEXTURE_TILE_CONTENT = TEXTURE_TILE - 2;
+const size_t TEXTURE_TILE_BYTES = TEXTURE_TILE * TEXTURE_TILE * sizeof(uint32_t);
+
+/// A texture split into tiles, laid out as `TextureInfo` in `shader/main.comp`.
+///
+/// The mip chain stops at the first level which fits in a single tile. The tiles of all levels are
+/// numbered consecutively from `firstTile`, level by level in row major order.
+struct TextureInfo {
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipCount;
+    uint32_t firstTile;
+};
+
+/// Textures cut into tiles, stored in a file the tiles are streamed from.
+struct TiledTextures {
+    std::vector<TextureInfo> textures;
+
+    /// Index into `textures` for each material, or `NO_TEXTURE`.
+    std::vector<uint32_t> materialTextures;
+
+    /// Total number of tiles, each of them `TEXTURE_TILE_BYTES` long in the file.
+    size_t tileCount = 0;
+
+    /// The single tile of the last level of each texture. These are kept resident, so there
+    /// is always something to fall back to.
+    std::vector<uint32_t> pinnedTiles;
+
+    std::shared_ptr<std::FILE> file;
+
+    static constexpr uint32_t NO_TEXTURE = ~uint32_t(0);
+};
+
+/// Load the textures given as `material:path` in the options from PFM files, build their mip chains
+/// and write their tiles to an anonymous temporary file.
+///
+/// Texels are converted to 8 bits per channel with a gamma of 2. The textures are mapped onto
+/// the primitives by the longitude and latitude on the unit sphere, so they wrap around horizontally.
+TiledTextures tileTextures(const Options& options, size_t materialCount);
+
+/// Streams the tiles of the textures the shader samples into an atlas of fixed size on the device.
+///
+/// The shader picks a mip level from the footprint of a ray cone, marks the tile it wants in a
+/// feedback buffer and samples the finest resident level at or above it. After every frame the
+/// feedback is copied to the host. Once the copy is done the missing tiles are handed to a loader
+/// thread which reads them from the tile file, and the tiles it has read are copied into free slots
+/// of the atlas or the slots of the least recently used tiles with the next upload. Neither the
+/// render loop nor the loader waits for the device.
+class TextureStreamer {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Request {
+        Clock::time_point time;
+        uint64_t frame;
+    };
+
+    struct LoadedTile {
+        uint32_t tile;
+        std::vector<uint32_t> texels;
+    };
+
+    /// State shared with the loader thread, kept behind a pointer so the streamer can be moved.
+    struct Loader {
+        std::shared_ptr<std::FILE> file;
+
+        std::mutex mutex;
+        std::condition_variable tileRequested;
+        std::deque<uint32_t> requested;
+        std::vector<LoadedTile> loaded;
+        bool stopping = false;
+
+        size_t bytesRead = 0;
+        double readSeconds = 0.0;
+        std::string error;
+    };
+
+    vk::Device device;
+    Queues queues;
+    TiledTextures tiles;
+
+    vk::UniqueDeviceMemory texturesMemory;
+    vk::UniqueBuffer texturesBuffer;
+    vk::UniqueDeviceMemory materialTexturesMemory;
+    vk::UniqueBuffer materialTexturesBuffer;
+    vk::UniqueDeviceMemory tileTableMemory;
+    vk::UniqueBuffer tileTable;
+    vk::UniqueDeviceMemory feedbackMemory;
+    vk::UniqueBuffer feedback;
+    vk::UniqueDeviceMemory atlasMemory;
+    vk::UniqueBuffer atlas;
+
+    vk::UniqueCommandPool cmdPool;
+
+    vk::UniqueDeviceMemory readbackMemory;
+    vk::UniqueBuffer readback;
+    const uint32_t* readbackMapped;
+    vk::UniqueCommandBuffer readbackCmd;
+    vk::UniqueFence readbackFence;
+    bool readbackPending;
+    uint64_t readbackFrame;
+
+    vk::UniqueDeviceMemory stagingMemory;
+    vk::UniqueBuffer staging;
+    uint32_t* stagingMapped;
+    vk::UniqueCommandBuffer uploadCmd;
+    vk::UniqueFence uploadFence;
+    bool uploadPending;
+
+    /// Tiles in the upload in flight, with the time they were requested.
+    std::vector<std::pair<uint32_t, Request>> uploading;
+
+    /// Tiles requested from the loader or waiting for an upload.
+    std::unordered_map<uint32_t, Request> requests;
+    std::vector<LoadedTile> loaded;
+
+    /// Tile in each slot of the atlas, or `NONE`, and the last frame it was used in.
+    std::vector<uint32_t> slotTiles;
+    std::vector<uint64_t> slotUsed;
+
+    /// Host copy of the tile table, the slot of each tile or `NONE`.
+    std::vector<uint32_t> tileSlots;
+
+    std::unique_ptr<Loader> loader;
+    std::thread thread;
+
+    uint64_t frame;
+    size_t tilesRequested;
+    size_t tilesLoaded;
+    size_t tilesEvicted;
+    double latencySeconds;
+    double maxLatencySeconds;
+    uint64_t latencyFrames;
+    uint64_t maxLatencyFrames;
+
+    TextureStreamer(vk::Device device, const Queues& queues, TiledTextures&& tiles);
+
+public:
+    static constexpr uint32_t NONE = ~uint32_t(0);
+
+    /// Without textures, the buffers bound to the shader hold a single unused element.
+    static TextureStreamer create(vk::Device device, vk::PhysicalDevice physical, const Queues& queues,
+        TiledTextures&& tiles, const Options& options);
+
+    TextureStreamer(TextureStreamer&&) = default;
+    TextureStreamer& operator=(TextureStreamer&&) = default;
+    ~TextureStreamer();
+
+    bool enabled() const { return !this->tiles.textures.empty(); }
+
+    /// Textures, material textures, tile table, feedback and atlas, bound right after the pager's buffers.
+    std::vector<vk::Buffer> bindings() const;
+
+    /// Request the tiles missed by earlier frames and upload the ones which have been read.
+    /// Called once per frame, after the frame is submitted.
+    void update();
+
+    /// Stop the loader and print the streaming statistics. The device must be idle.
+    void finish();
+
+private:
+    void request();
+    void upload();
+    void completeUpload();
+    void submit(vk::CommandBuffer cmd, vk::Fence fence);
+    void stop();
+
+    static void loadLoop(Loader& loader);
+};
+
+} // namespace app
@@ -0,0 +1,848 @@
+#include "tracer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace app {
+
+namespace {
+
+const float PI = 3.14159265358979323846f;
+const float EPS = 0.000061035f;
+const float INF = std::numeric_limits<float>::infinity();
+
+const uint32_t MAX_DEPTH = 8;
+const uint32_t NO_PRIMITIVE = ~uint32_t(0);
+
+struct Vec3 {
+    float x, y, z;
+};
+
+Vec3 operator+(Vec3 a, Vec3 b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+Vec3 operator-(Vec3 a, Vec3 b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+Vec3 operator-(Vec3 a) { return { -a.x, -a.y, -a.z }; }
+Vec3 operator*(Vec3 a, Vec3 b) { return { a.x * b.x, a.y * b.y, a.z * b.z }; }
+Vec3 operator*(Vec3 a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+Vec3 operator*(float s, Vec3 a) { return a * s; }
+Vec3 operator/(Vec3 a, float s) { return { a.x / s, a.y / s, a.z / s }; }
+Vec3& operator+=(Vec3& a, Vec3 b) { return a = a + b; }
+Vec3& operator*=(Vec3& a, Vec3 b) { return a = a * b; }
+
+float dot(Vec3 a, Vec3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+float length(Vec3 a) { return std::sqrt(dot(a, a)); }
+Vec3 normalize(Vec3 a) { return a / length(a); }
+Vec3 reflect(Vec3 dir, Vec3 normal) { return dir - 2.0f * dot(normal, dir) * normal; }
+
+Vec3 cross(Vec3 a, Vec3 b) {
+    return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+Vec3 load(const float* v) { return { v[0], v[1], v[2] }; }
+
+float luminance(Vec3 color) {
+    return dot(color, { 0.2126f, 0.7152f, 0.0722f });
+}
+
+/// A PCG32 generator, seeded per pixel and sample.
+class Rng {
+private:
+    uint64_t state;
+
+public:
+    /// Consecutive seeds are scrambled with SplitMix64, so neighbouring pixels get unrelated streams.
+    explicit Rng(uint64_t seed) {
+        uint64_t z = seed + 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        this->state = z ^ (z >> 31);
+    }
+
+    /// A uniform number in [0, 1).
+    float next() {
+        uint64_t old = this->state;
+        this->state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+
+        uint32_t shifted = uint32_t(((old >> 18) ^ old) >> 27);
+        uint32_t rot = uint32_t(old >> 59);
+        uint32_t bits = (shifted >> rot) | (shifted << ((32 - rot) & 31));
+
+        return float(bits >> 8) * (1.0f / 16777216.0f);
+    }
+};
+
+struct Ray {
+    Vec3 start;
+    Vec3 dir;
+};
+
+struct Hit {
+    uint32_t primitive;
+    Vec3 point;
+    float dist;
+};
+
+struct LightSample {
+    Vec3 point;
+    Vec3 radiance;
+    float pdf;
+    bool delta;
+};
+
+float powerHeuristic(float pdf, float otherPdf) {
+    float pdf2 = pdf * pdf;
+    return pdf2 / (pdf2 + otherPdf * otherPdf);
+}
+
+void orthonormalSystem(Vec3 dir, Vec3& e2, Vec3& e3) {
+    const Vec3 fixed0 = { -0.267261242f, +0.534522484f, -0.801783726f };
+    const Vec3 fixed1 = { +0.483368245f, +0.096673649f, +0.870062840f };
+
+    e2 = normalize(cross(dir, std::abs(dot(dir, fixed0)) < 0.99f ? fixed0 : fixed1));
+    e3 = normalize(cross(dir, e2));
+}
+
+Vec3 specularReflection(Vec3 color, Vec3 wIn, Vec3 normal) {
+    float cosTerm = 1.0f - dot(wIn, normal);
+    float cosTerm2 = cosTerm * cosTerm;
+    float cosTerm5 = cosTerm2 * cosTerm2 * cosTerm;
+
+    return color + (Vec3 { 1.0f, 1.0f, 1.0f } - color) * cosTerm5;
+}
+
+/// cos(a - b), clamped to 1 when a < b.
+float cosSubClamped(float sinA, float cosA, float sinB, float cosB) {
+    return cosA > cosB ? 1.0f : cosA * cosB + sinA * sinB;
+}
+
+/// sin(a - b), clamped to 0 when a < b.
+float sinSubClamped(float sinA, float cosA, float sinB, float cosB) {
+    return cosA > cosB ? 0.0f : sinA * cosB - cosA * sinB;
+}
+
+/// The functions of `shader/main.comp` used by `trace_pixel`, with the shader's globals as members.
+class Tracer {
+private:
+    const CpuScene& scene;
+    CpuCounters& counters;
+    Rng rng;
+
+public:
+    Tracer(const CpuScene& scene, CpuCounters& counters, uint64_t seed):
+        scene(scene),
+        counters(counters),
+        rng(seed)
+    {
+    }
+
+    Vec3 tracePixel(uint32_t x, uint32_t y) {
+        const Vec3 background = { 0.05f, 0.05f, 0.05f };
+
+        Ray ray = this->screenRay(x, y);
+        Vec3 color = { 0.0f, 0.0f, 0.0f };
+        Vec3 lightMult = { 1.0f, 1.0f, 1.0f };
+
+        Vec3 prevPoint = { 0.0f, 0.0f, 0.0f };
+        Vec3 prevNormal = { 0.0f, 0.0f, 0.0f };
+        float bsdfPdf = 0.0f;
+
+        for (uint32_t i = 0; i < MAX_DEPTH; i++) {
+            Hit hit = this->traceRay(ray);
+
+            uint32_t lightIndex;
+            float lightDist;
+
+            if (this->traceEmitter(ray, hit.dist, lightIndex, lightDist)) {
+                const Light& light = this->scene.lights[lightIndex];
+                float weight = 1.0f;
+
+                if (bsdfPdf > 0.0f) {
+                    Vec3 lightPoint = ray.start + lightDist * ray.dir;
+                    float pdf = this->lightTreePmf(light, prevPoint, prevNormal)
+                        * lightPdf(light, prevPoint, lightPoint);
+                    weight = powerHeuristic(bsdfPdf, pdf);
+                }
+
+                color += lightEmission(light, ray.dir) * lightMult * weight;
+                break;
+            }
+
+            if (hit.primitive == NO_PRIMITIVE) {
+                color += background * lightMult;
+                break;
+            }
+
+            const Material& material = this->scene.primitives.materials[
+                this->scene.primitiveMaterials[hit.primitive]];
+            Vec3 normal = this->primitiveNormal(hit.primitive, hit.point);
+
+            color += this->traceShadowRay(ray, hit, normal, material) * lightMult;
+
+            Vec3 wOut;
+            Vec3 colorMult;
+            this->spawnRay(material, -ray.dir, normal, wOut, colorMult, bsdfPdf);
+
+            ray = Ray { hit.point + EPS * wOut, wOut };
+            lightMult *= colorMult;
+            prevPoint = hit.point;
+            prevNormal = normal;
+        }
+
+        return color;
+    }
+
+private:
+    Ray screenRay(uint32_t x, uint32_t y) const {
+        const Camera& camera = this->scene.camera;
+        float u = -1.0f + float(x) / float(this->scene.width) * 2.0f;
+        float v = -1.0f + float(y) / float(this->scene.height) * 2.0f;
+
+        Vec3 dir = normalize(load(camera.forward) + u * load(camera.right) + v * load(camera.down));
+        return Ray { load(camera.position), dir };
+    }
+
+    Hit traceRay(Ray ray) {
+        this->counters.rays += 1;
+
+        Hit hit = { NO_PRIMITIVE, { 0.0f, 0.0f, 0.0f }, INF };
+        this->traceBvh(ray, false, hit.dist, hit.primitive);
+        hit.point = ray.start + hit.dist * ray.dir;
+
+        return hit;
+    }
+
+    bool traceOcclusion(Ray ray, float maxDist) {
+        this->counters.shadowRays += 1;
+
+        float dist = maxDist;
+        uint32_t primitive;
+
+        if (this->traceBvh(ray, true, dist, primitive)) {
+            this->counters.shadowHits += 1;
+            return true;
+        }
+
+        return false;
+    }
+
+    /// Same as `trace_bvh`, without paging.
+    bool traceBvh(Ray ray, bool anyHit, float& dist, uint32_t& primitive) {
+        const size_t stackSize = 64;
+        uint32_t stack[stackSize];
+        size_t stackLen = 1;
+        stack[0] = 0;
+
+        const auto& nodes = this->scene.bvh.nodes;
+        const Vec3 invDir = { 1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z };
+        bool found = false;
+
+        while (stackLen > 0) {
+            stackLen -= 1;
+            const BvhNode& node = nodes[stack[stackLen]];
+
+            for (size_t i = 0; i < 4; i++) {
+                uint32_t child = node.children[i];
+                if (child == BvhNode::EMPTY) { continue; }
+
+                float t0X = (node.minX[i] - ray.start.x) * invDir.x;
+                float t1X = (node.maxX[i] - ray.start.x) * invDir.x;
+                float t0Y = (node.minY[i] - ray.start.y) * invDir.y;
+                float t1Y = (node.maxY[i] - ray.start.y) * invDir.y;
+                float t0Z = (node.minZ[i] - ray.start.z) * invDir.z;
+                float t1Z = (node.maxZ[i] - ray.start.z) * invDir.z;
+
+                float tEnter = std::max(std::max(std::min(t0X, t1X), std::min(t0Y, t1Y)),
+                    std::max(std::min(t0Z, t1Z), 0.0f));
+                float tExit = std::min(std::min(std::max(t0X, t1X), std::max(t0Y, t1Y)),
+                    std::min(std::max(t0Z, t1Z), dist));
+
+                if (tEnter > tExit) { continue; }
+
+                if ((child & BvhNode::LEAF) == 0) {
+                    if (stackLen < stackSize) {
+                        stack[stackLen] = child;
+                        stackLen += 1;
+                    }
+                    continue;
+                }
+
+                uint32_t first = child & 0xffffff;
+                uint32_t count = (child >> 24) & 0x7f;
+
+                for (uint32_t j = first; j < first + count; j++) {
+                    uint32_t candidate = this->scene.bvh.primitives[j];
+                    float candidateDist;
+
+                    if (anyHit) {
+                        this->counters.shadowTests += 1;
+                    } else {
+                        this->counters.rayTests += 1;
+                    }
+
+                    if (this->primitiveIntersect(candidate, ray, candidateDist) && candidateDist < dist) {
+                        dist = candidateDist;
+                        primitive = candidate;
+                        found = true;
+
+                        if (anyHit) { return true; }
+                    }
+                }
+            }
+        }
+
+        return found;
+    }
+
+    /// Same as `trace_emitter`, the light tree doubles as a BVH over the lights.
+    bool traceEmitter(Ray ray, float maxDist, uint32_t& light, float& dist) {
+        const size_t stackSize = 64;
+        uint32_t stack[stackSize];
+        size_t stackLen = 1;
+        stack[0] = 0;
+
+        const Vec3 invDir = { 1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z };
+        dist = maxDist;
+        bool found = false;
+
+        while (stackLen > 0) {
+            stackLen -= 1;
+            const LightNode& node = this->scene.lightTree[stack[stackLen]];
+
+            Vec3 t0 = (load(node.boundsMin) - Vec3 { EPS, EPS, EPS } - ray.start) * invDir;
+            Vec3 t1 = (load(node.boundsMax) + Vec3 { EPS, EPS, EPS } - ray.start) * invDir;
+
+            float tEnter = std::max(std::max(std::min(t0.x, t1.x), std::min(t0.y, t1.y)),
+                std::max(std::min(t0.z, t1.z), 0.0f));
+            float tExit = std::min(std::min(std::max(t0.x, t1.x), std::max(t0.y, t1.y)), std::max(t0.z, t1.z));
+
+            if (tEnter > tExit || tEnter > dist) { continue; }
+
+            if (node.children[0] == LightNode::LEAF) {
+                float lightDist;
+                this->counters.rayTests += 1;
+
+                if (lightIntersect(this->scene.lights[node.children[2]], ray, lightDist) && lightDist < dist) {
+                    light = node.children[2];
+                    dist = lightDist;
+                    found = true;
+                }
+            } else if (stackLen + 2 <= stackSize) {
+                stack[stackLen] = node.children[0];
+                stack[stackLen + 1] = node.children[1];
+                stackLen += 2;
+            }
+        }
+
+        return found;
+    }
+
+    bool primitiveIntersect(uint32_t primitive, Ray ray, float& dist) const {
+        const auto& spheres = this->scene.primitives.spheres;
+
+        if (primitive < spheres.size()) {
+            const Sphere& sphere = spheres[primitive];
+            Vec3 toStart = ray.start - load(sphere.center);
+            float b = dot(toStart, ray.dir);
+            float c = dot(toStart, toStart) - sphere.radius * sphere.radius;
+            float disc = b * b - c;
+
+            if (disc < 0.0f) { return false; }
+
+            float sqrtDisc = std::sqrt(disc);
+            dist = -b - sqrtDisc >= 0.0f ? -b - sqrtDisc : -b + sqrtDisc;
+            return dist >= 0.0f;
+        }
+
+        const auto& rows = this->scene.primitives.ellipsoids[primitive - spheres.size()].worldToLocal;
+        Vec3 start = Vec3 { dot(load(rows[0]), ray.start), dot(load(rows[1]), ray.start),
+            dot(load(rows[2]), ray.start) } + Vec3 { rows[0][3], rows[1][3], rows[2][3] };
+        Vec3 dir = { dot(load(rows[0]), ray.dir), dot(load(rows[1]), ray.dir), dot(load(rows[2]), ray.dir) };
+
+        float a = dot(dir, dir);
+        float b = dot(start, dir);
+        float c = dot(start, start) - 1.0f;
+        float disc = b * b - a * c;
+
+        if (disc < 0.0f) { return false; }
+
+        float sqrtDisc = std::sqrt(disc);
+        dist = (-b - sqrtDisc >= 0.0f ? -b - sqrtDisc : -b + sqrtDisc) / a;
+        return dist >= 0.0f;
+    }
+
+    Vec3 primitiveNormal(uint32_t primitive, Vec3 point) const {
+        const auto& spheres = this->scene.primitives.spheres;
+
+        if (primitive < spheres.size()) {
+            return normalize(point - load(spheres[primitive].center));
+        }
+
+        // The local normal is transformed by the transpose of the world to local transform.
+        const auto& rows = this->scene.primitives.ellipsoids[primitive - spheres.size()].worldToLocal;
+        Vec3 local = Vec3 { dot(load(rows[0]), point), dot(load(rows[1]), point), dot(load(rows[2]), point) }
+            + Vec3 { rows[0][3], rows[1][3], rows[2][3] };
+        return normalize(local.x * load(rows[0]) + local.y * load(rows[1]) + local.z * load(rows[2]));
+    }
+
+    /// Same as `trace_shadow_ray`, next event estimation with a light picked from the light tree.
+    Vec3 traceShadowRay(Ray ray, const Hit& hit, Vec3 normal, const Material& material) {
+        const Vec3 black = { 0.0f, 0.0f, 0.0f };
+
+        uint32_t lightIndex;
+        float lightPmf;
+
+        if (!this->lightTreeSample(hit.point, normal, lightIndex, lightPmf)) {
+            return black;
+        }
+
+        const Light& light = this->scene.lights[lightIndex];
+        LightSample sampled = this->lightSample(light, hit.point);
+
+        if (sampled.pdf <= 0.0f) {
+            return black;
+        }
+
+        Vec3 toLight = sampled.point - hit.point;
+        float distToLight = length(toLight);
+        Ray lightRay = { hit.point + EPS * normal, toLight / distToLight };
+
+        uint32_t blockingLight;
+        float blockingDist;
+
+        if (this->traceOcclusion(lightRay, distToLight * (1.0f - EPS))
+            || (this->traceEmitter(lightRay, distToLight * (1.0f - EPS), blockingLight, blockingDist)
+                && blockingLight != lightIndex))
+        {
+            return black;
+        }
+
+        Vec3 brdf = materialBrdf(material, -ray.dir, lightRay.dir, normal);
+        float pdf = lightPmf * sampled.pdf;
+        float weight = 1.0f;
+
+        if (!sampled.delta) {
+            weight = powerHeuristic(pdf, materialPdf(material, -ray.dir, lightRay.dir, normal));
+        }
+
+        return sampled.radiance * brdf * (std::max(dot(lightRay.dir, normal), 0.0f) * weight / pdf);
+    }
+
+    float lightTreePmf(const Light& light, Vec3 point, Vec3 normal) const {
+        const auto& tree = this->scene.lightTree;
+        uint32_t node = 0;
+        float pmf = 1.0f;
+
+        for (uint32_t depth = 0; depth < light.treeDepth; depth++) {
+            const uint32_t* children = tree[node].children;
+            float left = nodeImportance(tree[children[0]], point, normal);
+            float right = nodeImportance(tree[children[1]], point, normal);
+
+            if (left + right <= 0.0f) {
+                return 0.0f;
+            }
+
+            uint32_t bits = depth < 32 ? light.treePath[0] >> depth : light.treePath[1] >> (depth - 32);
+
+            if ((bits & 1) == 0) {
+                node = children[0];
+                pmf *= left / (left + right);
+            } else {
+                node = children[1];
+                pmf *= right / (left + right);
+            }
+        }
+
+        return pmf;
+    }
+
+    bool lightTreeSample(Vec3 point, Vec3 normal, uint32_t& light, float& pmf) {
+        const auto& tree = this->scene.lightTree;
+        uint32_t node = 0;
+        pmf = 1.0f;
+
+        while (tree[node].children[0] != LightNode::LEAF) {
+            const uint32_t* children = tree[node].children;
+            float left = nodeImportance(tree[children[0]], point, normal);
+            float right = nodeImportance(tree[children[1]], point, normal);
+
+            if (left + right <= 0.0f) {
+                return false;
+            }
+
+            float probLeft = left / (left + right);
+
+            if (this->rng.next() < probLeft) {
+                node = children[0];
+                pmf *= probLeft;
+            } else {
+                node = children[1];
+                pmf *= 1.0f - probLeft;
+            }
+        }
+
+        light = tree[node].children[2];
+        return true;
+    }
+
+    /// Same as `light_node_importance`.
+    static float nodeImportance(const LightNode& node, Vec3 point, Vec3 normal) {
+        Vec3 boundsMin = load(node.boundsMin);
+        Vec3 boundsMax = load(node.boundsMax);
+        Vec3 center = 0.5f * (boundsMin + boundsMax);
+        float radius = 0.5f * length(boundsMax - boundsMin);
+
+        float dist2 = std::max(dot(point - center, point - center), radius);
+        Vec3 wI = normalize(point - center);
+
+        float cosB = -1.0f;
+        if (dist2 > radius * radius) {
+            cosB = std::sqrt(1.0f - radius * radius / dist2);
+        }
+        float sinB = std::sqrt(std::max(0.0f, 1.0f - cosB * cosB));
+
+        float cosO = node.axis[3];
+        float sinO = std::sqrt(std::max(0.0f, 1.0f - cosO * cosO));
+        float cosW = dot(load(node.axis), wI);
+        float sinW = std::sqrt(std::max(0.0f, 1.0f - cosW * cosW));
+
+        float cosX = cosSubClamped(sinW, cosW, sinO, cosO);
+        float sinX = sinSubClamped(sinW, cosW, sinO, cosO);
+        float cosP = cosSubClamped(sinX, cosX, sinB, cosB);
+
+        if (cosP <= node.boundsMax[3]) {
+            return 0.0f;
+        }
+
+        float cosI = std::abs(dot(wI, normal));
+        float sinI = std::sqrt(std::max(0.0f, 1.0f - cosI * cosI));
+        float cosPi = cosSubClamped(sinI, cosI, sinB, cosB);
+
+        return std::max(node.boundsMin[3] * cosP * cosPi / dist2, 0.0f);
+    }
+
+    LightSample lightSample(const Light& light, Vec3 point) {
+        if (light.type == Light::POINT) {
+            Vec3 toLight = load(light.position) - point;
+            return LightSample { load(light.position), load(light.color) / dot(toLight, toLight), 1.0f, true };
+        }
+
+        if (light.type == Light::RECT) {
+            float u = this->rng.next();
+            float v = this->rng.next();
+            Vec3 lightPoint = load(light.position) + u * load(light.edgeU) + v * load(light.edgeV);
+            return LightSample { lightPoint, lightEmission(light, normalize(lightPoint - point)),
+                lightPdf(light, point, lightPoint), false };
+        }
+
+        Vec3 toCenter = load(light.position) - point;
+        float dist2 = dot(toCenter, toCenter);
+        float radius = light.position[3];
+
+        if (dist2 <= radius * radius) {
+            return LightSample { point, { 0.0f, 0.0f, 0.0f }, 0.0f, false };
+        }
+
+        float cosMax = std::sqrt(1.0f - radius * radius / dist2);
+        float cosTheta = 1.0f - this->rng.next() * (1.0f - cosMax);
+        float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+        float phi = 2.0f * PI * this->rng.next();
+
+        Vec3 axis = normalize(toCenter);
+        Vec3 e2, e3;
+        orthonormalSystem(axis, e2, e3);
+        Vec3 dir = cosTheta * axis + sinTheta * (std::cos(phi) * e2 + std::sin(phi) * e3);
+
+        float along = dot(toCenter, dir);
+        float dist = along - std::sqrt(std::max(0.0f, radius * radius - (dist2 - along * along)));
+
+        return LightSample { point + dist * dir, load(light.color), 1.0f / (2.0f * PI * (1.0f - cosMax)), false };
+    }
+
+    static float lightPdf(const Light& light, Vec3 point, Vec3 lightPoint) {
+        if (light.type == Light::RECT) {
+            Vec3 normal = cross(load(light.edgeU), load(light.edgeV));
+            float area = length(normal);
+            Vec3 toLight = lightPoint - point;
+            float dist2 = dot(toLight, toLight);
+            float cosLight = -dot(normalize(toLight), normal / area);
+
+            return cosLight > 0.0f ? dist2 / (area * cosLight) : 0.0f;
+        }
+
+        if (light.type == Light::SPHERE) {
+            Vec3 toCenter = load(light.position) - point;
+            float dist2 = dot(toCenter, toCenter);
+            float radius = light.position[3];
+
+            if (dist2 <= radius * radius) { return 0.0f; }
+
+            float cosMax = std::sqrt(1.0f - radius * radius / dist2);
+            return 1.0f / (2.0f * PI * (1.0f - cosMax));
+        }
+
+        return 0.0f;
+    }
+
+    static Vec3 lightEmission(const Light& light, Vec3 dir) {
+        if (light.type == Light::RECT && dot(dir, cross(load(light.edgeU), load(light.edgeV))) >= 0.0f) {
+            return { 0.0f, 0.0f, 0.0f };
+        }
+
+        return load(light.color);
+    }
+
+    static bool lightIntersect(const Light& light, Ray ray, float& dist) {
+        if (light.type == Light::RECT) {
+            Vec3 edgeU = load(light.edgeU);
+            Vec3 edgeV = load(light.edgeV);
+            Vec3 normal = cross(edgeU, edgeV);
+            float denom = dot(ray.dir, normal);
+            if (denom == 0.0f) { return false; }
+
+            dist = dot(load(light.position) - ray.start, normal) / denom;
+            if (dist < 0.0f) { return false; }
+
+            Vec3 local = ray.start + dist * ray.dir - load(light.position);
+            float u = dot(local, edgeU) / dot(edgeU, edgeU);
+            float v = dot(local, edgeV) / dot(edgeV, edgeV);
+
+            return u >= 0.0f && u <= 1.0f && v >= 0.0f && v <= 1.0f;
+        }
+
+        if (light.type == Light::SPHERE) {
+            Vec3 toStart = ray.start - load(light.position);
+            float b = dot(toStart, ray.dir);
+            float c = dot(toStart, toStart) - light.position[3] * light.position[3];
+            float disc = b * b - c;
+
+            if (disc < 0.0f) { return false; }
+
+            float sqrtDisc = std::sqrt(disc);
+            dist = -b - sqrtDisc >= 0.0f ? -b - sqrtDisc : -b + sqrtDisc;
+            return dist >= 0.0f;
+        }
+
+        return false;
+    }
+
+    static Vec3 materialBrdf(const Material& material, Vec3 wIn, Vec3 wOut, Vec3 normal) {
+        if (dot(wIn, normal) < 0.0f || dot(wOut, normal) < 0.0f) {
+            return { 0.0f, 0.0f, 0.0f };
+        }
+
+        Vec3 halfv = normalize(wIn + wOut);
+        Vec3 spec = specularReflection(load(material.specColor), wIn, halfv);
+
+        // Same as `material_brdf`, the microfacet BRDF sampled for reflections off the outside of glass.
+        if (material.refrIndex != 0.0f) {
+            float cosI = dot(wIn, normal);
+            float cosO = dot(wOut, normal);
+            float cosH = dot(normal, halfv);
+
+            if (cosI <= 0.0f || cosO <= 0.0f || cosH <= 0.0f) {
+                return { 0.0f, 0.0f, 0.0f };
+            }
+
+            float ndf = materialNdfPdf(material, cosH) / cosH;
+            float shadowing = materialG1(material, wIn, normal) * materialG1(material, wOut, normal);
+
+            return spec * (ndf * shadowing / (4.0f * cosI * cosO));
+        }
+
+        Vec3 diff = (Vec3 { 1.0f, 1.0f, 1.0f } - spec) * load(material.diffColor);
+        float ndf = materialNdf(material, dot(normal, halfv));
+
+        return (1.0f / PI) * diff + ndf * spec;
+    }
+
+    static float materialSpecProb(const Material& material, Vec3 wIn, Vec3 normal) {
+        Vec3 spec = specularReflection(load(material.specColor), wIn, normal);
+        float specWeight = luminance(spec);
+        float diffWeight = luminance((Vec3 { 1.0f, 1.0f, 1.0f } - spec) * load(material.diffColor));
+
+        return specWeight + diffWeight > 0.0f ? specWeight / (specWeight + diffWeight) : 1.0f;
+    }
+
+    static float materialPdf(const Material& material, Vec3 wIn, Vec3 wOut, Vec3 normal) {
+        if (dot(wIn, normal) <= 0.0f || dot(wOut, normal) <= 0.0f) {
+            return 0.0f;
+        }
+
+        Vec3 halfv = normalize(wIn + wOut);
+        float specPdf = materialNdfPdf(material, dot(normal, halfv)) / (4.0f * dot(wIn, halfv));
+
+        if (material.refrIndex != 0.0f) {
+            float fresnel = luminance(specularReflection(load(material.specColor), wIn, halfv));
+            return std::min(std::max(fresnel, 0.0f), 1.0f) * specPdf;
+        }
+
+        float diffPdf = dot(wOut, normal) / PI;
+        float specProb = materialSpecProb(material, wIn, normal);
+
+        return specProb * specPdf + (1.0f - specProb) * diffPdf;
+    }
+
+    /// Same as `material_spawn_ray`.
+    void spawnRay(const Material& material, Vec3 wIn, Vec3 normal, Vec3& wOut, Vec3& colorMult, float& pdf) {
+        if (material.refrIndex != 0.0f) {
+            this->spawnRefracted(material, wIn, normal, wOut, colorMult, pdf);
+            return;
+        }
+
+        if (dot(wIn, normal) < 0.0f) {
+            normal = -normal;
+        }
+
+        if (this->rng.next() < materialSpecProb(material, wIn, normal)) {
+            Vec3 modNormal;
+            float modPdf;
+            this->ndfSample(material, normal, modNormal, modPdf);
+            wOut = reflect(-wIn, modNormal);
+        } else {
+            float angle = this->rng.next() * 2.0f * PI;
+            float r = std::sqrt(this->rng.next());
+            float x = r * std::sin(angle);
+            float y = r * std::cos(angle);
+
+            Vec3 e2, e3;
+            orthonormalSystem(normal, e2, e3);
+            wOut = x * e2 + y * e3 + std::sqrt(std::max(0.0f, 1.0f - x * x - y * y)) * normal;
+        }
+
+        pdf = materialPdf(material, wIn, wOut, normal);
+
+        if (pdf > 0.0f) {
+            colorMult = materialBrdf(material, wIn, wOut, normal) * (dot(wOut, normal) / pdf);
+        } else {
+            colorMult = { 0.0f, 0.0f, 0.0f };
+        }
+    }
+
+    /// Same as `material_spawn_refracted`.
+    void spawnRefracted(const Material& material, Vec3 wIn, Vec3 normal, Vec3& wOut, Vec3& colorMult,
+        float& pdf)
+    {
+        bool entering = dot(wIn, normal) >= 0.0f;
+        float n = entering ? 1.0f / material.refrIndex : material.refrIndex;
+
+        if (!entering) {
+            normal = -normal;
+        }
+
+        Vec3 modNormal;
+        float modPdf;
+        this->ndfSample(material, normal, modNormal, modPdf);
+
+        float cosIn = dot(wIn, modNormal);
+        if (cosIn <= 0.0f) {
+            wOut = normal;
+            colorMult = { 0.0f, 0.0f, 0.0f };
+            pdf = 0.0f;
+            return;
+        }
+
+        float w = n * cosIn;
+        float k2 = 1.0f + (w - n) * (w + n);
+        bool totalReflection = k2 < 0.0f;
+
+        float k = std::sqrt(std::max(k2, 0.0f));
+        Vec3 wTrans = (w - k) * modNormal - n * wIn;
+
+        Vec3 fresnel = { 1.0f, 1.0f, 1.0f };
+        if (!totalReflection) {
+            fresnel = entering
+                ? specularReflection(load(material.specColor), wIn, modNormal)
+                : specularReflection(load(material.specColor), -wTrans, modNormal);
+        }
+
+        float reflProb = totalReflection ? 1.0f : std::min(std::max(luminance(fresnel), 0.0f), 1.0f);
+
+        if (this->rng.next() < reflProb) {
+            wOut = reflect(-wIn, modNormal);
+            colorMult = fresnel / reflProb;
+            pdf = entering ? reflProb * modPdf / (4.0f * cosIn) : 0.0f;
+
+            if (dot(wOut, normal) <= 0.0f) {
+                colorMult = { 0.0f, 0.0f, 0.0f };
+            }
+        } else {
+            wOut = wTrans;
+            colorMult = (Vec3 { 1.0f, 1.0f, 1.0f } - fresnel) / (1.0f - reflProb);
+            pdf = 0.0f;
+        }
+
+        float shadowing = materialG1(material, wIn, normal) * materialG1(material, wOut, normal);
+        colorMult = colorMult * (cosIn * shadowing / (dot(wIn, normal) * dot(modNormal, normal)));
+    }
+
+    static float materialG1(const Material& material, Vec3 w, Vec3 normal) {
+        float cosTheta = std::abs(dot(w, normal));
+        float tanTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta)) / cosTheta;
+
+        if (tanTheta == 0.0f) { return 1.0f; }
+
+        float alpha = std::sqrt(2.0f / (material.roughness + 2.0f));
+        float a = 1.0f / (alpha * tanTheta);
+
+        if (a >= 1.6f) { return 1.0f; }
+
+        return (3.535f * a + 2.181f * a * a) / (1.0f + 2.276f * a + 2.577f * a * a);
+    }
+
+    static float materialNdf(const Material& material, float cosAngle) {
+        float m = material.roughness;
+        return (m + 8.0f) / (8.0f * PI) * std::pow(cosAngle, m);
+    }
+
+    void ndfSample(const Material& material, Vec3 normal, Vec3& sampled, float& prob) {
+        float m = material.roughness;
+
+        float cosTheta = std::pow(this->rng.next(), 1.0f / (m + 2.0f));
+        float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+        float phi = 2.0f * PI * this->rng.next();
+
+        Vec3 e2, e3;
+        orthonormalSystem(normal, e2, e3);
+
+        sampled = cosTheta * normal + sinTheta * (std::cos(phi) * e2 + std::sin(phi) * e3);
+        prob = materialNdfPdf(material, cosTheta);
+    }
+
+    static float materialNdfPdf(const Material& material, float cosAngle) {
+        if (cosAngle <= 0.0f) {
+            return 0.0f;
+        }
+
+        float m = material.roughness;
+        return (m + 2.0f) / (2.0f * PI) * std::pow(cosAngle, m + 1.0f);
+    }
+};
+
+} // namespace
+
+void traceCpuTile(const CpuScene& scene, uint32_t tileX, uint32_t tileY, uint64_t seed, float* colors,
+    CpuCounters& counters)
+{
+    for (uint32_t y = 0; y < CPU_TILE; y++) {
+        for (uint32_t x = 0; x < CPU_TILE; x++) {
+            uint32_t pixelX = tileX * CPU_TILE + x;
+            uint32_t pixelY = tileY * CPU_TILE + y;
+            float* color = colors + 3 * (y * CPU_TILE + x);
+
+            if (pixelX >= scene.width || pixelY >= scene.height) {
+                color[0] = color[1] = color[2] = 0.0f;
+                continue;
+            }
+
+            // Every pixel gets its own stream, the seed only picks the sample.
+            auto tracer = Tracer(scene, counters, seed * scene.width * scene.height + pixelY * scene.width + pixelX);
+            Vec3 sampled = tracer.tracePixel(pixelX, pixelY);
+
+            color[0] = sampled.x;
+            color[1] = sampled.y;
+            color[2] = sampled.z;
+        }
+    }
+}
+
+} // namespace app
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "bvh.h"
+#include "camera.h"
+#include "lights.h"
+#include "primitives.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace app {
+
+/// Size of the square tiles traced by `traceCpuTile`, the same as `WORKGROUP_SIZE` in `shader/main.comp`.
+const uint32_t CPU_TILE = 32;
+
+/// Host copy of the scene uploaded by `createSceneBuffers`, for tracing on the CPU.
+struct CpuScene {
+    Primitives primitives;
+
+    /// Material of each primitive, as `PRIMITIVE_MATERIALS` in `shader/main.comp`.
+    std::vector<uint32_t> primitiveMaterials;
+
+    Bvh bvh;
+    std::vector<Light> lights;
+    std::vector<LightNode> lightTree;
+    Camera camera;
+
+    uint32_t width;
+    uint32_t height;
+};
+
+/// Ray counters of the CPU tracer, the same as the ones in `State`.
+struct CpuCounters {
+    uint64_t rays = 0;
+    uint64_t rayTests = 0;
+    uint64_t shadowRays = 0;
+    uint64_t shadowTests = 0;
+    uint64_t shadowHits = 0;
+};
+
+/// Trace one sample of each pixel in the tile at `tileX, tileY`, with the same integrator as `trace_pixel`
+/// in `shader/main.comp`.
+///
+/// `colors` receives `CPU_TILE * CPU_TILE` RGB triples in row major order, pixels outside of the image
+/// are set to zero. `seed` picks the random numbers, so every sample of a tile needs a different one.
+void traceCpuTile(const CpuScene& scene, uint32_t tileX, uint32_t tileY, uint64_t seed, float* colors,
+    CpuCounters& counters);
+
+} // namespace app
@@ -1,5 +1,8 @@
 #include "util.h"
 
+#include <cstring>
+#include <vector>
+
 namespace app {
 
 void copyBuffer(vk::Device device, vk::CommandPool commandPool, const Queues& queues, vk::Buffer srcBuffer,
@@ -9,30 +12,20 @@ void copyBuffer(vk::Device device, vk::CommandPool commandPool, const Queues& qu
 void zeroBuffer(vk::Device device, vk::PhysicalDevice physical, vk::CommandPool commandPool,
     const Queues& queues, vk::Buffer dstBuffer, size_t bufferSize)
 {
-    const auto info = vk::BufferCreateInfo(
-        vk::BufferCreateFlags(),                    // flags
-        bufferSize,                                 // size
-        vk::BufferUsageFlagBits::eTransferSrc,      // usage
-        vk::SharingMode::eExclusive,                // sharingMode
-        0,                                          // queueFamilyIndexCount
-        nullptr                                     // pQueueFamilyIndices
-    );
-
-    auto srcBuffer = device.createBufferUnique(info);
-
-    const auto allocInfo = vk::MemoryAllocateInfo(
-        bufferSize,
-        findMemoryType(physical, ~0, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent)
-    );
+    auto zeroes = std::vector<char>(bufferSize, 0);
+    uploadBuffer(device, physical, commandPool, queues, dstBuffer, zeroes.data(), bufferSize);
+}
 
-    auto memory = device.allocateMemoryUnique(allocInfo, nullptr);
-    device.bindBufferMemory(*srcBuffer, *memory, 0);
+void uploadBuffer(vk::Device device, vk::PhysicalDevice physical, vk::CommandPool commandPool,
+    const Queues& queues, vk::Buffer dstBuffer, const void* data, size_t dataSize)
+{
+    auto [memory, srcBuffer] = createHostBuffer(device, physical, dataSize, vk::BufferUsageFlagBits::eTransferSrc);
 
-    auto ptr = device.mapMemory(*memory, 0, bufferSize, vk::MemoryMapFlags());
-    memset(ptr, 0, bufferSize);
+    auto ptr = device.mapMemory(*memory, 0, dataSize, vk::MemoryMapFlags());
+    memcpy(ptr, data, dataSize);
     device.unmapMemory(*memory);
 
-    copyBuffer(device, commandPool, queues, *srcBuffer, dstBuffer, bufferSize);
+    copyBuffer(device, commandPool, queues, *srcBuffer, dstBuffer, dataSize);
 }
 
 void copyBuffer(vk::Device device, vk::CommandPool commandPool, const Queues& queues, vk::Buffer srcBuffer,
@@ -73,6 +66,75 @@ void copyBuffer(vk::Device device, vk::CommandPool commandPool, const Queues& qu
     queues.compute.waitIdle();
 }
 
+void submitOnce(vk::Device device, vk::CommandPool commandPool, const Queues& queues,
+    const std::function<void(vk::CommandBuffer)>& record)
+{
+    auto allocInfo = vk::CommandBufferAllocateInfo(
+        commandPool,                            // commandPool,
+        vk::CommandBufferLevel::ePrimary,       // level
+        1                                       // commandBufferCount
+    );
+
+    auto cmds = device.allocateCommandBuffersUnique(allocInfo);
+    auto& cmd = cmds[0];
+
+    auto beginInfo = vk::CommandBufferBeginInfo(
+        vk::CommandBufferUsageFlagBits::eOneTimeSubmit,     // flags
+        nullptr                                             // pInheritanceInfo
+    );
+    cmd->begin(beginInfo);
+    record(*cmd);
+    cmd->end();
+
+    auto submitInfo = vk::SubmitInfo(
+        0,                                  // waitSemaphoreCount
+        nullptr,                            // pWaitSemaphores
+        nullptr,                            // pWaitDstStageMask
+        1,                                  // commandBufferCount
+        &*cmd,                              // pCommandBuffers
+        0,                                  // signalSemaphoreCount
+        nullptr                             // pSignalSemaphores
+    );
+
+    queues.compute.submit(1, &submitInfo, nullptr);
+    queues.compute.waitIdle();
+}
+
+std::tuple<vk::UniqueDeviceMemory, vk::UniqueBuffer> createHostBuffer(vk::Device device,
+    vk::PhysicalDevice physical, size_t bufferSize, vk::BufferUsageFlags usage)
+{
+    const auto info = vk::BufferCreateInfo(
+        vk::BufferCreateFlags(),                    // flags
+        bufferSize,                                 // size
+        usage,                                      // usage
+        vk::SharingMode::eExclusive,                // sharingMode
+        0,                                          // queueFamilyIndexCount
+        nullptr                                     // pQueueFamilyIndices
+    );
+
+    auto buffer = device.createBufferUnique(info);
+
+    const auto requirements = device.getBufferMemoryRequirements(*buffer);
+    const auto allocInfo = vk::MemoryAllocateInfo(
+        requirements.size,
+        findMemoryType(physical, requirements.memoryTypeBits,
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent)
+    );
+
+    auto memory = device.allocateMemoryUnique(allocInfo, nullptr);
+    device.bindBufferMemory(*buffer, *memory, 0);
+
+    return std::make_tuple(std::move(memory), std::move(buffer));
+}
+
+size_t texelSize(vk::Format format) {
+    switch (format) {
+        case vk::Format::eR32G32B32A32Sfloat: return 16;
+        case vk::Format::eR16G16B16A16Sfloat: return 8;
+        default: throw std::runtime_error("unsupported work image format");
+    }
+}
+
 uint32_t findMemoryType(vk::PhysicalDevice physical, uint32_t mask, vk::MemoryPropertyFlags desired) {
     auto available = physical.getMemoryProperties();
 
@@ -85,4 +147,84 @@ uint32_t findMemoryType(vk::PhysicalDevice physical, uint32_t mask, vk::MemoryPr
     throw std::runtime_error("failed to find suitable memory type!");
 }
 
+vk::UniqueCommandBuffer recordFeedbackReadback(vk::Device device, vk::CommandPool pool, vk::Buffer feedback,
+    vk::Buffer readback, size_t size)
+{
+    auto allocInfo = vk::CommandBufferAllocateInfo(
+        pool,                                   // commandPool,
+        vk::CommandBufferLevel::ePrimary,       // level
+        1                                       // commandBufferCount
+    );
+
+    auto cmds = device.allocateCommandBuffersUnique(allocInfo);
+    auto cmd = std::move(cmds[0]);
+
+    cmd->begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlags(), nullptr));
+
+    const auto computeToTransfer = vk::MemoryBarrier(
+        vk::AccessFlagBits::eShaderRead |
+            vk::AccessFlagBits::eShaderWrite,   // srcAccessMask
+        vk::AccessFlagBits::eTransferRead |
+            vk::AccessFlagBits::eTransferWrite  // dstAccessMask
+    );
+
+    cmd->pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,  // srcStageMask
+        vk::PipelineStageFlagBits::eTransfer,       // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &computeToTransfer,                         // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        0,                                          // imageMemoryBarrierCount
+        nullptr                                     // pImageMemoryBarriers
+    );
+
+    const auto region = vk::BufferCopy(0, 0, size);
+    cmd->copyBuffer(feedback, readback, 1, &region);
+
+    const auto readToClear = vk::MemoryBarrier(
+        vk::AccessFlagBits::eTransferRead,      // srcAccessMask
+        vk::AccessFlagBits::eTransferWrite      // dstAccessMask
+    );
+
+    cmd->pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,       // srcStageMask
+        vk::PipelineStageFlagBits::eTransfer,       // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &readToClear,                               // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        0,                                          // imageMemoryBarrierCount
+        nullptr                                     // pImageMemoryBarriers
+    );
+
+    cmd->fillBuffer(feedback, 0, size, 0);
+
+    const auto transferToUsers = vk::MemoryBarrier(
+        vk::AccessFlagBits::eTransferWrite,     // srcAccessMask
+        vk::AccessFlagBits::eShaderRead |
+            vk::AccessFlagBits::eShaderWrite |
+            vk::AccessFlagBits::eHostRead       // dstAccessMask
+    );
+
+    cmd->pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,       // srcStageMask
+        vk::PipelineStageFlagBits::eComputeShader |
+            vk::PipelineStageFlagBits::eHost,       // dstStageMask
+        vk::DependencyFlags(),                      // dependencyFlags
+        1,                                          // memoryBarrierCount
+        &transferToUsers,                           // pMemoryBarriers
+        0,                                          // bufferMemoryBarrierCount
+        nullptr,                                    // pBufferMemoryBarriers
+        0,                                          // imageMemoryBarrierCount
+        nullptr                                     // pImageMemoryBarriers
+    );
+
+    cmd->end();
+
+    return cmd;
+}
+
 } // namespace app
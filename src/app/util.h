@@ -1,11 +1,36 @@
+#pragma once
+
 #include "deps.h"
 #include "device.h"
 
+#include <functional>
+#include <tuple>
+
 namespace app {
 
 void zeroBuffer(vk::Device device, vk::PhysicalDevice physical, vk::CommandPool commandPool,
     const Queues& queues, vk::Buffer dstBuffer, size_t bufferSize);
 
+/// Record commands with `record`, submit them on the compute queue and wait for them to finish.
+void submitOnce(vk::Device device, vk::CommandPool commandPool, const Queues& queues,
+    const std::function<void(vk::CommandBuffer)>& record);
+
+/// Create a buffer in host visible and coherent memory, suitable for staging transfers.
+std::tuple<vk::UniqueDeviceMemory, vk::UniqueBuffer> createHostBuffer(vk::Device device,
+    vk::PhysicalDevice physical, size_t bufferSize, vk::BufferUsageFlags usage);
+
+/// Copy `dataSize` bytes from `data` into a device buffer through a temporary staging buffer.
+void uploadBuffer(vk::Device device, vk::PhysicalDevice physical, vk::CommandPool commandPool,
+    const Queues& queues, vk::Buffer dstBuffer, const void* data, size_t dataSize);
+
+/// Record a copy of the `feedback` buffer written by the previous dispatches to the host visible `readback`
+/// buffer, which clears `feedback` for the next ones.
+vk::UniqueCommandBuffer recordFeedbackReadback(vk::Device device, vk::CommandPool pool, vk::Buffer feedback,
+    vk::Buffer readback, size_t size);
+
+/// Size in bytes of a texel of the work image, for the supported work image formats.
+size_t texelSize(vk::Format format);
+
 uint32_t findMemoryType(vk::PhysicalDevice physical, uint32_t mask, vk::MemoryPropertyFlags desired);
 
 }
@@ -0,0 +1,468 @@
+#include "shader.h"
+#include "util.h"
+#include "visibility.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <experimental/array>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using std::experimental::make_array;
+
+namespace app {
+
+namespace {
+
+const vk::Format PRIMITIVE_FORMAT = vk::Format::eR32Uint;
+const vk::Format DEPTH_FORMAT = vk::Format::eD32Sfloat;
+
+/// Vertex attributes of a primitive, see `shader/visibility.vert`.
+struct Instance {
+    float bounds[4];
+    float rows[3][4];
+};
+
+/// Push constants of the visibility shaders.
+struct Constants {
+    Camera camera;
+    uint32_t sphereCount;
+};
+
+std::vector<Instance> createInstances(const Primitives& primitives) {
+    const auto bounds = primitives.bounds();
+    const size_t sphereCount = primitives.spheres.size();
+
+    auto instances = std::vector<Instance>(bounds.size());
+
+    for (size_t i = 0; i < bounds.size(); i++) {
+        auto& instance = instances[i];
+
+        if (i < sphereCount) {
+            const auto& sphere = primitives.spheres[i];
+            std::copy(sphere.center, sphere.center + 3, instance.bounds);
+            instance.bounds[3] = sphere.radius;
+            continue;
+        }
+
+        // The sphere through the corners of the bounding box.
+        float radius2 = 0.0f;
+        for (int j = 0; j < 3; j++) {
+            float half = 0.5f * (bounds[i].max[j] - bounds[i].min[j]);
+            instance.bounds[j] = bounds[i].min[j] + half;
+            radius2 += half * half;
+        }
+        instance.bounds[3] = std::sqrt(radius2);
+
+        std::memcpy(instance.rows, primitives.ellipsoids[i - sphereCount].worldToLocal, sizeof(instance.rows));
+    }
+
+    return instances;
+}
+
+std::tuple<vk::UniqueDeviceMemory, vk::UniqueImage, vk::UniqueImageView> createAttachment(
+    vk::Device device, vk::PhysicalDevice physical, vk::Extent2D extent, vk::Format format,
+    vk::ImageUsageFlags usage, vk::ImageAspectFlags aspect)
+{
+    const auto info = vk::ImageCreateInfo(
+        vk::ImageCreateFlags(),                         // flags
+        vk::ImageType::e2D,                             // imageType
+        format,                                         // format
+        vk::Extent3D(extent.width, extent.height, 1),   // extent
+        1,                                              // mipLevels
+        1,                                              // arrayLayers
+        vk::SampleCountFlagBits::e1,                    // samples
+        vk::ImageTiling::eOptimal,                      // tiling
+        usage,                                          // usage
+        vk::SharingMode::eExclusive,                    // sharingMode
+        0,                                              // queueFamilyIndexCount
+        nullptr,                                        // pQueueFamilyIndices
+        vk::ImageLayout::eUndefined                     // initialLayout
+    );
+
+    auto image = device.createImageUnique(info, nullptr);
+
+    const auto requirements = device.getImageMemoryRequirements(*image);
+    const auto allocInfo = vk::MemoryAllocateInfo(
+        requirements.size,
+        findMemoryType(physical, requirements.memoryTypeBits, vk::MemoryPropertyFlags())
+    );
+
+    auto memory = device.allocateMemoryUnique(allocInfo, nullptr);
+    device.bindImageMemory(*image, *memory, 0);
+
+    const auto viewInfo = vk::ImageViewCreateInfo(
+        vk::ImageViewCreateFlags(),             // flags
+        *image,                                 // image
+        vk::ImageViewType::e2D,                 // viewType
+        format,                                 // format
+        vk::ComponentMapping(),                 // components
+        vk::ImageSubresourceRange(aspect, 0, 1, 0, 1)  // subresourceRange
+    );
+
+    auto view = device.createImageViewUnique(viewInfo, nullptr);
+
+    return std::make_tuple(std::move(memory), std::move(image), std::move(view));
+}
+
+/// The primitive index is cleared to `VISIBILITY_NONE` and left in `TransferSrcOptimal` to be read back.
+vk::UniqueRenderPass createRenderPass(vk::Device device) {
+    const auto attachments = make_array(
+        vk::AttachmentDescription(
+            vk::AttachmentDescriptionFlags(),           // flags
+            PRIMITIVE_FORMAT,                           // format
+            vk::SampleCountFlagBits::e1,                // samples
+            vk::AttachmentLoadOp::eClear,               // loadOp
+            vk::AttachmentStoreOp::eStore,              // storeOp
+            vk::AttachmentLoadOp::eDontCare,            // stencilLoadOp
+            vk::AttachmentStoreOp::eDontCare,           // stencilStoreOp
+            vk::ImageLayout::eUndefined,                // initialLayout
+            vk::ImageLayout::eTransferSrcOptimal        // finalLayout
+        ),
+        vk::AttachmentDescription(
+            vk::AttachmentDescriptionFlags(),           // flags
+            DEPTH_FORMAT,                               // format
+            vk::SampleCountFlagBits::e1,                // samples
+            vk::AttachmentLoadOp::eClear,               // loadOp
+            vk::AttachmentStoreOp::eDontCare,           // storeOp
+            vk::AttachmentLoadOp::eDontCare,            // stencilLoadOp
+            vk::AttachmentStoreOp::eDontCare,           // stencilStoreOp
+            vk::ImageLayout::eUndefined,                // initialLayout
+            vk::ImageLayout::eDepthStencilAttachmentOptimal // finalLayout
+        )
+    );
+
+    const auto colorRef = vk::AttachmentReference(0, vk::ImageLayout::eColorAttachmentOptimal);
+    const auto depthRef = vk::AttachmentReference(1, vk::ImageLayout::eDepthStencilAttachmentOptimal);
+
+    const auto subpass = vk::SubpassDescription(
+        vk::SubpassDescriptionFlags(),          // flags
+        vk::PipelineBindPoint::eGraphics,       // pipelineBindPoint
+        0,                                      // inputAttachmentCount
+        nullptr,                                // pInputAttachments
+        1,                                      // colorAttachmentCount
+        &colorRef,                              // pColorAttachments
+        nullptr,                                // pResolveAttachments
+        &depthRef,                              // pDepthStencilAttachment
+        0,                                      // preserveAttachmentCount
+        nullptr                                 // pPreserveAttachments
+    );
+
+    // Make the written primitives visible to the copy after the render pass.
+    const auto dependency = vk::SubpassDependency(
+        0,                                                  // srcSubpass
+        VK_SUBPASS_EXTERNAL,                                // dstSubpass
+        vk::PipelineStageFlagBits::eColorAttachmentOutput,  // srcStageMask
+        vk::PipelineStageFlagBits::eTransfer,               // dstStageMask
+        vk::AccessFlagBits::eColorAttachmentWrite,          // srcAccessMask
+        vk::AccessFlagBits::eTransferRead,                  // dstAccessMask
+        vk::DependencyFlags()                               // dependencyFlags
+    );
+
+    const auto info = vk::RenderPassCreateInfo(
+        vk::RenderPassCreateFlags(),            // flags
+        attachments.size(),                     // attachmentCount
+        attachments.data(),                     // pAttachments
+        1,                                      // subpassCount
+        &subpass,                               // pSubpasses
+        1,                                      // dependencyCount
+        &dependency                             // pDependencies
+    );
+
+    return device.createRenderPassUnique(info, nullptr);
+}
+
+std::tuple<vk::UniquePipeline, vk::UniquePipelineLayout> createVisibilityPipeline(vk::Device device,
+    vk::RenderPass renderPass, vk::Extent2D extent)
+{
+    const auto pushConstants = vk::PushConstantRange(
+        vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,  // stageFlags
+        0,                                                                      // offset
+        sizeof(Constants)                                                       // size
+    );
+
+    auto layout = device.createPipelineLayoutUnique(vk::PipelineLayoutCreateInfo(
+        vk::PipelineLayoutCreateFlags(),        // flags
+        0,                                      // setLayoutCount
+        nullptr,                                // pSetLayouts
+        1,                                      // pushConstantRangeCount
+        &pushConstants                          // pPushConstantRanges
+    ), nullptr);
+
+    auto vertexCode = loadShader("shader/visibility_vert.spv");
+    auto fragmentCode = loadShader("shader/visibility_frag.spv");
+    auto vertexShader = device.createShaderModuleUnique(vk::ShaderModuleCreateInfo(
+        vk::ShaderModuleCreateFlags(), vertexCode.size() * 4, vertexCode.data()), nullptr);
+    auto fragmentShader = device.createShaderModuleUnique(vk::ShaderModuleCreateInfo(
+        vk::ShaderModuleCreateFlags(), fragmentCode.size() * 4, fragmentCode.data()), nullptr);
+
+    const auto stages = make_array(
+        vk::PipelineShaderStageCreateInfo(
+            vk::PipelineShaderStageCreateFlags(),   // flags
+            vk::ShaderStageFlagBits::eVertex,       // stage
+            *vertexShader,                          // module
+            "main",                                 // pName
+            nullptr                                 // pSpecializationInfo
+        ),
+        vk::PipelineShaderStageCreateInfo(
+            vk::PipelineShaderStageCreateFlags(),   // flags
+            vk::ShaderStageFlagBits::eFragment,     // stage
+            *fragmentShader,                        // module
+            "main",                                 // pName
+            nullptr                                 // pSpecializationInfo
+        )
+    );
+
+    // One instance per primitive, the bounds and the three rows of the transform.
+    const auto binding = vk::VertexInputBindingDescription(0, sizeof(Instance), vk::VertexInputRate::eInstance);
+    const auto vec4 = vk::Format::eR32G32B32A32Sfloat;
+    const uint32_t rows = offsetof(Instance, rows);
+    const uint32_t rowSize = sizeof(Instance::rows[0]);
+    const auto attributes = make_array(
+        vk::VertexInputAttributeDescription(0, 0, vec4, offsetof(Instance, bounds)),
+        vk::VertexInputAttributeDescription(1, 0, vec4, rows),
+        vk::VertexInputAttributeDescription(2, 0, vec4, rows + rowSize),
+        vk::VertexInputAttributeDescription(3, 0, vec4, rows + 2 * rowSize)
+    );
+
+    const auto vertexInput = vk::PipelineVertexInputStateCreateInfo(
+        vk::PipelineVertexInputStateCreateFlags(),  // flags
+        1,                                          // vertexBindingDescriptionCount
+        &binding,                                   // pVertexBindingDescriptions
+        attributes.size(),                          // vertexAttributeDescriptionCount
+        attributes.data()                           // pVertexAttributeDescriptions
+    );
+
+    const auto inputAssembly = vk::PipelineInputAssemblyStateCreateInfo(
+        vk::PipelineInputAssemblyStateCreateFlags(),    // flags
+        vk::PrimitiveTopology::eTriangleStrip,          // topology
+        false                                           // primitiveRestartEnable
+    );
+
+    const auto viewport = vk::Viewport(0.0f, 0.0f, float(extent.width), float(extent.height), 0.0f, 1.0f);
+    const auto scissor = vk::Rect2D(vk::Offset2D(0, 0), extent);
+    const auto viewportState = vk::PipelineViewportStateCreateInfo(
+        vk::PipelineViewportStateCreateFlags(),     // flags
+        1,                                          // viewportCount
+        &viewport,                                  // pViewports
+        1,                                          // scissorCount
+        &scissor                                    // pScissors
+    );
+
+    const auto rasterization = vk::PipelineRasterizationStateCreateInfo(
+        vk::PipelineRasterizationStateCreateFlags(),    // flags
+        false,                                          // depthClampEnable
+        false,                                          // rasterizerDiscardEnable
+        vk::PolygonMode::eFill,                         // polygonMode
+        vk::CullModeFlagBits::eNone,                    // cullMode
+        vk::FrontFace::eCounterClockwise,               // frontFace
+        false,                                          // depthBiasEnable
+        0.0f,                                           // depthBiasConstantFactor
+        0.0f,                                           // depthBiasClamp
+        0.0f,                                           // depthBiasSlopeFactor
+        1.0f                                            // lineWidth
+    );
+
+    const auto multisample = vk::PipelineMultisampleStateCreateInfo(
+        vk::PipelineMultisampleStateCreateFlags(),  // flags
+        vk::SampleCountFlagBits::e1,                // rasterizationSamples
+        false,                                      // sampleShadingEnable
+        0.0f,                                       // minSampleShading
+        nullptr,                                    // pSampleMask
+        false,                                      // alphaToCoverageEnable
+        false                                       // alphaToOneEnable
+    );
+
+    const auto depthStencil = vk::PipelineDepthStencilStateCreateInfo(
+        vk::PipelineDepthStencilStateCreateFlags(), // flags
+        true,                                       // depthTestEnable
+        true,                                       // depthWriteEnable
+        vk::CompareOp::eLess,                       // depthCompareOp
+        false,                                      // depthBoundsTestEnable
+        false,                                      // stencilTestEnable
+        vk::StencilOpState(),                       // front
+        vk::StencilOpState(),                       // back
+        0.0f,                                       // minDepthBounds
+        1.0f                                        // maxDepthBounds
+    );
+
+    const auto blendAttachment = vk::PipelineColorBlendAttachmentState(
+        false,                                      // blendEnable
+        vk::BlendFactor::eOne,                      // srcColorBlendFactor
+        vk::BlendFactor::eZero,                     // dstColorBlendFactor
+        vk::BlendOp::eAdd,                          // colorBlendOp
+        vk::BlendFactor::eOne,                      // srcAlphaBlendFactor
+        vk::BlendFactor::eZero,                     // dstAlphaBlendFactor
+        vk::BlendOp::eAdd,                          // alphaBlendOp
+        vk::ColorComponentFlagBits::eR              // colorWriteMask
+    );
+
+    const auto blend = vk::PipelineColorBlendStateCreateInfo(
+        vk::PipelineColorBlendStateCreateFlags(),   // flags
+        false,                                      // logicOpEnable
+        vk::LogicOp::eCopy,                         // logicOp
+        1,                                          // attachmentCount
+        &blendAttachment                            // pAttachments
+    );
+
+    const auto info = vk::GraphicsPipelineCreateInfo(
+        vk::PipelineCreateFlags(),              // flags
+        stages.size(),                          // stageCount
+        stages.data(),                          // pStages
+        &vertexInput,                           // pVertexInputState
+        &inputAssembly,                         // pInputAssemblyState
+        nullptr,                                // pTessellationState
+        &viewportState,                         // pViewportState
+        &rasterization,                         // pRasterizationState
+        &multisample,                           // pMultisampleState
+        &depthStencil,                          // pDepthStencilState
+        &blend,                                 // pColorBlendState
+        nullptr,                                // pDynamicState
+        *layout,                                // layout
+        renderPass,                             // renderPass
+        0,                                      // subpass
+        nullptr,                                // basePipelineHandle
+        0                                       // basePipelineIndex
+    );
+
+    auto pipeline = device.createGraphicsPipelineUnique(nullptr, info, nullptr);
+
+    return std::make_tuple(std::move(pipeline), std::move(layout));
+}
+
+} // namespace
+
+std::tuple<vk::UniqueDeviceMemory, vk::UniqueBuffer> createVisibilityBuffer(vk::Device device,
+    vk::PhysicalDevice physical, vk::CommandPool pool, const Queues& queues, const Primitives& primitives,
+    const Camera& camera, vk::Extent2D extent, const Options& options)
+{
+    if (!options.visibilityBuffer) {
+        return createBuffer(device, physical, sizeof(uint32_t));
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const size_t pixelCount = size_t(extent.width) * extent.height;
+
+    // Everything is drawn and read back on the present queue, so nothing has to change queue families.
+    const auto graphics = Queues {
+        queues.presentQueueFamily, queues.presentQueueFamily, queues.present, queues.present
+    };
+
+    auto graphicsPool = device.createCommandPoolUnique(vk::CommandPoolCreateInfo(
+        vk::CommandPoolCreateFlagBits::eTransient, graphics.computeQueueFamily), nullptr);
+
+    auto instances = createInstances(primitives);
+    const size_t instancesSize = std::max<size_t>(instances.size(), 1) * sizeof(Instance);
+    auto [instancesMemory, instancesBuffer] = createHostBuffer(device, physical, instancesSize,
+        vk::BufferUsageFlagBits::eVertexBuffer);
+
+    if (!instances.empty()) {
+        auto mapped = device.mapMemory(*instancesMemory, 0, instancesSize, vk::MemoryMapFlags());
+        std::memcpy(mapped, instances.data(), instances.size() * sizeof(Instance));
+        device.unmapMemory(*instancesMemory);
+    }
+
+    auto [primitiveMemory, primitiveImage, primitiveView] = createAttachment(device, physical, extent,
+        PRIMITIVE_FORMAT, vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc,
+        vk::ImageAspectFlagBits::eColor);
+    auto [depthMemory, depthImage, depthView] = createAttachment(device, physical, extent, DEPTH_FORMAT,
+        vk::ImageUsageFlagBits::eDepthStencilAttachment, vk::ImageAspectFlagBits::eDepth);
+
+    auto renderPass = createRenderPass(device);
+    auto [pipeline, layout] = createVisibilityPipeline(device, *renderPass, extent);
+
+    const auto views = make_array(*primitiveView, *depthView);
+    auto framebuffer = device.createFramebufferUnique(vk::FramebufferCreateInfo(
+        vk::FramebufferCreateFlags(),           // flags
+        *renderPass,                            // renderPass
+        views.size(),                           // attachmentCount
+        views.data(),                           // pAttachments
+        extent.width,                           // width
+        extent.height,                          // height
+        1                                       // layers
+    ), nullptr);
+
+    auto [readbackMemory, readback] = createHostBuffer(device, physical, pixelCount * sizeof(uint32_t),
+        vk::BufferUsageFlagBits::eTransferDst);
+
+    const auto constants = Constants { camera, uint32_t(primitives.spheres.size()) };
+    const auto instanceCount = uint32_t(instances.size());
+
+    submitOnce(device, *graphicsPool, graphics, [&, pipeline = *pipeline, layout = *layout,
+        instancesBuffer = *instancesBuffer, primitiveImage = *primitiveImage, readback = *readback](
+        vk::CommandBuffer cmd)
+    {
+        const auto clearValues = make_array(
+            vk::ClearValue(vk::ClearColorValue(make_array(VISIBILITY_NONE, 0u, 0u, 0u))),
+            vk::ClearValue(vk::ClearDepthStencilValue(1.0f, 0))
+        );
+
+        cmd.beginRenderPass(vk::RenderPassBeginInfo(
+            *renderPass,                            // renderPass
+            *framebuffer,                           // framebuffer
+            vk::Rect2D(vk::Offset2D(0, 0), extent), // renderArea
+            clearValues.size(),                     // clearValueCount
+            clearValues.data()                      // pClearValues
+        ), vk::SubpassContents::eInline);
+
+        cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+        cmd.pushConstants(layout, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0,
+            sizeof(Constants), &constants);
+
+        const vk::DeviceSize offset = 0;
+        cmd.bindVertexBuffers(0, 1, &instancesBuffer, &offset);
+        cmd.draw(4, instanceCount, 0, 0);
+
+        cmd.endRenderPass();
+
+        const auto region = vk::BufferImageCopy(
+            0,                                      // bufferOffset
+            0,                                      // bufferRowLength
+            0,                                      // bufferImageHeight
+            vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
+            vk::Offset3D(0, 0, 0),                  // imageOffset
+            vk::Extent3D(extent.width, extent.height, 1)
+        );
+
+        cmd.copyImageToBuffer(primitiveImage, vk::ImageLayout::eTransferSrcOptimal, readback, 1, &region);
+
+        const auto transferToHost = vk::MemoryBarrier(
+            vk::AccessFlagBits::eTransferWrite,     // srcAccessMask
+            vk::AccessFlagBits::eHostRead           // dstAccessMask
+        );
+
+        cmd.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,       // srcStageMask
+            vk::PipelineStageFlagBits::eHost,           // dstStageMask
+            vk::DependencyFlags(),                      // dependencyFlags
+            1,                                          // memoryBarrierCount
+            &transferToHost,                            // pMemoryBarriers
+            0,                                          // bufferMemoryBarrierCount
+            nullptr,                                    // pBufferMemoryBarriers
+            0,                                          // imageMemoryBarrierCount
+            nullptr                                     // pImageMemoryBarriers
+        );
+    });
+
+    const auto rasterized = std::chrono::steady_clock::now();
+
+    auto visible = static_cast<const uint32_t*>(device.mapMemory(*readbackMemory, 0,
+        pixelCount * sizeof(uint32_t), vk::MemoryMapFlags()));
+    const auto covered = pixelCount - size_t(std::count(visible, visible + pixelCount, VISIBILITY_NONE));
+
+    auto [memory, buffer] = createBuffer(device, physical, pixelCount * sizeof(uint32_t));
+    uploadBuffer(device, physical, pool, queues, *buffer, visible, pixelCount * sizeof(uint32_t));
+    device.unmapMemory(*readbackMemory);
+
+    std::cout << "Visibility buffer: " << instances.size() << " primitives rasterized in " << std::fixed
+        << std::setprecision(2) << std::chrono::duration<double, std::milli>(rasterized - start).count()
+        << " ms, " << 100.0 * double(covered) / double(pixelCount) << "% of the pixels covered\n"
+        << std::defaultfloat;
+
+    return std::make_tuple(std::move(memory), std::move(buffer));
+}
+
+} // namespace app
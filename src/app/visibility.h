@@ -0,0 +1,29 @@
+#pragma once
+
+#include "camera.h"
+#include "deps.h"
+#include "device.h"
+#include "options.h"
+#include "primitives.h"
+
+#include <tuple>
+
+namespace app {
+
+/// Marks pixels whose primary ray doesn't hit any primitive in the visibility buffer.
+const uint32_t VISIBILITY_NONE = 0xffffffff;
+
+/// Rasterize the primitives into a buffer holding, for each pixel, the primitive hit first by its primary ray.
+///
+/// Primary rays go through the same point of every pixel in every frame, so for a still scene the buffer
+/// is rasterized once, on the present queue which has graphics support. Each primitive is drawn as a quad
+/// around its bounding sphere (see `shader/visibility.vert`), whose fragments intersect the primitive with
+/// the primary ray of the pixel and keep the closest hit by its depth. The tracer then starts from that
+/// hit instead of tracing the primary ray, see `VISIBILITY_BUFFER` in `shader/main.comp`.
+///
+/// With `Options::visibilityBuffer` unset the buffer holds a single unused element.
+std::tuple<vk::UniqueDeviceMemory, vk::UniqueBuffer> createVisibilityBuffer(vk::Device device,
+    vk::PhysicalDevice physical, vk::CommandPool pool, const Queues& queues, const Primitives& primitives,
+    const Camera& camera, vk::Extent2D extent, const Options& options);
+
+} // namespace app
@@ -1,10 +1,19 @@
 #include "app/app.h"
+#include "app/mesh.h"
+#include "app/options.h"
 
 #include <iostream>
 
 using app::App;
 
-int main() {
-    auto app = App::create();
+int main(int argc, char** argv) {
+    auto options = app::parseOptions(argc, argv);
+
+    if (!options.importBenchPath.empty()) {
+        app::benchmarkMeshImport(options);
+        return 0;
+    }
+
+    auto app = App::create(options);
     app.mainLoop();
 }